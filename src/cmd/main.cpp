@@ -19,11 +19,15 @@
 #include <cxxopts.hpp>
 
 // STL:
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 
 // readybase:
 #include <AbstractRD.hpp>
+#include <FormulaOpenCLImageRD.hpp>
+#include <MeshRD.hpp>
 #include <OpenCL_utils.hpp>
 #include <OpenCLImageRD.hpp>
 #include <Properties.hpp>
@@ -74,6 +78,10 @@ int main(int argc,char *argv[])
                         "that currently isn't supported.\n";
 
     int numiter = 1000;
+    int drift_steps = 0;
+    int record_every = 0;
+    int rewind_to = -1;
+    int64_t random_seed = -1;
     bool print_kernel = false;
     bool print_formula = false;
     bool print_rule_info = false;
@@ -95,6 +103,10 @@ int main(int argc,char *argv[])
             ("h,help", "Print the help message")
             // Went to 0 iterations by default. Need to provide option for flags
             ("n,num-iterations", "Number of iterations to run before saving", cxxopts::value<int>(numiter)->default_value("0"))
+            ("c,check-drift", "Run this many iterations alongside a reference that computes and stores in double, and print how far each chemical drifts from it", cxxopts::value<int>(drift_steps)->default_value("0"))
+            ("t,record-every", "While running, record the state every this many iterations, so that --rewind-to can go back to it", cxxopts::value<int>(record_every)->default_value("0"))
+            ("w,rewind-to", "After running, go back to the last recorded state at or before this timestep, before saving", cxxopts::value<int>(rewind_to)->default_value("-1"))
+            ("e,random-seed", "Seed for the rand_uniform() and rand_normal() keywords, so that runs can be repeated (default: the file's random_seed, or random)", cxxopts::value<int64_t>(random_seed)->default_value("-1"))
             ("k,print-kernel", "Print (full) OpenCL kernel source (when possible)", cxxopts::value<bool>(print_kernel)->default_value("false"))
             ("f,print-formula", "Print kernel formula (when possible)", cxxopts::value<bool>(print_formula)->default_value("false"))
             ("u,print-rule-info", "Print rule info", cxxopts::value<bool>(print_rule_info)->default_value("false"))
@@ -240,6 +252,16 @@ int main(int argc,char *argv[])
                 cout << "type=" << system->GetRuleType() << "\n";
                 cout << "name=" << system->GetRuleName() << "\n";
                 cout << "neighborhood_type=" << system->GetNeighborhoodType() << "\n";
+                const MeshRD* mesh_system = dynamic_cast<const MeshRD*>( system.get() );
+                if ( mesh_system )
+                {
+                    const char* order_labels[4] = { "original", "rcm", "morton", "bisection" };
+                    int bandwidth_before, bandwidth_after;
+                    mesh_system->GetNeighborBandwidth( bandwidth_before, bandwidth_after );
+                    cout << "cell_order=" << order_labels[static_cast<int>( mesh_system->GetCellOrder() )] << "\n";
+                    cout << "neighbor_bandwidth_before=" << bandwidth_before << "\n";
+                    cout << "neighbor_bandwidth_after=" << bandwidth_after << "\n";
+                }
                 cout << "================================\n";
             }
             if ( print_parameter_info )
@@ -357,10 +379,72 @@ int main(int argc,char *argv[])
         if( warn_to_update )
             cout << "This pattern was created with a newer version of Ready. You should update your copy.\n";
 
+        if ( random_seed >= 0 )
+        {
+            OpenCL_MixIn* opencl_system = dynamic_cast<OpenCL_MixIn*>( system.get() );
+            if ( !opencl_system )
+            {
+                cout << "A random seed can only be set for OpenCL rules.\n";
+                return EXIT_FAILURE;
+            }
+            opencl_system->SetRandomSeed( static_cast<cl_uint>( random_seed ) );
+        }
+
+        if ( drift_steps > 0 )
+        {
+            FormulaOpenCLImageRD* formula_system = dynamic_cast<FormulaOpenCLImageRD*>( system.get() );
+            if ( !formula_system )
+            {
+                cout << "Drift checking is only available for formula rules on images.\n";
+                return EXIT_FAILURE;
+            }
+            cout << "Run the simulation and a double-precision reference for " << drift_steps << " steps...\n";
+            const vector<FormulaOpenCLImageRD::PrecisionDrift> drifts = formula_system->MeasurePrecisionDrift( drift_steps );
+            cout << "\n";
+            cout << "Drift from reference:\n";
+            printSeparator();
+            for ( const FormulaOpenCLImageRD::PrecisionDrift& drift : drifts )
+            {
+                cout << drift.chemical << ": max_abs=" << drift.max_abs_difference << " rms=" << drift.rms_difference << "\n";
+            }
+            printSeparator();
+        }
+
         if ( numiter > 0 )
         {
             cout << "Run the simulation for " << numiter << " steps...\n";
-            system->Update( numiter );
+            if ( record_every > 0 )
+            {
+                system->RecordTimeline();
+                for ( int done = 0; done < numiter; )
+                {
+                    const int n = min( record_every, numiter - done );
+                    system->Update( n );
+                    system->RecordTimeline();
+                    done += n;
+                }
+                if (verbose)
+                {
+                    cout << "Recorded " << system->GetNumberOfRecordedTimesteps() << " timesteps, from "
+                         << system->GetRecordedTimestep( 0 ) << ".\n";
+                }
+            }
+            else
+            {
+                system->Update( numiter );
+            }
+
+            if ( rewind_to >= 0 )
+            {
+                const int i = system->FindRecordedTimestep( rewind_to );
+                if ( i < 0 )
+                {
+                    cout << "No state was recorded at or before timestep " << rewind_to << " (use --record-every).\n";
+                    return EXIT_FAILURE;
+                }
+                system->GoToRecordedTimestep( i );
+                cout << "Went back to timestep " << system->GetTimestepsTaken() << ".\n";
+            }
 
             if ( !vti_out.empty() )
             {
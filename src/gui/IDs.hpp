@@ -79,6 +79,9 @@ namespace ID
         StepN,
         RunStop,
         Reset,
+        StepBack,
+        StepForward,
+        GoToTimestep,
         GenerateInitialPattern,
         Blank,
         ChangeRunningSpeed,
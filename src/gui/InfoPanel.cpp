@@ -28,6 +28,7 @@
 
 // readybase:
 #include "ImageRD.hpp"
+#include "MeshRD.hpp"
 #include "scene_items.hpp"
 
 // wxWidgets:
@@ -62,6 +63,12 @@ const wxString InfoPanel::neighborhood_range_label = _("Neighborhood range");
 const wxString InfoPanel::neighborhood_weight_label = _("Neighborhood weight");
 const wxString InfoPanel::accuracy_label = _("Accuracy");
 const wxString InfoPanel::accuracy_labels[3] = { _("low"), _("medium"), _("high") };
+const wxString InfoPanel::storage_label = _("Storage");
+const wxString InfoPanel::storage_labels[5] = { _("default"), _("uint8"), _("int16"), _("half"), _("float") };
+const wxString InfoPanel::cell_order_label = _("Cell order");
+const wxString InfoPanel::cell_order_labels[4] = { _("original"), _("rcm"), _("morton"), _("bisection") };
+const wxString InfoPanel::integrator_label = _("Integrator");
+const wxString InfoPanel::integrator_labels[3] = { _("explicit"), _("semi-implicit (Jacobi)"), _("semi-implicit (incomplete Cholesky)") };
 
 // -----------------------------------------------------------------------------
 
@@ -191,6 +198,26 @@ void InfoPanel::UpdatePanel(const AbstractRD& system)
         contents += AppendRow(neighborhood_type_label, neighborhood_type_label, system.GetNeighborhoodType() + "-neighbors", false);
     }
 
+    const MeshRD* mesh_system = dynamic_cast<const MeshRD*>(&system);
+    if (mesh_system)
+    {
+        int bandwidth_before, bandwidth_after;
+        mesh_system->GetNeighborBandwidth(bandwidth_before, bandwidth_after);
+        wxString cell_order = cell_order_labels[static_cast<int>(mesh_system->GetCellOrder())];
+        if (mesh_system->GetCellOrder() != MeshRD::CellOrder::Original)
+            cell_order += wxString::Format(_(" (neighbor bandwidth %d, was %d)"), bandwidth_after, bandwidth_before);
+        contents += AppendRow(cell_order_label, cell_order_label, cell_order, false);
+
+        if (mesh_system->HasEditableIntegrator())
+        {
+            // (the preconditioner only matters for the semi-implicit integrator, so they share a row)
+            int i = 0;
+            if (mesh_system->GetIntegrator() == MeshRD::Integrator::SemiImplicit)
+                i = 1 + static_cast<int>(mesh_system->GetPreconditioner());
+            contents += AppendRow(integrator_label, integrator_label, integrator_labels[i], true);
+        }
+    }
+
     if (system.HasEditableAccuracyOption())
     {
         contents += AppendRow(accuracy_label, accuracy_label, accuracy_labels[static_cast<int>(system.GetAccuracy())], true);
@@ -208,6 +235,11 @@ void InfoPanel::UpdatePanel(const AbstractRD& system)
     contents += AppendRow(data_type_label, data_type_label, system.GetDataType() == VTK_DOUBLE ? _("double") : _("float"),
         system.HasEditableDataType());
 
+    if (system.HasEditableStorageOption())
+    {
+        contents += AppendRow(storage_label, storage_label, storage_labels[static_cast<int>(system.GetStorage())], true);
+    }
+
     contents += _T("</table>");
 
     contents += wxT("<h5><center>");
@@ -637,6 +669,38 @@ void InfoPanel::ChangeAccuracy()
 
 // -----------------------------------------------------------------------------
 
+void InfoPanel::ChangeIntegrator()
+{
+    MeshRD* mesh_system = dynamic_cast<MeshRD*>(&frame->GetCurrentRDSystem());
+    if (!mesh_system) return;
+
+    wxArrayString choices;
+    for (const wxString& label : integrator_labels)
+    {
+        choices.Add(label);
+    }
+    wxSingleChoiceDialog dlg(this, _("Integrator:"), _("Select integrator:"),
+        choices);
+    int old_selection = 0;
+    if (mesh_system->GetIntegrator() == MeshRD::Integrator::SemiImplicit)
+        old_selection = 1 + static_cast<int>(mesh_system->GetPreconditioner());
+    dlg.SetSelection(old_selection);
+    if (dlg.ShowModal() != wxID_OK) return;
+    const int new_selection = dlg.GetSelection();
+    if (new_selection == 0)
+    {
+        mesh_system->SetIntegrator(MeshRD::Integrator::Explicit);
+    }
+    else
+    {
+        mesh_system->SetIntegrator(MeshRD::Integrator::SemiImplicit);
+        mesh_system->SetPreconditioner(static_cast<SparseSolver::Preconditioner>(new_selection - 1));
+    }
+    UpdatePanel(frame->GetCurrentRDSystem());
+}
+
+// -----------------------------------------------------------------------------
+
 void InfoPanel::ChangeBlockSize()
 {
     const AbstractRD& sys = frame->GetCurrentRDSystem();
@@ -710,6 +774,31 @@ void InfoPanel::ChangeDataType()
 
 // -----------------------------------------------------------------------------
 
+void InfoPanel::ChangeStorage()
+{
+    const AbstractRD::Storage old_val = frame->GetCurrentRDSystem().GetStorage();
+
+    wxArrayString choices;
+    for (const wxString& label : storage_labels)
+    {
+        choices.Add(label);
+    }
+    wxSingleChoiceDialog dlg(this, _("Storage:"), _("Select how the chemicals are stored between timesteps:"),
+        choices);
+    dlg.SetSelection(static_cast<int>(old_val));
+    if (dlg.ShowModal() != wxID_OK) return;
+    const AbstractRD::Storage new_val = static_cast<AbstractRD::Storage>(dlg.GetSelection());
+    if (new_val == old_val) return;
+    const int confirm = wxMessageBox(_("This will overwrite the existing pattern, OK to continue?"), _("Confirm"), wxOK | wxCANCEL);
+    if (confirm != wxOK)
+    {
+        return;
+    }
+    frame->SetStorage(new_val);
+}
+
+// -----------------------------------------------------------------------------
+
 void InfoPanel::ChangeInfo(const wxString& label)
 {
     if ( label == rule_name_label ) {
@@ -730,6 +819,9 @@ void InfoPanel::ChangeInfo(const wxString& label)
     } else if ( label == accuracy_label ) {
         ChangeAccuracy();
 
+    } else if ( label == integrator_label ) {
+        ChangeIntegrator();
+
     } else if ( label == block_size_label ) {
         ChangeBlockSize();
 
@@ -742,6 +834,9 @@ void InfoPanel::ChangeInfo(const wxString& label)
     } else if ( label == data_type_label ) {
         ChangeDataType();
 
+    } else if ( label == storage_label ) {
+        ChangeStorage();
+
     } else if ( frame->GetRenderSettings().IsProperty(string(label.mb_str())) ) {
         ChangeRenderSetting(label);
 
@@ -92,6 +92,12 @@ class InfoPanel : public wxPanel
         static const wxString neighborhood_weight_label;
         static const wxString accuracy_label;
         static const wxString accuracy_labels[3];
+        static const wxString storage_label;
+        static const wxString storage_labels[5];
+        static const wxString cell_order_label;
+        static const wxString cell_order_labels[4];
+        static const wxString integrator_label;
+        static const wxString integrator_labels[3];
 
 private:
         
@@ -110,9 +116,11 @@ private:
         void ChangeDimensions();
         void ChangeBlockSize();
         void ChangeAccuracy();
+        void ChangeIntegrator();
         void ChangeUseLocalMemory();
         void ChangeWrapOption();
         void ChangeDataType();
+        void ChangeStorage();
         
         // event handlers
         void OnSmallerButton(wxCommandEvent& event);
@@ -85,6 +85,40 @@ void MyApp::MacOpenFile(const wxString& fullPath)
 }
 #endif
 
+static bool EventMayUseSystem(wxEvent& event)
+{
+    // menu items, tools, buttons, links and other commands change the system, as do clicks in the render window,
+    // the patterns pane and the help and info panes; update UI events come in floods and their handlers only look
+    // at the system when it isn't running
+    if (event.IsCommandEvent())
+        return event.GetEventType() != wxEVT_UPDATE_UI;
+    wxMouseEvent* mouse_event = dynamic_cast<wxMouseEvent*>(&event);
+    if (mouse_event)
+        return mouse_event->ButtonDown() || mouse_event->ButtonUp() || mouse_event->ButtonDClick();
+    // the rest (idle, paint, motion, keys, timers, etc.) don't pause: MyFrame::OnIdle only uses the system when the
+    // simulation thread has stopped, mouse moves post their painting and pause just to read a value, and keyboard
+    // shortcuts are sent on as menu commands
+    return false;
+}
+
+void MyApp::CallEventHandler(wxEvtHandler* handler, wxEventFunctor& functor, wxEvent& event) const
+{
+    if (!currframe || !EventMayUseSystem(event)) {
+        wxApp::CallEventHandler(handler, functor, event);
+        return;
+    }
+    MyFrame* frame = currframe;
+    frame->PauseSimulation();
+    try {
+        wxApp::CallEventHandler(handler, functor, event);
+    }
+    catch (...) {
+        frame->ResumeSimulation();
+        throw;
+    }
+    frame->ResumeSimulation();
+}
+
 bool MyApp::OnInit()
 {
     if ( !wxApp::OnInit() )
@@ -30,8 +30,13 @@ class MyFrame;
 class MyApp : public wxApp
 {
 public:
+    MyApp() : currframe(NULL) {}
+
     virtual bool OnInit();
 
+    // pauses the simulation thread while each command or mouse click is handled, since those handlers use the RD system
+    virtual void CallEventHandler(wxEvtHandler* handler, wxEventFunctor& functor, wxEvent& event) const;
+
     #ifdef __WXMAC__
         // called in response to an open-document event which is sent
         // if a .vti file is double-clicked or dropped onto the app icon
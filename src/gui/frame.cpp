@@ -213,6 +213,12 @@ BEGIN_EVENT_TABLE(MyFrame, wxFrame)
     EVT_MENU(ID::ChangeRunningSpeed, MyFrame::OnChangeRunningSpeed)
     EVT_MENU(ID::Reset, MyFrame::OnReset)
     EVT_UPDATE_UI(ID::Reset, MyFrame::OnUpdateReset)
+    EVT_MENU(ID::StepBack, MyFrame::OnStepBack)
+    EVT_UPDATE_UI(ID::StepBack, MyFrame::OnUpdateStepBack)
+    EVT_MENU(ID::StepForward, MyFrame::OnStepForward)
+    EVT_UPDATE_UI(ID::StepForward, MyFrame::OnUpdateStepForward)
+    EVT_MENU(ID::GoToTimestep, MyFrame::OnGoToTimestep)
+    EVT_UPDATE_UI(ID::GoToTimestep, MyFrame::OnUpdateGoToTimestep)
     EVT_MENU(ID::GenerateInitialPattern, MyFrame::OnGenerateInitialPattern)
     EVT_MENU(ID::Blank, MyFrame::OnBlank)
     EVT_MENU(ID::AddParameter,MyFrame::OnAddParameter)
@@ -309,6 +315,9 @@ MyFrame::MyFrame(const wxString& title)
     this->LoadSettings();
     this->aui_mgr.Update();
 
+    // the simulation thread wakes us up when it has done the steps up to the next render (see OnIdle)
+    this->simulation.SetFinishedCallback([] { wxWakeUpIdle(); });
+
     // enable/disable tool tips
     #if wxUSE_TOOLTIPS
         // AKT TODO!!! fix bug: can't disable tooltips in Mac app (bug is in wxOSX-Cocoa)
@@ -335,6 +344,8 @@ MyFrame::MyFrame(const wxString& title)
 
 MyFrame::~MyFrame()
 {
+    wxGetApp().currframe = NULL; // (so that events are no longer passed to us to pause the simulation thread)
+    this->simulation.Stop();
     this->SaveSettings(); // save the current settings so it starts up the same next time
     this->aui_mgr.UnInit();
 }
@@ -436,6 +447,9 @@ void MyFrame::InitializeMenus()
         menu->Append(ID::ChangeRunningSpeed, _("Change Running Speed...") + GetAccelerator(DO_CHANGESPEED),_("Change the number of timesteps between each render"));
         menu->AppendSeparator();
         menu->Append(ID::Reset, _("Reset") + GetAccelerator(DO_RESET), _("Go back to the starting pattern"));
+        menu->Append(ID::StepBack, _("Step Back") + GetAccelerator(DO_STEPBACK), _("Go back to the previous recorded timestep"));
+        menu->Append(ID::StepForward, _("Step Forward") + GetAccelerator(DO_STEPFORWARD), _("Go forward to the next recorded timestep"));
+        menu->Append(ID::GoToTimestep, _("Go to Timestep...") + GetAccelerator(DO_GOTOSTEP), _("Go back or forward to any recorded timestep"));
         menu->Append(ID::GenerateInitialPattern, _("Generate Initial &Pattern") + GetAccelerator(DO_GENPATT), _("Run the Initial Pattern Generator"));
         menu->Append(ID::Blank, _("&Blank") + GetAccelerator(DO_BLANK), _("Sets every value to zero"));
         menu->AppendSeparator();
@@ -988,7 +1002,10 @@ void MyFrame::OnAddMyPatterns(wxCommandEvent& event)
 
 void MyFrame::SetCurrentRDSystem(unique_ptr<AbstractRD> sys)
 {
+    this->simulation.SetSystem(sys.get()); // (stops the simulation thread, if it was stepping the old system)
     this->system = std::move(sys);
+    this->system->SetStartingPatternStorage(regenerate_start ? AbstractRD::StartingPatternStorage::Regenerated
+                                                             : AbstractRD::StartingPatternStorage::Compressed);
     int iChem = IndexFromChemicalName(this->render_settings.GetProperty("active_chemical").GetChemical());
     iChem = min(iChem,this->system->GetNumberOfChemicals()-1); // ensure is in valid range
     this->render_settings.GetProperty("active_chemical").SetChemical(GetChemicalName(iChem));
@@ -1050,28 +1067,31 @@ void MyFrame::OnStep(wxCommandEvent& event)
     {
         this->system->SaveStartingPattern();
 
-        // reset the initial number of steps used by system->Update in OnIdle
-        num_steps = 50;
+        // reset the initial number of steps in each batch of the simulation thread
+        this->simulation.SetStepsPerBatch(50);
         // 50 is half the initial timesteps_per_render value used in most
         // pattern files, but really we could choose any small number > 0
     }
 
     try
     {
+        this->RecordTimeline(); // (so we can step back to here)
         if (event.GetId() == ID::Step1)
         {
             this->system->Update(1);
+            this->RecordTimeline();
             this->pVTKWindow->GetRenderWindow()->GetRenderers()->GetFirstRenderer()->ResetCameraClippingRange();
         }
         else if (event.GetId() == ID::StepN)
         {
             // timesteps_per_render might be huge, so don't do this:
             // this->system->Update(this->render_settings.GetProperty("timesteps_per_render").GetInt());
-            // instead we let OnIdle do the stepping, but stop at next render
+            // instead we let the simulation thread do the stepping, and OnIdle stops at the next render
             this->is_running = true;
             steps_since_last_render = 0;
             this->computation_time_since_last_render = 0.0;
             do_one_render = true;
+            this->RunUntilNextRender();
         }
     }
     catch(const exception& e)
@@ -1113,14 +1133,23 @@ void MyFrame::OnRunStop(wxCommandEvent& event)
         {
             this->system->SaveStartingPattern();
 
-            // reset the initial number of steps used by system->Update in OnIdle
-            num_steps = 50;
+            // reset the initial number of steps in each batch of the simulation thread
+            this->simulation.SetStepsPerBatch(50);
             // 50 is half the initial timesteps_per_render value used in most
             // pattern files, but really we could choose any small number > 0
         }
+        try
+        {
+            this->RecordTimeline(); // (so we can step back to here)
+        }
+        catch(const exception& e)
+        {
+            MonospaceMessageBox(_("An error occurred when recording the timeline:\n\n")+wxString(e.what(),wxConvUTF8),_("Error"),wxART_ERROR);
+        }
         steps_since_last_render = 0;
         this->computation_time_since_last_render = 0.0;
         do_one_render = false;
+        this->RunUntilNextRender();
     }
 }
 
@@ -1185,7 +1214,96 @@ void MyFrame::OnReset(wxCommandEvent& event)
 
 void MyFrame::OnUpdateReset(wxUpdateUIEvent& event)
 {
-    event.Enable(this->system->GetTimestepsTaken() > 0);
+    // (update UI events are handled while the simulation thread is running, so we only look at the system when it is stopped)
+    event.Enable(this->is_running || this->system->GetTimestepsTaken() > 0);
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::RecordTimeline()
+{
+    if (!record_timeline)
+        return;
+    // (the limit follows the size of the state, which changes with the pattern)
+    this->system->SetTimelineMemoryLimit(size_t(timeline_states) * this->system->GetMemorySize());
+    this->system->RecordTimeline();
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::GoToRecordedTimestep(int i)
+{
+    if (i < 0 || i >= this->system->GetNumberOfRecordedTimesteps())
+        return;
+    try
+    {
+        this->system->GoToRecordedTimestep(i);
+    }
+    catch(const exception& e)
+    {
+        MonospaceMessageBox(_("An error occurred when going to a recorded timestep:\n\n")+wxString(e.what(),wxConvUTF8),_("Error"),wxART_ERROR);
+    }
+    this->UpdateWindows();
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::OnStepBack(wxCommandEvent& event)
+{
+    if (this->is_running)
+        return;
+    // the last state recorded before the current timestep
+    this->GoToRecordedTimestep(this->system->FindRecordedTimestep(this->system->GetTimestepsTaken() - 1));
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::OnUpdateStepBack(wxUpdateUIEvent& event)
+{
+    event.Enable(!this->is_running && this->system->FindRecordedTimestep(this->system->GetTimestepsTaken() - 1) >= 0);
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::OnStepForward(wxCommandEvent& event)
+{
+    if (this->is_running)
+        return;
+    // the first state recorded after the current timestep
+    this->GoToRecordedTimestep(this->system->FindRecordedTimestep(this->system->GetTimestepsTaken()) + 1);
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::OnUpdateStepForward(wxUpdateUIEvent& event)
+{
+    event.Enable(!this->is_running && this->system->FindRecordedTimestep(this->system->GetTimestepsTaken()) + 1
+        < this->system->GetNumberOfRecordedTimesteps());
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::OnGoToTimestep(wxCommandEvent& event)
+{
+    const int n_recorded = this->system->GetNumberOfRecordedTimesteps();
+    if (this->is_running || n_recorded == 0)
+        return;
+    const int first = this->system->GetRecordedTimestep(0);
+    const int last = this->system->GetRecordedTimestep(n_recorded - 1);
+    IntegerDialog dlg(this, _("Go to timestep"),
+                      wxString::Format(_("Timestep (%d recorded, from %d to %d):"), n_recorded, first, last),
+                      min(max(this->system->GetTimestepsTaken(), first), last),
+                      first, last, wxDefaultPosition, wxDefaultSize);
+    if(dlg.ShowModal()!=wxID_OK) return;
+    // (if the timestep wasn't recorded we go to the one before it)
+    this->GoToRecordedTimestep(this->system->FindRecordedTimestep(dlg.GetValue()));
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::OnUpdateGoToTimestep(wxUpdateUIEvent& event)
+{
+    event.Enable(!this->is_running && this->system->GetNumberOfRecordedTimesteps() > 0);
 }
 
 // ---------------------------------------------------------------------
@@ -1213,106 +1331,114 @@ void MyFrame::OnIdle(wxIdleEvent& event)
         if (this->IsActive()) this->CheckFocus();
     #endif
 
-    // we drive our simulation loop via idle events
-    if (this->is_running)
+    // the simulation thread does the stepping, and wakes us up when it has done the steps up to the next render
+    SimulationThread::Progress progress;
+    if (this->is_running && this->simulation.GetLatestProgress(progress) && progress.finished)
     {
-        // ensure num_steps <= timesteps_per_render
-        int timesteps_per_render = this->render_settings.GetProperty("timesteps_per_render").GetInt();
-        if (num_steps > timesteps_per_render) num_steps = timesteps_per_render;
-
-        // use temp_steps for the actual system->Update call because it might be < num_steps
-        int temp_steps = num_steps;
-        if (steps_since_last_render + temp_steps > timesteps_per_render) {
-            // do final steps of this rendering phase
-            temp_steps = timesteps_per_render - steps_since_last_render;
-        }
-
-        double time_before = get_time_in_seconds();
-
-        try
-        {
-            this->system->Update(temp_steps);
-            this->pVTKWindow->GetRenderWindow()->GetRenderers()->GetFirstRenderer()->ResetCameraClippingRange();
-        }
-        catch(const exception& e)
+        if (!progress.error.empty())
         {
             this->is_running = false;
             this->SetStatusBarText();
             this->UpdateToolbars();
-            MonospaceMessageBox(_("An error occurred when running the simulation:\n\n")+wxString(e.what(),wxConvUTF8),_("Error"),wxART_ERROR);
+            MonospaceMessageBox(_("An error occurred when running the simulation:\n\n")+wxString(progress.error.c_str(),wxConvUTF8),_("Error"),wxART_ERROR);
         }
-        catch(...)
+        else
         {
-            this->is_running = false;
-            this->SetStatusBarText();
-            this->UpdateToolbars();
-            wxMessageBox(_("An unknown error occurred when running the simulation"));
-        }
-
-        double time_diff = get_time_in_seconds() - time_before;
-
-        // note that we don't change num_steps if temp_steps < num_steps
-        if (num_steps == temp_steps) {
-            // if the above system->Update was quick then we'll use more steps in the next call,
-            // otherwise we'll use less steps so that the app remains responsive
-            if (time_diff < 0.1) {
-                num_steps *= 2;
-                if (num_steps > timesteps_per_render) num_steps = timesteps_per_render;
-            } else {
-                num_steps /= 2;
-                if (num_steps < 1) num_steps = 1;
-            }
+            // (the simulation thread has stopped, so the system is ours until we ask for the next run)
+            this->RenderRunResult(progress);
         }
+    }
 
-        this->computation_time_since_last_render += time_diff;
-        steps_since_last_render += temp_steps;
-
-        if (steps_since_last_render >= timesteps_per_render) {
-            // it's time to render what we've computed so far
-            if (this->computation_time_since_last_render == 0.0)
-                this->computation_time_since_last_render = 0.000001;  // unlikely, but play safe
-            double time_since_last_render = time_before - this->time_at_last_render;
-            this->time_at_last_render = time_before;
-            this->timesteps_per_second_buffer[this->i_timesteps_per_second_buffer] = steps_since_last_render / time_since_last_render;
-            this->computed_frames_per_second_buffer[this->i_timesteps_per_second_buffer] = steps_since_last_render / this->computation_time_since_last_render;
-            this->i_timesteps_per_second_buffer++;
-            if(this->i_timesteps_per_second_buffer==10)
-            {
-                this->smoothed_timesteps_per_second = 0.0;
-                double smoothed_cfps = 0.0;
-                for(int i=0;i<10;i++) {
-                    this->smoothed_timesteps_per_second += this->timesteps_per_second_buffer[i]/10.0;
-                    smoothed_cfps += this->computed_frames_per_second_buffer[i]/10.0;
-                }
-                if(smoothed_cfps > this->smoothed_timesteps_per_second)
-                    this->percentage_spent_rendering = 100.0 - 100.0 * this->smoothed_timesteps_per_second / smoothed_cfps;
-                this->i_timesteps_per_second_buffer = 0;
-                this->speed_data_available = true;
-            }
+    event.Skip();
+}
 
-            if(this->is_recording)
-                this->RecordFrame();
+// ---------------------------------------------------------------------
 
-            this->pVTKWindow->Refresh(false);
-            this->SetStatusBarText();
+void MyFrame::RenderRunResult(const SimulationThread::Progress& progress)
+{
+    try
+    {
+        this->system->UpdateRenderPipeline();
+        this->RecordTimeline(); // keep each rendered state, for stepping back
+        this->pVTKWindow->GetRenderWindow()->GetRenderers()->GetFirstRenderer()->ResetCameraClippingRange();
+    }
+    catch(const exception& e)
+    {
+        this->is_running = false;
+        this->SetStatusBarText();
+        this->UpdateToolbars();
+        MonospaceMessageBox(_("An error occurred when running the simulation:\n\n")+wxString(e.what(),wxConvUTF8),_("Error"),wxART_ERROR);
+        return;
+    }
 
-            if (do_one_render) {
-                // user selected Step by N so stop now
-                this->is_running = false;
-                this->speed_data_available = false;
-                this->SetStatusBarText();
-                this->UpdateToolbars();
-            } else {
-                // keep simulating
-                steps_since_last_render = 0;
-                this->computation_time_since_last_render = 0.0;
-            }
+    steps_since_last_render = progress.steps_done;
+    this->computation_time_since_last_render = progress.computation_time;
+
+    // it's time to render what we've computed so far
+    if (this->computation_time_since_last_render == 0.0)
+        this->computation_time_since_last_render = 0.000001;  // unlikely, but play safe
+    const double time_now = get_time_in_seconds();
+    double time_since_last_render = time_now - this->time_at_last_render;
+    this->time_at_last_render = time_now;
+    this->timesteps_per_second_buffer[this->i_timesteps_per_second_buffer] = steps_since_last_render / time_since_last_render;
+    this->computed_frames_per_second_buffer[this->i_timesteps_per_second_buffer] = steps_since_last_render / this->computation_time_since_last_render;
+    this->i_timesteps_per_second_buffer++;
+    if(this->i_timesteps_per_second_buffer==10)
+    {
+        this->smoothed_timesteps_per_second = 0.0;
+        double smoothed_cfps = 0.0;
+        for(int i=0;i<10;i++) {
+            this->smoothed_timesteps_per_second += this->timesteps_per_second_buffer[i]/10.0;
+            smoothed_cfps += this->computed_frames_per_second_buffer[i]/10.0;
         }
+        if(smoothed_cfps > this->smoothed_timesteps_per_second)
+            this->percentage_spent_rendering = 100.0 - 100.0 * this->smoothed_timesteps_per_second / smoothed_cfps;
+        this->i_timesteps_per_second_buffer = 0;
+        this->speed_data_available = true;
+    }
 
-        event.RequestMore(); // trigger another idle event
+    if(this->is_recording)
+        this->RecordFrame();
+
+    this->pVTKWindow->Refresh(false);
+    this->SetStatusBarText();
+
+    if (do_one_render) {
+        // user selected Step by N so stop now
+        this->is_running = false;
+        this->speed_data_available = false;
+        this->SetStatusBarText();
+        this->UpdateToolbars();
+    } else {
+        // keep simulating
+        steps_since_last_render = 0;
+        this->computation_time_since_last_render = 0.0;
+        this->RunUntilNextRender();
     }
+}
 
-    event.Skip();
+// ---------------------------------------------------------------------
+
+void MyFrame::RunUntilNextRender()
+{
+    this->simulation.Run(this->render_settings.GetProperty("timesteps_per_render").GetInt());
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::PauseSimulation()
+{
+    this->simulation.Pause();
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::ResumeSimulation()
+{
+    // (if the event handler stopped the simulation then the simulation thread mustn't carry on to the next render)
+    if (!this->is_running)
+        this->simulation.Stop();
+    this->simulation.Resume();
 }
 
 // ---------------------------------------------------------------------
@@ -1951,7 +2077,7 @@ void MyFrame::SetDescription(string s)
 
 void MyFrame::SetParameter(int iParam,float val)
 {
-    this->system->SetParameterValue(iParam,val);
+    this->simulation.Post([iParam,val](AbstractRD& system) { system.SetParameterValue(iParam,val); });
     this->UpdateWindowTitle();
     this->UpdateInfoPane();
 }
@@ -2007,6 +2133,13 @@ void MyFrame::ShowPrefsDialog(const wxString& page)
     if (ChangePrefs(page)) {
         // user hit OK button so might as well save prefs now
         SaveSettings();
+        // (takes effect the next time the starting pattern is saved)
+        this->system->SetStartingPatternStorage(regenerate_start ? AbstractRD::StartingPatternStorage::Regenerated
+                                                                 : AbstractRD::StartingPatternStorage::Compressed);
+        if (record_timeline)
+            this->system->SetTimelineMemoryLimit(size_t(timeline_states) * this->system->GetMemorySize());
+        else
+            this->system->ClearTimeline();
     }
     // safer to update everything even if user hit Cancel
     this->UpdateWindows();
@@ -2117,6 +2250,9 @@ void MyFrame::UpdateMenuAccelerators()
         SetAccelerator(mbar, ID::Slower,                    DO_SLOWER);
         SetAccelerator(mbar, ID::ChangeRunningSpeed,        DO_CHANGESPEED);
         SetAccelerator(mbar, ID::Reset,                     DO_RESET);
+        SetAccelerator(mbar, ID::StepBack,                  DO_STEPBACK);
+        SetAccelerator(mbar, ID::StepForward,               DO_STEPFORWARD);
+        SetAccelerator(mbar, ID::GoToTimestep,              DO_GOTOSTEP);
         SetAccelerator(mbar, ID::GenerateInitialPattern,    DO_GENPATT);
         SetAccelerator(mbar, ID::Blank,                     DO_BLANK);
         SetAccelerator(mbar, ID::AddParameter,              DO_ADDPARAM);
@@ -2141,7 +2277,11 @@ void MyFrame::ProcessKey(int key, int modifiers)
                                 if (fullscreen) { cmdid = ID::FullScreen; }
                                 break;
 
-        case DO_OPENFILE:       OpenFile(action.file);
+        case DO_OPENFILE:       {
+                                    // (not sent on as a menu command, so the simulation thread isn't paused for us)
+                                    SimulationThread::ScopedPause pause(this->simulation);
+                                    OpenFile(action.file);
+                                }
                                 return;
 
         // File menu
@@ -2199,6 +2339,9 @@ void MyFrame::ProcessKey(int key, int modifiers)
         case DO_SLOWER:         cmdid = ID::Slower; break;
         case DO_CHANGESPEED:    cmdid = ID::ChangeRunningSpeed; break;
         case DO_RESET:          cmdid = ID::Reset; break;
+        case DO_STEPBACK:       cmdid = ID::StepBack; break;
+        case DO_STEPFORWARD:    cmdid = ID::StepForward; break;
+        case DO_GOTOSTEP:       cmdid = ID::GoToTimestep; break;
         case DO_GENPATT:        cmdid = ID::GenerateInitialPattern; break;
         case DO_BLANK:          cmdid = ID::Blank; break;
         case DO_ADDPARAM:       cmdid = ID::AddParameter; break;
@@ -2455,6 +2598,33 @@ void MyFrame::SetDataType(int data_type)
 
 // ---------------------------------------------------------------------
 
+void MyFrame::SetStorage(AbstractRD::Storage storage)
+{
+    const AbstractRD::Storage old_storage = this->system->GetStorage();
+    try
+    {
+        this->system->SetStorage(storage);
+        InitializeVTKPipeline(this->pVTKWindow, *this->system, this->render_settings, false);
+        this->UpdateWindows();
+    }
+    catch (const exception& e)
+    {
+        MonospaceMessageBox(_("Failed to set storage:\n\n") + wxString(e.what(), wxConvUTF8), _("Error"), wxART_ERROR);
+        this->system->SetStorage(old_storage);
+        InitializeVTKPipeline(this->pVTKWindow, *this->system, this->render_settings, false);
+        this->UpdateWindows();
+    }
+    catch (...)
+    {
+        wxMessageBox(_("Failed to set storage"));
+        this->system->SetStorage(old_storage);
+        InitializeVTKPipeline(this->pVTKWindow, *this->system, this->render_settings, false);
+        this->UpdateWindows();
+    }
+}
+
+// ---------------------------------------------------------------------
+
 void MyFrame::RenderSettingsChanged()
 {
     // first do some range checking (not done in InfoPanel::ChangeRenderSetting)
@@ -3189,27 +3359,26 @@ void MyFrame::LeftMouseDown(int x, int y)
                 break; // (VTK will handle the control of the viewpoint)
             case TCursorType::PENCIL:
             {
-                if (repaint_to_erase && this->current_paint_value == this->system->GetValue(p[0],p[1],p[2],this->render_settings)) {
+                if (repaint_to_erase && this->current_paint_value == this->GetValueAt(p)) {
                     // erase cell by using low value
-                    this->system->SetValue(p[0],p[1],p[2],this->render_settings.GetProperty("low").GetFloat(),this->render_settings);
+                    this->PaintValue(p,this->render_settings.GetProperty("low").GetFloat());
                     // set flag in case mouse is moved (see MouseMove)
                     this->erasing = true;
                 } else {
-                    this->system->SetValue(p[0],p[1],p[2],this->current_paint_value,this->render_settings);
+                    this->PaintValue(p,this->current_paint_value);
                 }
                 this->pVTKWindow->Refresh();
             }
             break;
             case TCursorType::BRUSH:
             {
-                this->system->SetValuesInRadius(p[0],p[1],p[2],this->brush_sizes[current_brush_size],
-                    this->current_paint_value,this->render_settings);
+                this->PaintValuesInRadius(p,this->current_paint_value);
                 this->pVTKWindow->Refresh();
             }
             break;
             case TCursorType::PICKER:
             {
-                this->current_paint_value = this->system->GetValue(p[0],p[1],p[2],this->render_settings);
+                this->current_paint_value = this->GetValueAt(p);
                 this->UpdateToolbars();
             }
             break;
@@ -3218,18 +3387,47 @@ void MyFrame::LeftMouseDown(int x, int y)
     else
     {
         // pick
-        this->current_paint_value = this->system->GetValue(p[0],p[1],p[2],this->render_settings);
+        this->current_paint_value = this->GetValueAt(p);
         this->UpdateToolbars();
     }
 }
 
 // ---------------------------------------------------------------------
 
+float MyFrame::GetValueAt(const double* p)
+{
+    // (mouse moves are handled while the simulation thread is stepping, so it must wait while we read)
+    SimulationThread::ScopedPause pause(this->simulation);
+    return this->system->GetValue(p[0],p[1],p[2],this->render_settings);
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::PaintValue(const double* p, float value)
+{
+    // (a copy of the render settings goes with the command, in case it is run later by the simulation thread)
+    const float x = p[0], y = p[1], z = p[2];
+    const Properties settings = this->render_settings;
+    this->simulation.Post([=](AbstractRD& system) { system.SetValue(x,y,z,value,settings); });
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::PaintValuesInRadius(const double* p, float value)
+{
+    const float x = p[0], y = p[1], z = p[2];
+    const float r = this->brush_sizes[current_brush_size];
+    const Properties settings = this->render_settings;
+    this->simulation.Post([=](AbstractRD& system) { system.SetValuesInRadius(x,y,z,r,value,settings); });
+}
+
+// ---------------------------------------------------------------------
+
 void MyFrame::LeftMouseUp(int x, int y)
 {
     this->left_mouse_is_down = false;
     this->erasing = false;
-    this->system->SetUndoPoint();
+    this->simulation.Post([](AbstractRD& system) { system.SetUndoPoint(); });
 }
 
 // ---------------------------------------------------------------------
@@ -3246,7 +3444,7 @@ void MyFrame::RightMouseDown(int x, int y)
 
     // color pick
     this->pVTKWindow->SetCursor(*this->picker_cursor);
-    this->current_paint_value = this->system->GetValue(p[0],p[1],p[2],this->render_settings);
+    this->current_paint_value = this->GetValueAt(p);
     this->UpdateToolbars();
 }
 
@@ -3285,23 +3483,22 @@ void MyFrame::MouseMove(int x, int y)
             case TCursorType::PENCIL:
             {
                 if (erasing) {
-                    this->system->SetValue(p[0],p[1],p[2],this->render_settings.GetProperty("low").GetFloat(),this->render_settings);
+                    this->PaintValue(p,this->render_settings.GetProperty("low").GetFloat());
                 } else {
-                    this->system->SetValue(p[0],p[1],p[2],this->current_paint_value,this->render_settings);
+                    this->PaintValue(p,this->current_paint_value);
                 }
                 this->pVTKWindow->Refresh();
             }
             break;
             case TCursorType::BRUSH:
             {
-                this->system->SetValuesInRadius(p[0],p[1],p[2],this->brush_sizes[current_brush_size],
-                    this->current_paint_value,this->render_settings);
+                this->PaintValuesInRadius(p,this->current_paint_value);
                 this->pVTKWindow->Refresh();
             }
             break;
             case TCursorType::PICKER:
             {
-                this->current_paint_value = this->system->GetValue(p[0],p[1],p[2],this->render_settings);
+                this->current_paint_value = this->GetValueAt(p);
                 this->UpdateToolbars();
             }
             break;
@@ -3310,7 +3507,7 @@ void MyFrame::MouseMove(int x, int y)
     else
     {
         // color pick
-        this->current_paint_value = this->system->GetValue(p[0],p[1],p[2],this->render_settings);
+        this->current_paint_value = this->GetValueAt(p);
         this->UpdateToolbars();
     }
 }
@@ -3350,7 +3547,7 @@ void MyFrame::OnUndo(wxCommandEvent& event)
 
 void MyFrame::OnUpdateUndo(wxUpdateUIEvent& event)
 {
-    event.Enable(this->system->CanUndo());
+    event.Enable(!this->is_running && this->system->CanUndo());
 }
 
 // ---------------------------------------------------------------------
@@ -3367,7 +3564,7 @@ void MyFrame::OnRedo(wxCommandEvent& event)
 
 void MyFrame::OnUpdateRedo(wxUpdateUIEvent& event)
 {
-    event.Enable(this->system->CanRedo());
+    event.Enable(!this->is_running && this->system->CanRedo());
 }
 
 // ---------------------------------------------------------------------
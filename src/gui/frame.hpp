@@ -36,6 +36,7 @@ class wxVTKRenderWindowInteractor;
 // readybase
 #include "AbstractRD.hpp"
 #include "Properties.hpp"
+#include "SimulationThread.hpp"
 
 // VTK:
 class vtkUnstructuredGrid;
@@ -64,9 +65,14 @@ class MyFrame : public wxFrame, public IPaintHandler
         bool SetDimensions(int x,int y,int z);
         void SetBlockSize(int x,int y,int z);
         void SetDataType(int data_type);
+        void SetStorage(AbstractRD::Storage storage);
         Properties& GetRenderSettings() { return this->render_settings; }
         void RenderSettingsChanged();
 
+        // interface with MyApp: the simulation thread is paused while each command or mouse click is handled
+        void PauseSimulation();
+        void ResumeSimulation();
+
         // interface with Preferences dialog
         void ShowPrefsDialog(const wxString& page = wxEmptyString);
         void UpdateMenuAccelerators();
@@ -169,6 +175,12 @@ class MyFrame : public wxFrame, public IPaintHandler
         void OnChangeRunningSpeed(wxCommandEvent& event);
         void OnReset(wxCommandEvent& event);
         void OnUpdateReset(wxUpdateUIEvent& event);
+        void OnStepBack(wxCommandEvent& event);
+        void OnUpdateStepBack(wxUpdateUIEvent& event);
+        void OnStepForward(wxCommandEvent& event);
+        void OnUpdateStepForward(wxUpdateUIEvent& event);
+        void OnGoToTimestep(wxCommandEvent& event);
+        void OnUpdateGoToTimestep(wxUpdateUIEvent& event);
         void OnGenerateInitialPattern(wxCommandEvent& event);
         void OnBlank(wxCommandEvent& event);
         void OnAddParameter(wxCommandEvent& event);
@@ -213,6 +225,13 @@ class MyFrame : public wxFrame, public IPaintHandler
         void UpdateToolbars();
         void SetStatusBarText();
         void RecordFrame();
+        void RecordTimeline();
+        void GoToRecordedTimestep(int i);
+        void RunUntilNextRender();
+        void RenderRunResult(const SimulationThread::Progress& progress);
+        float GetValueAt(const double* p);
+        void PaintValue(const double* p, float value);
+        void PaintValuesInRadius(const double* p, float value);
 
         bool LoadMesh(const wxFileName& filename, vtkUnstructuredGrid* ug);
         void MakeDefaultImageSystemFromMesh(vtkUnstructuredGrid* ug);
@@ -234,6 +253,9 @@ class MyFrame : public wxFrame, public IPaintHandler
         // current system being simulated (in future we might want more than one)
         std::unique_ptr<AbstractRD> system;
 
+        // steps the system while running (declared after system, so that it stops before system is deleted)
+        SimulationThread simulation;
+
         // panes:
         PatternsPanel *patterns_panel;
         InfoPanel *info_panel;
@@ -246,7 +268,6 @@ class MyFrame : public wxFrame, public IPaintHandler
 
         // following are used when running a simulation:
         bool is_running;
-        int num_steps;
         bool do_one_render;
 
         // used for reporting speed:
@@ -95,6 +95,9 @@ bool allowbeep = true;           // okay to play beep sound?
 bool askonnew = true;            // ask to save changes before creating new pattern?
 bool askonload = true;           // ask to save changes before loading pattern file?
 bool askonquit = true;           // ask to save changes before quitting app?
+bool regenerate_start = false;   // keep just the seeds of a generated starting pattern?
+bool record_timeline = false;    // keep rendered states so we can step back to them?
+int timeline_states = 8;         // timeline may use this many times the memory of the current state
 wxString opensavedir;            // directory for Open/Save Pattern dialogs
 wxString screenshotdir;          // directory for Save Screenshot dialog
 wxString userdir;                // directory for user's patterns
@@ -301,6 +304,8 @@ void AddDefaultKeyActions()
     keyaction[IK_TAB][0].id =           DO_STEPN;
     keyaction[IK_RETURN][0].id =        DO_RUNSTOP;
     keyaction[(int)'r'][mk_CMD].id =    DO_RESET;
+    keyaction[(int)'['][0].id =         DO_STEPBACK;
+    keyaction[(int)']'][0].id =         DO_STEPFORWARD;
     keyaction[(int)'+'][0].id =         DO_FASTER;
     keyaction[(int)'+'][mk_SHIFT].id =  DO_FASTER;
     keyaction[(int)'='][0].id =         DO_FASTER;
@@ -368,6 +373,9 @@ const char* GetActionName(action_id action)
         case DO_SLOWER:         return "Run Slower";
         case DO_CHANGESPEED:    return "Change Running Speed...";
         case DO_RESET:          return "Reset";
+        case DO_STEPBACK:       return "Step Back";
+        case DO_STEPFORWARD:    return "Step Forward";
+        case DO_GOTOSTEP:       return "Go to Timestep...";
         case DO_GENPATT:        return "Generate Initial Pattern";
         case DO_BLANK:          return "Blank";
         case DO_ADDPARAM:       return "Add Parameter...";
@@ -934,6 +942,9 @@ void SavePrefs()
     fprintf(f, "ask_on_new=%d\n", askonnew ? 1 : 0);
     fprintf(f, "ask_on_load=%d\n", askonload ? 1 : 0);
     fprintf(f, "ask_on_quit=%d\n", askonquit ? 1 : 0);
+    fprintf(f, "regenerate_starting_pattern=%d\n", regenerate_start ? 1 : 0);
+    fprintf(f, "record_timeline=%d\n", record_timeline ? 1 : 0);
+    fprintf(f, "timeline_states=%d (%d..%d)\n", timeline_states, mintimelinestates, maxtimelinestates);
 
     fputs("\n", f);
 
@@ -1249,6 +1260,13 @@ void GetPrefs()
         } else if (strcmp(keyword, "ask_on_new") == 0)  { askonnew = value[0] == '1';
         } else if (strcmp(keyword, "ask_on_load") == 0) { askonload = value[0] == '1';
         } else if (strcmp(keyword, "ask_on_quit") == 0) { askonquit = value[0] == '1';
+        } else if (strcmp(keyword, "regenerate_starting_pattern") == 0) { regenerate_start = value[0] == '1';
+        } else if (strcmp(keyword, "record_timeline") == 0) { record_timeline = value[0] == '1';
+
+        } else if (strcmp(keyword, "timeline_states") == 0) {
+            sscanf(value, "%d", &timeline_states);
+            if (timeline_states < mintimelinestates) timeline_states = mintimelinestates;
+            if (timeline_states > maxtimelinestates) timeline_states = maxtimelinestates;
 
         } else if (strcmp(keyword, "open_save_dir") == 0)  { GetRelPath(value, opensavedir, PATT_DIR);
         } else if (strcmp(keyword, "screenshot_dir") == 0) { GetRelPath(value, screenshotdir, PATT_DIR);
@@ -1335,7 +1353,9 @@ enum
     // View prefs
     PREF_SHOW_TIPS,
     // Action prefs
-    // none as yet
+    PREF_REGENERATE,
+    PREF_RECORD_TIMELINE,
+    PREF_TIMELINE_STATES,
     // Keyboard prefs
     PREF_KEYCOMBO,
     PREF_ACTION,
@@ -1620,7 +1640,9 @@ void PrefsDialog::OnSpinCtrlChar(wxKeyEvent& event)
             // no spin ctrls on this page
         }
         else if ( currpage == ACTION_PAGE ) {
-            // no spin ctrls on this page
+            // only one spin ctrl on this page
+            wxSpinCtrl* s1 = (wxSpinCtrl*) FindWindowById(PREF_TIMELINE_STATES);
+            if ( s1 ) { s1->SetFocus(); s1->SetSelection(ALL_TEXT); }
         }
         else if ( currpage == KEYBOARD_PAGE ) {
             // no spin ctrls on this page
@@ -1900,13 +1922,39 @@ wxPanel* PrefsDialog::CreateActionPrefs(wxWindow* parent)
     wxBoxSizer* topSizer = new wxBoxSizer(wxVERTICAL);
     wxBoxSizer* vbox = new wxBoxSizer(wxVERTICAL);
 
-    wxString note = _("No settings here as yet.");
-    wxBoxSizer* notebox = new wxBoxSizer(wxHORIZONTAL);
-    notebox->Add(new wxStaticText(panel, wxID_STATIC, note));
+    // regenerate_starting_pattern
+
+    wxCheckBox* regencheck = new wxCheckBox(panel, PREF_REGENERATE,
+        _("Reset by generating the starting pattern again, instead of keeping a copy"));
+
+    // record_timeline and timeline_states
+
+    wxCheckBox* timelinecheck = new wxCheckBox(panel, PREF_RECORD_TIMELINE,
+        _("Record a timeline of rendered states, for stepping back"));
+
+    wxBoxSizer* statesbox = new wxBoxSizer(wxHORIZONTAL);
+    statesbox->Add(new wxStaticText(panel, wxID_STATIC, _("Timeline memory, as a multiple of the current state:")),
+        0, wxALL, 0);
+
+    wxSpinCtrl* spin1 = new MySpinCtrl(panel, PREF_TIMELINE_STATES, wxEmptyString,
+        wxDefaultPosition, wxSize(70, wxDefaultCoord));
+
+    wxBoxSizer* hsbox = new wxBoxSizer(wxHORIZONTAL);
+    hsbox->Add(statesbox, 0, wxALIGN_CENTER_VERTICAL, 0);
+    hsbox->Add(spin1, 0, wxLEFT | wxRIGHT | wxALIGN_CENTER_VERTICAL, SPINGAP);
 
     // position things
     vbox->AddSpacer(5);
-    vbox->Add(notebox, 0, wxALIGN_CENTER, LRGAP);
+    vbox->Add(regencheck, 0, wxLEFT | wxRIGHT, LRGAP);
+    vbox->AddSpacer(10);
+    vbox->Add(timelinecheck, 0, wxLEFT | wxRIGHT, LRGAP);
+    vbox->AddSpacer(5);
+    vbox->Add(hsbox, 0, wxLEFT | wxRIGHT, LRGAP);
+
+    // init control values
+    regencheck->SetValue(regenerate_start);
+    timelinecheck->SetValue(record_timeline);
+    spin1->SetRange(mintimelinestates, maxtimelinestates); spin1->SetValue(timeline_states);
 
     topSizer->Add(vbox, 1, wxGROW | wxALL, 5);
     panel->SetSizer(topSizer);
@@ -2232,7 +2280,9 @@ bool PrefsDialog::ValidatePage()
         // no spin ctrls on this page
 
     } else if (currpage == ACTION_PAGE) {
-        // no spin ctrls on this page
+        if ( BadSpinVal(PREF_TIMELINE_STATES, mintimelinestates, maxtimelinestates,
+                        _("Timeline memory multiple")) )
+            return false;
 
     } else if (currpage == KEYBOARD_PAGE) {
         // no spin ctrls on this page
@@ -2296,7 +2346,9 @@ bool PrefsDialog::TransferDataFromWindow()
     #endif
 
     // ACTION_PAGE
-    // nothing yet
+    regenerate_start = GetCheckVal(PREF_REGENERATE);
+    record_timeline  = GetCheckVal(PREF_RECORD_TIMELINE);
+    timeline_states  = GetSpinVal(PREF_TIMELINE_STATES);
 
     // KEYBOARD_PAGE
     // go thru keyaction table and make sure the file field is empty
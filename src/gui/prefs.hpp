@@ -38,6 +38,8 @@ void ChooseTextEditor(wxWindow* parent, wxString& result);
 
 const int minfontsize = 8;       // minimum value of infofontsize/helpfontsize
 const int maxfontsize = 30;      // maximum value of infofontsize/helpfontsize
+const int mintimelinestates = 1;     // minimum value of timeline_states
+const int maxtimelinestates = 1000;  // maximum value of timeline_states
 
 // Global directory paths:
 
@@ -68,6 +70,9 @@ extern bool allowbeep;           // okay to play beep sound?
 extern bool askonnew;            // ask to save changes before creating new pattern?
 extern bool askonload;           // ask to save changes before loading pattern file?
 extern bool askonquit;           // ask to save changes before quitting app?
+extern bool regenerate_start;    // keep just the seeds of a generated starting pattern?
+extern bool record_timeline;     // keep rendered states so we can step back to them?
+extern int timeline_states;      // timeline may use this many times the memory of the current state
 extern wxString opensavedir;     // directory for Open/Save Pattern dialogs
 extern wxString screenshotdir;   // directory for Save Screenshot dialog
 extern wxString userdir;         // directory for user's patterns
@@ -102,6 +107,7 @@ typedef enum
     DO_FIT,                      // fit pattern
     DO_FULLSCREEN,               // full screen
     DO_GENPATT,                  // generate pattern
+    DO_GOTOSTEP,                 // go to timestep...
     DO_IMPORTIMAGE,              // import an image...
     DO_IMPORTMESH,               // import a mesh...
     DO_NEWPATT,                  // new pattern
@@ -138,8 +144,10 @@ typedef enum
     DO_FILETOOLBAR,              // show file toolbar
     DO_PAINTTOOLBAR,             // show paint toolbar
     DO_RECORDFRAMES,             // start recording
+    DO_STEPBACK,                 // step back
     DO_STEP1,                    // step by 1
     DO_STEPN,                    // step by N
+    DO_STEPFORWARD,              // step forward
     DO_UNDO,                     // undo
     DO_VIEWKERNEL,               // view full kernel
     DO_WIREFRAME,                // wireframe
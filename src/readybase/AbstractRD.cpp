@@ -21,6 +21,7 @@
 
 // STL:
 #include <algorithm>
+#include <cstdint>
 
 // SSE:
 #if USE_SSE
@@ -31,16 +32,51 @@ using namespace std;
 
 // ---------------------------------------------------------------------
 
+namespace
+{
+    /// A fast hash of the raw values, for checking that a pattern was generated the same as before.
+    uint64_t HashBlocks(const vector<Timeline::Block>& blocks)
+    {
+        const uint64_t prime = 0x100000001B3ULL;
+        uint64_t hash = 0xCBF29CE484222325ULL;
+        for(const Timeline::Block& block : blocks)
+        {
+            const uint8_t* bytes = static_cast<const uint8_t*>(block.data);
+            size_t i = 0;
+            for(; i + sizeof(uint64_t) <= block.n_bytes; i += sizeof(uint64_t))
+            {
+                uint64_t word;
+                copy(bytes + i, bytes + i + sizeof(uint64_t), reinterpret_cast<uint8_t*>(&word));
+                hash = (hash ^ word) * prime;
+                hash ^= hash >> 29;
+            }
+            for(; i < block.n_bytes; i++)
+                hash = (hash ^ bytes[i]) * prime;
+            hash = (hash ^ block.n_bytes) * prime;
+        }
+        return hash;
+    }
+}
+
+// ---------------------------------------------------------------------
+
 AbstractRD::AbstractRD(int data_type)
     : use_local_memory(false)
     , timesteps_taken(0)
     , need_reload_formula(true)
     , is_modified(false)
     , wrap(true)
+    , timeline_position(-1)
+    , starting_pattern_storage(StartingPatternStorage::Compressed)
+    , starting_state_is_generated(false)
+    , starting_state_hash(0)
+    , keep_initial_pattern_seeds(false)
     , neighborhood_type(TNeighborhood::VERTEX_NEIGHBORS)
     , x_spacing_proportion(0.05)
     , y_spacing_proportion(0.1)
     , accuracy(Accuracy::Medium)
+    , storage(Storage::Default)
+    , storage_scale(0.0f)
 {
     this->InternalSetDataType(data_type);
 
@@ -301,14 +337,14 @@ void AbstractRD::CreateDefaultInitialPatternGenerator(size_t num_chemicals)
 
 bool AbstractRD::CanUndo() const
 {
-    return !this->undo_stack.empty() && this->undo_stack.front().done;
+    return this->undo_history.CanUndo();
 }
 
 // ---------------------------------------------------------------------
 
 bool AbstractRD::CanRedo() const
 {
-    return !this->undo_stack.empty() && !this->undo_stack.back().done;
+    return this->undo_history.CanRedo();
 }
 
 // ---------------------------------------------------------------------
@@ -316,26 +352,23 @@ bool AbstractRD::CanRedo() const
 void AbstractRD::SetUndoPoint()
 {
     // paint events are treated as a block until (e.g.) mouse up calls this function
-    if(!this->undo_stack.empty())
-        this->undo_stack.back().last_of_group = true;
+    this->undo_history.EndStroke([this](int iChemical,int first_cell,int n_cells,float* values) {
+        this->ReadCellValues(iChemical,first_cell,n_cells,values);
+    });
 }
 
 // ---------------------------------------------------------------------
 
 void AbstractRD::Undo()
 {
+    this->SetUndoPoint(); // (in case we are in the middle of a block)
     if(!this->CanUndo()) throw runtime_error("AbstractRD::Undo() : attempt to undo when undo not possible");
 
-    // find the last done paint action, undo backwards from there until the previous last_of_group (exclusive)
-    vector<PaintAction>::reverse_iterator rit;
-    for(rit=this->undo_stack.rbegin();!rit->done;rit++); // skip over actions that have already been undone
-    while(true)
-    {
-        this->FlipPaintAction(*rit);
-        rit++;
-        if(rit==this->undo_stack.rend() || rit->last_of_group)
-            break;
-    }
+    // restore the whole block, one run of cells at a time
+    this->undo_history.Undo([this](int iChemical,int first_cell,int n_cells,const float* values) {
+        this->WriteCellValues(iChemical,first_cell,n_cells,values);
+        this->CellsPainted(iChemical,first_cell,n_cells);
+    });
 }
 
 // ---------------------------------------------------------------------
@@ -344,33 +377,171 @@ void AbstractRD::Redo()
 {
     if(!this->CanRedo()) throw runtime_error("AbstractRD::Redo() : attempt to redo when redo not possible");
 
-    // find the first undone paint action, redo forwards from there until the next last_of_group (inclusive)
-    vector<PaintAction>::iterator it;
-    for(it=this->undo_stack.begin();it->done;it++); // skip over actions that have already been done
-    do
-    {
-        this->FlipPaintAction(*it);
-        if(it->last_of_group)
-            break;
-        it++;
-    } while(it!=this->undo_stack.end());
+    this->undo_history.Redo([this](int iChemical,int first_cell,int n_cells,const float* values) {
+        this->WriteCellValues(iChemical,first_cell,n_cells,values);
+        this->CellsPainted(iChemical,first_cell,n_cells);
+    });
 }
 
 // ---------------------------------------------------------------------
 
 void AbstractRD::StorePaintAction(int iChemical,int iCell,float old_val)
 {
-    // forget all stored undone actions
-    while(!this->undo_stack.empty() && !this->undo_stack.back().done)
-        this->undo_stack.pop_back();
-    // add the new paint action
-    PaintAction pa;
-    pa.iCell = iCell;
-    pa.iChemical = iChemical;
-    pa.val = old_val; // (the cell itself stores the new val, we just need the old one)
-    pa.done = true;
-    pa.last_of_group = false;
-    this->undo_stack.push_back(pa);
+    // (the cell itself stores the new val, we just need the old one)
+    this->undo_history.StoreOldValue(iChemical,iCell,old_val);
+    this->CellsPainted(iChemical,iCell,1);
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::RecordTimeline()
+{
+    if(this->timeline_position >= 0)
+    {
+        // we went back to an earlier state, so the states recorded after it are no longer where we are heading
+        this->timeline.DiscardAfter(this->timeline_position);
+        this->timeline_position = -1;
+    }
+    const int n_frames = this->timeline.GetNumberOfFrames();
+    if(n_frames > 0 && this->timeline.GetTimestep(n_frames-1) == this->timesteps_taken)
+        return;
+    this->timeline.Record(this->timesteps_taken, this->GetStateBlocks());
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::SetTimelineMemoryLimit(size_t bytes)
+{
+    const int n_frames_before = this->timeline.GetNumberOfFrames();
+    this->timeline.SetMemoryLimit(bytes);
+    if(this->timeline_position >= 0)
+    {
+        // the oldest states were forgotten, so the one we went back to has moved down, or is gone
+        this->timeline_position -= n_frames_before - this->timeline.GetNumberOfFrames();
+        if(this->timeline_position < 0)
+            this->timeline_position = -1;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::ClearTimeline()
+{
+    this->timeline.Clear();
+    this->timeline_position = -1;
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::GoToRecordedTimestep(int i)
+{
+    this->timeline.Restore(i, this->GetStateBlocks());
+    this->timeline_position = i;
+    this->timesteps_taken = this->timeline.GetTimestep(i);
+    this->undo_history.Clear();
+    this->is_modified = true;
+    this->AllCellsChanged();
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::ReseedInitialPatternGenerator()
+{
+    if(this->keep_initial_pattern_seeds)
+        return;
+    for(size_t iOverlay = 0; iOverlay < this->initial_pattern_generator.GetNumberOfOverlays(); iOverlay++)
+        this->initial_pattern_generator.GetOverlay(iOverlay).Reseed();
+}
+
+// ---------------------------------------------------------------------
+
+uint64_t AbstractRD::RegenerateInitialPattern()
+{
+    this->keep_initial_pattern_seeds = true;
+    try
+    {
+        this->GenerateInitialPattern();
+    }
+    catch(...)
+    {
+        this->keep_initial_pattern_seeds = false;
+        throw;
+    }
+    this->keep_initial_pattern_seeds = false;
+    return HashBlocks(this->GetStateBlocks());
+}
+
+// ---------------------------------------------------------------------
+
+bool AbstractRD::SaveCompactStartingPattern()
+{
+    this->starting_state.Clear();
+    this->starting_state_is_generated = false;
+    this->starting_parameters.clear();
+    if(this->starting_pattern_storage == StartingPatternStorage::Full)
+        return false;
+
+    const vector<Timeline::Block> blocks = this->GetStateBlocks();
+    this->starting_state.Record(this->timesteps_taken, blocks);
+    this->starting_state.Compact(); // (only one frame is ever kept)
+
+    if(this->starting_pattern_storage == StartingPatternStorage::Regenerated && this->initial_pattern_generator.ShouldZeroFirst())
+    {
+        // if the pattern is just what the initial pattern generator makes then we only need to keep its seeds, so we
+        // generate it again to check (the seeds are kept by the overlays until the next GenerateInitialPattern)
+        const uint64_t hash = HashBlocks(blocks);
+        const bool was_modified = this->is_modified;
+        const int timesteps = this->timesteps_taken;
+        if(this->RegenerateInitialPattern() == hash)
+        {
+            this->starting_state_is_generated = true;
+            this->starting_state_hash = hash;
+            this->starting_parameters = this->parameters;
+            this->starting_state.Clear();
+        }
+        else
+        {
+            // the pattern has been painted on, or the generator isn't deterministic, so keep the values after all
+            this->starting_state.Restore(0, this->GetStateBlocks());
+            this->AllCellsChanged();
+        }
+        this->is_modified = was_modified;
+        this->timesteps_taken = timesteps;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------
+
+bool AbstractRD::RestoreCompactStartingPattern()
+{
+    if(this->starting_state_is_generated)
+    {
+        // the overlays may depend on the parameters, which might have been changed since
+        swap(this->parameters, this->starting_parameters);
+        uint64_t hash;
+        try
+        {
+            hash = this->RegenerateInitialPattern();
+        }
+        catch(...)
+        {
+            swap(this->parameters, this->starting_parameters);
+            throw;
+        }
+        swap(this->parameters, this->starting_parameters);
+        if(hash != this->starting_state_hash)
+            throw runtime_error("AbstractRD::RestoreCompactStartingPattern : the starting pattern was generated differently from before");
+    }
+    else if(this->starting_state.GetNumberOfFrames() > 0)
+    {
+        this->starting_state.Restore(0, this->GetStateBlocks());
+        this->AllCellsChanged();
+    }
+    else
+        return false;
+    this->undo_history.Clear();
+    return true;
 }
 
 // ---------------------------------------------------------------------
@@ -400,6 +571,51 @@ void AbstractRD::SetDataType(int type)
 
 // ---------------------------------------------------------------------
 
+void AbstractRD::SetStorage(Storage s)
+{
+    this->storage = s;
+    this->need_reload_formula = true;
+    const bool reallocate_storage = true;
+    this->SetNumberOfChemicals(this->n_chemicals, reallocate_storage);
+    this->GenerateInitialPattern();
+}
+
+// ---------------------------------------------------------------------
+
+int AbstractRD::GetStorageDataType() const
+{
+    switch( this->storage ) {
+        case Storage::Float: return VTK_FLOAT;
+        default: return this->data_type; // (the integer and half types are converted to and from this)
+    }
+}
+
+// ---------------------------------------------------------------------
+
+float AbstractRD::GetEffectiveStorageScale() const
+{
+    switch( this->storage ) {
+        case Storage::UInt8: return this->storage_scale > 0.0f ? this->storage_scale : 255.0f;
+        case Storage::Int16: return this->storage_scale > 0.0f ? this->storage_scale : 4096.0f;
+        default: return 1.0f;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+size_t AbstractRD::GetStorageSize() const
+{
+    switch( this->storage ) {
+        case Storage::UInt8: return sizeof( uint8_t );
+        case Storage::Int16: return sizeof( int16_t );
+        case Storage::Half: return sizeof( uint16_t );
+        case Storage::Float: return sizeof( float );
+        default: return this->data_type_size;
+    }
+}
+
+// ---------------------------------------------------------------------
+
 void AbstractRD::InternalSetDataType(int type)
 {
     switch( type ) {
@@ -20,6 +20,8 @@
 
 // local:
 #include "InitialPatternGenerator.hpp"
+#include "PaintHistory.hpp"
+#include "Timeline.hpp"
 class Overlay;
 class Properties;
 
@@ -49,7 +51,11 @@ class AbstractRD
         virtual vtkSmartPointer<vtkXMLDataElement> GetAsXML(bool generate_initial_pattern_when_loading) const;
 
         /// Called to progress the simulation by N steps.
-        virtual void Update(int n_steps) =0;
+        void Update(int n_steps) { this->Step(n_steps); this->UpdateRenderPipeline(); }
+        /// Progresses the simulation by N steps without touching the render pipeline, so can be called on a worker thread.
+        virtual void Step(int n_steps) =0;
+        /// Lets the render pipeline know that the values have changed. Call on the thread that renders.
+        virtual void UpdateRenderPipeline() =0;
 
         /// Some implementations (e.g. inbuilt ones) cannot have their number_of_chemicals edited.
         virtual bool HasEditableNumberOfChemicals() const { return true; }
@@ -114,6 +120,13 @@ class AbstractRD
         virtual void SaveStartingPattern() =0;
         virtual void RestoreStartingPattern() =0;
 
+        /// How SaveStartingPattern keeps the starting pattern: as a full copy, as a lossless compressed copy, or (if it
+        /// came straight from the initial pattern generator) as just the seeds and parameters to generate it again.
+        /** Regenerated falls back to Compressed when generating again would not give back the same pattern. */
+        enum class StartingPatternStorage { Full, Compressed, Regenerated };
+        StartingPatternStorage GetStartingPatternStorage() const { return this->starting_pattern_storage; }
+        void SetStartingPatternStorage(StartingPatternStorage s) { this->starting_pattern_storage = s; }
+
         virtual bool HasEditableDimensions() const { return false; }
         virtual float GetX() const =0;
         virtual float GetY() const =0;
@@ -141,6 +154,30 @@ class AbstractRD
         Accuracy GetAccuracy() const { return this->accuracy; }
         virtual void SetAccuracy(Accuracy acc) { this->accuracy = acc; }
 
+        /// How the chemical values are stored between timesteps. Computation is always done in the data type (float or double).
+        /** Float with a double data type gives mixed precision: half the memory traffic, with the sums done in double. */
+        enum class Storage { Default, UInt8, Int16, Half, Float };
+        virtual bool HasEditableStorageOption() const { return false; }
+        Storage GetStorage() const { return this->storage; }
+
+        /// Change the storage type, reallocating the chemicals and regenerating the initial pattern
+        void SetStorage(Storage s);
+
+        /// uint8 and int16 storage keep each value v as the integer round(v * scale), so the steps are 1/scale apart.
+        /** Zero (the default) picks 255 for uint8, covering [0,1], and 4096 for int16, covering [-8,8). Use 1 for integer states. */
+        float GetStorageScale() const { return this->storage_scale; }
+        void SetStorageScale(float scale) { this->storage_scale = scale; this->need_reload_formula = true; }
+
+        /// The scale in use for the current storage type: 1 unless the storage is uint8 or int16
+        float GetEffectiveStorageScale() const;
+
+        /// The VTK type of the stored values on the host: VTK_FLOAT for Float, otherwise the data type
+        /** uint8, int16 and half values are converted when they are moved between the host and the device. */
+        int GetStorageDataType() const;
+
+        /// The size in bytes of each stored value on the OpenCL device
+        size_t GetStorageSize() const;
+
         /// Retrieve the current 3D object as a vtkPolyData.
         virtual void GetAsMesh(vtkPolyData *out,const Properties& render_settings) const =0;
 
@@ -166,6 +203,24 @@ class AbstractRD
         virtual void Undo();  ///< Rewind all actions until the previous undo point.
         virtual void Redo();  ///< Redo all actions until the next undo point.
         void SetUndoPoint();  ///< Set an undo point, e.g on mouse up. All actions between undo points are grouped into one block.
+        /// The oldest blocks of paint actions are forgotten when the undo history takes more memory than this.
+        void SetUndoMemoryLimit(size_t bytes) { this->undo_history.SetMemoryLimit(bytes); }
+        size_t GetUndoMemoryLimit() const { return this->undo_history.GetMemoryLimit(); }
+
+        /// Keep the current state in the timeline, so that it can be gone back to later. Does nothing if this timestep is already the last one recorded.
+        void RecordTimeline();
+        /// The timesteps recorded in the timeline, in order.
+        int GetNumberOfRecordedTimesteps() const { return this->timeline.GetNumberOfFrames(); }
+        int GetRecordedTimestep(int i) const { return this->timeline.GetTimestep(i); }
+        /// Returns the index of the last recorded timestep at or before timestep, or -1 if there is none.
+        int FindRecordedTimestep(int timestep) const { return this->timeline.FindFrame(timestep); }
+        /// Go back (or forward) to the i'th recorded state. Recording after running on from there forgets the states that were recorded after it.
+        void GoToRecordedTimestep(int i);
+        /// The oldest states are forgotten when the timeline takes more memory than this.
+        void SetTimelineMemoryLimit(size_t bytes);
+        size_t GetTimelineMemoryLimit() const { return this->timeline.GetMemoryLimit(); }
+        /// Forget every recorded state, e.g. when the timeline is turned off.
+        void ClearTimeline();
 
         std::string GetNeighborhoodType() const;
 
@@ -220,12 +275,17 @@ class AbstractRD
         bool wrap; ///< should the data wrap-around or have a boundary?
 
         /// We only allow undo for paint actions.
-        struct PaintAction {
-            int iChemical,iCell;
-            bool done,last_of_group;
-            float val; // value to paint to undo/redo this action
-        };
-        std::vector<PaintAction> undo_stack;
+        PaintHistory undo_history;
+
+        Timeline timeline;
+        int timeline_position; ///< the recorded state that we last went back to, or -1 if we have moved on since
+
+        StartingPatternStorage starting_pattern_storage;
+        Timeline starting_state;                   ///< the compressed starting pattern, if kept that way
+        bool starting_state_is_generated;          ///< whether the starting pattern is generated again instead of being kept
+        uint64_t starting_state_hash;              ///< if so, the hash of the values that it must give
+        std::vector<Parameter> starting_parameters; ///< if so, the parameters to generate it with
+        bool keep_initial_pattern_seeds;           ///< set while generating the starting pattern again, to stop the overlays being reseeded
 
         TNeighborhood neighborhood_type;
 
@@ -236,6 +296,8 @@ class AbstractRD
         double y_spacing_proportion;    /// spatial separation for rendering multiple chemicals, as a proportion of Y
 
         Accuracy accuracy;
+        Storage storage;
+        float storage_scale;
 
     protected: // functions
 
@@ -244,13 +306,34 @@ class AbstractRD
 
         virtual void AddPhasePlot(vtkRenderer* pRenderer, float scaling, float low, float high, float posX, float posY, float posZ,
             int iChemX, int iChemY, int iChemZ) =0;
-        virtual void FlipPaintAction(PaintAction& cca) =0; ///< Undo/redo this paint action.
+        /// Read the values of n_cells consecutive cells of a chemical, in the order used for painting.
+        virtual void ReadCellValues(int iChemical,int first_cell,int n_cells,float* values) const =0;
+        /// Write the values of n_cells consecutive cells of a chemical, as for undo/redo.
+        virtual void WriteCellValues(int iChemical,int first_cell,int n_cells,const float* values) =0;
         void StorePaintAction(int iChemical,int iCell,float old_val); ///< Implementations call this when performing undo-able paint actions.
+        /// Called whenever painting, undo or redo changes the values of cells first_cell to first_cell+n_cells-1.
+        virtual void CellsPainted(int iChemical,int first_cell,int n_cells) {}
+
+        /// The raw values of each chemical, for recording in the timeline and restoring from it.
+        virtual std::vector<Timeline::Block> GetStateBlocks() =0;
+        /// Called when the values of every cell have been replaced from outside, e.g. from the timeline.
+        virtual void AllCellsChanged() =0;
+
+        /// Implementations call this before generating the initial pattern, to give the overlays new random seeds.
+        void ReseedInitialPatternGenerator();
+        /// Keeps the current state as the starting pattern, unless the storage is Full, in which case it returns false
+        /// for the implementation to keep its own copy.
+        bool SaveCompactStartingPattern();
+        /// Restores the starting pattern kept by SaveCompactStartingPattern, or returns false if there isn't one.
+        bool RestoreCompactStartingPattern();
 
     private: // functions
 
         void InternalSetDataType(int type);
 
+        /// Generates the initial pattern with the current seeds, and returns the hash of the values it gives.
+        uint64_t RegenerateInitialPattern();
+
     private: // constants
 
         static const int ready_format_version = 6;
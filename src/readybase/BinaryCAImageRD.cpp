@@ -0,0 +1,567 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "BinaryCAImageRD.hpp"
+#include "utils.hpp"
+
+// STL:
+#include <cctype>
+#include <stdexcept>
+#include <utility>
+
+// VTK:
+#include <vtkImageData.h>
+#include <vtkXMLDataElement.h>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+namespace
+{
+    const int MAX_NEIGHBORS = 26;
+
+    /// Sums N one-bit inputs at each of the 64 bit positions with a network of full adders, giving the count as five bit-planes.
+    template<int N>
+    inline void CountBits(const uint64_t* inputs, uint64_t count[5])
+    {
+        // column[k] holds the partial sums of weight 2^k still to be added
+        uint64_t column[6][N + 1];
+        int size[6] = { N, 0, 0, 0, 0, 0 };
+        for (int i = 0; i < N; i++)
+        {
+            column[0][i] = inputs[i];
+        }
+        for (int k = 0; k < 5; k++)
+        {
+            while (size[k] > 1)
+            {
+                const uint64_t a = column[k][--size[k]];
+                const uint64_t b = column[k][--size[k]];
+                const uint64_t t = a ^ b;
+                if (size[k] > 0)
+                {
+                    // full adder
+                    const uint64_t c = column[k][--size[k]];
+                    column[k][size[k]++] = t ^ c;
+                    column[k + 1][size[k + 1]++] = (a & b) | (t & c);
+                }
+                else
+                {
+                    // half adder
+                    column[k][size[k]++] = t;
+                    column[k + 1][size[k + 1]++] = a & b;
+                }
+            }
+            count[k] = size[k] ? column[k][0] : 0;
+        }
+    }
+
+    /// Returns the bits where the count is one of those set in mask.
+    inline uint64_t CountMatches(const uint64_t count[5], uint32_t mask)
+    {
+        uint64_t matches = 0;
+        for (int n = 0; (mask >> n) != 0; n++)
+        {
+            if (!((mask >> n) & 1))
+                continue;
+            uint64_t equal = ~uint64_t(0);
+            for (int k = 0; k < 5; k++)
+                equal &= ((n >> k) & 1) ? count[k] : ~count[k];
+            matches |= equal;
+        }
+        return matches;
+    }
+
+    /// Bit i of the result is the cell to the west (x-1) of cell 64*w+i.
+    inline uint64_t West(const uint64_t* row, int w, int X, bool wrap)
+    {
+        uint64_t carry = 0;
+        if (w > 0)
+            carry = row[w - 1] >> 63;
+        else if (wrap)
+            carry = (row[(X - 1) / 64] >> ((X - 1) % 64)) & 1;
+        return (row[w] << 1) | carry;
+    }
+
+    /// Bit i of the result is the cell to the east (x+1) of cell 64*w+i.
+    inline uint64_t East(const uint64_t* row, int w, int X, int W, bool wrap)
+    {
+        if (w < W - 1)
+            return (row[w] >> 1) | (row[w + 1] << 63);
+        const uint64_t carry = wrap ? (row[0] & 1) : 0;
+        return (row[w] >> 1) | (carry << ((X - 1) % 64));
+    }
+
+    /// One step of the packed cells, where RX, RY and RZ are 1 for each axis along which there are neighbors, else 0.
+    template<int RX, int RY, int RZ>
+    void StepWords(const uint64_t* src, uint64_t* dst, const uint64_t* zero_row, int X, int Y, int Z, int W, bool wrap,
+                   uint32_t birth, uint32_t survival)
+    {
+        const int N_ROWS = (2 * RY + 1) * (2 * RZ + 1);
+        const int N_NEIGHBORS = (2 * RX + 1) * N_ROWS - 1;
+        const uint64_t last_word_mask = (X % 64) ? (uint64_t(1) << (X % 64)) - 1 : ~uint64_t(0);
+        for (int z = 0; z < Z; z++)
+        {
+            for (int y = 0; y < Y; y++)
+            {
+                // collect the rows in the neighborhood, with the row itself last
+                const uint64_t* rows[N_ROWS];
+                int n_rows = 0;
+                for (int dz = -RZ; dz <= RZ; dz++)
+                {
+                    for (int dy = -RY; dy <= RY; dy++)
+                    {
+                        if (dy == 0 && dz == 0)
+                            continue;
+                        int sy = y + dy;
+                        int sz = z + dz;
+                        if (wrap)
+                        {
+                            sy = (sy + Y) % Y;
+                            sz = (sz + Z) % Z;
+                        }
+                        else if (sy < 0 || sy >= Y || sz < 0 || sz >= Z)
+                        {
+                            rows[n_rows++] = zero_row; // outside cells count as dead
+                            continue;
+                        }
+                        rows[n_rows++] = src + (size_t)W * (Y * sz + sy);
+                    }
+                }
+                rows[n_rows] = src + (size_t)W * (Y * z + y);
+                uint64_t* out_row = dst + (size_t)W * (Y * z + y);
+                for (int w = 0; w < W; w++)
+                {
+                    uint64_t neighbors[N_NEIGHBORS + 1];
+                    int n = 0;
+                    for (int r = 0; r < N_ROWS; r++)
+                    {
+                        if (r < N_ROWS - 1)
+                            neighbors[n++] = rows[r][w];
+                        if (RX)
+                        {
+                            neighbors[n++] = West(rows[r], w, X, wrap);
+                            neighbors[n++] = East(rows[r], w, X, W, wrap);
+                        }
+                    }
+                    uint64_t count[5];
+                    CountBits<N_NEIGHBORS>(neighbors, count);
+                    const uint64_t self = rows[N_ROWS - 1][w];
+                    uint64_t result = (~self & CountMatches(count, birth)) | (self & CountMatches(count, survival));
+                    if (w == W - 1)
+                        result &= last_word_mask;
+                    out_row[w] = result;
+                }
+            }
+        }
+    }
+
+    void StepWords(const uint64_t* src, uint64_t* dst, const uint64_t* zero_row, int X, int Y, int Z, int W, bool wrap,
+                   uint32_t birth, uint32_t survival)
+    {
+        // instantiate for each dimensionality, so that the adder network is fixed at compile time
+        const int config = (X > 1 ? 1 : 0) + (Y > 1 ? 2 : 0) + (Z > 1 ? 4 : 0);
+        switch (config)
+        {
+            case 0: StepWords<0, 0, 0>(src, dst, zero_row, X, Y, Z, W, wrap, birth, survival); break;
+            case 1: StepWords<1, 0, 0>(src, dst, zero_row, X, Y, Z, W, wrap, birth, survival); break;
+            case 2: StepWords<0, 1, 0>(src, dst, zero_row, X, Y, Z, W, wrap, birth, survival); break;
+            case 3: StepWords<1, 1, 0>(src, dst, zero_row, X, Y, Z, W, wrap, birth, survival); break;
+            case 4: StepWords<0, 0, 1>(src, dst, zero_row, X, Y, Z, W, wrap, birth, survival); break;
+            case 5: StepWords<1, 0, 1>(src, dst, zero_row, X, Y, Z, W, wrap, birth, survival); break;
+            case 6: StepWords<0, 1, 1>(src, dst, zero_row, X, Y, Z, W, wrap, birth, survival); break;
+            default: StepWords<1, 1, 1>(src, dst, zero_row, X, Y, Z, W, wrap, birth, survival); break;
+        }
+    }
+
+    void ParseCounts(const string& s, uint32_t& mask)
+    {
+        // either single digits ("23") or comma-separated numbers ("4,5,10"), either with ranges ("2-3")
+        const bool multi_digit = s.find(',') != string::npos;
+        size_t i = 0;
+        while (i < s.size())
+        {
+            if (s[i] == ',')
+            {
+                i++;
+                continue;
+            }
+            if (!isdigit((unsigned char)s[i]))
+                throw runtime_error(string("BinaryCAImageRD::ParseRule : unexpected character: ") + s[i]);
+            int first = 0;
+            do { first = first * 10 + (s[i++] - '0'); } while (multi_digit && i < s.size() && isdigit((unsigned char)s[i]));
+            int last = first;
+            if (i < s.size() && s[i] == '-')
+            {
+                i++;
+                if (i >= s.size() || !isdigit((unsigned char)s[i]))
+                    throw runtime_error("BinaryCAImageRD::ParseRule : incomplete range");
+                last = 0;
+                do { last = last * 10 + (s[i++] - '0'); } while (multi_digit && i < s.size() && isdigit((unsigned char)s[i]));
+            }
+            if (first > last)
+                throw runtime_error("BinaryCAImageRD::ParseRule : range is backwards (use commas for counts above 9)");
+            if (last > MAX_NEIGHBORS)
+                throw runtime_error("BinaryCAImageRD::ParseRule : neighbor counts must be in the range 0 to 26");
+            for (int n = first; n <= last; n++)
+                mask |= 1u << n;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------
+
+BinaryCAImageRD::BinaryCAImageRD()
+    : ImageRD(VTK_FLOAT)
+    , words_per_row(0)
+    , birth_mask(0)
+    , survival_mask(0)
+    , image_is_newer(false)
+    , cells_are_newer(false)
+{
+    this->rule_name = "Life";
+    this->n_chemicals = 1;
+    this->SetFormula("B3/S23");
+}
+
+// ---------------------------------------------------------------------
+
+/* static */ void BinaryCAImageRD::ParseRule(const string& rule,uint32_t& birth,uint32_t& survival)
+{
+    string s;
+    for (char c : rule)
+        if (!isspace((unsigned char)c))
+            s += (char)toupper((unsigned char)c);
+    const size_t slash = s.find('/');
+    if (s.empty() || s[0] != 'B' || slash == string::npos || slash + 1 >= s.size() || s[slash + 1] != 'S')
+        throw runtime_error("BinaryCAImageRD::ParseRule : expected a rule like B3/S23, not: " + rule);
+    birth = 0;
+    survival = 0;
+    ParseCounts(s.substr(1, slash - 1), birth);
+    ParseCounts(s.substr(slash + 2), survival);
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::TestFormula(string program_string)
+{
+    uint32_t birth, survival;
+    ParseRule(program_string, birth, survival); // will throw on error
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update)
+{
+    ImageRD::InitializeFromXML(rd,warn_to_update);
+
+    vtkSmartPointer<vtkXMLDataElement> rule = rd->FindNestedElementWithName("rule");
+    if(!rule) throw runtime_error("rule node not found in file");
+
+    // formula:
+    vtkSmartPointer<vtkXMLDataElement> xml_formula = rule->FindNestedElementWithName("formula");
+    if(!xml_formula) throw runtime_error("formula node not found in file");
+    this->n_chemicals = 1;
+
+    string formula = trim_multiline_string(xml_formula->GetCharacterData());
+    this->TestFormula(formula); // will throw on error
+    this->SetFormula(formula);
+}
+
+// ---------------------------------------------------------------------
+
+vtkSmartPointer<vtkXMLDataElement> BinaryCAImageRD::GetAsXML(bool generate_initial_pattern_when_loading) const
+{
+    vtkSmartPointer<vtkXMLDataElement> rd = ImageRD::GetAsXML(generate_initial_pattern_when_loading);
+
+    vtkSmartPointer<vtkXMLDataElement> rule = rd->FindNestedElementWithName("rule");
+    if(!rule) throw runtime_error("rule node not found");
+
+    vtkSmartPointer<vtkXMLDataElement> formula = vtkSmartPointer<vtkXMLDataElement>::New();
+    formula->SetName("formula");
+    string f = this->GetFormula();
+    formula->SetCharacterData(f.c_str(), (int)f.length());
+    rule->AddNestedElement(formula);
+
+    return rd;
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::AllocateImages(int x,int y,int z,int nc,int data_type)
+{
+    // N.B. the images are only used for display and file input/output, so are always float
+    if(nc!=1) throw runtime_error("BinaryCAImageRD::AllocateImages : this implementation is for 1 chemical only");
+    ImageRD::AllocateImages(x,y,z,1,VTK_FLOAT);
+    this->words_per_row = (x + 63) / 64;
+    const size_t n_words = (size_t)this->words_per_row * y * z;
+    this->cells.assign(n_words, 0);
+    this->buffer.assign(n_words, 0);
+    this->image_is_newer = false;
+    this->cells_are_newer = false;
+}
+
+// ---------------------------------------------------------------------
+
+size_t BinaryCAImageRD::GetMemorySize() const
+{
+    // the float image as well as the two arrays of packed words
+    const size_t n_image_values = size_t(this->GetX()) * this->GetY() * this->GetZ();
+    return n_image_values * sizeof(float) + (this->cells.size() + this->buffer.size()) * sizeof(uint64_t);
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::PackImageIfNeeded()
+{
+    if(!this->image_is_newer)
+        return;
+    this->PackImage();
+    this->image_is_newer = false;
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::UnpackImageIfNeeded() const
+{
+    if(!this->cells_are_newer)
+        return;
+    this->ReadCellsIfNeeded();
+    this->UnpackImage();
+    this->cells_are_newer = false;
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::PackImage()
+{
+    const int X = this->images.front()->GetDimensions()[0];
+    const int Y = this->images.front()->GetDimensions()[1];
+    const int Z = this->images.front()->GetDimensions()[2];
+    const float* values = static_cast<float*>(this->images.front()->GetScalarPointer());
+    fill(this->cells.begin(), this->cells.end(), 0);
+    for(int z=0;z<Z;z++)
+    {
+        for(int y=0;y<Y;y++)
+        {
+            uint64_t* row = this->cells.data() + (size_t)this->words_per_row * (Y * z + y);
+            const float* row_values = values + (size_t)X * (Y * z + y);
+            for(int x=0;x<X;x++)
+            {
+                if(row_values[x] >= 0.5f)
+                    row[x / 64] |= uint64_t(1) << (x % 64);
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::UnpackImage() const
+{
+    const int X = this->images.front()->GetDimensions()[0];
+    const int Y = this->images.front()->GetDimensions()[1];
+    const int Z = this->images.front()->GetDimensions()[2];
+    float* values = static_cast<float*>(this->images.front()->GetScalarPointer());
+    for(int z=0;z<Z;z++)
+    {
+        for(int y=0;y<Y;y++)
+        {
+            const uint64_t* row = this->cells.data() + (size_t)this->words_per_row * (Y * z + y);
+            float* row_values = values + (size_t)X * (Y * z + y);
+            for(int x=0;x<X;x++)
+                row_values[x] = ((row[x / 64] >> (x % 64)) & 1) ? 1.0f : 0.0f;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::InternalUpdate(int n_steps)
+{
+    ParseRule(this->formula, this->birth_mask, this->survival_mask); // (cheap, and the formula may have changed)
+    this->PackImageIfNeeded();
+    this->StepPacked(n_steps);
+    this->cells_are_newer = true;
+}
+
+// ---------------------------------------------------------------------
+
+vector<Timeline::Block> BinaryCAImageRD::GetStateBlocks()
+{
+    // the packed cells are 32 times smaller than the image, and are what we step
+    this->PackImageIfNeeded();
+    this->ReadCellsIfNeeded();
+    return { { this->cells.data(), this->cells.size() * sizeof(uint64_t), sizeof(uint64_t) } };
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::AllCellsChanged()
+{
+    // (the packed cells have been written to, e.g. when going back to a recorded timestep)
+    ImageRD::AllCellsChanged();
+    this->image_is_newer = false;
+    this->cells_are_newer = true;
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::ReadCellValues(int iChemical,int first_cell,int n_cells,float* values) const
+{
+    this->UnpackImageIfNeeded();
+    ImageRD::ReadCellValues(iChemical, first_cell, n_cells, values);
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::WriteCellValues(int iChemical,int first_cell,int n_cells,const float* values)
+{
+    this->UnpackImageIfNeeded();
+    ImageRD::WriteCellValues(iChemical, first_cell, n_cells, values);
+    this->image_is_newer = true;
+}
+
+// ---------------------------------------------------------------------
+
+vector<float> BinaryCAImageRD::GetRegion(int i_chemical,int x0,int y0,int z0,int nx,int ny,int nz) const
+{
+    this->UnpackImageIfNeeded();
+    return ImageRD::GetRegion(i_chemical, x0, y0, z0, nx, ny, nz);
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::SaveFile(const char* filename,const Properties& render_settings,bool generate_initial_pattern_when_loading) const
+{
+    this->UnpackImageIfNeeded();
+    ImageRD::SaveFile(filename, render_settings, generate_initial_pattern_when_loading);
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::UpdateRenderPipeline()
+{
+    this->UnpackImageIfNeeded();
+    ImageRD::UpdateRenderPipeline();
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::InitializeRenderPipeline(vtkRenderer* pRenderer,const Properties& render_settings)
+{
+    this->UnpackImageIfNeeded();
+    ImageRD::InitializeRenderPipeline(pRenderer, render_settings);
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::GetAsMesh(vtkPolyData *out,const Properties& render_settings) const
+{
+    this->UnpackImageIfNeeded();
+    ImageRD::GetAsMesh(out, render_settings);
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::GetAs2DImage(vtkImageData *out,const Properties& render_settings) const
+{
+    this->UnpackImageIfNeeded();
+    ImageRD::GetAs2DImage(out, render_settings);
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::SaveStartingPattern()
+{
+    this->UnpackImageIfNeeded();
+    ImageRD::SaveStartingPattern();
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::GenerateInitialPattern()
+{
+    this->UnpackImageIfNeeded(); // (some overlays add to the existing values)
+    ImageRD::GenerateInitialPattern();
+    this->image_is_newer = true;
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::BlankImage(float value)
+{
+    ImageRD::BlankImage(value);
+    this->image_is_newer = true;
+    this->cells_are_newer = false;
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::CopyFromImage(vtkImageData* im)
+{
+    ImageRD::CopyFromImage(im);
+    this->image_is_newer = true;
+    this->cells_are_newer = false;
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::SetFrom2DImage(int iChemical, vtkImageData *im)
+{
+    this->UnpackImageIfNeeded();
+    ImageRD::SetFrom2DImage(iChemical, im);
+    this->image_is_newer = true;
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::SetValue(float x,float y,float z,float val,const Properties& render_settings)
+{
+    this->UnpackImageIfNeeded();
+    ImageRD::SetValue(x, y, z, val, render_settings);
+    this->image_is_newer = true;
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings)
+{
+    this->UnpackImageIfNeeded();
+    ImageRD::SetValuesInRadius(x, y, z, r, val, render_settings);
+    this->image_is_newer = true;
+}
+
+// ---------------------------------------------------------------------
+
+void BinaryCAImageRD::StepPacked(int n_steps)
+{
+    const int X = this->images.front()->GetDimensions()[0];
+    const int Y = this->images.front()->GetDimensions()[1];
+    const int Z = this->images.front()->GetDimensions()[2];
+    const vector<uint64_t> zero_row(this->words_per_row, 0);
+    for(int iStep=0;iStep<n_steps;iStep++)
+    {
+        StepWords(this->cells.data(), this->buffer.data(), zero_row.data(), X, Y, Z, this->words_per_row, this->wrap,
+            this->birth_mask, this->survival_mask);
+        swap(this->cells, this->buffer);
+    }
+}
+
+// ---------------------------------------------------------------------
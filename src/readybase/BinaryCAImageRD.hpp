@@ -0,0 +1,114 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __BINARYCAIMAGERD__
+#define __BINARYCAIMAGERD__
+
+// local:
+#include "ImageRD.hpp"
+
+// STL:
+#include <cstdint>
+
+/// Outer-totalistic cellular automata with two states, on 1D, 2D or 3D images.
+/** The rule is given as the formula, in B/S notation, e.g. "B3/S23" for Conway's Life, counting the Moore neighborhood
+ *  (8 neighbors in 2D, 26 in 3D). Internally the cells are packed 64 to a word along x and the neighbor counts are
+ *  computed for all 64 at once with a network of full adders. The packed cells are the state of the system: the image
+ *  is only unpacked when it is needed for display, editing or saving, and only repacked after it has been edited. */
+class BinaryCAImageRD : public ImageRD
+{
+    public:
+
+        BinaryCAImageRD();
+
+        void InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update) override;
+        vtkSmartPointer<vtkXMLDataElement> GetAsXML(bool generate_initial_pattern_when_loading) const override;
+
+        std::string GetRuleType() const override { return "binary"; }
+
+        bool HasEditableFormula() const override { return true; }
+        bool HasEditableNumberOfChemicals() const override { return false; }
+        bool HasEditableWrapOption() const override { return true; }
+        bool HasEditableDataType() const override { return false; }
+
+        void TestFormula(std::string program_string) override;
+
+        void SaveFile(const char* filename,
+            const Properties& render_settings,
+            bool generate_initial_pattern_when_loading) const override;
+
+        void UpdateRenderPipeline() override;
+
+        void GenerateInitialPattern() override;
+        void BlankImage(float value = 0.0f) override;
+        void CopyFromImage(vtkImageData* im) override;
+        void SaveStartingPattern() override;
+
+        void InitializeRenderPipeline(vtkRenderer* pRenderer,const Properties& render_settings) override;
+
+        void GetAsMesh(vtkPolyData *out,const Properties& render_settings) const override;
+        void GetAs2DImage(vtkImageData *out,const Properties& render_settings) const override;
+        void SetFrom2DImage(int iChemical, vtkImageData *im) override;
+
+        void SetValue(float x,float y,float z,float val,const Properties& render_settings) override;
+        void SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings) override;
+
+        std::vector<float> GetRegion(int i_chemical,int x0,int y0,int z0,int nx,int ny,int nz) const override;
+
+        size_t GetMemorySize() const override;
+
+        /// Parses a rule like "B3/S23" or "B5/S4,5" into bit masks: bit n is set if a count of n causes birth (or survival).
+        /** Counts are single digits unless commas are used, and ranges like "B4-6" are allowed with commas or without. */
+        static void ParseRule(const std::string& rule,uint32_t& birth,uint32_t& survival);
+
+    protected:
+
+        void AllocateImages(int x,int y,int z,int nc,int data_type) override;
+
+        void InternalUpdate(int n_steps) override;
+
+        /// Advances the packed cells by n steps. The result must end up in cells, or somewhere ReadCellsIfNeeded can get it from.
+        virtual void StepPacked(int n_steps);
+
+        /// Brings cells up to date, for implementations that step them somewhere else (e.g. on an OpenCL device).
+        virtual void ReadCellsIfNeeded() const {}
+
+        virtual void PackImage();
+        void UnpackImage() const;
+
+        /// Packs the image into cells if it has been edited since they were last packed.
+        void PackImageIfNeeded();
+        /// Unpacks cells into the image if they have been stepped since it was last unpacked.
+        void UnpackImageIfNeeded() const;
+
+        void ReadCellValues(int iChemical,int first_cell,int n_cells,float* values) const override;
+        void WriteCellValues(int iChemical,int first_cell,int n_cells,const float* values) override;
+        std::vector<Timeline::Block> GetStateBlocks() override; ///< (the packed cells)
+        void AllCellsChanged() override;
+
+    protected:
+
+        int words_per_row;
+        mutable std::vector<uint64_t> cells; // bit x%64 of word (Y*z+y)*words_per_row+x/64 is cell (x,y,z) (mutable for ReadCellsIfNeeded)
+        std::vector<uint64_t> buffer;
+        uint32_t birth_mask, survival_mask;
+
+        bool image_is_newer;         ///< the image has been edited since it was last packed
+        mutable bool cells_are_newer; ///< the cells have been stepped (or restored) since they were last unpacked
+};
+
+#endif
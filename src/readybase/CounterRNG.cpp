@@ -0,0 +1,142 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+
+// local:
+#include "CounterRNG.hpp"
+#include "utils.hpp"
+
+// STL:
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+// ----------------------------------------------------------------------------------------------------------------
+
+namespace
+{
+    const uint32_t PHILOX_M0 = 0xD2511F53;
+    const uint32_t PHILOX_M1 = 0xCD9E8D57;
+    const uint32_t PHILOX_W0 = 0x9E3779B9;
+    const uint32_t PHILOX_W1 = 0xBB67AE85;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+array<uint32_t,4> CounterRNG::Philox4x32(array<uint32_t,4> counter, array<uint32_t,2> key)
+{
+    for(int round = 0; round < 10; round++)
+    {
+        const uint64_t product0 = uint64_t(PHILOX_M0) * counter[0];
+        const uint64_t product1 = uint64_t(PHILOX_M1) * counter[2];
+        counter = { uint32_t(product1 >> 32) ^ counter[1] ^ key[0], uint32_t(product1),
+                    uint32_t(product0 >> 32) ^ counter[3] ^ key[1], uint32_t(product0) };
+        key[0] += PHILOX_W0;
+        key[1] += PHILOX_W1;
+    }
+    return counter;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+double CounterRNG::UniformFromBits(uint32_t bits)
+{
+    // (23 bits, so that every value is a float, and never 0 or 1 so that log() is safe)
+    return double((bits >> 9) * 2 + 1) / 16777216.0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+double CounterRNG::Uniform(uint32_t seed, uint64_t index, uint32_t stream)
+{
+    const array<uint32_t,4> bits = Philox4x32({ uint32_t(index), uint32_t(index >> 32), 0, 0 }, { seed, stream });
+    return UniformFromBits(bits[0]);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+string CounterRNG::GetOpenCLSource(const string& real_type)
+{
+    ostringstream oss;
+    oss << "// counter-based random numbers (Philox4x32-10)\n";
+    oss << "uint4 philox4x32(uint4 counter, uint2 key)\n";
+    oss << "{\n";
+    oss << "    for(int round = 0; round < 10; round++)\n";
+    oss << "    {\n";
+    oss << "        const uint hi0 = mul_hi(" << PHILOX_M0 << "u, counter.x), lo0 = " << PHILOX_M0 << "u * counter.x;\n";
+    oss << "        const uint hi1 = mul_hi(" << PHILOX_M1 << "u, counter.z), lo1 = " << PHILOX_M1 << "u * counter.z;\n";
+    oss << "        counter = (uint4)(hi1 ^ counter.y ^ key.x, lo1, hi0 ^ counter.w ^ key.y, lo0);\n";
+    oss << "        key += (uint2)(" << PHILOX_W0 << "u, " << PHILOX_W1 << "u);\n";
+    oss << "    }\n";
+    oss << "    return counter;\n";
+    oss << "}\n\n";
+    oss << "// a value in (0,1) from 32 random bits\n";
+    oss << real_type << " counter_uniform(uint bits)\n";
+    oss << "{\n";
+    oss << "    return (" << real_type << ")((bits >> 9) * 2 + 1) / 16777216;\n";
+    oss << "}\n\n";
+    return oss.str();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+string CounterRNG::GetKeywordsOpenCLSource(const string& real_type, int vector_size)
+{
+    const string type = vector_size == 4 ? real_type + "4" : real_type;
+    const string two_pi = real_type == "double" ? "(2 * M_PI)" : "(2 * M_PI_F)";
+    ostringstream oss;
+    oss << "// the counter and key of the random numbers for the keywords, in each work item\n";
+    oss << "typedef struct { uint4 counter; uint2 key; } rand_state;\n\n";
+    oss << type << " rand_uniform_next(rand_state* state)\n";
+    oss << "{\n";
+    oss << "    const uint4 bits = philox4x32(state->counter, state->key);\n";
+    oss << "    state->counter.y++;\n";
+    if(vector_size == 4)
+        oss << "    return (" << type << ")(counter_uniform(bits.x), counter_uniform(bits.y), counter_uniform(bits.z), counter_uniform(bits.w));\n";
+    else
+        oss << "    return counter_uniform(bits.x);\n";
+    oss << "}\n\n";
+    oss << "// a normally distributed value, by the Box-Muller transform\n";
+    oss << type << " rand_normal_next(rand_state* state)\n";
+    oss << "{\n";
+    oss << "    const " << type << " u1 = rand_uniform_next(state);\n";
+    oss << "    const " << type << " u2 = rand_uniform_next(state);\n";
+    oss << "    return sqrt(-2 * log(u1)) * cos(" << two_pi << " * u2);\n";
+    oss << "}\n\n";
+    oss << "#define rand_uniform() rand_uniform_next(&rand_state_here)\n";
+    oss << "#define rand_normal() rand_normal_next(&rand_state_here)\n\n";
+    return oss.str();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+string CounterRNG::GetOpenCLStateCode(const string& index)
+{
+    // (the counter holds the cell and the number of calls so far, the key holds the seed and the step)
+    return "rand_state rand_state_here = { (uint4)((uint)(" + index + "), 0, 0, 0), rand_key };\n";
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+bool CounterRNG::UsesKeywords(const string& formula)
+{
+    const vector<string> formula_tokens = tokenize_for_keywords(formula);
+    return UsingKeyword(formula_tokens, "rand_uniform") || UsingKeyword(formula_tokens, "rand_normal");
+}
+
+// ----------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,57 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+
+#ifndef __COUNTERRNG__
+#define __COUNTERRNG__
+
+// STL:
+#include <array>
+#include <cstdint>
+#include <string>
+
+/// Counter-based random numbers (Philox4x32-10, from Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", 2011).
+/** Each value is a pure function of a key and a counter, with no state carried from one value to the next. So the values
+ *  can be generated in any order, on any number of threads or on an OpenCL device, and always come out the same. The
+ *  OpenCL source matches the host functions bit for bit. */
+namespace CounterRNG
+{
+    /// Four 32-bit random values for the given counter and key.
+    std::array<uint32_t,4> Philox4x32(std::array<uint32_t,4> counter, std::array<uint32_t,2> key);
+
+    /// Maps 32 random bits to a value in the open interval (0,1) that is exact in single precision.
+    double UniformFromBits(uint32_t bits);
+
+    /// A value in (0,1) for the given seed, cell index and stream (e.g. the chemical), whatever order they are asked for in.
+    double Uniform(uint32_t seed, uint64_t index, uint32_t stream);
+
+    /// OpenCL source for philox4x32(uint4 counter, uint2 key) and counter_uniform(uint bits), using the given floating-point type.
+    std::string GetOpenCLSource(const std::string& real_type);
+
+    /// OpenCL source for the rand_uniform() and rand_normal() keywords, which need a variable rand_state rand_state_here
+    /// to be initialized by GetOpenCLStateCode in each work item. Each call gives new values, vector_size of them at once.
+    std::string GetKeywordsOpenCLSource(const std::string& real_type, int vector_size);
+
+    /// OpenCL code to initialize rand_state_here for the cell with the given index, from a uint2 kernel argument rand_key
+    /// that holds the seed and the step number.
+    std::string GetOpenCLStateCode(const std::string& index);
+
+    /// Whether the formula uses the rand_uniform() or rand_normal() keywords.
+    bool UsesKeywords(const std::string& formula);
+}
+
+#endif
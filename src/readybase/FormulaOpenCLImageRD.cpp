@@ -17,6 +17,8 @@
 
 // local:
 #include "FormulaOpenCLImageRD.hpp"
+#include "CounterRNG.hpp"
+#include "OpenCL_SummedAreaTable.hpp"
 #include "stencils.hpp"
 #include "utils.hpp"
 
@@ -28,6 +30,9 @@
 #include <string>
 
 // VTK:
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
 #include <vtkXMLUtilities.h>
 
 using namespace std;
@@ -52,6 +57,14 @@ delta_b = D_b * laplacian_b + a*b*b - (F+K)*b;");
 
 // -------------------------------------------------------------------------
 
+struct BoxSum {
+    string chem;
+    int radius[3];
+    string name;
+};
+
+// -------------------------------------------------------------------------
+
 struct InputsNeeded {
     vector<string> chemicals_needed;
     vector<AppliedStencil> stencils_needed;
@@ -60,13 +73,35 @@ struct InputsNeeded {
     bool using_x_pos;
     bool using_y_pos;
     bool using_z_pos;
+    bool using_random_numbers; // rand_uniform() or rand_normal()
     vector<string> deltas_needed;
     vector<string> local_memory_needed;
+    vector<AppliedStencil> stages_needed; // stencils evaluated by a separate kernel into an intermediate buffer
+    vector<string> summed_area_tables_needed; // chemicals whose summed-area table is computed before rd_compute
+    vector<BoxSum> box_sums_needed;
     int stencil_radii[3];
 };
 
 // -------------------------------------------------------------------------
 
+void AddAlignedBlocksNeeded(set<InputPoint>& cells_needed)
+{
+    // non-block-aligned inputs need other inputs: the two blocks that supply them
+    vector<InputPoint> blocks_needed;
+    for (const InputPoint& input_point : cells_needed)
+    {
+        if (input_point.point.x % 4 != 0)
+        {
+            const pair<InputPoint, InputPoint> blocks = input_point.GetAlignedBlocks_Block411();
+            blocks_needed.push_back(blocks.first);
+            blocks_needed.push_back(blocks.second);
+        }
+    }
+    cells_needed.insert(blocks_needed.begin(), blocks_needed.end());
+}
+
+// -------------------------------------------------------------------------
+
 InputsNeeded DetectInputsNeeded(const string& formula, int num_chemicals, int dimensionality, const int block_size[3],
                                 const AbstractRD::Accuracy& accuracy)
 {
@@ -100,9 +135,31 @@ InputsNeeded DetectInputsNeeded(const string& formula, int num_chemicals, int di
                 dependent_stencils.insert("x_gradient_" + chem); // (N.B. no breaks)
             }
         }
+        // the tri-Laplacian stencil is the Laplacian stencil convolved with the bi-Laplacian one (see GetTriLaplacianStencil)
+        // so instead of reading up to 7x7x7 cells we write the bi-Laplacian into an intermediate buffer in a separate
+        // kernel and then apply the Laplacian to that
+        const bool using_staged_trilaplacian = UsingKeyword(formula_tokens, "trilaplacian_" + chem);
+        if (using_staged_trilaplacian)
+        {
+            const AppliedStencil stage{ GetBiLaplacianStencil(dimensionality), chem };
+            inputs_needed.stages_needed.push_back(stage);
+            inputs_needed.local_memory_needed.push_back(stage.GetName());
+            // the central cell of the intermediate buffer is the bi-Laplacian itself, so that keyword comes for free
+            inputs_needed.cells_needed.insert({ { { 0, 0, 0 } }, stage.GetName() });
+            Stencil trilaplacian = GetLaplacianStencil(dimensionality, AbstractRD::Accuracy::Medium);
+            trilaplacian.label = "trilaplacian";
+            const AppliedStencil applied_stencil{ trilaplacian, chem, stage.GetName() };
+            inputs_needed.stencils_needed.push_back(applied_stencil);
+            const set<InputPoint> input_points = applied_stencil.GetInputPoints();
+            inputs_needed.cells_needed.insert(input_points.begin(), input_points.end());
+        }
         // search for keywords that are stencils
         for (const Stencil& stencil : known_stencils)
         {
+            if (using_staged_trilaplacian && (stencil.label == "bilaplacian" || stencil.label == "trilaplacian"))
+            {
+                continue; // these come from the intermediate buffer instead
+            }
             const string keyword = stencil.label + "_" + chem;
             if (UsingKeyword(formula_tokens, keyword) || dependent_stencils.find(keyword) != dependent_stencils.end())
             {
@@ -113,6 +170,29 @@ InputsNeeded DetectInputsNeeded(const string& formula, int num_chemicals, int di
                 inputs_needed.cells_needed.insert(input_points.begin(), input_points.end());
             }
         }
+        // search for box sums, e.g. "box_sum_a_r5", which are read from the summed-area table of the chemical
+        const string box_sum_prefix = "box_sum_" + chem + "_r";
+        for (const string& token : formula_tokens)
+        {
+            if (token.size() <= box_sum_prefix.size() || token.compare(0, box_sum_prefix.size(), box_sum_prefix) != 0
+                || token.find_first_not_of("0123456789", box_sum_prefix.size()) != string::npos)
+            {
+                continue;
+            }
+            const bool already_found = find_if(inputs_needed.box_sums_needed.begin(), inputs_needed.box_sums_needed.end(),
+                [&](const BoxSum& box_sum) { return box_sum.name == token; }) != inputs_needed.box_sums_needed.end();
+            if (already_found)
+            {
+                continue;
+            }
+            const int radius = stoi(token.substr(box_sum_prefix.size()));
+            inputs_needed.box_sums_needed.push_back({ chem, { radius, dimensionality > 1 ? radius : 0, dimensionality > 2 ? radius : 0 }, token });
+            if (find(inputs_needed.summed_area_tables_needed.begin(), inputs_needed.summed_area_tables_needed.end(), chem)
+                == inputs_needed.summed_area_tables_needed.end())
+            {
+                inputs_needed.summed_area_tables_needed.push_back(chem);
+            }
+        }
         // search for direct access to neighbors, e.g. "a_nw"
         const int MAX_RADIUS = 10; // surely if the user wants something this big they should use a kernel?
         for (int x = -MAX_RADIUS; x <= MAX_RADIUS; x++)
@@ -132,23 +212,13 @@ InputsNeeded DetectInputsNeeded(const string& formula, int num_chemicals, int di
     }
     if (block_size[0] == 4)
     {
-        // non-block-aligned inputs need other inputs: the two blocks that supply them
-        vector<InputPoint> blocks_needed;
-        for (const InputPoint& input_point : inputs_needed.cells_needed)
-        {
-            if (input_point.point.x % 4 != 0)
-            {
-                const pair<InputPoint, InputPoint> blocks = input_point.GetAlignedBlocks_Block411();
-                blocks_needed.push_back(blocks.first);
-                blocks_needed.push_back(blocks.second);
-            }
-        }
-        inputs_needed.cells_needed.insert(blocks_needed.begin(), blocks_needed.end());
+        AddAlignedBlocksNeeded(inputs_needed.cells_needed);
     }
     // detect if using x_pos, y_pos or z_pos
     inputs_needed.using_x_pos = UsingKeyword(formula_tokens, "x_pos");
     inputs_needed.using_y_pos = UsingKeyword(formula_tokens, "y_pos");
     inputs_needed.using_z_pos = UsingKeyword(formula_tokens, "z_pos");
+    inputs_needed.using_random_numbers = CounterRNG::UsesKeywords(formula);
     // compute the overall stencil radius in each direction
     inputs_needed.stencil_radii[0] = 0;
     inputs_needed.stencil_radii[1] = 0;
@@ -167,13 +237,16 @@ InputsNeeded DetectInputsNeeded(const string& formula, int num_chemicals, int di
 
 struct KernelOptions {
     KernelOptions(bool wrap, const string& indent, int data_type, const string& data_type_string,
-                  const string& data_type_suffix, const int block_size[3],
-                  bool use_local_memory, const size_t local_work_size[3])
+                  const string& data_type_suffix, AbstractRD::Storage storage, const string& storage_type_string,
+                  float storage_scale, const int block_size[3], bool use_local_memory, const size_t local_work_size[3])
         : wrap(wrap)
         , indent(indent)
         , data_type(data_type)
         , data_type_string(data_type_string)
         , data_type_suffix(data_type_suffix)
+        , storage(storage)
+        , storage_type_string(storage_type_string)
+        , storage_scale(storage_scale)
         , block_size{ block_size[0], block_size[1], block_size[2] }
         , use_local_memory(use_local_memory)
         , local_work_size{ local_work_size[0], local_work_size[1], local_work_size[2] }
@@ -183,6 +256,9 @@ struct KernelOptions {
     int data_type;
     string data_type_string;
     string data_type_suffix;
+    AbstractRD::Storage storage;
+    string storage_type_string; // the type of the chemical buffers, e.g. uchar4, or the same as data_type_string
+    float storage_scale; // integer storage holds round(value * storage_scale)
     const int block_size[3];
     bool use_local_memory;
     const size_t local_work_size[3];
@@ -190,6 +266,26 @@ struct KernelOptions {
 
 // -------------------------------------------------------------------------
 
+bool UsingLoadMacro(const string& name, const vector<string>& chemicals, const KernelOptions& options)
+{
+    // chemicals in a compact storage type are converted when read; the intermediate buffers always hold the compute type
+    return options.storage != AbstractRD::Storage::Default
+        && find(chemicals.begin(), chemicals.end(), name) != chemicals.end();
+}
+
+// -------------------------------------------------------------------------
+
+string GetLoadCode(const string& name, const string& index, const vector<string>& chemicals, const KernelOptions& options)
+{
+    if (UsingLoadMacro(name, chemicals, options))
+    {
+        return "LOAD(" + name + "_in, " + index + ")";
+    }
+    return name + "_in[" + index + "]";
+}
+
+// -------------------------------------------------------------------------
+
 void WriteHeader(ostringstream& kernel_source, const InputsNeeded& inputs_needed, const KernelOptions& options)
 {
     if (options.data_type == VTK_DOUBLE)
@@ -203,6 +299,39 @@ void WriteHeader(ostringstream& kernel_source, const InputsNeeded& inputs_needed
     #error \"Double precision floating point not supported on this OpenCL device. Choose another or contact the Ready team.\"\n\
 #endif\n\n";
     }
+    if (options.storage != AbstractRD::Storage::Default)
+    {
+        const string vector_size = (options.block_size[0] == 4) ? "4" : "";
+        kernel_source << "// the chemicals are stored as " << options.storage_type_string << " and converted to "
+            << options.data_type_string << " for computation:\n";
+        if (options.storage == AbstractRD::Storage::Half)
+        {
+            // vload_half returns float, so convert again if computing in double
+            if (options.data_type == VTK_DOUBLE)
+            {
+                kernel_source << "#define LOAD(p, i) convert_" << options.data_type_string << "(vload_half" << vector_size << "(i, p))\n";
+            }
+            else
+            {
+                kernel_source << "#define LOAD(p, i) vload_half" << vector_size << "(i, p)\n";
+            }
+            kernel_source << "#define STORE(p, i, v) vstore_half" << vector_size << "_rte(v, i, p)\n\n";
+        }
+        else if (options.storage == AbstractRD::Storage::Float)
+        {
+            kernel_source << "#define LOAD(p, i) convert_" << options.data_type_string << "(p[i])\n";
+            kernel_source << "#define STORE(p, i, v) p[i] = convert_" << options.storage_type_string << "_rte(v)\n\n";
+        }
+        else
+        {
+            // integers hold fixed-point values: round(v * scale), saturated to the range of the type
+            ostringstream scale;
+            scale << setprecision(8) << options.storage_scale << options.data_type_suffix;
+            kernel_source << "#define LOAD(p, i) (convert_" << options.data_type_string << "(p[i]) * (1.0" << options.data_type_suffix
+                << " / " << scale.str() << "))\n";
+            kernel_source << "#define STORE(p, i, v) p[i] = convert_" << options.storage_type_string << "_sat_rte((v) * " << scale.str() << ")\n\n";
+        }
+    }
     if (options.use_local_memory)
     {
         kernel_source << "// work group size, in blocks:\n";
@@ -214,21 +343,46 @@ void WriteHeader(ostringstream& kernel_source, const InputsNeeded& inputs_needed
         kernel_source << "#define YR " << inputs_needed.stencil_radii[1] << "\n";
         kernel_source << "#define ZR " << inputs_needed.stencil_radii[2] << "\n\n";
     }
+    const string real_type = (options.data_type == VTK_DOUBLE) ? "double" : "float";
+    if (!inputs_needed.summed_area_tables_needed.empty())
+    {
+        kernel_source << OpenCL_SummedAreaTable::GetBoxSumSource(real_type, options.wrap);
+    }
+    if (inputs_needed.using_random_numbers)
+    {
+        kernel_source << CounterRNG::GetOpenCLSource(real_type);
+        kernel_source << CounterRNG::GetKeywordsOpenCLSource(real_type, options.block_size[0]);
+    }
     // output the function declaration
     kernel_source << "kernel void rd_compute(";
     for (const string& chem : inputs_needed.chemicals_needed)
     {
-        kernel_source << "global " << options.data_type_string << " *" << chem << "_in";
+        kernel_source << "global " << options.storage_type_string << " *" << chem << "_in";
         kernel_source << ",";
     }
     for (size_t i = 0; i < inputs_needed.chemicals_needed.size(); i++)
     {
-        kernel_source << "global " << options.data_type_string << " *" << inputs_needed.chemicals_needed[i] << "_out";
+        kernel_source << "global " << options.storage_type_string << " *" << inputs_needed.chemicals_needed[i] << "_out";
         if (i < inputs_needed.chemicals_needed.size() - 1)
         {
             kernel_source << ",";
         }
     }
+    // the intermediate buffers written by the stage kernels come last
+    for (const AppliedStencil& stage : inputs_needed.stages_needed)
+    {
+        kernel_source << ",global " << options.data_type_string << " *" << stage.GetName() << "_in";
+    }
+    // then the summed-area tables, which hold one value per cell whatever the block size
+    for (const string& chem : inputs_needed.summed_area_tables_needed)
+    {
+        kernel_source << ",global const " << real_type << " *sat_" << chem;
+    }
+    // then the seed and step number for the random numbers
+    if (inputs_needed.using_random_numbers)
+    {
+        kernel_source << ",const uint2 rand_key";
+    }
     kernel_source << ")\n{\n";
 }
 
@@ -274,9 +428,15 @@ void WriteIndices(ostringstream& kernel_source, const InputsNeeded& inputs_neede
     kernel_source << options.indent << "const int index_here = X*(Y*index_z + index_y) + index_x;\n";
     for (const string& chem : inputs_needed.chemicals_needed)
     {
-        kernel_source << options.indent << options.data_type_string << " " << chem << " = " << chem << "_in[index_here];\n";
+        kernel_source << options.indent << options.data_type_string << " " << chem << " = "
+            << GetLoadCode(chem, "index_here", inputs_needed.chemicals_needed, options) << ";\n";
         // (non-const to allow the user to assign directly to it if needed)
     }
+    for (const AppliedStencil& stage : inputs_needed.stages_needed)
+    {
+        kernel_source << options.indent << "const " << options.data_type_string << " " << stage.GetName() << " = "
+            << stage.GetName() << "_in[index_here];\n";
+    }
     kernel_source << "\n";
 }
 
@@ -362,7 +522,8 @@ void WriteLocalMemoryCopyBlocksUnrolled(ostringstream& kernel_source, const Inpu
                         kernel_source << cx << " * LX + ";
                     }
                     kernel_source << "local_x]";
-                    kernel_source << "= " << chem << "_in[" << GetIndexString(ix.str(), iy.str(), iz.str(), options.wrap) << "]; \n";
+                    kernel_source << "= " << GetLoadCode(chem, GetIndexString(ix.str(), iy.str(), iz.str(), options.wrap),
+                        inputs_needed.chemicals_needed, options) << "; \n";
                 }
                 if (!first_block)
                 {
@@ -390,8 +551,8 @@ void WriteLocalMemoryCopyBlocksWithLoops(ostringstream& kernel_source, const Inp
     for (const string& chem : inputs_needed.local_memory_needed)
     {
         kernel_source << options.indent << options.indent << options.indent << options.indent << "local_" << chem
-            << "[z - z_start][y - y_start][x - x_start] = " << chem << "_in["
-            << GetIndexString("x", "y", "z", options.wrap) << "];\n";
+            << "[z - z_start][y - y_start][x - x_start] = "
+            << GetLoadCode(chem, GetIndexString("x", "y", "z", options.wrap), inputs_needed.chemicals_needed, options) << ";\n";
     }
     kernel_source << options.indent << options.indent << options.indent << "}\n";
     kernel_source << options.indent << options.indent << "}\n";
@@ -420,7 +581,8 @@ void WriteLocalMemorySection(ostringstream& kernel_source, const InputsNeeded& i
 
 // -------------------------------------------------------------------------
 
-void WriteCellsNeeded(ostringstream& kernel_source, const set<InputPoint>& cells_needed, const KernelOptions& options)
+void WriteCellsNeeded(ostringstream& kernel_source, const set<InputPoint>& cells_needed, const vector<string>& chemicals,
+                      const KernelOptions& options)
 {
     kernel_source << options.indent << "// cells needed:\n";
     // write code to retrieve the block-aligned inputs from global memory
@@ -431,7 +593,8 @@ void WriteCellsNeeded(ostringstream& kernel_source, const set<InputPoint>& cells
             && input_point.point.x % options.block_size[0] == 0)
         {
             kernel_source << options.indent << "const " << options.data_type_string << " "
-                          << input_point.GetDirectAccessCode(options.wrap, options.block_size, options.use_local_memory) << ";\n";
+                          << input_point.GetDirectAccessCode(options.wrap, options.block_size, options.use_local_memory,
+                                 UsingLoadMacro(input_point.chem, chemicals, options)) << ";\n";
         }
     }
     if (options.block_size[0] == 4)
@@ -460,6 +623,31 @@ void WriteKeywords(ostringstream& kernel_source, const InputsNeeded& inputs_need
     {
         kernel_source << options.indent << "const " << options.data_type_string << " " << applied_stencil.GetCode() << ";\n";
     }
+    // write code for the box sums, from the summed-area tables
+    for (const BoxSum& box_sum : inputs_needed.box_sums_needed)
+    {
+        ostringstream args;
+        args << ", index_y, index_z, " << box_sum.radius[0] << ", " << box_sum.radius[1] << ", " << box_sum.radius[2];
+        kernel_source << options.indent << "const " << options.data_type_string << " " << box_sum.name << " = ";
+        if (options.block_size[0] == 4)
+        {
+            kernel_source << "(" << options.data_type_string << ")(\n";
+            for (int i = 0; i < 4; i++)
+            {
+                kernel_source << options.indent << options.indent << "sat_box_sum(sat_" << box_sum.chem << ", 4 * index_x + " << i
+                    << args.str() << ", 4 * X, Y, Z)" << ((i < 3) ? ",\n" : ");\n");
+            }
+        }
+        else
+        {
+            kernel_source << "sat_box_sum(sat_" << box_sum.chem << ", index_x" << args.str() << ", X, Y, Z);\n";
+        }
+    }
+    // start the random numbers for this block if needed
+    if (inputs_needed.using_random_numbers)
+    {
+        kernel_source << options.indent << CounterRNG::GetOpenCLStateCode("index_here");
+    }
     // write code for x_pos, y_pos, z_pos if needed
     if (inputs_needed.using_x_pos)
     {
@@ -509,6 +697,41 @@ void WriteKeywords(ostringstream& kernel_source, const InputsNeeded& inputs_need
 
 // -------------------------------------------------------------------------
 
+void WriteStageKernel(ostringstream& kernel_source, const AppliedStencil& stage,
+    const vector<AbstractRD::Parameter>& parameters,
+    const InputsNeeded& inputs_needed,
+    const KernelOptions& options)
+{
+    // a kernel that evaluates a single stencil into an intermediate buffer, run before rd_compute on each step
+    InputsNeeded stage_inputs = {};
+    stage_inputs.chemicals_needed.push_back(stage.chem);
+    stage_inputs.stencils_needed.push_back(stage);
+    const set<InputPoint> input_points = stage.GetInputPoints();
+    stage_inputs.cells_needed.insert(input_points.begin(), input_points.end());
+    if (options.block_size[0] == 4)
+    {
+        AddAlignedBlocksNeeded(stage_inputs.cells_needed);
+    }
+    const KernelOptions stage_options(options.wrap, options.indent, options.data_type, options.data_type_string,
+        options.data_type_suffix, options.storage, options.storage_type_string, options.storage_scale, options.block_size, false,
+        options.local_work_size);
+
+    kernel_source << "kernel void rd_compute_" << stage.GetName() << "(";
+    for (const string& chem : inputs_needed.chemicals_needed)
+    {
+        kernel_source << "global " << options.storage_type_string << " *" << chem << "_in,";
+    }
+    kernel_source << "global " << options.data_type_string << " *" << stage.GetName() << "_out)\n{\n";
+    WriteParameters(kernel_source, parameters, stage_inputs, stage_options);
+    WriteIndices(kernel_source, stage_inputs, stage_options);
+    WriteCellsNeeded(kernel_source, stage_inputs.cells_needed, stage_inputs.chemicals_needed, stage_options);
+    WriteKeywords(kernel_source, stage_inputs, stage_options);
+    kernel_source << options.indent << stage.GetName() << "_out[index_here] = " << stage.GetName() << ";\n";
+    kernel_source << "}\n";
+}
+
+// -------------------------------------------------------------------------
+
 string AssembleKernelSource(const InputsNeeded& inputs_needed,
     const vector<AbstractRD::Parameter>& parameters,
     const string& formula,
@@ -528,7 +751,7 @@ string AssembleKernelSource(const InputsNeeded& inputs_needed,
         WriteLocalMemorySection(kernel_source, inputs_needed, options);
     }
     // add the cells we need
-    WriteCellsNeeded(kernel_source, inputs_needed.cells_needed, options);
+    WriteCellsNeeded(kernel_source, inputs_needed.cells_needed, inputs_needed.chemicals_needed, options);
     // add the keywords we need
     WriteKeywords(kernel_source, inputs_needed, options);
     // add the formula
@@ -546,11 +769,24 @@ string AssembleKernelSource(const InputsNeeded& inputs_needed,
     kernel_source << options.indent << "// forward-Euler update step:\n";
     for (const string& chem : inputs_needed.chemicals_needed)
     {
-        kernel_source << options.indent << chem << "_out[index_here] = " << chem << " + timestep * delta_" << chem << ";\n";
+        if (options.storage != AbstractRD::Storage::Default)
+        {
+            kernel_source << options.indent << "STORE(" << chem << "_out, index_here, " << chem << " + timestep * delta_" << chem << ");\n";
+        }
+        else
+        {
+            kernel_source << options.indent << chem << "_out[index_here] = " << chem << " + timestep * delta_" << chem << ";\n";
+        }
     }
     // TODO: timestep only needed if it appears in the formula or if we are doing forward-Euler for at least one chemical
     // finish up
     kernel_source << "}\n";
+    // add any kernels that write intermediate buffers for rd_compute
+    for (const AppliedStencil& stage : inputs_needed.stages_needed)
+    {
+        kernel_source << "\n";
+        WriteStageKernel(kernel_source, stage, parameters, inputs_needed, options);
+    }
 
     return kernel_source.str();
 }
@@ -575,9 +811,20 @@ string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(const string& formu
     const InputsNeeded inputs_needed = DetectInputsNeeded(formula, this->GetNumberOfChemicals(),
         this->GetArenaDimensionality(), this->block_size, this->GetAccuracy());
 
+    string storage_type_string = full_data_type_string;
+    switch (this->storage)
+    {
+        case Storage::UInt8: storage_type_string = ReplaceAllSubstrings(full_data_type_string, this->data_type_string, "uchar"); break;
+        case Storage::Int16: storage_type_string = ReplaceAllSubstrings(full_data_type_string, this->data_type_string, "short"); break;
+        case Storage::Half: storage_type_string = "half"; break; // (read and written with vload_half and vstore_half)
+        case Storage::Float: storage_type_string = ReplaceAllSubstrings(full_data_type_string, this->data_type_string, "float"); break;
+        default: break;
+    }
+
     const string indent = "    ";
-    const KernelOptions options(this->wrap, indent, this->data_type, full_data_type_string, this->data_type_suffix, this->block_size,
-        this->use_local_memory, this->local_work_size);
+    const KernelOptions options(this->wrap, indent, this->data_type, full_data_type_string, this->data_type_suffix,
+        this->storage, storage_type_string, this->GetEffectiveStorageScale(), this->block_size, this->use_local_memory,
+        this->local_work_size);
 
     string amended_formula = formula;
     if (this->data_type == VTK_DOUBLE)
@@ -602,6 +849,34 @@ string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(const string& formu
 
 // -------------------------------------------------------------------------
 
+vector<string> FormulaOpenCLImageRD::GetStageKernelNames() const
+{
+    const InputsNeeded inputs_needed = DetectInputsNeeded(this->formula, this->GetNumberOfChemicals(),
+        this->GetArenaDimensionality(), this->block_size, this->GetAccuracy());
+    vector<string> names;
+    for (const AppliedStencil& stage : inputs_needed.stages_needed)
+    {
+        names.push_back("rd_compute_" + stage.GetName());
+    }
+    return names;
+}
+
+// -------------------------------------------------------------------------
+
+vector<int> FormulaOpenCLImageRD::GetSummedAreaTableChemicals() const
+{
+    const InputsNeeded inputs_needed = DetectInputsNeeded(this->formula, this->GetNumberOfChemicals(),
+        this->GetArenaDimensionality(), this->block_size, this->GetAccuracy());
+    vector<int> chemicals;
+    for (const string& chem : inputs_needed.summed_area_tables_needed)
+    {
+        chemicals.push_back(IndexFromChemicalName(chem));
+    }
+    return chemicals;
+}
+
+// -------------------------------------------------------------------------
+
 void FormulaOpenCLImageRD::InitializeFromXML(vtkXMLDataElement *rd, bool &warn_to_update)
 {
     OpenCLImageRD::InitializeFromXML(rd,warn_to_update);
@@ -633,6 +908,29 @@ void FormulaOpenCLImageRD::InitializeFromXML(vtkXMLDataElement *rd, bool &warn_t
         this->SetAccuracy(static_cast<AbstractRD::Accuracy>(it - accuracy_labels));
     }
 
+    // storage
+    string storage_string;
+    read_optional_attribute(xml_formula, "storage", storage_string);
+    if (storage_string.size() > 0)
+    {
+        const char* storage_labels[5] = { "default", "uint8", "int16", "half", "float" };
+        auto it = find(storage_labels, storage_labels + 5, storage_string);
+        if (it == storage_labels + 5)
+        {
+            throw std::runtime_error("unknown storage attribute: " + storage_string);
+        }
+        // (the images are allocated later, by SetDimensionsAndNumberOfChemicals or CopyFromImage, so we just set the member)
+        this->storage = static_cast<AbstractRD::Storage>(it - storage_labels);
+        this->need_reload_formula = true;
+    }
+    float storage_scale = 0.0f;
+    read_optional_attribute(xml_formula, "storage_scale", storage_scale);
+    if (storage_scale < 0.0f)
+    {
+        throw std::runtime_error("storage_scale must not be negative");
+    }
+    this->SetStorageScale(storage_scale);
+
     string formula = trim_multiline_string(xml_formula->GetCharacterData());
     //this->TestFormula(formula); // will throw on error
     this->SetFormula(formula); // (won't throw yet)
@@ -656,6 +954,15 @@ vtkSmartPointer<vtkXMLDataElement> FormulaOpenCLImageRD::GetAsXML(bool generate_
     formula->SetIntAttribute("block_size_z", this->block_size[2]);
     const char* accuracy_labels[3] = { "low", "medium", "high" };
     formula->SetAttribute("accuracy", accuracy_labels[static_cast<int>(this->accuracy)]);
+    if (this->storage != Storage::Default)
+    {
+        const char* storage_labels[5] = { "default", "uint8", "int16", "half", "float" };
+        formula->SetAttribute("storage", storage_labels[static_cast<int>(this->storage)]);
+    }
+    if (this->storage_scale > 0.0f)
+    {
+        formula->SetFloatAttribute("storage_scale", this->storage_scale);
+    }
     string f = this->GetFormula();
     f = ReplaceAllSubstrings(f, "\n", "\n        "); // indent the lines
     formula->SetCharacterData(f.c_str(), (int)f.length());
@@ -713,3 +1020,60 @@ void FormulaOpenCLImageRD::SetWrap(bool w)
 }
 
 // -------------------------------------------------------------------------
+
+void FormulaOpenCLImageRD::CopyStateTo(FormulaOpenCLImageRD& copy, Storage storage) const
+{
+    bool warn_to_update;
+    copy.InitializeFromXML(this->GetAsXML(false), warn_to_update);
+    // (the storage is chosen before the images are allocated, since SetStorage would reallocate them and generate an
+    // initial pattern, only for it to be overwritten below)
+    copy.storage = storage;
+    copy.need_reload_formula = true;
+    copy.SetDimensionsAndNumberOfChemicals(this->GetX(), this->GetY(), this->GetZ(), this->GetNumberOfChemicals());
+    copy.random_seed = this->random_seed; // (so that rand_uniform() and rand_normal() give the same numbers)
+    this->ReadFromOpenCLBuffersIfNeeded();
+    for (int iChem = 0; iChem < this->GetNumberOfChemicals(); iChem++)
+    {
+        // (converts to the storage type of the copy)
+        copy.images[iChem]->GetPointData()->GetScalars()->DeepCopy(this->images[iChem]->GetPointData()->GetScalars());
+    }
+    copy.need_write_to_opencl_buffers = true;
+    copy.timesteps_taken = this->timesteps_taken; // (the random numbers depend on it)
+}
+
+// -------------------------------------------------------------------------
+
+vector<FormulaOpenCLImageRD::PrecisionDrift> FormulaOpenCLImageRD::MeasurePrecisionDrift(int n_steps) const
+{
+    // run a copy of this system, with the same storage type
+    FormulaOpenCLImageRD copy(this->GetPlatform(), this->GetDevice(), this->GetDataType());
+    this->CopyStateTo(copy, this->GetStorage());
+    copy.Step(n_steps);
+    copy.ReadFromOpenCLBuffersIfNeeded();
+
+    // and a reference copy that computes in double and has the default storage type
+    FormulaOpenCLImageRD reference(this->GetPlatform(), this->GetDevice(), VTK_DOUBLE);
+    this->CopyStateTo(reference, Storage::Default);
+    reference.Step(n_steps);
+    reference.ReadFromOpenCLBuffersIfNeeded();
+
+    vector<PrecisionDrift> drifts;
+    const vtkIdType n_cells = this->GetX() * this->GetY() * this->GetZ();
+    for (int iChem = 0; iChem < this->GetNumberOfChemicals(); iChem++)
+    {
+        vtkDataArray* values = copy.images[iChem]->GetPointData()->GetScalars();
+        vtkDataArray* reference_values = reference.images[iChem]->GetPointData()->GetScalars();
+        PrecisionDrift drift{ GetChemicalName(iChem), 0.0, 0.0 };
+        for (vtkIdType i = 0; i < n_cells; i++)
+        {
+            const double diff = fabs(values->GetComponent(i, 0) - reference_values->GetComponent(i, 0));
+            drift.max_abs_difference = max(drift.max_abs_difference, diff);
+            drift.rms_difference += diff * diff;
+        }
+        drift.rms_difference = sqrt(drift.rms_difference / n_cells);
+        drifts.push_back(drift);
+    }
+    return drifts;
+}
+
+// -------------------------------------------------------------------------
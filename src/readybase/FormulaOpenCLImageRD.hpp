@@ -45,7 +45,22 @@ class FormulaOpenCLImageRD : public OpenCLImageRD
         bool HasEditableAccuracyOption() const override { return true; }
         void SetAccuracy(Accuracy acc) override { this->accuracy = acc; this->need_reload_formula = true; }
 
+        bool HasEditableStorageOption() const override { return true; }
+
+        /// How far one chemical ended up from the reference run, as found by MeasurePrecisionDrift.
+        struct PrecisionDrift {
+            std::string chemical;
+            double max_abs_difference;
+            double rms_difference;
+        };
+
+        /// Advances a copy of this system by n_steps alongside a copy that computes in double with default storage, and reports the differences.
+        /** For checking whether a compact storage type or float computation is accurate enough for a long run. This system is left as it is. */
+        std::vector<PrecisionDrift> MeasurePrecisionDrift(int n_steps) const;
+
         std::string AssembleKernelSourceFromFormula(const std::string& formula) const override;
+        std::vector<std::string> GetStageKernelNames() const override;
+        std::vector<int> GetSummedAreaTableChemicals() const override;
 
         // we override the parameter access functions because changing the parameters requires rewriting the kernel
         void AddParameter(const std::string& name,float val) override;
@@ -58,6 +73,11 @@ class FormulaOpenCLImageRD : public OpenCLImageRD
         void SetWrap(bool w) override;
         bool HasEditableDataType() const override { return true; }
 
+    private:
+
+        /// Gives the copy this system's rule and current values, with the copy's data type and the given storage type.
+        void CopyStateTo(FormulaOpenCLImageRD& copy, Storage storage) const;
+
     private:
 
         int block_size[3];
@@ -17,9 +17,11 @@
 
 // local:
 #include "FormulaOpenCLMeshRD.hpp"
+#include "CounterRNG.hpp"
 #include "utils.hpp"
 
 // STL:
+#include <algorithm>
 #include <string>
 #include <sstream>
 
@@ -48,9 +50,19 @@ delta_b = D_b * laplacian_b + a*b*b - (F+K)*b;");
 // -------------------------------------------------------------------------
 
 std::string FormulaOpenCLMeshRD::AssembleKernelSourceFromFormula(const std::string& f) const
+{
+    return this->AssembleKernel(f, this->UsesClusters());
+}
+
+// -------------------------------------------------------------------------
+
+std::string FormulaOpenCLMeshRD::AssembleKernel(const std::string& f,bool use_clusters) const
 {
     const string indent = "    ";
     const int NC = this->GetNumberOfChemicals();
+    // when using clusters the Laplacians are computed from the copies of the values in local memory
+    const string source = use_clusters ? "_local" : "_in";
+    const bool using_random_numbers = CounterRNG::UsesKeywords(f);
 
     ostringstream kernel_source;
     kernel_source << fixed << setprecision(6);
@@ -65,29 +77,94 @@ std::string FormulaOpenCLMeshRD::AssembleKernelSourceFromFormula(const std::stri
     #error \"Double precision floating point not supported on this OpenCL device. Choose another or contact the Ready team.\"\n\
 #endif\n\n";
     }
+    if(use_clusters)
+    {
+        kernel_source << "#define N_CELLS " << this->mesh->GetNumberOfCells() << "\n";
+        kernel_source << "#define CLUSTER_SIZE " << MeshRD::CLUSTER_SIZE << "\n";
+        kernel_source << "#define MAX_HALO " << max(1, this->max_halo) << "\n\n";
+    }
+    if(using_random_numbers)
+    {
+        kernel_source << CounterRNG::GetOpenCLSource(this->data_type_string);
+        kernel_source << CounterRNG::GetKeywordsOpenCLSource(this->data_type_string, 1);
+    }
     // output the function definition
     kernel_source << "kernel void rd_compute(";
     for(int i=0;i<NC;i++)
         kernel_source << "global " << this->data_type_string << " *" << GetChemicalName(i) << "_in,";
     for(int i=0;i<NC;i++)
         kernel_source << "global " << this->data_type_string << " *" << GetChemicalName(i) << "_out,";
-    kernel_source << "global int* neighbor_indices,global float* neighbor_weights,const int max_neighbors)\n";
+    kernel_source << "global int* neighbor_indices,global float* neighbor_weights,const int max_neighbors";
+    if(this->neighbor_layout != NeighborLayout::Padded)
+        kernel_source << ",global int* neighbor_offsets,global int* overflow_indices,global float* overflow_weights";
+    if(use_clusters)
+        kernel_source << ",global int* halo_offsets,global int* halo_cells";
+    if(using_random_numbers)
+        kernel_source << ",const uint2 rand_key";
+    kernel_source << ")\n";
     // output the body
     kernel_source << "{\n";
     kernel_source << indent << "const int index_x = get_global_id(0);\n";
+    if(use_clusters)
+    {
+        // each work group copies its cluster and the cells around it into local memory, for the Laplacians to read
+        kernel_source << indent << "const int _lid = get_local_id(0);\n";
+        kernel_source << indent << "const int _group = get_group_id(0);\n";
+        for(int i=0;i<NC;i++)
+            kernel_source << indent << "local " << this->data_type_string << " " << GetChemicalName(i) << "_local[CLUSTER_SIZE+MAX_HALO];\n";
+        kernel_source << indent << "if(index_x<N_CELLS)\n" << indent << "{\n";
+        for(int i=0;i<NC;i++)
+            kernel_source << indent << indent << GetChemicalName(i) << "_local[_lid] = " << GetChemicalName(i) << "_in[index_x];\n";
+        kernel_source << indent << "}\n";
+        kernel_source << indent << "for(int _h=halo_offsets[_group]+_lid;_h<halo_offsets[_group+1];_h+=CLUSTER_SIZE)\n" << indent << "{\n";
+        kernel_source << indent << indent << "const int _j = CLUSTER_SIZE + _h - halo_offsets[_group];\n";
+        for(int i=0;i<NC;i++)
+            kernel_source << indent << indent << GetChemicalName(i) << "_local[_j] = " << GetChemicalName(i) << "_in[halo_cells[_h]];\n";
+        kernel_source << indent << "}\n";
+        kernel_source << indent << "barrier(CLK_LOCAL_MEM_FENCE);\n";
+        kernel_source << indent << "if(index_x>=N_CELLS) return; // (the last cluster may not be full)\n";
+    }
     for(int i=0;i<NC;i++)
         kernel_source << indent << this->data_type_string << " " << GetChemicalName(i) << " = " << GetChemicalName(i) << "_in[index_x];\n";
+    if(using_random_numbers)
+        kernel_source << indent << CounterRNG::GetOpenCLStateCode("index_x");
     kernel_source << "\n";
     // compute the laplacians
     kernel_source << indent << "// compute the Laplacians\n";
     for(int i=0;i<NC;i++)
         kernel_source << indent << this->data_type_string << " laplacian_" << GetChemicalName(i) << " = -" << GetChemicalName(i) << ";\n";
-    kernel_source << indent << "int _offset = index_x * max_neighbors;\n";
-    kernel_source << indent << "for(int _i=0;_i<max_neighbors;_i++)\n" << indent << "{\n";
-    for(int i=0;i<NC;i++)
-        kernel_source << indent << indent << "laplacian_" << GetChemicalName(i) << " += " << GetChemicalName(i)
-                      << "_in[neighbor_indices[_offset+_i]] * neighbor_weights[_offset+_i];\n";
-    kernel_source << indent << "}\n";
+    switch(this->neighbor_layout)
+    {
+        case NeighborLayout::Padded:
+            // every cell has max_neighbors slots, stored row by row
+            kernel_source << indent << "int _offset = index_x * max_neighbors;\n";
+            kernel_source << indent << "for(int _i=0;_i<max_neighbors;_i++)\n" << indent << "{\n";
+            for(int i=0;i<NC;i++)
+                kernel_source << indent << indent << "laplacian_" << GetChemicalName(i) << " += " << GetChemicalName(i)
+                              << source << "[neighbor_indices[_offset+_i]] * neighbor_weights[_offset+_i];\n";
+            kernel_source << indent << "}\n";
+            break;
+        case NeighborLayout::Hybrid:
+            // the padded slots are stored column by column, so neighboring work items read neighboring memory
+            if(use_clusters)
+                kernel_source << indent << "const int _n_cells = N_CELLS;\n"; // (the global size is rounded up to whole clusters)
+            else
+                kernel_source << indent << "const int _n_cells = get_global_size(0);\n";
+            kernel_source << indent << "for(int _i=0;_i<max_neighbors;_i++)\n" << indent << "{\n";
+            kernel_source << indent << indent << "const int _k = _i * _n_cells + index_x;\n";
+            for(int i=0;i<NC;i++)
+                kernel_source << indent << indent << "laplacian_" << GetChemicalName(i) << " += " << GetChemicalName(i)
+                              << source << "[neighbor_indices[_k]] * neighbor_weights[_k];\n";
+            kernel_source << indent << "}\n";
+            [[fallthrough]]; // (then the overflow, as for CSR)
+        case NeighborLayout::CSR:
+            kernel_source << indent << "for(int _k=neighbor_offsets[index_x];_k<neighbor_offsets[index_x+1];_k++)\n" << indent << "{\n";
+            for(int i=0;i<NC;i++)
+                kernel_source << indent << indent << "laplacian_" << GetChemicalName(i) << " += " << GetChemicalName(i)
+                              << source << "[overflow_indices[_k]] * overflow_weights[_k];\n";
+            kernel_source << indent << "}\n";
+            break;
+    }
     for(int i=0;i<NC;i++)
         kernel_source << indent << "laplacian_" << GetChemicalName(i) << " *= 4.0" << this->data_type_suffix << ";\n"; // TODO: not sure about 3D meshes
     kernel_source << "\n";
@@ -31,6 +31,8 @@ class FormulaOpenCLMeshRD : public OpenCLMeshRD
         std::string GetRuleType() const override { return "formula"; }
 
         std::string AssembleKernelSourceFromFormula(const std::string& formula) const override;
+        /// The kernel that reads its neighbors from global memory, since a full kernel doesn't stage clusters in local memory.
+        std::string GetKernel() const override { return this->AssembleKernel(this->formula,false); }
 
         // we override the parameter access functions because changing the parameters requires rewriting the kernel
         void AddParameter(const std::string& name,float val) override;
@@ -40,4 +42,12 @@ class FormulaOpenCLMeshRD : public OpenCLMeshRD
         void SetParameterValue(int iParam,float val) override;
 
         bool HasEditableDataType() const override { return true; }
+
+    protected:
+
+        bool UsesClusters() const override { return this->use_local_memory; }
+
+    private:
+
+        std::string AssembleKernel(const std::string& formula,bool use_clusters) const;
 };
@@ -17,9 +17,11 @@
 
 // local:
 #include "FullKernelOpenCLImageRD.hpp"
+#include "OpenCL_SummedAreaTable.hpp"
 #include "utils.hpp"
 
 // STL:
+#include <sstream>
 #include <string>
 
 // VTK:
@@ -50,8 +52,12 @@ FullKernelOpenCLImageRD::FullKernelOpenCLImageRD(const OpenCLImageRD& source)
     this->block_size[2] = source.GetBlockSizeZ();
 
     this->SetFormula(source.GetKernel());
+    this->stage_kernel_names = source.GetStageKernelNames();
+    this->convolutions = source.GetConvolutions();
+    this->summed_area_table_chemicals = source.GetSummedAreaTableChemicals();
 
     vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
+    source.ReadFromOpenCLBuffersIfNeeded();
     source.GetImage(image);
     this->SetDimensionsAndNumberOfChemicals(image->GetDimensions()[0],image->GetDimensions()[1],
         image->GetDimensions()[2],source.GetNumberOfChemicals());
@@ -76,6 +82,10 @@ string FullKernelOpenCLImageRD::AssembleKernelSourceFromFormula(const string& fo
         kernel_source << "#define LY " << this->local_work_size[1] << "\n";
         kernel_source << "#define LZ " << this->local_work_size[2] << "\n";
     }
+    if (!this->summed_area_table_chemicals.empty())
+    {
+        kernel_source << OpenCL_SummedAreaTable::GetBoxSumSource(this->data_type_string, this->wrap);
+    }
     kernel_source << formula;
     return kernel_source.str();
 }
@@ -100,6 +110,40 @@ void FullKernelOpenCLImageRD::InitializeFromXML(vtkXMLDataElement *rd, bool &war
     // number_of_chemicals:
     read_required_attribute(xml_kernel,"number_of_chemicals",this->n_chemicals);
 
+    // stages: (space-separated names of kernels to run before rd_compute)
+    string stages;
+    read_optional_attribute(xml_kernel,"stages",stages);
+    this->stage_kernel_names.clear();
+    istringstream iss(stages);
+    string stage_kernel_name;
+    while(iss >> stage_kernel_name)
+        this->stage_kernel_names.push_back(stage_kernel_name);
+
+    // convolutions:
+    this->convolutions.clear();
+    for(int i=0;i<rule->GetNumberOfNestedElements();i++)
+    {
+        vtkSmartPointer<vtkXMLDataElement> node = rule->GetNestedElement(i);
+        if(string(node->GetName())!="convolution") continue;
+        string chem;
+        read_required_attribute(node,"chemical",chem);
+        RadialConvolution convolution{ IndexFromChemicalName(chem), 0.0f, 0.0f };
+        read_optional_attribute(node,"inner_radius",convolution.inner_radius);
+        read_required_attribute(node,"outer_radius",convolution.outer_radius);
+        this->convolutions.push_back(convolution);
+    }
+
+    // summed-area tables:
+    this->summed_area_table_chemicals.clear();
+    for(int i=0;i<rule->GetNumberOfNestedElements();i++)
+    {
+        vtkSmartPointer<vtkXMLDataElement> node = rule->GetNestedElement(i);
+        if(string(node->GetName())!="summed_area_table") continue;
+        string chem;
+        read_required_attribute(node,"chemical",chem);
+        this->summed_area_table_chemicals.push_back(IndexFromChemicalName(chem));
+    }
+
     // do this last, because it requires everything else to be set up first
     this->TestFormula(formula); // will throw on error but won't set
     this->SetFormula(formula); // will set but won't throw
@@ -120,11 +164,36 @@ vtkSmartPointer<vtkXMLDataElement> FullKernelOpenCLImageRD::GetAsXML(bool genera
     kernel->SetIntAttribute("block_size_x",this->block_size[0]);
     kernel->SetIntAttribute("block_size_y",this->block_size[1]);
     kernel->SetIntAttribute("block_size_z",this->block_size[2]);
+    if(!this->stage_kernel_names.empty())
+    {
+        ostringstream stages;
+        for(size_t i=0;i<this->stage_kernel_names.size();i++)
+            stages << (i>0?" ":"") << this->stage_kernel_names[i];
+        kernel->SetAttribute("stages",stages.str().c_str());
+    }
     string f = this->GetFormula();
     f = ReplaceAllSubstrings(f, "\n", "\n        "); // indent the lines
     kernel->SetCharacterData(f.c_str(), (int)f.length());
     rule->AddNestedElement(kernel);
 
+    for(const RadialConvolution& convolution : this->convolutions)
+    {
+        vtkSmartPointer<vtkXMLDataElement> node = vtkSmartPointer<vtkXMLDataElement>::New();
+        node->SetName("convolution");
+        node->SetAttribute("chemical",GetChemicalName(convolution.iChemical).c_str());
+        node->SetFloatAttribute("inner_radius",convolution.inner_radius);
+        node->SetFloatAttribute("outer_radius",convolution.outer_radius);
+        rule->AddNestedElement(node);
+    }
+
+    for(int iChemical : this->summed_area_table_chemicals)
+    {
+        vtkSmartPointer<vtkXMLDataElement> node = vtkSmartPointer<vtkXMLDataElement>::New();
+        node->SetName("summed_area_table");
+        node->SetAttribute("chemical",GetChemicalName(iChemical).c_str());
+        rule->AddNestedElement(node);
+    }
+
     return rd;
 }
 
@@ -42,10 +42,14 @@ class FullKernelOpenCLImageRD : public OpenCLImageRD
         void SetBlockSizeZ(int n) override { this->block_size[2]=n; this->need_reload_formula=true; }
 
         std::string AssembleKernelSourceFromFormula(const std::string& formula) const override;
+        std::vector<std::string> GetStageKernelNames() const override { return this->stage_kernel_names; }
+        std::vector<int> GetSummedAreaTableChemicals() const override { return this->summed_area_table_chemicals; }
 
         bool HasEditableDataType() const override { return false; }
 
 protected:
 
         int block_size[3];
+        std::vector<std::string> stage_kernel_names;
+        std::vector<int> summed_area_table_chemicals;
 };
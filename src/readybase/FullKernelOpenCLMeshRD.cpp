@@ -35,6 +35,7 @@ FullKernelOpenCLMeshRD::FullKernelOpenCLMeshRD(int opencl_platform,int opencl_de
 {
     this->SetRuleName("Full kernel example");
     this->SetFormula("kernel void rd_compute() {}");
+    this->neighbor_layout = NeighborLayout::Padded; // what kernels written before the other layouts existed expect
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -43,6 +44,8 @@ FullKernelOpenCLMeshRD::FullKernelOpenCLMeshRD(const OpenCLMeshRD& source)
     : OpenCLMeshRD(source.GetPlatform(),source.GetDevice(),source.GetDataType())
 {
     this->SetFormula(source.GetKernel());
+    this->neighbor_layout = source.GetNeighborLayout(); // the kernel's arguments depend on it
+    this->cell_order = source.GetCellOrder();
 
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
     source.GetMesh(mesh);
@@ -23,7 +23,54 @@
 #include <vtkFloatArray.h>
 #include <vtkUnstructuredGrid.h>
 #include <vtkCellData.h>
-#include <vtkMinimalStandardRandomSequence.h>
+
+// STL:
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+void InbuiltMeshRD::InternalUpdate(int n_steps)
+{
+    const vtkIdType n_cells = this->mesh->GetNumberOfCells();
+    const int MIN_CELLS_PER_THREAD = 4096; // below this, starting the threads costs more than it saves
+
+    // point straight at the chemical arrays, and at a buffer of the same size for each
+    vector<float*> chemicals(this->n_chemicals), current(this->n_chemicals), next(this->n_chemicals);
+    this->buffer.resize(this->n_chemicals);
+    for(int iChem = 0; iChem < this->n_chemicals; iChem++)
+    {
+        vtkFloatArray* array = vtkFloatArray::SafeDownCast( this->mesh->GetCellData()->GetArray(GetChemicalName(iChem).c_str()) );
+        if(!array)
+            throw runtime_error("InbuiltMeshRD::InternalUpdate : chemical arrays must be float");
+        chemicals[iChem] = current[iChem] = array->GetPointer(0);
+        this->buffer[iChem].resize(n_cells);
+        next[iChem] = this->buffer[iChem].data();
+    }
+
+    const bool semi_implicit = this->integrator == Integrator::SemiImplicit;
+    const vector<float> diffusion_coefficients = semi_implicit ? this->GetImplicitDiffusionCoefficients() : vector<float>();
+
+    for(int iStep = 0; iStep < n_steps; iStep++)
+    {
+        parallel_for(n_cells, [&](size_t first, size_t last) { this->UpdateCells(current, next, first, last, !semi_implicit); }, MIN_CELLS_PER_THREAD);
+        if(semi_implicit)
+        {
+            // the reaction has been applied, now the diffusion: solve (I - c L) x = next for x
+            for(int iChem = 0; iChem < this->n_chemicals; iChem++)
+                if(diffusion_coefficients[iChem] > 0.0f)
+                    this->SolveImplicitDiffusion(next[iChem], diffusion_coefficients[iChem]);
+        }
+        swap(current, next);
+    }
+
+    // after an odd number of steps the result is in the buffer, so copy the values back (but nothing else)
+    if(current != chemicals)
+        for(int iChem = 0; iChem < this->n_chemicals; iChem++)
+            copy(current[iChem], current[iChem] + n_cells, chemicals[iChem]);
+}
 
 // ---------------------------------------------------------------------
 
@@ -37,91 +84,56 @@ GrayScottMeshRD::GrayScottMeshRD()
     this->AddParameter("D_b",0.041f);
     this->AddParameter("k",0.06f);
     this->AddParameter("F",0.035f);
-    this->buffer = vtkSmartPointer<vtkUnstructuredGrid>::New();
 }
 
 // ---------------------------------------------------------------------
 
-void GrayScottMeshRD::InternalUpdate(int n_steps)
+void GrayScottMeshRD::UpdateCells(const vector<float*>& in,const vector<float*>& out,vtkIdType first,vtkIdType last,
+                                  bool with_diffusion) const
 {
-    float timestep = this->GetParameterValueByName("timestep");
-    float D_a = this->GetParameterValueByName("D_a");
-    float D_b = this->GetParameterValueByName("D_b");
-    float k = this->GetParameterValueByName("k");
-    float F = this->GetParameterValueByName("F");
-
-    vtkFloatArray *source_a,*source_b;
-    vtkFloatArray *target_a,*target_b;
+    const float timestep = this->GetParameterValueByName("timestep");
+    const float D_a = this->GetParameterValueByName("D_a");
+    const float D_b = this->GetParameterValueByName("D_b");
+    const float k = this->GetParameterValueByName("k");
+    const float F = this->GetParameterValueByName("F");
+
+    const float* source_a = in[0];
+    const float* source_b = in[1];
+    float* target_a = out[0];
+    float* target_b = out[1];
     float dda,ddb,aval,bval,da,db;
-    int neighbor_index;
-    float diffusion_coefficient;
 
-    for(int iStep=0;iStep<n_steps;iStep++)
+    for(vtkIdType iCell=first;iCell<last;iCell++)
     {
-        if(iStep%2)
-        {
-            source_a = vtkFloatArray::SafeDownCast( this->buffer->GetCellData()->GetArray(GetChemicalName(0).c_str()) );
-            source_b = vtkFloatArray::SafeDownCast( this->buffer->GetCellData()->GetArray(GetChemicalName(1).c_str()) );
-            target_a = vtkFloatArray::SafeDownCast( this->mesh->GetCellData()->GetArray(GetChemicalName(0).c_str()) );
-            target_b = vtkFloatArray::SafeDownCast( this->mesh->GetCellData()->GetArray(GetChemicalName(1).c_str()) );
-        }
-        else
-        {
-            source_a = vtkFloatArray::SafeDownCast( this->mesh->GetCellData()->GetArray(GetChemicalName(0).c_str()) );
-            source_b = vtkFloatArray::SafeDownCast( this->mesh->GetCellData()->GetArray(GetChemicalName(1).c_str()) );
-            target_a = vtkFloatArray::SafeDownCast( this->buffer->GetCellData()->GetArray(GetChemicalName(0).c_str()) );
-            target_b = vtkFloatArray::SafeDownCast( this->buffer->GetCellData()->GetArray(GetChemicalName(1).c_str()) );
-        }
-        for(vtkIdType iCell=0;iCell<this->mesh->GetNumberOfCells();iCell++)
-        {
-            // compute the laplacian
-            aval = source_a->GetValue(iCell);
-            bval = source_b->GetValue(iCell);
-            dda = 0.0f;
-            ddb = 0.0f;
-            for(int iNeighbor=0;iNeighbor<this->max_neighbors;iNeighbor++)
-            {
-                int k = iCell*this->max_neighbors + iNeighbor;
-                neighbor_index = this->cell_neighbor_indices[k];
-                diffusion_coefficient = this->cell_neighbor_weights[k];
-                dda += source_a->GetValue(neighbor_index) * diffusion_coefficient;
-                ddb += source_b->GetValue(neighbor_index) * diffusion_coefficient;
-            }
-            dda -= aval;
-            ddb -= bval;
-            dda *= 4.0f; // scale the Laplacian to be more similar to the 2D square grid version, so the same parameters work
-            ddb *= 4.0f;
-            // Gray-Scott update step:
-            da = D_a * dda - aval*bval*bval + F*(1-aval);
-            db = D_b * ddb + aval*bval*bval - (F+k)*bval;
-            #if !defined( USE_SSE )
-                // avoid denormals manually
-                da += 1e-10f;
-                db += 1e-10f;
-            #endif
-            // apply the step:
-            target_a->SetValue(iCell,aval + timestep*da );
-            target_b->SetValue(iCell,bval + timestep*db );
-        }
+        // compute the laplacian
+        aval = source_a[iCell];
+        bval = source_b[iCell];
+        dda = with_diffusion ? this->GetLaplacian(source_a,iCell) : 0.0f;
+        ddb = with_diffusion ? this->GetLaplacian(source_b,iCell) : 0.0f;
+        dda *= 4.0f; // scale the Laplacian to be more similar to the 2D square grid version, so the same parameters work
+        ddb *= 4.0f;
+        // Gray-Scott update step:
+        da = D_a * dda - aval*bval*bval + F*(1-aval);
+        db = D_b * ddb + aval*bval*bval - (F+k)*bval;
+        #if !defined( USE_SSE )
+            // avoid denormals manually
+            da += 1e-10f;
+            db += 1e-10f;
+        #endif
+        // apply the step:
+        target_a[iCell] = aval + timestep*da;
+        target_b[iCell] = bval + timestep*db;
     }
-    if(n_steps%2)
-        this->mesh->DeepCopy(this->buffer);
-}
-
-// ---------------------------------------------------------------------
-
-void GrayScottMeshRD::SetNumberOfChemicals(int n, bool reallocate_storage)
-{
-    MeshRD::SetNumberOfChemicals(n, reallocate_storage);
-    this->buffer->DeepCopy(this->mesh);
 }
 
 // ---------------------------------------------------------------------
 
-void GrayScottMeshRD::CopyFromMesh(vtkUnstructuredGrid *mesh2)
+vector<float> GrayScottMeshRD::GetImplicitDiffusionCoefficients() const
 {
-    MeshRD::CopyFromMesh(mesh2);
-    this->buffer->DeepCopy(this->mesh);
+    const float timestep = this->GetParameterValueByName("timestep");
+    const float D_a = this->GetParameterValueByName("D_a");
+    const float D_b = this->GetParameterValueByName("D_b");
+    return { 4.0f * timestep * D_a, 4.0f * timestep * D_b }; // (with the same scaling of the Laplacian as in UpdateCells)
 }
 
 // ---------------------------------------------------------------------
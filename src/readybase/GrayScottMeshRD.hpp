@@ -18,7 +18,14 @@
 // local:
 #include "MeshRD.hpp"
 
+// STL:
+#include <vector>
+
 /// Base class for all the inbuilt mesh implementations.
+/** Runs the update on the CPU, reading and writing the chemicals as plain float arrays, with the cells shared out
+ *  between threads. Each thread only writes to its own range of cells, so no locking is needed. Derived classes
+ *  just implement UpdateCells and GetImplicitDiffusionCoefficients. With the semi-implicit integrator, UpdateCells
+ *  leaves out the diffusion, which is then solved for separately. */
 // TODO: put in its own file (when there is more than one derived class)
 class InbuiltMeshRD : public MeshRD
 {
@@ -31,6 +38,23 @@ class InbuiltMeshRD : public MeshRD
         bool HasEditableFormula() const override { return false; }
         bool HasEditableNumberOfChemicals() const override { return false; }
         bool HasEditableDataType() const override { return false; }
+        bool HasEditableIntegrator() const override { return true; }
+
+    protected:
+
+        void InternalUpdate(int n_steps) override;
+
+        /// Computes cells [first,last) of the next step into out, from the current values in (one array per chemical).
+        /** Called from several threads at once, on different ranges of cells. Diffusion is left out unless with_diffusion. */
+        virtual void UpdateCells(const std::vector<float*>& in,const std::vector<float*>& out,vtkIdType first,vtkIdType last,
+                                 bool with_diffusion) const =0;
+
+        /// The timestep times the diffusion rate of each chemical, scaled as UpdateCells scales GetLaplacian.
+        virtual std::vector<float> GetImplicitDiffusionCoefficients() const =0;
+
+    protected:
+
+        std::vector<std::vector<float> > buffer; ///< temporary storage used during computation, one array per chemical
 };
 
 /// A non-OpenCL mesh implementation, just as an example.
@@ -40,14 +64,9 @@ class GrayScottMeshRD : public InbuiltMeshRD
 
         GrayScottMeshRD();
 
-        void SetNumberOfChemicals(int n, bool reallocate_storage = false) override;
-        void CopyFromMesh(vtkUnstructuredGrid *mesh2) override;
-
-    protected:
-
-        void InternalUpdate(int n_steps) override;
-
     protected:
 
-        vtkSmartPointer<vtkUnstructuredGrid> buffer;           ///< temporary storage used during computation
+        void UpdateCells(const std::vector<float*>& in,const std::vector<float*>& out,vtkIdType first,vtkIdType last,
+                         bool with_diffusion) const override;
+        std::vector<float> GetImplicitDiffusionCoefficients() const override;
 };
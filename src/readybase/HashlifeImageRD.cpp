@@ -0,0 +1,173 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "HashlifeImageRD.hpp"
+
+// STL:
+#include <algorithm>
+#include <stdexcept>
+
+// VTK:
+#include <vtkImageData.h>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+HashlifeImageRD::HashlifeImageRD()
+    : need_rebuild_universe(true)
+    , need_clip_universe(false)
+{
+    this->wrap = false; // the plane is unbounded
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeImageRD::InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update)
+{
+    BinaryCAImageRD::InitializeFromXML(rd,warn_to_update);
+    this->wrap = false;
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeImageRD::TestFormula(string program_string)
+{
+    uint32_t birth, survival;
+    ParseRule(program_string, birth, survival); // will throw on error
+    if(birth & 1)
+        throw runtime_error("HashlifeImageRD::TestFormula : rules with B0 are not supported, since the plane is unbounded");
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeImageRD::AllocateImages(int x,int y,int z,int nc,int data_type)
+{
+    if(z!=1) throw runtime_error("HashlifeImageRD::AllocateImages : this implementation is for 2D images only");
+    if(nc!=1) throw runtime_error("HashlifeImageRD::AllocateImages : this implementation is for 1 chemical only");
+    // (the cells live in the universe, so unlike BinaryCAImageRD we don't allocate the packed words)
+    ImageRD::AllocateImages(x,y,z,1,VTK_FLOAT);
+    this->view.assign((size_t)x * y, 0);
+    this->need_rebuild_universe = true;
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeImageRD::CopyFromImage(vtkImageData* im)
+{
+    BinaryCAImageRD::CopyFromImage(im);
+    this->need_clip_universe = true; // (also covers RestoreStartingPattern)
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeImageRD::GenerateInitialPattern()
+{
+    BinaryCAImageRD::GenerateInitialPattern();
+    this->need_clip_universe = true;
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeImageRD::BlankImage(float value)
+{
+    BinaryCAImageRD::BlankImage(value);
+    this->need_clip_universe = true;
+}
+
+// ---------------------------------------------------------------------
+
+vector<Timeline::Block> HashlifeImageRD::GetStateBlocks()
+{
+    // (the cells live in the universe, so there are no packed words: the state is the window)
+    return ImageRD::GetStateBlocks();
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeImageRD::AllCellsChanged()
+{
+    ImageRD::AllCellsChanged(); // (the image was written to, not the packed words)
+    this->need_clip_universe = true; // (the cells beyond the image are not recorded, e.g. in the timeline)
+}
+
+// ---------------------------------------------------------------------
+
+size_t HashlifeImageRD::GetMemorySize() const
+{
+    return this->universe.GetMemorySize() + this->view.size();
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeImageRD::ReadEditsFromImage()
+{
+    const int X = this->images.front()->GetDimensions()[0];
+    const int Y = this->images.front()->GetDimensions()[1];
+    if(this->need_rebuild_universe)
+    {
+        this->universe.Clear();
+        fill(this->view.begin(), this->view.end(), 0);
+        this->need_rebuild_universe = false;
+        this->need_clip_universe = false;
+    }
+    else if(this->need_clip_universe)
+    {
+        // the whole pattern was replaced by the image, so the cells outside the window are gone (the window itself is
+        // still as in the view, so the changes to it are applied cell by cell below, keeping the cached results)
+        this->universe.ClearOutside(0, 0, X, Y);
+        this->need_clip_universe = false;
+    }
+    const float* values = static_cast<float*>(this->images.front()->GetScalarPointer());
+    for(int y=0;y<Y;y++)
+    {
+        for(int x=0;x<X;x++)
+        {
+            const size_t i = (size_t)X * y + x;
+            const uint8_t alive = values[i] >= 0.5f ? 1 : 0;
+            if(alive != this->view[i])
+            {
+                this->universe.SetCell(x, y, alive != 0);
+                this->view[i] = alive;
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeImageRD::RasterizeView()
+{
+    const int X = this->images.front()->GetDimensions()[0];
+    const int Y = this->images.front()->GetDimensions()[1];
+    this->universe.Rasterize(0, 0, X, Y, this->view.data());
+    float* values = static_cast<float*>(this->images.front()->GetScalarPointer());
+    for(size_t i=0;i<this->view.size();i++)
+        values[i] = this->view[i];
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeImageRD::InternalUpdate(int n_steps)
+{
+    ParseRule(this->formula, this->birth_mask, this->survival_mask);
+    this->universe.SetRule(this->birth_mask, this->survival_mask); // (does nothing if the rule hasn't changed)
+    this->ReadEditsFromImage();
+    this->universe.Step(n_steps);
+    this->RasterizeView();
+}
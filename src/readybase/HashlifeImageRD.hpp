@@ -0,0 +1,73 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __HASHLIFEIMAGERD__
+#define __HASHLIFEIMAGERD__
+
+// local:
+#include "BinaryCAImageRD.hpp"
+#include "HashlifeUniverse.hpp"
+
+/// A 2D binary cellular automaton on an unbounded plane, advanced with hashlife, with the image as a window onto it.
+/** The image shows the cells from (0,0) to (X-1,Y-1) of the plane. Patterns can leave the window and keep evolving
+ *  outside it. Edits to the image are copied into the plane cell by cell before each update. When the whole pattern
+ *  is replaced (loading, resetting, or going back to a recorded timestep, where only the window is recorded) the plane
+ *  is clipped to the window. Since each update jumps forward in powers of two, large numbers of timesteps per render
+ *  are cheap, especially for orderly patterns. */
+class HashlifeImageRD : public BinaryCAImageRD
+{
+    public:
+
+        HashlifeImageRD();
+
+        void InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update) override;
+
+        std::string GetRuleType() const override { return "hashlife"; }
+
+        bool HasEditableWrapOption() const override { return false; }
+
+        void TestFormula(std::string program_string) override;
+
+        void CopyFromImage(vtkImageData* im) override;
+        void GenerateInitialPattern() override;
+        void BlankImage(float value = 0.0f) override;
+
+        size_t GetMemorySize() const override;
+
+    protected:
+
+        void AllocateImages(int x,int y,int z,int nc,int data_type) override;
+
+        void InternalUpdate(int n_steps) override;
+        std::vector<Timeline::Block> GetStateBlocks() override;
+        void AllCellsChanged() override;
+
+        /// Copies any cells in the image that differ from the last view into the plane, or all of them if the plane needs rebuilding.
+        void ReadEditsFromImage();
+
+        /// Writes the window of the plane into the image.
+        void RasterizeView();
+
+    protected:
+
+        HashlifeUniverse universe;
+        std::vector<uint8_t> view; // the window as last written to the image
+        bool need_rebuild_universe; ///< the image has been reallocated, so the view no longer matches the universe
+        bool need_clip_universe;    ///< the image holds a whole new pattern, so the cells outside the window must go
+};
+
+#endif
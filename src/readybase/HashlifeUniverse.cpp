@@ -0,0 +1,433 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "HashlifeUniverse.hpp"
+
+// STL:
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+namespace
+{
+    const int MIN_ROOT_LEVEL = 3;
+    const int MAX_ROOT_LEVEL = 62; // so that cell coordinates fit in int64_t
+}
+
+// ---------------------------------------------------------------------
+
+size_t HashlifeUniverse::NodeKeyHash::operator()(const NodeKey& k) const
+{
+    uint64_t h = k.nw;
+    h = h * 0x9E3779B97F4A7C15ULL + k.ne;
+    h = h * 0x9E3779B97F4A7C15ULL + k.sw;
+    h = h * 0x9E3779B97F4A7C15ULL + k.se;
+    return (size_t)(h ^ (h >> 29));
+}
+
+// ---------------------------------------------------------------------
+
+HashlifeUniverse::HashlifeUniverse()
+    : root(NONE)
+    , birth_mask(0)
+    , survival_mask(0)
+    , gc_threshold(1 << 21)
+{
+    this->Clear();
+    this->SetRule(1 << 3, (1 << 2) | (1 << 3)); // B3/S23
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeUniverse::SetRule(uint32_t birth,uint32_t survival)
+{
+    if(birth & 1)
+        throw runtime_error("HashlifeUniverse::SetRule : rules with B0 are not supported");
+    if(birth == this->birth_mask && survival == this->survival_mask && !this->base_table.empty())
+        return;
+    this->birth_mask = birth;
+    this->survival_mask = survival;
+
+    // for each 4x4 block (bit 4*y+x), the next state of the four center cells (bits nw, ne, sw, se)
+    this->base_table.assign(1 << 16, 0);
+    for(int block = 0; block < (1 << 16); block++)
+    {
+        uint8_t result = 0;
+        for(int i = 0; i < 4; i++)
+        {
+            const int cx = 1 + (i & 1);
+            const int cy = 1 + (i >> 1);
+            int count = 0;
+            for(int dy = -1; dy <= 1; dy++)
+                for(int dx = -1; dx <= 1; dx++)
+                    if(dx || dy)
+                        count += (block >> (4 * (cy + dy) + cx + dx)) & 1;
+            const bool alive = (block >> (4 * cy + cx)) & 1;
+            if((alive ? survival : birth) >> count & 1)
+                result |= 1 << i;
+        }
+        this->base_table[block] = result;
+    }
+
+    // the cached results were for the old rule
+    for(Node& node : this->nodes)
+        node.result = NONE;
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeUniverse::Clear()
+{
+    this->nodes.clear();
+    this->node_index.clear();
+    this->nodes.push_back({ 0, 0, 0, 0, NONE, 0, -1 }); // dead cell
+    this->nodes.push_back({ 0, 0, 0, 0, NONE, 0, -1 }); // live cell
+    this->empty_nodes.assign(1, 0);
+    this->root = this->EmptyNode(MIN_ROOT_LEVEL);
+}
+
+// ---------------------------------------------------------------------
+
+uint32_t HashlifeUniverse::Join(uint32_t nw,uint32_t ne,uint32_t sw,uint32_t se)
+{
+    const NodeKey key = { nw, ne, sw, se };
+    const auto found = this->node_index.find(key);
+    if(found != this->node_index.end())
+        return found->second;
+    const uint32_t index = (uint32_t)this->nodes.size();
+    this->nodes.push_back({ nw, ne, sw, se, NONE, (int8_t)(this->nodes[nw].level + 1), -1 });
+    this->node_index[key] = index;
+    return index;
+}
+
+// ---------------------------------------------------------------------
+
+uint32_t HashlifeUniverse::EmptyNode(int level)
+{
+    while((int)this->empty_nodes.size() <= level)
+    {
+        const uint32_t e = this->empty_nodes.back();
+        this->empty_nodes.push_back(this->Join(e, e, e, e));
+    }
+    return this->empty_nodes[level];
+}
+
+// ---------------------------------------------------------------------
+
+bool HashlifeUniverse::IsEmpty(uint32_t node) const
+{
+    const int level = this->nodes[node].level;
+    return level < (int)this->empty_nodes.size() && this->empty_nodes[level] == node;
+}
+
+// ---------------------------------------------------------------------
+
+uint32_t HashlifeUniverse::Expand(uint32_t node)
+{
+    // returns a node of twice the size with this one at its center
+    const Node n = this->nodes[node];
+    const uint32_t e = this->EmptyNode(n.level - 1);
+    return this->Join(this->Join(e, e, e, n.nw), this->Join(e, e, n.ne, e),
+                      this->Join(e, n.sw, e, e), this->Join(n.se, e, e, e));
+}
+
+// ---------------------------------------------------------------------
+
+uint32_t HashlifeUniverse::Center(uint32_t node)
+{
+    const Node n = this->nodes[node];
+    return this->Join(this->nodes[n.nw].se, this->nodes[n.ne].sw, this->nodes[n.sw].ne, this->nodes[n.se].nw);
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeUniverse::SetCell(int64_t x,int64_t y,bool alive)
+{
+    for(;;)
+    {
+        const int64_t half = int64_t(1) << (this->nodes[this->root].level - 1);
+        if(x >= -half && x < half && y >= -half && y < half)
+        {
+            this->root = this->SetCell(this->root, x + half, y + half, alive);
+            return;
+        }
+        if(this->nodes[this->root].level >= MAX_ROOT_LEVEL)
+            throw runtime_error("HashlifeUniverse::SetCell : coordinates out of range");
+        this->root = this->Expand(this->root);
+    }
+}
+
+// ---------------------------------------------------------------------
+
+uint32_t HashlifeUniverse::SetCell(uint32_t node,int64_t x,int64_t y,bool alive)
+{
+    // x and y are relative to the top-left corner of the node
+    Node n = this->nodes[node];
+    if(n.level == 0)
+        return alive ? 1 : 0;
+    const int64_t half = int64_t(1) << (n.level - 1);
+    if(y < half)
+    {
+        if(x < half) n.nw = this->SetCell(n.nw, x, y, alive);
+        else         n.ne = this->SetCell(n.ne, x - half, y, alive);
+    }
+    else
+    {
+        if(x < half) n.sw = this->SetCell(n.sw, x, y - half, alive);
+        else         n.se = this->SetCell(n.se, x - half, y - half, alive);
+    }
+    return this->Join(n.nw, n.ne, n.sw, n.se);
+}
+
+// ---------------------------------------------------------------------
+
+bool HashlifeUniverse::GetCell(int64_t x,int64_t y) const
+{
+    uint32_t node = this->root;
+    int64_t half = int64_t(1) << (this->nodes[node].level - 1);
+    if(x < -half || x >= half || y < -half || y >= half)
+        return false;
+    x += half;
+    y += half;
+    while(this->nodes[node].level > 0)
+    {
+        const Node& n = this->nodes[node];
+        half = int64_t(1) << (n.level - 1);
+        if(y < half) node = (x < half) ? n.nw : n.ne;
+        else         node = (x < half) ? n.sw : n.se;
+        if(x >= half) x -= half;
+        if(y >= half) y -= half;
+    }
+    return node == 1;
+}
+
+// ---------------------------------------------------------------------
+
+uint32_t HashlifeUniverse::BaseResult(uint32_t node)
+{
+    // gather the 4x4 block of cells
+    const Node& n = this->nodes[node];
+    const uint32_t quadrants[4] = { n.nw, n.ne, n.sw, n.se };
+    int block = 0;
+    for(int q = 0; q < 4; q++)
+    {
+        const Node& c = this->nodes[quadrants[q]];
+        const int x = 2 * (q & 1);
+        const int y = 2 * (q >> 1);
+        block |= (int)c.nw << (4 * y + x);
+        block |= (int)c.ne << (4 * y + x + 1);
+        block |= (int)c.sw << (4 * (y + 1) + x);
+        block |= (int)c.se << (4 * (y + 1) + x + 1);
+    }
+    const uint8_t r = this->base_table[block];
+    return this->Join(r & 1, (r >> 1) & 1, (r >> 2) & 1, (r >> 3) & 1);
+}
+
+// ---------------------------------------------------------------------
+
+uint32_t HashlifeUniverse::Result(uint32_t node,int step)
+{
+    // returns the center half of the node after 2^step generations, where step <= level-2
+    const Node n = this->nodes[node];
+    if(n.result != NONE && n.result_step == step)
+        return n.result;
+
+    uint32_t result;
+    if(this->IsEmpty(node))
+        result = this->EmptyNode(n.level - 1);
+    else if(n.level == 2)
+        result = this->BaseResult(node);
+    else
+    {
+        // the nine overlapping subnodes of half the size
+        const Node a = this->nodes[n.nw], b = this->nodes[n.ne], c = this->nodes[n.sw], d = this->nodes[n.se];
+        uint32_t sub[3][3] = {
+            { n.nw,                               this->Join(a.ne, b.nw, a.se, b.sw), n.ne },
+            { this->Join(a.sw, a.se, c.nw, c.ne), this->Join(a.se, b.sw, c.ne, d.nw), this->Join(b.sw, b.se, d.nw, d.ne) },
+            { n.sw,                               this->Join(c.ne, d.nw, c.se, d.sw), n.se } };
+        int inner_step = step;
+        if(step == n.level - 2)
+        {
+            // full speed: advance each by half the generations, then the four combinations by the other half
+            inner_step = step - 1;
+            for(int i = 0; i < 3; i++)
+                for(int j = 0; j < 3; j++)
+                    sub[i][j] = this->Result(sub[i][j], inner_step);
+        }
+        else
+        {
+            // slower: no time passes in this half, only in the next
+            for(int i = 0; i < 3; i++)
+                for(int j = 0; j < 3; j++)
+                    sub[i][j] = this->Center(sub[i][j]);
+        }
+        const uint32_t nw = this->Join(sub[0][0], sub[0][1], sub[1][0], sub[1][1]);
+        const uint32_t ne = this->Join(sub[0][1], sub[0][2], sub[1][1], sub[1][2]);
+        const uint32_t sw = this->Join(sub[1][0], sub[1][1], sub[2][0], sub[2][1]);
+        const uint32_t se = this->Join(sub[1][1], sub[1][2], sub[2][1], sub[2][2]);
+        result = this->Join(this->Result(nw, inner_step), this->Result(ne, inner_step),
+                            this->Result(sw, inner_step), this->Result(se, inner_step));
+    }
+    this->nodes[node].result = result;
+    this->nodes[node].result_step = (int8_t)step;
+    return result;
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeUniverse::Step(uint64_t n_generations)
+{
+    for(int step = 63; step >= 0; step--)
+        if((n_generations >> step) & 1)
+            this->AdvancePowerOfTwo(step);
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeUniverse::AdvancePowerOfTwo(int step)
+{
+    if(this->nodes.size() > this->gc_threshold)
+    {
+        this->CollectGarbage();
+        if(this->nodes.size() > this->gc_threshold / 2)
+            this->gc_threshold *= 2; // most of the nodes are in use, so allow more
+    }
+
+    // pad with empty space until the pattern cannot escape the center half in the time available
+    while(this->nodes[this->root].level < step + 3 ||
+          this->root != this->Expand(this->Expand(this->Center(this->Center(this->root)))))
+    {
+        if(this->nodes[this->root].level >= MAX_ROOT_LEVEL)
+            throw runtime_error("HashlifeUniverse::Step : the pattern has grown too large");
+        this->root = this->Expand(this->root);
+    }
+
+    this->root = this->Result(this->root, step);
+
+    // remove the empty border
+    while(this->nodes[this->root].level > MIN_ROOT_LEVEL && this->root == this->Expand(this->Center(this->root)))
+        this->root = this->Center(this->root);
+}
+
+// ---------------------------------------------------------------------
+
+uint32_t HashlifeUniverse::CopyNode(uint32_t node,vector<Node>& new_nodes,vector<uint32_t>& remap) const
+{
+    if(remap[node] != NONE)
+        return remap[node];
+    const Node& n = this->nodes[node];
+    Node copy = { CopyNode(n.nw, new_nodes, remap), CopyNode(n.ne, new_nodes, remap),
+                  CopyNode(n.sw, new_nodes, remap), CopyNode(n.se, new_nodes, remap), NONE, n.level, -1 };
+    remap[node] = (uint32_t)new_nodes.size();
+    new_nodes.push_back(copy);
+    return remap[node];
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeUniverse::CollectGarbage()
+{
+    // copy the nodes reachable from the root (and the empty nodes) into a fresh store, dropping the cached results
+    vector<Node> new_nodes;
+    vector<uint32_t> remap(this->nodes.size(), NONE);
+    new_nodes.push_back(this->nodes[0]);
+    new_nodes.push_back(this->nodes[1]);
+    remap[0] = 0;
+    remap[1] = 1;
+    for(uint32_t& e : this->empty_nodes)
+        e = this->CopyNode(e, new_nodes, remap);
+    this->root = this->CopyNode(this->root, new_nodes, remap);
+    this->nodes.swap(new_nodes);
+
+    this->node_index.clear();
+    for(uint32_t i = 2; i < (uint32_t)this->nodes.size(); i++)
+    {
+        const Node& n = this->nodes[i];
+        this->node_index[{ n.nw, n.ne, n.sw, n.se }] = i;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeUniverse::Rasterize(int64_t x0,int64_t y0,int width,int height,uint8_t* out) const
+{
+    fill(out, out + (size_t)width * height, 0);
+    const int64_t half = int64_t(1) << (this->nodes[this->root].level - 1);
+    this->Rasterize(this->root, -half, -half, x0, y0, width, height, out);
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeUniverse::Rasterize(uint32_t node,int64_t ox,int64_t oy,int64_t x0,int64_t y0,int width,int height,uint8_t* out) const
+{
+    const Node& n = this->nodes[node];
+    const int64_t size = int64_t(1) << n.level;
+    if(ox >= x0 + width || oy >= y0 + height || ox + size <= x0 || oy + size <= y0 || this->IsEmpty(node))
+        return;
+    if(n.level == 0)
+    {
+        out[(size_t)(oy - y0) * width + (ox - x0)] = 1;
+        return;
+    }
+    const int64_t half = size / 2;
+    this->Rasterize(n.nw, ox, oy, x0, y0, width, height, out);
+    this->Rasterize(n.ne, ox + half, oy, x0, y0, width, height, out);
+    this->Rasterize(n.sw, ox, oy + half, x0, y0, width, height, out);
+    this->Rasterize(n.se, ox + half, oy + half, x0, y0, width, height, out);
+}
+
+// ---------------------------------------------------------------------
+
+void HashlifeUniverse::ClearOutside(int64_t x0,int64_t y0,int width,int height)
+{
+    const int64_t half = int64_t(1) << (this->nodes[this->root].level - 1);
+    this->root = this->ClearOutside(this->root, -half, -half, x0, y0, width, height);
+}
+
+// ---------------------------------------------------------------------
+
+uint32_t HashlifeUniverse::ClearOutside(uint32_t node,int64_t ox,int64_t oy,int64_t x0,int64_t y0,int width,int height)
+{
+    // the nodes wholly inside the region are kept as they are, so their cached results stay valid
+    const Node n = this->nodes[node]; // (a copy, since Join can reallocate the store)
+    const int64_t size = int64_t(1) << n.level;
+    if(this->IsEmpty(node) || (ox >= x0 && oy >= y0 && ox + size <= x0 + width && oy + size <= y0 + height))
+        return node;
+    if(ox >= x0 + width || oy >= y0 + height || ox + size <= x0 || oy + size <= y0)
+        return this->EmptyNode(n.level);
+    const int64_t half = size / 2;
+    const uint32_t nw = this->ClearOutside(n.nw, ox, oy, x0, y0, width, height);
+    const uint32_t ne = this->ClearOutside(n.ne, ox + half, oy, x0, y0, width, height);
+    const uint32_t sw = this->ClearOutside(n.sw, ox, oy + half, x0, y0, width, height);
+    const uint32_t se = this->ClearOutside(n.se, ox + half, oy + half, x0, y0, width, height);
+    return this->Join(nw, ne, sw, se);
+}
+
+// ---------------------------------------------------------------------
+
+size_t HashlifeUniverse::GetMemorySize() const
+{
+    // (the hash table overhead is approximate)
+    return this->nodes.capacity() * sizeof(Node)
+        + this->node_index.size() * (sizeof(NodeKey) + sizeof(uint32_t) + 2 * sizeof(void*))
+        + this->node_index.bucket_count() * sizeof(void*)
+        + this->base_table.size();
+}
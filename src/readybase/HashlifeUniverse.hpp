@@ -0,0 +1,109 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __HASHLIFEUNIVERSE__
+#define __HASHLIFEUNIVERSE__
+
+// STL:
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/// An unbounded 2D plane of two-state cells, stored as a quadtree of shared nodes and advanced with memoized results.
+/** Identical subtrees are stored only once, so each node is canonical and its future (the center half after 2^j
+ *  generations) can be cached on it. Patterns with repeated structure then advance by huge numbers of generations at
+ *  little cost. The rule is outer-totalistic on the Moore neighborhood and must not include B0. Cell (0,0) is at the
+ *  center of the tree, with x increasing to the east and y to the south. */
+class HashlifeUniverse
+{
+    public:
+
+        HashlifeUniverse();
+
+        /// Sets the rule from bit masks as given by BinaryCAImageRD::ParseRule. Cached results are discarded if it changes.
+        void SetRule(uint32_t birth,uint32_t survival);
+
+        /// Makes every cell dead.
+        void Clear();
+
+        /// Makes every cell outside the region [x0,x0+width) x [y0,y0+height) dead, keeping the cached results.
+        void ClearOutside(int64_t x0,int64_t y0,int width,int height);
+
+        void SetCell(int64_t x,int64_t y,bool alive);
+        bool GetCell(int64_t x,int64_t y) const;
+
+        /// Advances the whole universe by n generations, as a sequence of power-of-two jumps.
+        void Step(uint64_t n_generations);
+
+        /// Writes the region [x0,x0+width) x [y0,y0+height) into out (row-major, 1 for alive, 0 for dead).
+        /** Only the parts of the tree that overlap the region are visited, and empty parts are skipped. */
+        void Rasterize(int64_t x0,int64_t y0,int width,int height,uint8_t* out) const;
+
+        size_t GetNumberOfNodes() const { return this->nodes.size(); }
+        size_t GetMemorySize() const;
+
+        /// When the node store grows beyond this, the nodes not reachable from the current pattern are discarded before the next jump.
+        void SetGarbageCollectionThreshold(size_t n_nodes) { this->gc_threshold = n_nodes; }
+
+    private:
+
+        struct Node
+        {
+            uint32_t nw, ne, sw, se;  // children, or unused for the two level-0 nodes (0 = dead cell, 1 = live cell)
+            uint32_t result;          // the cached center half after 2^result_step generations, or NONE
+            int8_t level;             // the node covers 2^level x 2^level cells
+            int8_t result_step;
+        };
+        struct NodeKey
+        {
+            uint32_t nw, ne, sw, se;
+            bool operator==(const NodeKey& o) const { return nw == o.nw && ne == o.ne && sw == o.sw && se == o.se; }
+        };
+        struct NodeKeyHash
+        {
+            size_t operator()(const NodeKey& k) const;
+        };
+
+        static const uint32_t NONE = 0xFFFFFFFF;
+
+        uint32_t Join(uint32_t nw,uint32_t ne,uint32_t sw,uint32_t se);
+        uint32_t EmptyNode(int level);
+        uint32_t Expand(uint32_t node);
+        uint32_t Center(uint32_t node);
+        uint32_t SetCell(uint32_t node,int64_t x,int64_t y,bool alive);
+        uint32_t BaseResult(uint32_t node);
+        uint32_t Result(uint32_t node,int step);
+        void AdvancePowerOfTwo(int step);
+        void CollectGarbage();
+        uint32_t CopyNode(uint32_t node,std::vector<Node>& new_nodes,std::vector<uint32_t>& remap) const;
+        void Rasterize(uint32_t node,int64_t ox,int64_t oy,int64_t x0,int64_t y0,int width,int height,uint8_t* out) const;
+        uint32_t ClearOutside(uint32_t node,int64_t ox,int64_t oy,int64_t x0,int64_t y0,int width,int height);
+        bool IsEmpty(uint32_t node) const;
+
+    private:
+
+        std::vector<Node> nodes;
+        std::unordered_map<NodeKey,uint32_t,NodeKeyHash> node_index;
+        std::vector<uint32_t> empty_nodes; // the empty node at each level
+        uint32_t root;
+        uint32_t birth_mask, survival_mask;
+        std::vector<uint8_t> base_table; // the center 2x2 cells of a 4x4 block after one generation
+        size_t gc_threshold;
+};
+
+#endif
@@ -25,7 +25,9 @@
 
 // STL:
 #include <algorithm>
+#include <array>
 #include <cassert>
+#include <cmath>
 #include <stdexcept>
 
 // VTK:
@@ -200,7 +202,17 @@ void ImageRD::CopyFromImage(vtkImageData* im)
         for(int iChem=0;iChem<this->GetNumberOfChemicals();iChem++)
         {
             this->images[iChem]->SetExtent(im->GetExtent());
-            this->images[iChem]->GetPointData()->SetScalars(im->GetPointData()->GetArray(GetChemicalName(iChem).c_str()));
+            vtkDataArray *source = im->GetPointData()->GetArray(GetChemicalName(iChem).c_str());
+            if(source->GetDataType() != this->GetStorageDataType())
+            {
+                // e.g. a file saved with a different storage type
+                vtkSmartPointer<vtkDataArray> converted = vtkSmartPointer<vtkDataArray>::Take( vtkDataArray::CreateDataArray( this->GetStorageDataType() ) );
+                converted->DeepCopy(source);
+                converted->SetName(source->GetName());
+                this->images[iChem]->GetPointData()->SetScalars(converted);
+            }
+            else
+                this->images[iChem]->GetPointData()->SetScalars(source);
         }
     }
     else if(n_arrays==1 && n_components==this->GetNumberOfChemicals())
@@ -218,7 +230,7 @@ void ImageRD::CopyFromImage(vtkImageData* im)
     else
         throw runtime_error("ImageRD::CopyFromImage : chemical count mismatch");
 
-    this->undo_stack.clear();
+    this->undo_history.Clear();
 }
 
 // ---------------------------------------------------------------------
@@ -247,7 +259,7 @@ void ImageRD::CopyFromMesh(
             image_size[xyz] <<= 1;
         }
     }
-    AllocateImages(image_size[0], image_size[1], image_size[2], num_chemicals, this->GetDataType());
+    AllocateImages(image_size[0], image_size[1], image_size[2], num_chemicals, this->GetStorageDataType());
     BlankImage(value_outside);
 
     // write data into the image
@@ -282,7 +294,7 @@ void ImageRD::AllocateImages(int x,int y,int z,int nc,int data_type)
     for(int i=0;i<nc;i++)
         this->images[i] = AllocateVTKImage(x,y,z,data_type);
     this->is_modified = true;
-    this->undo_stack.clear();
+    this->undo_history.Clear();
 }
 
 // ---------------------------------------------------------------------
@@ -308,35 +320,86 @@ void ImageRD::GenerateInitialPattern()
     const int X = this->images.front()->GetDimensions()[0];
     const int Y = this->images.front()->GetDimensions()[1];
     const int Z = this->images.front()->GetDimensions()[2];
+    const int NC = this->GetNumberOfChemicals();
+
+    this->ReseedInitialPatternGenerator();
 
-    for (size_t iOverlay = 0; iOverlay < this->initial_pattern_generator.GetNumberOfOverlays(); iOverlay++)
+    vector<const Overlay*> overlays;
+    vector<bool> is_target(NC, false);
+    for(size_t iOverlay=0; iOverlay < this->initial_pattern_generator.GetNumberOfOverlays(); iOverlay++)
     {
-        this->initial_pattern_generator.GetOverlay(iOverlay).Reseed();
+        const Overlay& overlay = this->initial_pattern_generator.GetOverlay(iOverlay);
+        int iC = overlay.GetTargetChemical();
+        if(iC<0 || iC>=NC)
+            continue; // best for now to silently ignore this overlay, because the user has no way of editing the overlays (short of editing the file)
+            //throw runtime_error("Overlay: chemical out of range: "+GetChemicalName(iC));
+        overlays.push_back(&overlay);
+        is_target[iC] = true;
     }
 
-    for(int z=0;z<Z;z++)
+    // find the range of cells that each overlay can change, so that only those need visiting
+    const ArenaSize arena = { this->GetX(), this->GetY(), this->GetZ(), this->GetArenaDimensionality() };
+    const int dims[3] = { X, Y, Z };
+    vector<array<int,6> > ranges(overlays.size()); // (the first and last cell on each axis)
+    for(size_t iOverlay=0; iOverlay < overlays.size(); iOverlay++)
     {
-        for(int y=0;y<Y;y++)
+        double bounds[6];
+        const bool bounded = overlays[iOverlay]->GetBounds(arena, bounds);
+        for(int xyz=0;xyz<3;xyz++)
         {
-            for(int x=0;x<X;x++)
-            {
-                for(size_t iOverlay=0; iOverlay < this->initial_pattern_generator.GetNumberOfOverlays(); iOverlay++)
-                {
-                    const Overlay& overlay = this->initial_pattern_generator.GetOverlay(iOverlay);
-
-                    int iC = overlay.GetTargetChemical();
-                    if(iC<0 || iC>=this->GetNumberOfChemicals())
-                        continue; // best for now to silently ignore this overlay, because the user has no way of editing the overlays (short of editing the file)
-                        //throw runtime_error("Overlay: chemical out of range: "+GetChemicalName(iC));
+            // (with a cell to spare on each side, so that rounding can't exclude a cell that is inside)
+            const double first = bounded ? floor(bounds[xyz*2+0]) - 1 : 0.0;
+            const double last = bounded ? ceil(bounds[xyz*2+1]) + 1 : dims[xyz] - 1.0;
+            ranges[iOverlay][xyz*2+0] = (int)min<double>(dims[xyz], max(0.0, first));
+            ranges[iOverlay][xyz*2+1] = (int)max(-1.0, min(dims[xyz] - 1.0, last));
+        }
+    }
 
-                    vector<double> vals(this->GetNumberOfChemicals());
-                    for(int i=0;i<this->GetNumberOfChemicals();i++)
-                        vals[i] = this->GetImage(i)->GetScalarComponentAsDouble(x,y,z,0);
-                    this->GetImage(iC)->SetScalarComponentFromDouble(x, y, z, 0, overlay.Apply(vals, *this, x, y, z));
-                }
+    // apply the overlays a row at a time, with the rows shared out between threads
+    vector<vtkDataArray*> arrays(NC);
+    for(int i=0;i<NC;i++)
+        arrays[i] = this->GetImage(i)->GetPointData()->GetScalars();
+    const size_t MIN_CELLS_PER_THREAD = 4096;
+    parallel_for(size_t(Y)*Z, [&](size_t first_row, size_t last_row) {
+        vector<vector<double> > row(NC, vector<double>(X));
+        vector<double*> vals(NC);
+        vector<float> xs(X), ys(X), zs(X);
+        for(int x=0;x<X;x++)
+            xs[x] = float(x);
+        vector<size_t> row_overlays;
+        Overlay::SpanScratch scratch;
+        for(size_t iRow=first_row;iRow<last_row;iRow++)
+        {
+            const int y = int(iRow % Y);
+            const int z = int(iRow / Y);
+            row_overlays.clear();
+            for(size_t iOverlay=0; iOverlay < overlays.size(); iOverlay++)
+            {
+                const array<int,6>& range = ranges[iOverlay];
+                if(range[0] <= range[1] && y >= range[2] && y <= range[3] && z >= range[4] && z <= range[5])
+                    row_overlays.push_back(iOverlay);
+            }
+            if(row_overlays.empty())
+                continue;
+            fill(ys.begin(), ys.end(), float(y));
+            fill(zs.begin(), zs.end(), float(z));
+            for(int i=0;i<NC;i++)
+                read_values(arrays[i], iRow*X, X, row[i].data());
+            for(size_t iOverlay : row_overlays)
+            {
+                // apply the overlay to just the part of the row that it can change
+                const int x0 = ranges[iOverlay][0];
+                for(int i=0;i<NC;i++)
+                    vals[i] = row[i].data() + x0;
+                overlays[iOverlay]->ApplyToSpan(vals, *this, arena, xs.data() + x0, ys.data() + x0, zs.data() + x0,
+                                                ranges[iOverlay][1] - x0 + 1, iRow*X + x0, scratch);
             }
+            for(int i=0;i<NC;i++)
+                if(is_target[i])
+                    write_values(arrays[i], iRow*X, X, row[i].data());
         }
-    }
+    }, max<size_t>(1, MIN_CELLS_PER_THREAD / X));
+
     for(int i=0;i<(int)this->images.size();i++)
         this->images[i]->Modified();
     this->timesteps_taken = 0;
@@ -352,18 +415,23 @@ void ImageRD::BlankImage(float value)
         this->images[iImage]->Modified();
     }
     this->timesteps_taken = 0;
-    this->undo_stack.clear();
+    this->undo_history.Clear();
 }
 
 // ---------------------------------------------------------------------
 
-void ImageRD::Update(int n_steps)
+void ImageRD::Step(int n_steps)
 {
-    this->undo_stack.clear();
+    this->undo_history.Clear();
     this->InternalUpdate(n_steps);
 
     this->timesteps_taken += n_steps;
+}
 
+// ---------------------------------------------------------------------
+
+void ImageRD::UpdateRenderPipeline()
+{
     for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
         this->images[ic]->Modified();
 
@@ -1253,14 +1321,18 @@ void ImageRD::AddPhasePlot(vtkRenderer* pRenderer,float scaling,float low,float
 
 void ImageRD::SaveStartingPattern()
 {
-    this->GetImage(this->starting_pattern);
+    if(this->SaveCompactStartingPattern())
+        this->starting_pattern->Initialize(); // (the values are kept by AbstractRD instead)
+    else
+        this->GetImage(this->starting_pattern);
 }
 
 // ---------------------------------------------------------------------
 
 void ImageRD::RestoreStartingPattern()
 {
-    this->CopyFromImage(this->starting_pattern);
+    if(!this->RestoreCompactStartingPattern())
+        this->CopyFromImage(this->starting_pattern);
     this->timesteps_taken = 0;
 }
 
@@ -1268,7 +1340,7 @@ void ImageRD::RestoreStartingPattern()
 
 void ImageRD::SetDimensions(int x, int y, int z)
 {
-    this->AllocateImages(x,y,z,this->GetNumberOfChemicals(),this->data_type);
+    this->AllocateImages(x,y,z,this->GetNumberOfChemicals(),this->GetStorageDataType());
 }
 
 // ---------------------------------------------------------------------
@@ -1288,7 +1360,7 @@ void ImageRD::SetNumberOfChemicals(int n, bool reallocate_storage)
     if (n > this->n_chemicals)
     {
         while (static_cast<int>(this->images.size()) < n) {
-            this->images.push_back( AllocateVTKImage(X, Y, Z, this->data_type) );
+            this->images.push_back( AllocateVTKImage(X, Y, Z, this->GetStorageDataType()) );
             this->images.back()->GetPointData()->GetScalars()->FillComponent(0, 0.0);
         }
     }
@@ -1303,7 +1375,7 @@ void ImageRD::SetNumberOfChemicals(int n, bool reallocate_storage)
 
 void ImageRD::SetDimensionsAndNumberOfChemicals(int x,int y,int z,int nc)
 {
-    this->AllocateImages(x,y,z,nc,this->data_type);
+    this->AllocateImages(x,y,z,nc,this->GetStorageDataType());
 }
 
 // ---------------------------------------------------------------------
@@ -1417,7 +1489,7 @@ void ImageRD::SaveFile(const char* filename,const Properties& render_settings,bo
     im->GetPointData()->SetScalars(NULL);
     for(int iChem=0;iChem<this->GetNumberOfChemicals();iChem++)
     {
-        vtkSmartPointer<vtkDataArray> da = vtkSmartPointer<vtkDataArray>::Take( vtkDataArray::CreateDataArray( this->data_type ) );
+        vtkSmartPointer<vtkDataArray> da = vtkSmartPointer<vtkDataArray>::Take( vtkDataArray::CreateDataArray( this->GetStorageDataType() ) );
         da->DeepCopy(this->images[iChem]->GetPointData()->GetScalars());
         da->SetName(GetChemicalName(iChem).c_str());
         im->GetPointData()->AddArray(da);
@@ -1517,7 +1589,7 @@ void ImageRD::SetFrom2DImage(int iChemical, vtkImageData *im)
     }
     this->images[iChemical]->GetPointData()->DeepCopy(im->GetPointData());
     this->images[iChemical]->Modified();
-    this->undo_stack.clear();
+    this->undo_history.Clear();
 }
 
 // --------------------------------------------------------------------------------
@@ -1561,7 +1633,7 @@ float ImageRD::GetValue(float x,float y,float z,const Properties& render_setting
     iy = min(Y-1,max(0,iy));
     iz = min(Z-1,max(0,iz));
 
-    return this->GetImage(iChemical)->GetScalarComponentAsFloat(ix,iy,iz,0);
+    return this->GetRegion(iChemical,ix,iy,iz,1,1,1).front();
 }
 
 // --------------------------------------------------------------------------------
@@ -1681,37 +1753,82 @@ void ImageRD::SetValuesInRadius(float x,float y,float z,float r,float val,const
 
 // --------------------------------------------------------------------------------
 
-void ImageRD::FlipPaintAction(PaintAction& cca)
+void ImageRD::ReadCellValues(int iChemical,int first_cell,int n_cells,float* values) const
 {
-    float *pCell = static_cast<float*>(this->GetImage(cca.iChemical)->GetScalarPointer()) + cca.iCell;
-    float old_val = *pCell;
-    *pCell = cca.val;
-    cca.val = old_val;
-    cca.done = !cca.done;
-    this->images[cca.iChemical]->Modified();
+    vector<double> buffer(n_cells);
+    read_values(this->images[iChemical]->GetPointData()->GetScalars(), first_cell, n_cells, buffer.data());
+    copy(buffer.begin(), buffer.end(), values);
+}
+
+// --------------------------------------------------------------------------------
+
+void ImageRD::WriteCellValues(int iChemical,int first_cell,int n_cells,const float* values)
+{
+    const vector<double> buffer(values, values + n_cells);
+    write_values(this->images[iChemical]->GetPointData()->GetScalars(), first_cell, n_cells, buffer.data());
+    this->images[iChemical]->Modified();
+    this->is_modified = true;
+}
+
+// --------------------------------------------------------------------------------
+
+vector<Timeline::Block> ImageRD::GetStateBlocks()
+{
+    vector<Timeline::Block> blocks;
+    for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
+    {
+        vtkDataArray* scalars = this->images[ic]->GetPointData()->GetScalars();
+        const size_t element_size = scalars->GetDataTypeSize();
+        blocks.push_back({ scalars->GetVoidPointer(0), size_t(scalars->GetNumberOfValues()) * element_size, element_size });
+    }
+    return blocks;
+}
+
+// --------------------------------------------------------------------------------
+
+void ImageRD::AllCellsChanged()
+{
+    for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
+        this->images[ic]->Modified();
 }
 
 // --------------------------------------------------------------------------------
 
 size_t ImageRD::GetMemorySize() const
 {
-    return this->n_chemicals * this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    return this->n_chemicals * this->GetStorageSize() * this->GetX() * this->GetY() * this->GetZ();
 }
 
 // --------------------------------------------------------------------------------
 
 vector<float> ImageRD::GetData(int i_chemical) const
 {
-    vector<float> values(this->GetX() * this->GetY() * this->GetZ());
+    return this->GetRegion(i_chemical, 0, 0, 0, this->GetX(), this->GetY(), this->GetZ());
+}
+
+// --------------------------------------------------------------------------------
+
+vector<float> ImageRD::GetRegion(int i_chemical,int x0,int y0,int z0,int nx,int ny,int nz) const
+{
+    const int X = this->GetX();
+    const int Y = this->GetY();
+    const int Z = this->GetZ();
+    if(i_chemical < 0 || i_chemical >= this->GetNumberOfChemicals() || nx < 0 || ny < 0 || nz < 0 ||
+       x0 < 0 || y0 < 0 || z0 < 0 || x0 + nx > X || y0 + ny > Y || z0 + nz > Z)
+        throw runtime_error("ImageRD::GetRegion : region out of range");
+
+    // read each row of the box in one go
+    vtkDataArray* scalars = this->images[i_chemical]->GetPointData()->GetScalars();
+    vector<float> values(size_t(nx) * ny * nz);
+    vector<double> row(nx);
     size_t i = 0;
-    for(int z = 0; z < this->GetZ(); z++)
+    for(int z = z0; z < z0 + nz; z++)
     {
-        for (int y = 0; y < this->GetY(); y++)
+        for(int y = y0; y < y0 + ny; y++)
         {
-            for (int x = 0; x < this->GetX(); x++)
-            {
-                values[i++] = this->images[i_chemical]->GetScalarComponentAsFloat(x, y, z, 0);
-            }
+            read_values(scalars, size_t(X) * (size_t(Y) * z + y) + x0, nx, row.data());
+            for(int x = 0; x < nx; x++)
+                values[i++] = static_cast<float>(row[x]);
         }
     }
     return values;
@@ -39,7 +39,8 @@ class ImageRD : public AbstractRD
             const Properties& render_settings,
             bool generate_initial_pattern_when_loading) const override;
 
-        void Update(int n_steps) override;
+        void Step(int n_steps) override;
+        void UpdateRenderPipeline() override;
 
         bool HasEditableDimensions() const  override { return true; }
         float GetX() const override;
@@ -84,6 +85,10 @@ class ImageRD : public AbstractRD
 
         std::vector<float> GetData(int i_chemical) const override;
 
+        /// Returns the values of a chemical in the box [x0,x0+nx) x [y0,y0+ny) x [z0,z0+nz), x fastest.
+        /** Implementations that keep the chemicals elsewhere (e.g. on an OpenCL device) read just this box from there. */
+        virtual std::vector<float> GetRegion(int i_chemical,int x0,int y0,int z0,int nx,int ny,int nz) const;
+
     protected:
 
         std::vector<vtkSmartPointer<vtkImageData>> images; ///< one for each chemical
@@ -110,7 +115,10 @@ class ImageRD : public AbstractRD
 
         int GetArenaDimensionality() const override;
 
-        void FlipPaintAction(PaintAction& cca) override;
+        void ReadCellValues(int iChemical,int first_cell,int n_cells,float* values) const override;
+        void WriteCellValues(int iChemical,int first_cell,int n_cells,const float* values) override;
+        std::vector<Timeline::Block> GetStateBlocks() override;
+        void AllCellsChanged() override;
 
         // some saved handles into the pipeline, for manual updates to workaround a named arrays problem
         vtkAssignAttribute *assign_attribute_filter;
@@ -24,13 +24,13 @@
 #include "utils.hpp"
 
 // VTK:
+#include <vtkAbstractArray.h>
 #include <vtkActor.h>
 #include <vtkAssignAttribute.h>
 #include <vtkCaptionActor2D.h>
 #include <vtkCellArray.h>
 #include <vtkCellData.h>
 #include <vtkCellDataToPointData.h>
-#include <vtkCellLocator.h>
 #include <vtkContourFilter.h>
 #include <vtkCubeAxesActor2D.h>
 #include <vtkCubeSource.h>
@@ -38,9 +38,12 @@
 #include <vtkDataSetMapper.h>
 #include <vtkDataSetSurfaceFilter.h>
 #include <vtkExtractEdges.h>
+#include <vtkFieldData.h>
+#include <vtkFloatArray.h>
 #include <vtkGenericCell.h>
 #include <vtkGeometryFilter.h>
 #include <vtkIdList.h>
+#include <vtkIntArray.h>
 #include <vtkMath.h>
 #include <vtkMergeFilter.h>
 #include <vtkPlane.h>
@@ -54,6 +57,7 @@
 #include <vtkReverseSense.h>
 #include <vtkScalarBarActor.h>
 #include <vtkScalarsToColors.h>
+#include <vtkStringArray.h>
 #include <vtkTextActor.h>
 #include <vtkTextProperty.h>
 #include <vtkThreshold.h>
@@ -67,6 +71,11 @@
 // STL:
 #include <stdexcept>
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
 
 using namespace std;
 
@@ -74,6 +83,15 @@ using namespace std;
 
 MeshRD::MeshRD(int data_type)
     : AbstractRD(data_type)
+    , neighbor_layout(NeighborLayout::CSR)
+    , max_neighbors(0)
+    , padded_width(0)
+    , cell_order(CellOrder::Original)
+    , bandwidth_before(0)
+    , bandwidth_after(0)
+    , integrator(Integrator::Explicit)
+    , preconditioner(SparseSolver::Preconditioner::IncompleteCholesky)
+    , max_cell_radius(0.0f)
 {
     this->starting_pattern = vtkSmartPointer<vtkUnstructuredGrid>::New();
     this->mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
@@ -81,13 +99,18 @@ MeshRD::MeshRD(int data_type)
 
 // ---------------------------------------------------------------------
 
-void MeshRD::Update(int n_steps)
+void MeshRD::Step(int n_steps)
 {
-    this->undo_stack.clear();
+    this->undo_history.Clear();
     this->InternalUpdate(n_steps);
 
     this->timesteps_taken += n_steps;
+}
+
+// ---------------------------------------------------------------------
 
+void MeshRD::UpdateRenderPipeline()
+{
     this->mesh->Modified();
 }
 
@@ -136,7 +159,11 @@ void MeshRD::SaveFile(const char* filename,const Properties& render_settings,boo
         iw->GenerateInitialPatternWhenLoading();
     iw->SetFileName(filename);
     iw->SetDataModeToBinary(); // workaround for http://www.vtk.org/Bug/view.php?id=13382
-    iw->SetInputData(this->mesh);
+    vtkSmartPointer<vtkUnstructuredGrid> mesh_to_save = vtkSmartPointer<vtkUnstructuredGrid>::New();
+    mesh_to_save->ShallowCopy(this->GetMeshInOriginalOrder());
+    if(this->GetNumberOfCells() >= MeshRD::MIN_CELLS_TO_SAVE_NEIGHBORS)
+        this->AddCellNeighborArrays(mesh_to_save);
+    iw->SetInputData(mesh_to_save);
     iw->Write();
 }
 
@@ -148,41 +175,96 @@ void MeshRD::GenerateInitialPattern()
         this->BlankImage();
     }
 
-    for (size_t iOverlay = 0; iOverlay < this->initial_pattern_generator.GetNumberOfOverlays(); iOverlay++)
+    this->ReseedInitialPatternGenerator();
+
+    const int NC = this->GetNumberOfChemicals();
+    vector<const Overlay*> overlays;
+    vector<bool> is_target(NC, false);
+    for(size_t iOverlay=0; iOverlay < this->initial_pattern_generator.GetNumberOfOverlays(); iOverlay++)
     {
-        this->initial_pattern_generator.GetOverlay(iOverlay).Reseed();
+        const Overlay& overlay = this->initial_pattern_generator.GetOverlay(iOverlay);
+        int iC = overlay.GetTargetChemical();
+        if(iC<0 || iC>=NC)
+            continue; // best for now to silently ignore this overlay, because the user has no way of editing the overlays (short of editing the file)
+            //throw runtime_error("Overlay: chemical out of range: "+GetChemicalName(iC));
+        overlays.push_back(&overlay);
+        is_target[iC] = true;
     }
 
-    float cp[3];
-    double *bounds = this->mesh->GetBounds();
-    for(vtkIdType iCell=0;iCell<this->mesh->GetNumberOfCells();iCell++)
+    // the overlays are sampled at the centre of each cell, relative to the corner of the bounding box
+    const vtkIdType n_cells = this->mesh->GetNumberOfCells();
+    const double *bounds = this->mesh->GetBounds();
+    this->CreateCellGridIfNeeded();
+    const float *cx = this->cell_grid.GetX(), *cy = this->cell_grid.GetY(), *cz = this->cell_grid.GetZ();
+    const ArenaSize arena = { this->GetX(), this->GetY(), this->GetZ(), this->GetArenaDimensionality() };
+    vector<vtkDataArray*> arrays(NC);
+    for(int i=0;i<NC;i++)
+        arrays[i] = this->mesh->GetCellData()->GetArray(GetChemicalName(i).c_str());
+
+    // find the box that each overlay can change, so that spans of cells outside it can be skipped
+    vector<array<double,6> > overlay_bounds(overlays.size());
+    vector<bool> is_bounded(overlays.size());
+    const double margin = 1e-4 * max(arena.X, max(arena.Y, arena.Z)); // (so that rounding can't exclude a cell that is inside)
+    for(size_t iOverlay=0; iOverlay < overlays.size(); iOverlay++)
     {
-        vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
-        this->mesh->GetCellPoints(iCell, ids);
-        // get a point at the centre of the cell (need a location to sample the overlays)
-        cp[0]=cp[1]=cp[2]=0.0f;
-        for(vtkIdType iPt=0;iPt<ids->GetNumberOfIds();iPt++)
-            for(int xyz=0;xyz<3;xyz++)
-                cp[xyz] += this->mesh->GetPoint(ids->GetId(iPt))[xyz]-bounds[xyz*2+0];
+        is_bounded[iOverlay] = overlays[iOverlay]->GetBounds(arena, overlay_bounds[iOverlay].data());
         for(int xyz=0;xyz<3;xyz++)
-            cp[xyz] /= ids->GetNumberOfIds();
-        for(size_t iOverlay=0; iOverlay < this->initial_pattern_generator.GetNumberOfOverlays(); iOverlay++)
         {
-            const Overlay& overlay = this->initial_pattern_generator.GetOverlay(iOverlay);
-
-            int iC = overlay.GetTargetChemical();
-            if(iC<0 || iC>=this->GetNumberOfChemicals())
-                continue; // best for now to silently ignore this overlay, because the user has no way of editing the overlays (short of editing the file)
-                //throw runtime_error("Overlay: chemical out of range: "+GetChemicalName(iC));
+            overlay_bounds[iOverlay][xyz*2+0] -= margin;
+            overlay_bounds[iOverlay][xyz*2+1] += margin;
+        }
+    }
 
-            vector<double> vals(this->GetNumberOfChemicals());
-            for(int i=0;i<this->GetNumberOfChemicals();i++)
+    // apply the overlays to spans of cells, with the spans shared out between threads
+    const size_t SPAN = 1024;
+    const size_t MIN_CELLS_PER_THREAD = 4096;
+    const double INF = numeric_limits<double>::infinity();
+    parallel_for((n_cells + SPAN - 1) / SPAN, [&](size_t first_span, size_t last_span) {
+        vector<vector<double> > span(NC, vector<double>(SPAN));
+        vector<double*> vals(NC);
+        for(int i=0;i<NC;i++)
+            vals[i] = span[i].data();
+        vector<float> xs(SPAN), ys(SPAN), zs(SPAN);
+        vector<const Overlay*> span_overlays;
+        Overlay::SpanScratch scratch;
+        for(size_t iSpan=first_span;iSpan<last_span;iSpan++)
+        {
+            const size_t first = iSpan * SPAN;
+            const int n = (int)min<size_t>(SPAN, n_cells - first);
+            array<double,6> span_bounds = { INF, -INF, INF, -INF, INF, -INF };
+            for(int j=0;j<n;j++)
             {
-                vals[i] = this->mesh->GetCellData()->GetArray(GetChemicalName(i).c_str())->GetComponent( iCell, 0 );
+                xs[j] = float(cx[first+j] - bounds[0]);
+                ys[j] = float(cy[first+j] - bounds[2]);
+                zs[j] = float(cz[first+j] - bounds[4]);
+                const float p[3] = { xs[j], ys[j], zs[j] };
+                for(int xyz=0;xyz<3;xyz++)
+                {
+                    span_bounds[xyz*2+0] = min<double>(span_bounds[xyz*2+0], p[xyz]);
+                    span_bounds[xyz*2+1] = max<double>(span_bounds[xyz*2+1], p[xyz]);
+                }
+            }
+            // (the cells are only read and written if an overlay's box overlaps the span's)
+            span_overlays.clear();
+            for(size_t iOverlay=0; iOverlay < overlays.size(); iOverlay++)
+            {
+                const array<double,6>& b = overlay_bounds[iOverlay];
+                if(!is_bounded[iOverlay] || (b[0] <= span_bounds[1] && b[1] >= span_bounds[0] &&
+                                             b[2] <= span_bounds[3] && b[3] >= span_bounds[2] &&
+                                             b[4] <= span_bounds[5] && b[5] >= span_bounds[4]))
+                    span_overlays.push_back(overlays[iOverlay]);
             }
-            this->mesh->GetCellData()->GetArray(GetChemicalName(iC).c_str())->SetComponent(iCell, 0, overlay.Apply(vals, *this, cp[0], cp[1], cp[2]));
+            if(span_overlays.empty())
+                continue;
+            for(int i=0;i<NC;i++)
+                read_values(arrays[i], first, n, vals[i]);
+            for(const Overlay* overlay : span_overlays)
+                overlay->ApplyToSpan(vals, *this, arena, xs.data(), ys.data(), zs.data(), n, first, scratch);
+            for(int i=0;i<NC;i++)
+                if(is_target[i])
+                    write_values(arrays[i], first, n, vals[i]);
         }
-    }
+    }, MIN_CELLS_PER_THREAD / SPAN);
     this->mesh->Modified();
     this->is_modified = true;
     this->timesteps_taken = 0;
@@ -198,7 +280,7 @@ void MeshRD::BlankImage(float value)
     }
     this->mesh->Modified();
     this->is_modified = true;
-    this->undo_stack.clear();
+    this->undo_history.Clear();
 }
 
 // ---------------------------------------------------------------------
@@ -226,14 +308,19 @@ float MeshRD::GetZ() const
 
 void MeshRD::CopyFromMesh(vtkUnstructuredGrid* mesh2)
 {
-    this->undo_stack.clear();
+    this->undo_history.Clear();
     this->mesh->DeepCopy(mesh2);
     this->is_modified = true;
     this->n_chemicals = this->mesh->GetCellData()->GetNumberOfArrays();
 
-    this->cell_locator = NULL;
+    this->cell_grid.Clear(); // (rebuilt when next needed, after the cells have been reordered)
+    this->cell_radii.clear();
+
+    if(!this->ReadCellNeighborArrays())
+        this->ComputeCellNeighbors(this->neighborhood_type);
 
-    this->ComputeCellNeighbors(this->neighborhood_type);
+    this->original_cell_ids.clear();
+    this->ReorderCells();
 }
 
 // ---------------------------------------------------------------------
@@ -639,22 +726,27 @@ void MeshRD::AddPhasePlot(vtkRenderer* pRenderer,float scaling,float low,float h
 
 void MeshRD::SaveStartingPattern()
 {
-    this->starting_pattern->DeepCopy(this->mesh);
+    if(this->SaveCompactStartingPattern())
+        this->starting_pattern->Initialize(); // (the values are kept by AbstractRD instead, and the mesh doesn't change)
+    else
+    {
+        // kept in the original order, since RestoreStartingPattern will reorder it again
+        this->starting_pattern->DeepCopy(this->GetMeshInOriginalOrder());
+    }
 }
 
 // ---------------------------------------------------------------------
 
 void MeshRD::RestoreStartingPattern()
 {
-    this->CopyFromMesh(this->starting_pattern);
+    if(!this->RestoreCompactStartingPattern())
+        this->CopyFromMesh(this->starting_pattern);
     this->is_modified = true;
     this->timesteps_taken = 0;
 }
 
 // ---------------------------------------------------------------------
 
-struct TNeighbor { vtkIdType iNeighbor; float weight; };
-
 void add_if_new(vector<TNeighbor>& neighbors,TNeighbor neighbor)
 {
     for(vector<TNeighbor>::const_iterator it=neighbors.begin();it!=neighbors.end();it++)
@@ -663,109 +755,242 @@ void add_if_new(vector<TNeighbor>& neighbors,TNeighbor neighbor)
     neighbors.push_back(neighbor);
 }
 
-bool IsEdgeNeighbor(vtkUnstructuredGrid *grid,vtkIdType iCell1,vtkIdType iCell2)
+namespace
 {
-    vtkSmartPointer<vtkIdList> cellIds = vtkSmartPointer<vtkIdList>::New();
-    vtkCell* pCell = grid->GetCell(iCell1);
-    for(int iEdge=0;iEdge<pCell->GetNumberOfEdges();iEdge++)
+    /// The points of each cell, and the points of each of its edges (or faces), in flat arrays.
+    struct TCellParts
     {
-        vtkIdList *vertIds = pCell->GetEdge(iEdge)->GetPointIds();
-        grid->GetCellNeighbors(iCell1,vertIds,cellIds);
-        if(cellIds->IsId(iCell2)>=0)
+        vector<vtkIdType> point_offsets, points;           ///< cell i has points [point_offsets[i],point_offsets[i+1])
+        vector<vtkIdType> part_offsets;                     ///< cell i has parts [part_offsets[i],part_offsets[i+1])
+        vector<vtkIdType> part_point_offsets, part_points;  ///< part j has points [part_point_offsets[j],part_point_offsets[j+1])
+
+        TCellParts() : point_offsets(1,0), part_offsets(1,0), part_point_offsets(1,0) {}
+
+        void Append(const TCellParts& other)
+        {
+            const vtkIdType points_base = this->points.size();
+            const vtkIdType parts_base = this->part_point_offsets.size() - 1;
+            const vtkIdType part_points_base = this->part_points.size();
+            for(size_t i=1;i<other.point_offsets.size();i++)
+                this->point_offsets.push_back(points_base + other.point_offsets[i]);
+            for(size_t i=1;i<other.part_offsets.size();i++)
+                this->part_offsets.push_back(parts_base + other.part_offsets[i]);
+            for(size_t i=1;i<other.part_point_offsets.size();i++)
+                this->part_point_offsets.push_back(part_points_base + other.part_point_offsets[i]);
+            this->points.insert(this->points.end(),other.points.begin(),other.points.end());
+            this->part_points.insert(this->part_points.end(),other.part_points.begin(),other.part_points.end());
+        }
+    };
+}
+
+
+/// Reads the points of every cell, and of its edges or faces, using several threads.
+static void GetCellParts(vtkUnstructuredGrid* grid,bool faces,TCellParts& parts)
+{
+    const vtkIdType n_cells = grid->GetNumberOfCells();
+    const vtkIdType n_chunks = min<vtkIdType>(n_cells,256);
+    vector<TCellParts> chunks(n_chunks);
+    if(n_cells > 0)
+    {
+        // GetCell is only thread-safe once it has been called from a single thread
+        vtkSmartPointer<vtkGenericCell> cell = vtkSmartPointer<vtkGenericCell>::New();
+        grid->GetCell(0,cell);
+    }
+    parallel_for(n_chunks,[&](size_t first_chunk,size_t last_chunk) {
+        vtkSmartPointer<vtkGenericCell> cell = vtkSmartPointer<vtkGenericCell>::New();
+        for(size_t iChunk=first_chunk;iChunk<last_chunk;iChunk++)
+        {
+            TCellParts& chunk = chunks[iChunk];
+            for(vtkIdType iCell=n_cells*iChunk/n_chunks;iCell<n_cells*(iChunk+1)/n_chunks;iCell++)
+            {
+                grid->GetCell(iCell,cell);
+                vtkIdList* ptIds = cell->GetPointIds();
+                for(vtkIdType iPt=0;iPt<ptIds->GetNumberOfIds();iPt++)
+                    chunk.points.push_back(ptIds->GetId(iPt));
+                chunk.point_offsets.push_back(chunk.points.size());
+                const int n_parts = faces ? cell->GetNumberOfFaces() : cell->GetNumberOfEdges();
+                for(int iPart=0;iPart<n_parts;iPart++)
+                {
+                    vtkIdList* partIds = (faces ? cell->GetFace(iPart) : cell->GetEdge(iPart))->GetPointIds();
+                    for(vtkIdType iPt=0;iPt<partIds->GetNumberOfIds();iPt++)
+                        chunk.part_points.push_back(partIds->GetId(iPt));
+                    chunk.part_point_offsets.push_back(chunk.part_points.size());
+                }
+                chunk.part_offsets.push_back(chunk.part_point_offsets.size() - 1);
+            }
+        }
+    });
+    parts = TCellParts();
+    for(const TCellParts& chunk : chunks)
+        parts.Append(chunk);
+}
+
+/// Returns whether a cell other than iCell1 has all the points of one of the parts of iCell1.
+/** (This is what vtkUnstructuredGrid::GetCellNeighbors finds, so for edges it matches how the neighbors were found before.) */
+static bool HasPointsOfAPart(const TCellParts& parts,vtkIdType iCell1,vtkIdType iCell2)
+{
+    if(iCell1 == iCell2)
+        return false;
+    const vtkIdType* first = &parts.points[parts.point_offsets[iCell2]];
+    const vtkIdType* last = first + (parts.point_offsets[iCell2+1] - parts.point_offsets[iCell2]);
+    for(vtkIdType iPart=parts.part_offsets[iCell1];iPart<parts.part_offsets[iCell1+1];iPart++)
+    {
+        bool has_all = true;
+        for(vtkIdType k=parts.part_point_offsets[iPart];k<parts.part_point_offsets[iPart+1] && has_all;k++)
+            has_all = find(first,last,parts.part_points[k]) != last;
+        if(has_all)
             return true;
     }
     return false;
 }
 
+/// Groups the parts that have the same points (in any order), by hashing their sorted point ids.
+/** Part j is in group part_group[j], and group g is used by cells [group_cells[group_offsets[g]],group_cells[group_offsets[g+1]]),
+ *  in ascending order. */
+static void GroupMatchingParts(const TCellParts& parts,vector<vtkIdType>& part_group,vector<vtkIdType>& group_offsets,vector<vtkIdType>& group_cells)
+{
+    const vtkIdType n_cells = parts.part_offsets.size() - 1;
+    const vtkIdType n_parts = parts.part_point_offsets.size() - 1;
+    struct TKey { uint64_t hash; vtkIdType iCell, iPart; };
+    vector<TKey> keys(n_parts);
+    vector<vtkIdType> sorted_points(parts.part_points);
+    parallel_for(n_cells,[&](size_t first,size_t last) {
+        for(vtkIdType iCell=first;iCell<(vtkIdType)last;iCell++)
+        {
+            for(vtkIdType iPart=parts.part_offsets[iCell];iPart<parts.part_offsets[iCell+1];iPart++)
+            {
+                vtkIdType* first_point = &sorted_points[0] + parts.part_point_offsets[iPart];
+                vtkIdType* last_point = &sorted_points[0] + parts.part_point_offsets[iPart+1];
+                sort(first_point,last_point);
+                uint64_t hash = 14695981039346656037ULL; // FNV-1a
+                for(vtkIdType* p=first_point;p!=last_point;p++)
+                    hash = (hash ^ (uint64_t)*p) * 1099511628211ULL;
+                keys[iPart] = { hash, iCell, iPart };
+            }
+        }
+    },1024);
+    sort(keys.begin(),keys.end(),[](const TKey& a,const TKey& b) { return a.hash < b.hash || (a.hash == b.hash && a.iPart < b.iPart); });
+
+    auto same_points = [&](vtkIdType iPart1,vtkIdType iPart2) {
+        return equal(sorted_points.begin() + parts.part_point_offsets[iPart1],sorted_points.begin() + parts.part_point_offsets[iPart1+1],
+                     sorted_points.begin() + parts.part_point_offsets[iPart2],sorted_points.begin() + parts.part_point_offsets[iPart2+1]);
+    };
+    part_group.assign(n_parts,-1);
+    group_offsets.assign(1,0);
+    group_cells.clear();
+    for(size_t start=0,end;start<keys.size();start=end)
+    {
+        for(end=start+1;end<keys.size() && keys[end].hash==keys[start].hash;end++) {}
+        // (the parts with the same hash almost always have the same points, but we check in case of collisions)
+        for(size_t i=start;i<end;i++)
+        {
+            if(part_group[keys[i].iPart] != -1) continue;
+            const vtkIdType iGroup = group_offsets.size() - 1;
+            for(size_t j=i;j<end;j++)
+            {
+                if(part_group[keys[j].iPart] == -1 && same_points(keys[i].iPart,keys[j].iPart))
+                {
+                    part_group[keys[j].iPart] = iGroup;
+                    group_cells.push_back(keys[j].iCell); // ascending, since parts are numbered in cell order
+                }
+            }
+            group_offsets.push_back(group_cells.size());
+        }
+    }
+}
+
 // ---------------------------------------------------------------------
 
 void MeshRD::ComputeCellNeighbors(TNeighborhood neighborhood_type)
 {
     if(!this->mesh->IsHomogeneous())
         throw runtime_error("MeshRD::ComputeCellNeighbors : mixed cell types not supported");
+    if(neighborhood_type != TNeighborhood::VERTEX_NEIGHBORS && neighborhood_type != TNeighborhood::EDGE_NEIGHBORS
+        && neighborhood_type != TNeighborhood::FACE_NEIGHBORS)
+        throw runtime_error("MeshRD::ComputeCellNeighbors : unsupported neighborhood type");
 
-    vtkSmartPointer<vtkIdList> ptIds = vtkSmartPointer<vtkIdList>::New();
-    vtkSmartPointer<vtkIdList> cellIds = vtkSmartPointer<vtkIdList>::New();
-    TNeighbor nbor;
+    // read the points of each cell, and its edges or faces, into plain arrays that the threads can share
+    TCellParts parts;
+    GetCellParts(this->mesh,neighborhood_type==TNeighborhood::FACE_NEIGHBORS,parts);
+    const vtkIdType n_cells = this->mesh->GetNumberOfCells();
 
-    vector<vector<TNeighbor> > cell_neighbors; // the connectivity between cells; for each cell, what cells are its neighbors?
-    this->max_neighbors = 0;
-    for(vtkIdType iCell=0;iCell<this->mesh->GetNumberOfCells();iCell++)
+    vector<vector<TNeighbor> > cell_neighbors(n_cells); // the connectivity between cells; for each cell, what cells are its neighbors?
+    if(neighborhood_type == TNeighborhood::VERTEX_NEIGHBORS) // neighbors share a vertex
     {
-        vector<TNeighbor> neighbors;
-        this->mesh->GetCellPoints(iCell,ptIds);
-        vtkIdType npts = ptIds->GetNumberOfIds();
-        switch(neighborhood_type)
-        {
-            case TNeighborhood::VERTEX_NEIGHBORS: // neighbors share a vertex
+        // list the cells that use each point, in ascending order
+        const vtkIdType n_points = this->mesh->GetNumberOfPoints();
+        vector<vtkIdType> point_cell_offsets(n_points+1,0), point_cells(parts.points.size());
+        for(vtkIdType iPt : parts.points)
+            point_cell_offsets[iPt+1]++;
+        for(vtkIdType iPt=0;iPt<n_points;iPt++)
+            point_cell_offsets[iPt+1] += point_cell_offsets[iPt];
+        vector<vtkIdType> next_slot(point_cell_offsets.begin(),point_cell_offsets.end()-1);
+        for(vtkIdType iCell=0;iCell<n_cells;iCell++)
+            for(vtkIdType k=parts.point_offsets[iCell];k<parts.point_offsets[iCell+1];k++)
+                point_cells[next_slot[parts.points[k]]++] = iCell;
+
+        parallel_for(n_cells,[&](size_t first,size_t last) {
+            TNeighbor nbor;
+            nbor.weight = 1.0f;
+            for(vtkIdType iCell=first;iCell<(vtkIdType)last;iCell++)
             {
-                vtkSmartPointer<vtkIdList> vertIds = vtkSmartPointer<vtkIdList>::New();
-                vertIds->SetNumberOfIds(1);
+                vector<TNeighbor>& neighbors = cell_neighbors[iCell];
                 // first try to add neighbors that are also edge-neighbors of the previously added cell
                 size_t n_previously;
                 do {
                     n_previously = neighbors.size();
-                    for(vtkIdType iPt=0;iPt<npts;iPt++)
+                    for(vtkIdType k=parts.point_offsets[iCell];k<parts.point_offsets[iCell+1];k++)
                     {
-                        vertIds->SetId(0,ptIds->GetId(iPt));
-                        this->mesh->GetCellNeighbors(iCell,vertIds,cellIds);
-                        for(vtkIdType iNeighbor=0;iNeighbor<cellIds->GetNumberOfIds();iNeighbor++)
+                        const vtkIdType iPt = parts.points[k];
+                        for(vtkIdType m=point_cell_offsets[iPt];m<point_cell_offsets[iPt+1];m++)
                         {
-                            nbor.iNeighbor = cellIds->GetId(iNeighbor);
-                            nbor.weight = 1.0f;
-                            if(neighbors.empty() || IsEdgeNeighbor(this->mesh,neighbors.back().iNeighbor,nbor.iNeighbor))
+                            nbor.iNeighbor = point_cells[m];
+                            if(nbor.iNeighbor==iCell) continue;
+                            if(neighbors.empty() || HasPointsOfAPart(parts,neighbors.back().iNeighbor,nbor.iNeighbor))
                                 add_if_new(neighbors,nbor);
                         }
                     }
                 } while(neighbors.size() > n_previously);
                 // add any remaining neighbors (in case mesh is non-manifold)
-                for(vtkIdType iPt=0;iPt<npts;iPt++)
+                for(vtkIdType k=parts.point_offsets[iCell];k<parts.point_offsets[iCell+1];k++)
                 {
-                    vertIds->SetId(0,ptIds->GetId(iPt));
-                    this->mesh->GetCellNeighbors(iCell,vertIds,cellIds);
-                    for(vtkIdType iNeighbor=0;iNeighbor<cellIds->GetNumberOfIds();iNeighbor++)
+                    const vtkIdType iPt = parts.points[k];
+                    for(vtkIdType m=point_cell_offsets[iPt];m<point_cell_offsets[iPt+1];m++)
                     {
-                        nbor.iNeighbor = cellIds->GetId(iNeighbor);
-                        nbor.weight = 1.0f;
-                        add_if_new(neighbors,nbor);
+                        nbor.iNeighbor = point_cells[m];
+                        if(nbor.iNeighbor!=iCell)
+                            add_if_new(neighbors,nbor);
                     }
                 }
             }
-            break;
-            case TNeighborhood::EDGE_NEIGHBORS: // neighbors share an edge
-            {
-                vtkCell* pCell = this->mesh->GetCell(iCell);
-                for(int iEdge=0;iEdge<pCell->GetNumberOfEdges();iEdge++)
-                {
-                    vtkIdList *vertIds = pCell->GetEdge(iEdge)->GetPointIds();
-                    this->mesh->GetCellNeighbors(iCell,vertIds,cellIds);
-                    for(vtkIdType iNeighbor=0;iNeighbor<cellIds->GetNumberOfIds();iNeighbor++)
-                    {
-                        nbor.iNeighbor = cellIds->GetId(iNeighbor);
-                        nbor.weight = 1.0f;
-                        add_if_new(neighbors,nbor);
-                    }
-                }
-            }
-            break;
-            case TNeighborhood::FACE_NEIGHBORS:
+        },256);
+    }
+    else // neighbors share an edge or a face
+    {
+        vector<vtkIdType> part_group, group_offsets, group_cells;
+        GroupMatchingParts(parts,part_group,group_offsets,group_cells);
+        parallel_for(n_cells,[&](size_t first,size_t last) {
+            TNeighbor nbor;
+            nbor.weight = 1.0f;
+            for(vtkIdType iCell=first;iCell<(vtkIdType)last;iCell++)
             {
-                vtkCell* pCell = this->mesh->GetCell(iCell);
-                for(int iEdge=0;iEdge<pCell->GetNumberOfFaces();iEdge++)
+                for(vtkIdType iPart=parts.part_offsets[iCell];iPart<parts.part_offsets[iCell+1];iPart++)
                 {
-                    vtkIdList *vertIds = pCell->GetFace(iEdge)->GetPointIds();
-                    this->mesh->GetCellNeighbors(iCell,vertIds,cellIds);
-                    for(vtkIdType iNeighbor=0;iNeighbor<cellIds->GetNumberOfIds();iNeighbor++)
+                    const vtkIdType iGroup = part_group[iPart];
+                    for(vtkIdType m=group_offsets[iGroup];m<group_offsets[iGroup+1];m++)
                     {
-                        nbor.iNeighbor = cellIds->GetId(iNeighbor);
-                        nbor.weight = 1.0f;
-                        add_if_new(neighbors,nbor);
+                        nbor.iNeighbor = group_cells[m];
+                        if(nbor.iNeighbor!=iCell)
+                            add_if_new(cell_neighbors[iCell],nbor);
                     }
                 }
             }
-            break;
-            default: throw runtime_error("MeshRD::ComputeCellNeighbors : unsupported neighborhood type");
-        }
+        },256);
+    }
+
+    for(vtkIdType iCell=0;iCell<n_cells;iCell++)
+    {
+        vector<TNeighbor>& neighbors = cell_neighbors[iCell];
         // normalize the weights for this cell
         float weight_sum=0.0f;
         for(int iN=0;iN<(int)neighbors.size();iN++)
@@ -773,32 +998,627 @@ void MeshRD::ComputeCellNeighbors(TNeighborhood neighborhood_type)
         weight_sum = max(weight_sum,1e-5f); // avoid div0
         for(int iN=0;iN<(int)neighbors.size();iN++)
             neighbors[iN].weight /= weight_sum;
-        // store this list of neighbors
-        cell_neighbors.push_back(neighbors);
-        if((int)neighbors.size()>this->max_neighbors)
-            this->max_neighbors = (int)neighbors.size();
-        this->max_neighbors = max(1,this->max_neighbors); // avoid error in case of unconnected cells or single cell
+    }
+
+    this->StoreCellNeighbors(cell_neighbors);
+}
+
+// ---------------------------------------------------------------------
+
+void MeshRD::StoreCellNeighbors(const vector<vector<TNeighbor> >& cell_neighbors)
+{
+    const int n_cells = this->mesh->GetNumberOfCells();
+    this->implicit_solvers.clear();
+    this->max_neighbors = 0;
+    for(int i=0;i<n_cells;i++)
+        this->max_neighbors = max(this->max_neighbors,(int)cell_neighbors[i].size());
+    this->max_neighbors = max(1,this->max_neighbors); // avoid error in case of unconnected cells or single cell
+
+    // decide how many neighbors go in the padded slots
+    switch(this->neighbor_layout)
+    {
+        default:
+        case NeighborLayout::Padded: this->padded_width = this->max_neighbors; break;
+        case NeighborLayout::CSR: this->padded_width = 0; break;
+        case NeighborLayout::Hybrid:
+        {
+            // the widest padding that at least a third of the cells fill, so that little of the padding is wasted
+            vector<int> n_cells_with_at_least(this->max_neighbors + 2, 0);
+            for(int i=0;i<n_cells;i++)
+                n_cells_with_at_least[cell_neighbors[i].size()]++;
+            for(int n=this->max_neighbors;n>=0;n--)
+                n_cells_with_at_least[n] += n_cells_with_at_least[n+1];
+            this->padded_width = 0;
+            while(this->padded_width < this->max_neighbors && 3 * n_cells_with_at_least[this->padded_width + 1] >= n_cells)
+                this->padded_width++;
+        }
+        break;
     }
 
     // copy data to plain arrays
-    this->cell_neighbor_indices.resize(this->mesh->GetNumberOfCells() * this->max_neighbors);
-    this->cell_neighbor_weights.resize(this->mesh->GetNumberOfCells() * this->max_neighbors);
-    for(int i=0;i<this->mesh->GetNumberOfCells();i++)
+    // (the arrays are never empty, because OpenCL doesn't allow empty buffers)
+    this->cell_neighbor_indices.assign(max(1,n_cells * this->padded_width), 0);
+    this->cell_neighbor_weights.assign(max(1,n_cells * this->padded_width), 0.0f);
+    this->cell_neighbor_offsets.assign(n_cells + 1, 0);
+    this->overflow_neighbor_indices.clear();
+    this->overflow_neighbor_weights.clear();
+    for(int i=0;i<n_cells;i++)
+    {
+        for(int j=0;j<this->padded_width;j++)
+        {
+            const size_t k = this->GetPaddedSlotIndex(i,j);
+            if(j<(int)cell_neighbors[i].size())
+            {
+                this->cell_neighbor_indices[k] = cell_neighbors[i][j].iNeighbor;
+                this->cell_neighbor_weights[k] = cell_neighbors[i][j].weight;
+            }
+            else
+            {
+                // fill any remaining slots with iCell,0.0
+                this->cell_neighbor_indices[k] = i;
+                this->cell_neighbor_weights[k] = 0.0f;
+            }
+        }
+        // the rest go in the overflow arrays
+        for(int j=this->padded_width;j<(int)cell_neighbors[i].size();j++)
+        {
+            this->overflow_neighbor_indices.push_back(cell_neighbors[i][j].iNeighbor);
+            this->overflow_neighbor_weights.push_back(cell_neighbors[i][j].weight);
+        }
+        this->cell_neighbor_offsets[i+1] = (int)this->overflow_neighbor_indices.size();
+    }
+    if(this->overflow_neighbor_indices.empty())
+    {
+        this->overflow_neighbor_indices.push_back(0);
+        this->overflow_neighbor_weights.push_back(0.0f);
+    }
+}
+
+// ---------------------------------------------------------------------
+
+vector<vector<TNeighbor> > MeshRD::GetCellNeighborLists() const
+{
+    const int n_cells = (int)this->cell_neighbor_offsets.size() - 1;
+    vector<vector<TNeighbor> > cell_neighbors(n_cells);
+    TNeighbor nbor;
+    for(int i=0;i<n_cells;i++)
+    {
+        for(int j=0;j<this->padded_width;j++)
+        {
+            const size_t k = this->GetPaddedSlotIndex(i,j);
+            if(this->cell_neighbor_indices[k]==i && this->cell_neighbor_weights[k]==0.0f)
+                break; // the rest of the slots are unused
+            nbor.iNeighbor = this->cell_neighbor_indices[k];
+            nbor.weight = this->cell_neighbor_weights[k];
+            cell_neighbors[i].push_back(nbor);
+        }
+        for(int k=this->cell_neighbor_offsets[i];k<this->cell_neighbor_offsets[i+1];k++)
+        {
+            nbor.iNeighbor = this->overflow_neighbor_indices[k];
+            nbor.weight = this->overflow_neighbor_weights[k];
+            cell_neighbors[i].push_back(nbor);
+        }
+    }
+    return cell_neighbors;
+}
+
+// ---------------------------------------------------------------------
+
+static int NeighborBandwidth(const vector<vector<TNeighbor> >& cell_neighbors)
+{
+    int bandwidth = 0;
+    for(int i=0;i<(int)cell_neighbors.size();i++)
+        for(const TNeighbor& nbor : cell_neighbors[i])
+            bandwidth = max(bandwidth,abs((int)nbor.iNeighbor - i));
+    return bandwidth;
+}
+
+// ---------------------------------------------------------------------
+
+/// Returns the cells in reverse Cuthill-McKee order: breadth-first from a cell of lowest valence in each connected
+/// region, visiting the neighbors of each cell in order of increasing valence, and then reversed.
+static vector<vtkIdType> ReverseCuthillMcKeeOrder(const vector<vector<TNeighbor> >& cell_neighbors)
+{
+    const vtkIdType n_cells = (vtkIdType)cell_neighbors.size();
+    auto fewer_neighbors = [&](vtkIdType a,vtkIdType b) { return cell_neighbors[a].size() < cell_neighbors[b].size(); };
+    vector<vtkIdType> by_valence(n_cells);
+    for(vtkIdType i=0;i<n_cells;i++)
+        by_valence[i] = i;
+    stable_sort(by_valence.begin(),by_valence.end(),fewer_neighbors);
+
+    vector<vtkIdType> order;
+    order.reserve(n_cells);
+    vector<bool> visited(n_cells,false);
+    vector<vtkIdType> next;
+    for(vtkIdType iStart : by_valence)
+    {
+        if(visited[iStart]) continue;
+        // the cells left are whole connected regions, so this cell has the lowest valence in its region
+        visited[iStart] = true;
+        order.push_back(iStart);
+        for(size_t head=order.size()-1;head<order.size();head++)
+        {
+            next.clear();
+            for(const TNeighbor& nbor : cell_neighbors[order[head]])
+            {
+                if(visited[nbor.iNeighbor]) continue;
+                visited[nbor.iNeighbor] = true;
+                next.push_back(nbor.iNeighbor);
+            }
+            stable_sort(next.begin(),next.end(),fewer_neighbors);
+            order.insert(order.end(),next.begin(),next.end());
+        }
+    }
+    reverse(order.begin(),order.end());
+    return order;
+}
+
+// ---------------------------------------------------------------------
+
+/// Returns the average of the points of each cell.
+static vector<array<double,3> > GetCellCentroids(vtkUnstructuredGrid* grid)
+{
+    const vtkIdType n_cells = grid->GetNumberOfCells();
+    vector<array<double,3> > centroids(n_cells);
+    vtkSmartPointer<vtkIdList> ptIds = vtkSmartPointer<vtkIdList>::New();
+    double p[3];
+    for(vtkIdType iCell=0;iCell<n_cells;iCell++)
     {
-        for(int j=0;j<(int)cell_neighbors[i].size();j++)
+        array<double,3>& centroid = centroids[iCell];
+        centroid.fill(0.0);
+        grid->GetCellPoints(iCell,ptIds);
+        for(vtkIdType iPt=0;iPt<ptIds->GetNumberOfIds();iPt++)
         {
-            int k = i*this->max_neighbors + j;
-            this->cell_neighbor_indices[k] = cell_neighbors[i][j].iNeighbor;
-            this->cell_neighbor_weights[k] = cell_neighbors[i][j].weight;
+            grid->GetPoint(ptIds->GetId(iPt),p);
+            for(int xyz=0;xyz<3;xyz++)
+                centroid[xyz] += p[xyz];
         }
-        // fill any remaining slots with iCell,0.0
-        for(int j=(int)cell_neighbors[i].size();j<max_neighbors;j++)
+        for(int xyz=0;xyz<3;xyz++)
+            centroid[xyz] /= max<vtkIdType>(1,ptIds->GetNumberOfIds());
+    }
+    return centroids;
+}
+
+// ---------------------------------------------------------------------
+
+/// Returns the cells sorted along a Z-order (Morton) curve through their centroids.
+static vector<vtkIdType> MortonOrder(vtkUnstructuredGrid* grid)
+{
+    const int BITS = 21; // per axis, so that the three fit in a 64-bit key
+    const uint64_t MAX_COORD = (uint64_t(1) << BITS) - 1;
+    const vtkIdType n_cells = grid->GetNumberOfCells();
+    double bounds[6];
+    grid->GetBounds(bounds);
+    const vector<array<double,3> > centroids = GetCellCentroids(grid);
+    vector<pair<uint64_t,vtkIdType> > keys(n_cells);
+    for(vtkIdType iCell=0;iCell<n_cells;iCell++)
+    {
+        const array<double,3>& centroid = centroids[iCell];
+        uint64_t key = 0;
+        for(int xyz=0;xyz<3;xyz++)
         {
-            int k = i*this->max_neighbors + j;
-            this->cell_neighbor_indices[k] = i;
-            this->cell_neighbor_weights[k] = 0.0f;
+            const double extent = bounds[xyz*2+1] - bounds[xyz*2];
+            const uint64_t q = extent > 0 ? min(MAX_COORD,(uint64_t)((centroid[xyz] - bounds[xyz*2]) / extent * MAX_COORD)) : 0;
+            for(int iBit=0;iBit<BITS;iBit++)
+                key |= ((q >> iBit) & 1) << (iBit*3 + xyz);
         }
+        keys[iCell] = make_pair(key,iCell);
     }
+    stable_sort(keys.begin(),keys.end(),[](const pair<uint64_t,vtkIdType>& a,const pair<uint64_t,vtkIdType>& b) { return a.first < b.first; });
+    vector<vtkIdType> order(n_cells);
+    for(vtkIdType i=0;i<n_cells;i++)
+        order[i] = keys[i].second;
+    return order;
+}
+
+// ---------------------------------------------------------------------
+
+/// Reorders the cells in [first,last) so that each run of cluster_size cells is compact, by recursively splitting them
+/// across the widest extent of their centroids, each time at a whole number of clusters.
+static void BisectCells(vector<vtkIdType>::iterator first,vector<vtkIdType>::iterator last,const vector<array<double,3> >& centroids,int cluster_size)
+{
+    const ptrdiff_t n = last - first;
+    if(n <= cluster_size)
+        return;
+    double lower[3], upper[3];
+    for(int xyz=0;xyz<3;xyz++)
+        lower[xyz] = upper[xyz] = centroids[*first][xyz];
+    for(vector<vtkIdType>::iterator it=first;it!=last;it++)
+    {
+        for(int xyz=0;xyz<3;xyz++)
+        {
+            lower[xyz] = min(lower[xyz],centroids[*it][xyz]);
+            upper[xyz] = max(upper[xyz],centroids[*it][xyz]);
+        }
+    }
+    int axis = 0;
+    for(int xyz=1;xyz<3;xyz++)
+        if(upper[xyz]-lower[xyz] > upper[axis]-lower[axis])
+            axis = xyz;
+    const ptrdiff_t n_clusters = (n + cluster_size - 1) / cluster_size;
+    const vector<vtkIdType>::iterator middle = first + (n_clusters / 2) * cluster_size;
+    nth_element(first,middle,last,[&](vtkIdType a,vtkIdType b) { return centroids[a][axis] < centroids[b][axis]; });
+    BisectCells(first,middle,centroids,cluster_size);
+    BisectCells(middle,last,centroids,cluster_size);
+}
+
+// ---------------------------------------------------------------------
+
+/// Returns the cells in clusters of cluster_size, made by recursive coordinate bisection of their centroids.
+static vector<vtkIdType> BisectionOrder(vtkUnstructuredGrid* grid,int cluster_size)
+{
+    const vtkIdType n_cells = grid->GetNumberOfCells();
+    vector<vtkIdType> order(n_cells);
+    for(vtkIdType i=0;i<n_cells;i++)
+        order[i] = i;
+    BisectCells(order.begin(),order.end(),GetCellCentroids(grid),cluster_size);
+    return order;
+}
+
+// ---------------------------------------------------------------------
+
+/// Returns a grid with the same points, where cell i is cell new_to_old[i] of the input, with its cell data.
+static vtkSmartPointer<vtkUnstructuredGrid> PermuteCells(vtkUnstructuredGrid* grid,const vector<vtkIdType>& new_to_old)
+{
+    const vtkIdType n_cells = (vtkIdType)new_to_old.size();
+    vtkSmartPointer<vtkUnstructuredGrid> permuted = vtkSmartPointer<vtkUnstructuredGrid>::New();
+    permuted->SetPoints(grid->GetPoints());
+    permuted->GetPointData()->ShallowCopy(grid->GetPointData());
+    permuted->Allocate(n_cells);
+    vtkSmartPointer<vtkIdList> ptIds = vtkSmartPointer<vtkIdList>::New();
+    for(vtkIdType i=0;i<n_cells;i++)
+    {
+        const int cell_type = grid->GetCellType(new_to_old[i]);
+        if(cell_type==VTK_POLYHEDRON)
+            grid->GetFaceStream(new_to_old[i],ptIds); // what InsertNextCell expects for polyhedra
+        else
+            grid->GetCellPoints(new_to_old[i],ptIds);
+        permuted->InsertNextCell(cell_type,ptIds);
+    }
+    vtkCellData* cell_data = grid->GetCellData();
+    for(int iArray=0;iArray<cell_data->GetNumberOfArrays();iArray++)
+    {
+        vtkAbstractArray* source = cell_data->GetAbstractArray(iArray);
+        vtkSmartPointer<vtkAbstractArray> array = vtkSmartPointer<vtkAbstractArray>::Take(source->NewInstance());
+        array->SetName(source->GetName());
+        array->SetNumberOfComponents(source->GetNumberOfComponents());
+        array->SetNumberOfTuples(n_cells);
+        for(vtkIdType i=0;i<n_cells;i++)
+            array->SetTuple(i,new_to_old[i],source);
+        permuted->GetCellData()->AddArray(array);
+    }
+    return permuted;
+}
+
+// ---------------------------------------------------------------------
+
+void MeshRD::ReorderCells()
+{
+    vector<vector<TNeighbor> > cell_neighbors = this->GetCellNeighborLists();
+    this->bandwidth_before = this->bandwidth_after = NeighborBandwidth(cell_neighbors);
+
+    vector<vtkIdType> new_to_old;
+    switch(this->cell_order)
+    {
+        case CellOrder::RCM: new_to_old = ReverseCuthillMcKeeOrder(cell_neighbors); break;
+        case CellOrder::Morton: new_to_old = MortonOrder(this->mesh); break;
+        case CellOrder::Bisection: new_to_old = BisectionOrder(this->mesh,MeshRD::CLUSTER_SIZE); break;
+        default: return;
+    }
+    const vtkIdType n_cells = (vtkIdType)new_to_old.size();
+    vector<vtkIdType> old_to_new(n_cells);
+    for(vtkIdType i=0;i<n_cells;i++)
+        old_to_new[new_to_old[i]] = i;
+
+    this->mesh->ShallowCopy(PermuteCells(this->mesh,new_to_old));
+
+    vector<vector<TNeighbor> > reordered(n_cells);
+    for(vtkIdType i=0;i<n_cells;i++)
+    {
+        reordered[i] = cell_neighbors[new_to_old[i]];
+        for(TNeighbor& nbor : reordered[i])
+            nbor.iNeighbor = old_to_new[nbor.iNeighbor];
+    }
+    this->StoreCellNeighbors(reordered);
+    this->bandwidth_after = NeighborBandwidth(reordered);
+
+    this->original_cell_ids.swap(new_to_old);
+}
+
+// ---------------------------------------------------------------------
+
+namespace
+{
+    // the names of the field data arrays that the neighbors of each cell are saved in
+    const char* const NEIGHBOR_OFFSETS_ARRAY_NAME = "cell_neighbor_offsets";
+    const char* const NEIGHBOR_INDICES_ARRAY_NAME = "cell_neighbor_indices";
+    const char* const NEIGHBOR_WEIGHTS_ARRAY_NAME = "cell_neighbor_weights";
+    const char* const NEIGHBOR_SOURCE_ARRAY_NAME = "cell_neighbors_source";
+
+    /// Returns a hash of the cell types and of the points used by each cell (and for polyhedra, by each face).
+    uint64_t HashMeshTopology(vtkUnstructuredGrid* grid)
+    {
+        uint64_t hash = 14695981039346656037ULL; // FNV-1a
+        auto add = [&hash](uint64_t value) {
+            for(int iByte=0;iByte<8;iByte++)
+                hash = (hash ^ ((value >> (iByte*8)) & 0xFF)) * 1099511628211ULL;
+        };
+        add(grid->GetNumberOfPoints());
+        add(grid->GetNumberOfCells());
+        vtkSmartPointer<vtkIdList> ptIds = vtkSmartPointer<vtkIdList>::New();
+        for(vtkIdType iCell=0;iCell<grid->GetNumberOfCells();iCell++)
+        {
+            const int cell_type = grid->GetCellType(iCell);
+            add(cell_type);
+            if(cell_type==VTK_POLYHEDRON)
+                grid->GetFaceStream(iCell,ptIds);
+            else
+                grid->GetCellPoints(iCell,ptIds);
+            add(ptIds->GetNumberOfIds());
+            for(vtkIdType iPt=0;iPt<ptIds->GetNumberOfIds();iPt++)
+                add(ptIds->GetId(iPt));
+        }
+        return hash;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void MeshRD::AddCellNeighborArrays(vtkUnstructuredGrid* grid) const
+{
+    // the neighbor lists, in the original cell order
+    vector<vector<TNeighbor> > cell_neighbors = this->GetCellNeighborLists();
+    const vtkIdType n_cells = (vtkIdType)cell_neighbors.size();
+    vector<vtkIdType> current_cell_ids(n_cells);
+    for(vtkIdType i=0;i<n_cells;i++)
+        current_cell_ids[this->original_cell_ids.empty() ? i : this->original_cell_ids[i]] = i;
+
+    vtkSmartPointer<vtkIntArray> offsets = vtkSmartPointer<vtkIntArray>::New();
+    offsets->SetName(NEIGHBOR_OFFSETS_ARRAY_NAME);
+    vtkSmartPointer<vtkIntArray> indices = vtkSmartPointer<vtkIntArray>::New();
+    indices->SetName(NEIGHBOR_INDICES_ARRAY_NAME);
+    vtkSmartPointer<vtkFloatArray> weights = vtkSmartPointer<vtkFloatArray>::New();
+    weights->SetName(NEIGHBOR_WEIGHTS_ARRAY_NAME);
+    offsets->InsertNextValue(0);
+    for(vtkIdType iOriginal=0;iOriginal<n_cells;iOriginal++)
+    {
+        for(const TNeighbor& nbor : cell_neighbors[current_cell_ids[iOriginal]])
+        {
+            indices->InsertNextValue(this->original_cell_ids.empty() ? nbor.iNeighbor : this->original_cell_ids[nbor.iNeighbor]);
+            weights->InsertNextValue(nbor.weight);
+        }
+        offsets->InsertNextValue(indices->GetNumberOfTuples());
+    }
+
+    // what the neighbors were computed from, so that we can tell if they still apply when loading
+    vtkSmartPointer<vtkStringArray> source = vtkSmartPointer<vtkStringArray>::New();
+    source->SetName(NEIGHBOR_SOURCE_ARRAY_NAME);
+    source->InsertNextValue(this->GetNeighborhoodType());
+    ostringstream hash;
+    hash << hex << HashMeshTopology(grid);
+    source->InsertNextValue(hash.str());
+
+    grid->GetFieldData()->AddArray(offsets);
+    grid->GetFieldData()->AddArray(indices);
+    grid->GetFieldData()->AddArray(weights);
+    grid->GetFieldData()->AddArray(source);
+}
+
+// ---------------------------------------------------------------------
+
+bool MeshRD::ReadCellNeighborArrays()
+{
+    vtkFieldData* field_data = this->mesh->GetFieldData();
+    vtkIntArray* offsets = vtkIntArray::SafeDownCast(field_data->GetAbstractArray(NEIGHBOR_OFFSETS_ARRAY_NAME));
+    vtkIntArray* indices = vtkIntArray::SafeDownCast(field_data->GetAbstractArray(NEIGHBOR_INDICES_ARRAY_NAME));
+    vtkFloatArray* weights = vtkFloatArray::SafeDownCast(field_data->GetAbstractArray(NEIGHBOR_WEIGHTS_ARRAY_NAME));
+    vtkStringArray* source = vtkStringArray::SafeDownCast(field_data->GetAbstractArray(NEIGHBOR_SOURCE_ARRAY_NAME));
+
+    // check that the arrays are there and were computed from this mesh with the current neighborhood type
+    const vtkIdType n_cells = this->mesh->GetNumberOfCells();
+    bool usable = offsets && indices && weights && source && source->GetNumberOfValues() == 2
+        && source->GetValue(0) == this->GetNeighborhoodType()
+        && offsets->GetNumberOfTuples() == n_cells + 1 && offsets->GetValue(0) == 0
+        && offsets->GetValue(n_cells) == indices->GetNumberOfTuples()
+        && weights->GetNumberOfTuples() == indices->GetNumberOfTuples();
+    if(usable)
+    {
+        ostringstream hash;
+        hash << hex << HashMeshTopology(this->mesh);
+        usable = source->GetValue(1) == hash.str();
+    }
+    vector<vector<TNeighbor> > cell_neighbors;
+    if(usable)
+    {
+        cell_neighbors.resize(n_cells);
+        TNeighbor nbor;
+        for(vtkIdType iCell=0;iCell<n_cells && usable;iCell++)
+        {
+            const int first = offsets->GetValue(iCell), last = offsets->GetValue(iCell+1);
+            usable = first <= last;
+            for(int k=first;k<last && usable;k++)
+            {
+                nbor.iNeighbor = indices->GetValue(k);
+                nbor.weight = weights->GetValue(k);
+                usable = nbor.iNeighbor >= 0 && nbor.iNeighbor < n_cells;
+                cell_neighbors[iCell].push_back(nbor);
+            }
+        }
+    }
+
+    // the arrays only describe the mesh as loaded, so we don't keep them
+    field_data->RemoveArray(NEIGHBOR_OFFSETS_ARRAY_NAME);
+    field_data->RemoveArray(NEIGHBOR_INDICES_ARRAY_NAME);
+    field_data->RemoveArray(NEIGHBOR_WEIGHTS_ARRAY_NAME);
+    field_data->RemoveArray(NEIGHBOR_SOURCE_ARRAY_NAME);
+
+    if(!usable)
+        return false;
+    this->StoreCellNeighbors(cell_neighbors);
+    return true;
+}
+
+// ---------------------------------------------------------------------
+
+vtkSmartPointer<vtkUnstructuredGrid> MeshRD::GetMeshInOriginalOrder() const
+{
+    if(this->original_cell_ids.empty())
+        return this->mesh;
+    vector<vtkIdType> current_cell_ids(this->original_cell_ids.size());
+    for(size_t i=0;i<this->original_cell_ids.size();i++)
+        current_cell_ids[this->original_cell_ids[i]] = (vtkIdType)i;
+    return PermuteCells(this->mesh,current_cell_ids);
+}
+
+// ---------------------------------------------------------------------
+
+void MeshRD::SetNeighborLayout(NeighborLayout layout)
+{
+    if(this->mesh->GetNumberOfCells() == 0)
+    {
+        this->neighbor_layout = layout;
+        return;
+    }
+    if(this->cell_neighbor_offsets.empty())
+    {
+        this->neighbor_layout = layout;
+        this->ComputeCellNeighbors(this->neighborhood_type);
+        return;
+    }
+    // only the storage changes, so keep the neighbors we have (they may have been loaded from the file)
+    const vector<vector<TNeighbor> > cell_neighbors = this->GetCellNeighborLists(); // (read with the old layout)
+    this->neighbor_layout = layout;
+    this->StoreCellNeighbors(cell_neighbors);
+}
+
+// ---------------------------------------------------------------------
+
+int MeshRD::SolveImplicitDiffusion(float* values,float c)
+{
+    const int n_cells = this->mesh->GetNumberOfCells();
+    const float TOLERANCE = 1e-5f;
+    const int MAX_ITERATIONS = 500;
+
+    vector<pair<float,SparseSolver> >::iterator it = find_if(this->implicit_solvers.begin(), this->implicit_solvers.end(),
+        [c](const pair<float,SparseSolver>& solver) { return solver.first == c; });
+    if(it == this->implicit_solvers.end())
+    {
+        // Row i of (I - c L) has 1 + c on the diagonal and -c w_ij for each neighbor j. The neighbors of a cell all have the
+        // same weight, so multiplying row i by n_i / sum(w_ij) (the number of neighbors, since the weights sum to one)
+        // makes every off-diagonal entry -c, and the matrix symmetric and diagonally dominant, as conjugate gradients needs.
+        vector<int> offsets(1, 0), columns;
+        vector<float> entries, diagonal(n_cells);
+        this->implicit_row_scales.resize(n_cells);
+        for(int i=0;i<n_cells;i++)
+        {
+            const size_t row_start = columns.size();
+            float weight_sum = 0.0f;
+            auto add_neighbor = [&](int iNeighbor, float weight) {
+                if(weight == 0.0f) return; // (an unused padded slot)
+                columns.push_back(iNeighbor);
+                entries.push_back(weight);
+                weight_sum += weight;
+            };
+            for(int j=0;j<this->padded_width;j++)
+            {
+                const size_t k = this->GetPaddedSlotIndex(i,j);
+                add_neighbor(this->cell_neighbor_indices[k], this->cell_neighbor_weights[k]);
+            }
+            for(int k=this->cell_neighbor_offsets[i];k<this->cell_neighbor_offsets[i+1];k++)
+                add_neighbor(this->overflow_neighbor_indices[k], this->overflow_neighbor_weights[k]);
+            const float scale = columns.size() > row_start ? (columns.size() - row_start) / weight_sum : 1.0f;
+            for(size_t k=row_start;k<columns.size();k++)
+                entries[k] *= -c * scale;
+            diagonal[i] = (1.0f + c) * scale;
+            this->implicit_row_scales[i] = scale;
+            offsets.push_back((int)columns.size());
+        }
+        if(this->implicit_solvers.size() >= 8)
+            this->implicit_solvers.clear(); // (the coefficients must be changing, so there's no point keeping them all)
+        this->implicit_solvers.emplace_back(c, SparseSolver());
+        this->implicit_solvers.back().second.SetMatrix(offsets, columns, entries, diagonal, this->preconditioner);
+        it = this->implicit_solvers.end() - 1;
+    }
+
+    vector<float> b(n_cells);
+    for(int i=0;i<n_cells;i++)
+        b[i] = values[i] * this->implicit_row_scales[i];
+    return it->second.Solve(b.data(), values, TOLERANCE, MAX_ITERATIONS); // (starting from the explicit values, which are close)
+}
+
+// ---------------------------------------------------------------------
+
+void MeshRD::InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update)
+{
+    AbstractRD::InitializeFromXML(rd,warn_to_update);
+
+    vtkSmartPointer<vtkXMLDataElement> rule = rd->FindNestedElementWithName("rule");
+    if(!rule) throw runtime_error("rule node not found in file");
+
+    // neighbor_layout (optional, else we keep the default for this rule type)
+    const char *s = rule->GetAttribute("neighbor_layout");
+    if(s)
+    {
+        const string layout = s;
+        if(layout == "padded") this->neighbor_layout = NeighborLayout::Padded;
+        else if(layout == "csr") this->neighbor_layout = NeighborLayout::CSR;
+        else if(layout == "hybrid") this->neighbor_layout = NeighborLayout::Hybrid;
+        else throw runtime_error("Unrecognized neighbor_layout: " + layout);
+    }
+
+    // cell_order (optional, defaults to leaving the cells as they are)
+    s = rule->GetAttribute("cell_order");
+    if(s)
+    {
+        const string order = s;
+        if(order == "original") this->cell_order = CellOrder::Original;
+        else if(order == "rcm") this->cell_order = CellOrder::RCM;
+        else if(order == "morton") this->cell_order = CellOrder::Morton;
+        else if(order == "bisection") this->cell_order = CellOrder::Bisection;
+        else throw runtime_error("Unrecognized cell_order: " + order);
+    }
+
+    // integrator and preconditioner (optional, default to explicit)
+    s = rule->GetAttribute("integrator");
+    if(s)
+    {
+        const string integrator = s;
+        if(integrator == "explicit") this->integrator = Integrator::Explicit;
+        else if(integrator == "semi-implicit") this->integrator = Integrator::SemiImplicit;
+        else throw runtime_error("Unrecognized integrator: " + integrator);
+    }
+    s = rule->GetAttribute("preconditioner");
+    if(s)
+    {
+        const string preconditioner = s;
+        if(preconditioner == "jacobi") this->SetPreconditioner(SparseSolver::Preconditioner::Jacobi);
+        else if(preconditioner == "incomplete_cholesky") this->SetPreconditioner(SparseSolver::Preconditioner::IncompleteCholesky);
+        else throw runtime_error("Unrecognized preconditioner: " + preconditioner);
+    }
+}
+
+// ---------------------------------------------------------------------
+
+vtkSmartPointer<vtkXMLDataElement> MeshRD::GetAsXML(bool generate_initial_pattern_when_loading) const
+{
+    vtkSmartPointer<vtkXMLDataElement> rd = AbstractRD::GetAsXML(generate_initial_pattern_when_loading);
+
+    vtkSmartPointer<vtkXMLDataElement> rule = rd->FindNestedElementWithName("rule");
+    if(!rule) throw runtime_error("rule node not found");
+
+    const char* layout_labels[3] = { "padded", "csr", "hybrid" };
+    rule->SetAttribute("neighbor_layout", layout_labels[static_cast<int>(this->neighbor_layout)]);
+    const char* order_labels[4] = { "original", "rcm", "morton", "bisection" };
+    rule->SetAttribute("cell_order", order_labels[static_cast<int>(this->cell_order)]);
+    if(this->HasEditableIntegrator())
+    {
+        const char* integrator_labels[2] = { "explicit", "semi-implicit" };
+        rule->SetAttribute("integrator", integrator_labels[static_cast<int>(this->integrator)]);
+        const char* preconditioner_labels[2] = { "jacobi", "incomplete_cholesky" };
+        rule->SetAttribute("preconditioner", preconditioner_labels[static_cast<int>(this->preconditioner)]);
+    }
+
+    return rd;
 }
 
 // ---------------------------------------------------------------------
@@ -887,34 +1707,67 @@ void MeshRD::SetFrom2DImage(int iChemical, vtkImageData *im)
 
 // ---------------------------------------------------------------------
 
-float MeshRD::GetValue(float x, float y, float z, const Properties& render_settings)
+int MeshRD::GetChemicalAt(float x,const Properties& render_settings,float& offset_x) const
 {
+    offset_x = 0.0f;
+    if(!render_settings.GetProperty("show_multiple_chemicals").GetBool())
+    {
+        // only one chemical is shown, must be that one
+        return IndexFromChemicalName(render_settings.GetProperty("active_chemical").GetChemical());
+    }
+    // detect which chemical was drawn on from the click position
     const double X = this->GetX();
+    const float x_gap = this->x_spacing_proportion * this->GetX();
+    int iChemical = int(floor((x-this->mesh->GetBounds()[0] + x_gap / 2) / (X + x_gap)));
+    iChemical = min(this->GetNumberOfChemicals()-1,max(0,iChemical)); // clamp to allowed range (just in case)
+    offset_x = iChemical * (X + x_gap);
+    return iChemical;
+}
 
-    this->CreateCellLocatorIfNeeded();
+// --------------------------------------------------------------------------------
 
-    // which chemical was clicked-on?
-    float offset_x = 0.0f;
-    bool show_multiple_chemicals = render_settings.GetProperty("show_multiple_chemicals").GetBool();
-    int iChemical;
-    if(show_multiple_chemicals)
-    {
-        // detect which chemical was drawn on from the click position
-        const float x_gap = this->x_spacing_proportion * this->GetX();
-        iChemical = int(floor((x-this->mesh->GetBounds()[0] + x_gap / 2) / (X + x_gap)));
-        iChemical = min(this->GetNumberOfChemicals()-1,max(0,iChemical)); // clamp to allowed range (just in case)
-        offset_x = iChemical * (X + x_gap);
-    }
-    else
+int MeshRD::FindCellAt(const double p[3]) const
+{
+    // a cell can only contain p if its centroid is within the cell's radius of p, so the grid gives us the candidates
+    vector<int> cells;
+    this->cell_grid.FindWithinRadius(p,this->max_cell_radius,cells);
+
+    vtkSmartPointer<vtkGenericCell> cell = vtkSmartPointer<vtkGenericCell>::New();
+    vector<double> weights;
+    double closest[3],pcoords[3],dist2;
+    int sub_id;
+    int iClosestCell = -1;
+    double closest_dist2 = numeric_limits<double>::infinity();
+    for(int iCell : cells)
     {
-        // only one chemical is shown, must be that one
-        iChemical = IndexFromChemicalName(render_settings.GetProperty("active_chemical").GetChemical());
+        this->mesh->GetCell(iCell,cell);
+        weights.resize(cell->GetNumberOfPoints());
+        const int found = cell->EvaluatePosition(p,closest,sub_id,pcoords,dist2,weights.data());
+        if(found==1)
+            return iCell;
+        if(found==0 && dist2<closest_dist2)
+        {
+            iClosestCell = iCell;
+            closest_dist2 = dist2;
+        }
     }
+    if(iClosestCell<0)
+        iClosestCell = this->cell_grid.FindNearest(p); // (p is far from the mesh, so the nearest centroid will do)
+    return iClosestCell;
+}
 
-    double p[3]={x-offset_x,y,z},cp[3],dist2;
-    vtkIdType iCell;
-    int subId;
-    this->cell_locator->FindClosestPoint(p,cp,iCell,subId,dist2);
+// --------------------------------------------------------------------------------
+
+float MeshRD::GetValue(float x, float y, float z, const Properties& render_settings)
+{
+    this->CreateCellGridIfNeeded();
+
+    // which chemical was clicked-on?
+    float offset_x;
+    const int iChemical = this->GetChemicalAt(x,render_settings,offset_x);
+
+    const double p[3]={x-offset_x,y,z};
+    const int iCell = this->FindCellAt(p);
 
     if(iCell<0)
         return 0.0f;
@@ -926,32 +1779,14 @@ float MeshRD::GetValue(float x, float y, float z, const Properties& render_setti
 
 void MeshRD::SetValue(float x,float y,float z,float val,const Properties& render_settings)
 {
-    const double X = this->GetX();
-
-    this->CreateCellLocatorIfNeeded();
+    this->CreateCellGridIfNeeded();
 
     // which chemical was clicked-on?
-    float offset_x = 0.0f;
-    bool show_multiple_chemicals = render_settings.GetProperty("show_multiple_chemicals").GetBool();
-    int iChemical;
-    if(show_multiple_chemicals)
-    {
-        // detect which chemical was drawn on from the click position
-        const float x_gap = this->x_spacing_proportion * this->GetX();
-        iChemical = int(floor((x-this->mesh->GetBounds()[0] + x_gap / 2) / (X + x_gap)));
-        iChemical = min(this->GetNumberOfChemicals()-1,max(0,iChemical)); // clamp to allowed range (just in case)
-        offset_x = iChemical * (X + x_gap);
-    }
-    else
-    {
-        // only one chemical is shown, must be that one
-        iChemical = IndexFromChemicalName(render_settings.GetProperty("active_chemical").GetChemical());
-    }
+    float offset_x;
+    const int iChemical = this->GetChemicalAt(x,render_settings,offset_x);
 
-    double p[3]={x-offset_x,y,z},cp[3],dist2;
-    vtkIdType iCell;
-    int subId;
-    this->cell_locator->FindClosestPoint(p,cp,iCell,subId,dist2);
+    const double p[3]={x-offset_x,y,z};
+    const int iCell = this->FindCellAt(p);
 
     if(iCell<0)
         return;
@@ -967,88 +1802,121 @@ void MeshRD::SetValue(float x,float y,float z,float val,const Properties& render
 
 void MeshRD::SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings)
 {
-    const double X = this->GetX();
-    const double Y = this->GetY();
-    const double Z = this->GetZ();
-
-    this->CreateCellLocatorIfNeeded();
+    this->CreateCellGridIfNeeded();
 
     // which chemical was clicked-on?
-    float offset_x = 0.0f;
-    bool show_multiple_chemicals = render_settings.GetProperty("show_multiple_chemicals").GetBool();
-    int iChemical;
-    if(show_multiple_chemicals)
-    {
-        // detect which chemical was drawn on from the click position
-        const float x_gap = this->x_spacing_proportion * this->GetX();
-        iChemical = int(floor((x-this->mesh->GetBounds()[0] + x_gap / 2) / (X + x_gap)));
-        iChemical = min(this->GetNumberOfChemicals()-1,max(0,iChemical)); // clamp to allowed range (just in case)
-        offset_x = iChemical * (X + x_gap);
-    }
-    else
+    float offset_x;
+    const int iChemical = this->GetChemicalAt(x,render_settings,offset_x);
+
+    r *= hypot3(this->GetX(),this->GetY(),this->GetZ());
+
+    // a cell can only have a point inside the sphere if its centroid is within r plus the cell's radius
+    const double p[3] = {x-offset_x,y,z};
+    vector<int> cells;
+    this->cell_grid.FindWithinRadius(p,r+this->max_cell_radius,cells);
+
+    vtkDataArray* values = this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str());
+    const float *cx = this->cell_grid.GetX(), *cy = this->cell_grid.GetY(), *cz = this->cell_grid.GetZ();
+    vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+    for(int iCell : cells)
     {
-        // only one chemical is shown, must be that one
-        iChemical = IndexFromChemicalName(render_settings.GetProperty("active_chemical").GetChemical());
+        // set this cell if any of its points are inside (only the cells that straddle the sphere need their points checked)
+        const double dist = hypot3(cx[iCell]-p[0],cy[iCell]-p[1],cz[iCell]-p[2]);
+        if(dist - this->cell_radii[iCell] >= r)
+            continue;
+        bool inside = dist + this->cell_radii[iCell] < r;
+        if(!inside)
+        {
+            this->mesh->GetCellPoints(iCell, ids);
+            for(vtkIdType iPt=0;iPt<ids->GetNumberOfIds() && !inside;iPt++)
+                inside = vtkMath::Distance2BetweenPoints(this->mesh->GetPoint(ids->GetId(iPt)),p)<r*r;
+        }
+        if(inside)
+        {
+            this->StorePaintAction(iChemical,iCell,values->GetComponent( iCell, 0 ));
+            values->SetComponent( iCell, 0, val );
+        }
     }
+    this->mesh->Modified();
+    this->is_modified = true;
+}
 
-    r *= hypot3(X,Y,Z);
+// --------------------------------------------------------------------------------
 
-    double bbox[6]={x-offset_x-r,x-offset_x+r,y-r,y+r,z-r,z+r};
-    vtkSmartPointer<vtkIdList> cells = vtkSmartPointer<vtkIdList>::New();
-    this->cell_locator->FindCellsWithinBounds(bbox,cells);
+void MeshRD::CreateCellGridIfNeeded()
+{
+    if(!this->cell_grid.IsEmpty() || this->mesh->GetNumberOfCells()==0) return;
 
-    double p[3] = {x-offset_x,y,z};
+    this->cell_grid.SetPoints(GetCellCentroids(this->mesh));
 
-    for(vtkIdType i=0;i<cells->GetNumberOfIds();i++)
+    // measure the radius of each cell from its centroid as stored, so that the distances are consistent with the grid's,
+    // and round it up slightly so that the float can't understate it
+    const vtkIdType n_cells = this->mesh->GetNumberOfCells();
+    const float *cx = this->cell_grid.GetX(), *cy = this->cell_grid.GetY(), *cz = this->cell_grid.GetZ();
+    this->cell_radii.resize(n_cells);
+    this->max_cell_radius = 0.0f;
+    vtkSmartPointer<vtkIdList> ptIds = vtkSmartPointer<vtkIdList>::New();
+    double p[3];
+    for(vtkIdType iCell=0;iCell<n_cells;iCell++)
     {
-        int iCell = cells->GetId(i);
-        vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
-        this->mesh->GetCellPoints(iCell, ids);
-        // set this cell if any of its points are inside
-        for(vtkIdType iPt=0;iPt<ids->GetNumberOfIds();iPt++)
+        const double centroid[3] = { cx[iCell], cy[iCell], cz[iCell] };
+        double max_dist2 = 0.0;
+        this->mesh->GetCellPoints(iCell,ptIds);
+        for(vtkIdType iPt=0;iPt<ptIds->GetNumberOfIds();iPt++)
         {
-            if(vtkMath::Distance2BetweenPoints(this->mesh->GetPoint(ids->GetId(iPt)),p)<r*r)
-            {
-                float old_val = this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str())->GetComponent( iCell, 0 );
-                this->StorePaintAction(iChemical,iCell,old_val);
-                this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str())->SetComponent( iCell, 0, val );
-                break;
-            }
+            this->mesh->GetPoint(ptIds->GetId(iPt),p);
+            max_dist2 = max(max_dist2,vtkMath::Distance2BetweenPoints(p,centroid));
         }
+        this->cell_radii[iCell] = float(sqrt(max_dist2) * 1.0001);
+        this->max_cell_radius = max(this->max_cell_radius,this->cell_radii[iCell]);
     }
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshRD::ReadCellValues(int iChemical,int first_cell,int n_cells,float* values) const
+{
+    vector<double> buffer(n_cells);
+    read_values(this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str()), first_cell, n_cells, buffer.data());
+    copy(buffer.begin(), buffer.end(), values);
+}
+
+// --------------------------------------------------------------------------------
+
+void MeshRD::WriteCellValues(int iChemical,int first_cell,int n_cells,const float* values)
+{
+    const vector<double> buffer(values, values + n_cells);
+    write_values(this->mesh->GetCellData()->GetArray(GetChemicalName(iChemical).c_str()), first_cell, n_cells, buffer.data());
     this->mesh->Modified();
     this->is_modified = true;
 }
 
 // --------------------------------------------------------------------------------
 
-void MeshRD::CreateCellLocatorIfNeeded()
+vector<Timeline::Block> MeshRD::GetStateBlocks()
 {
-    if(this->cell_locator) return;
-
-    this->cell_locator = vtkSmartPointer<vtkCellLocator>::New();
-    this->cell_locator->SetDataSet(this->mesh);
-    this->cell_locator->SetTolerance(0.0001);
-    this->cell_locator->BuildLocator();
+    vector<Timeline::Block> blocks;
+    for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
+    {
+        vtkDataArray* values = this->mesh->GetCellData()->GetArray(GetChemicalName(ic).c_str());
+        const size_t element_size = values->GetDataTypeSize();
+        blocks.push_back({ values->GetVoidPointer(0), size_t(values->GetNumberOfValues()) * element_size, element_size });
+    }
+    return blocks;
 }
 
 // --------------------------------------------------------------------------------
 
-void MeshRD::FlipPaintAction(PaintAction& cca)
+void MeshRD::AllCellsChanged()
 {
-    float old_val = this->mesh->GetCellData()->GetArray(GetChemicalName(cca.iChemical).c_str())->GetComponent( cca.iCell, 0 );
-    this->mesh->GetCellData()->GetArray(GetChemicalName(cca.iChemical).c_str())->SetComponent( cca.iCell, 0, cca.val );
-    cca.val = old_val;
-    cca.done = !cca.done;
     this->mesh->Modified();
-    this->is_modified = true;
 }
 
 // --------------------------------------------------------------------------------
 
 void MeshRD::GetMesh(vtkUnstructuredGrid* mesh) const
 {
-    mesh->DeepCopy(this->mesh);
+    mesh->DeepCopy(this->GetMeshInOriginalOrder());
 }
 
 // --------------------------------------------------------------------------------
@@ -1056,9 +1924,11 @@ void MeshRD::GetMesh(vtkUnstructuredGrid* mesh) const
 size_t MeshRD::GetMemorySize() const
 {
     const size_t DATA_SIZE = this->n_chemicals * this->data_type_size * this->mesh->GetNumberOfCells();
-    const size_t NBORS_INDICES_SIZE = sizeof(int) * this->mesh->GetNumberOfCells() * this->max_neighbors;
-    const size_t NBORS_WEIGHTS_SIZE = sizeof(float) * this->mesh->GetNumberOfCells() * this->max_neighbors;
-    return DATA_SIZE + NBORS_INDICES_SIZE + NBORS_WEIGHTS_SIZE;
+    const size_t NBORS_INDICES_SIZE = sizeof(int) * (this->cell_neighbor_indices.size() + this->cell_neighbor_offsets.size()
+        + this->overflow_neighbor_indices.size());
+    const size_t NBORS_WEIGHTS_SIZE = sizeof(float) * (this->cell_neighbor_weights.size() + this->overflow_neighbor_weights.size());
+    const size_t ORDER_SIZE = sizeof(vtkIdType) * this->original_cell_ids.size();
+    return DATA_SIZE + NBORS_INDICES_SIZE + NBORS_WEIGHTS_SIZE + ORDER_SIZE;
 }
 
 // --------------------------------------------------------------------------------
@@ -1069,7 +1939,8 @@ vector<float> MeshRD::GetData(int i_chemical) const
     vector<float> values(this->mesh->GetNumberOfCells());
     for (int i = 0; i < this->mesh->GetNumberOfCells(); i++)
     {
-        values[i] = data->GetComponent(i, 0);
+        const vtkIdType iOriginal = this->original_cell_ids.empty() ? i : this->original_cell_ids[i];
+        values[iOriginal] = data->GetComponent(i, 0);
     }
     return values;
 }
@@ -20,11 +20,19 @@
 
 // local:
 #include "AbstractRD.hpp"
+#include "PointGrid.hpp"
+#include "SparseSolver.hpp"
 
 // VTK:
 #include <vtkType.h>
 class vtkUnstructuredGrid;
-class vtkCellLocator;
+
+// STL:
+#include <utility>
+#include <vector>
+
+/// One entry in a cell's list of neighbors.
+struct TNeighbor { vtkIdType iNeighbor; float weight; };
 
 /// Base class for mesh-based systems.
 class MeshRD : public AbstractRD
@@ -37,7 +45,8 @@ class MeshRD : public AbstractRD
             const Properties& render_settings,
             bool generate_initial_pattern_when_loading) const override;
 
-        void Update(int n_steps) override;
+        void Step(int n_steps) override;
+        void UpdateRenderPipeline() override;
 
         float GetX() const override;
         float GetY() const override;
@@ -77,6 +86,54 @@ class MeshRD : public AbstractRD
 
         std::vector<float> GetData(int i_chemical) const override;
 
+        void InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update) override;
+        vtkSmartPointer<vtkXMLDataElement> GetAsXML(bool generate_initial_pattern_when_loading) const override;
+
+        /// How the neighbors of each cell are stored for the update loops.
+        /** Padded: every cell has max_neighbors slots, row by row, with unused slots pointing at the cell itself with zero weight.
+         *  This is what kernel rules index into, so is kept for them.
+         *  CSR: each cell's neighbors are stored contiguously and found using an offsets array, so no work is wasted on
+         *  meshes where a few cells have many more neighbors than the rest (e.g. Penrose, Voronoi or hyperbolic tilings).
+         *  Hybrid: most of the neighbors are in padded slots stored column by column, so that adjacent work items read
+         *  adjacent memory on wide SIMD devices, and the few extra neighbors of high-valence cells are in a CSR overflow list. */
+        enum class NeighborLayout { Padded, CSR, Hybrid };
+        NeighborLayout GetNeighborLayout() const { return this->neighbor_layout; }
+        virtual void SetNeighborLayout(NeighborLayout layout);
+
+        /// The order the cells are stored in, internally.
+        /** Original: as in the mesh that was loaded or generated.
+         *  RCM: reverse Cuthill-McKee, which numbers the cells breadth-first from a low-valence cell so that neighbors
+         *  have nearby indices, keeping the values the update loops read close together in memory.
+         *  Morton: sorted along a Z-order curve through the cell centroids, which needs no connectivity.
+         *  Bisection: in compact clusters of CLUSTER_SIZE cells, made by recursively splitting the cells across the widest
+         *  extent of their centroids. Kernels that use local memory run one cluster per work group.
+         *  The reordering is hidden from the outside world: GetMesh, GetData and saved files use the original order. */
+        enum class CellOrder { Original, RCM, Morton, Bisection };
+
+        /// The number of cells in each cluster of the Bisection order, and in each work group when using local memory.
+        static const int CLUSTER_SIZE = 64;
+        CellOrder GetCellOrder() const { return this->cell_order; }
+        /// Takes effect the next time a mesh is loaded with CopyFromMesh.
+        void SetCellOrder(CellOrder order) { this->cell_order = order; }
+
+        /// Meshes with at least this many cells are saved with the neighbors of each cell, so they needn't be found again when loading.
+        static const int MIN_CELLS_TO_SAVE_NEIGHBORS = 100000;
+
+        /// The largest difference between the indices of two neighboring cells, before and after reordering.
+        void GetNeighborBandwidth(int& before,int& after) const { before = this->bandwidth_before; after = this->bandwidth_after; }
+
+        /// How diffusion is integrated, by the rules that support a choice.
+        /** Explicit: forward-Euler, along with the reaction. This is only stable while timestep times the largest diffusion
+         *  rate is small, which on meshes with tiny or high-valence cells can force a very small timestep.
+         *  SemiImplicit: the reaction is taken forward-Euler, then the diffusion backward-Euler, by solving
+         *  (I - timestep*D*L) x = y for each chemical with preconditioned conjugate gradients. Stable for any timestep. */
+        enum class Integrator { Explicit, SemiImplicit };
+        virtual bool HasEditableIntegrator() const { return false; }
+        Integrator GetIntegrator() const { return this->integrator; }
+        void SetIntegrator(Integrator integrator) { this->integrator = integrator; }
+        SparseSolver::Preconditioner GetPreconditioner() const { return this->preconditioner; }
+        void SetPreconditioner(SparseSolver::Preconditioner preconditioner) { this->preconditioner = preconditioner; this->implicit_solvers.clear(); }
+
     protected: // functions
 
         void AddPhasePlot(  vtkRenderer* pRenderer,float scaling,float low,float high,float posX,float posY,float posZ,
@@ -85,20 +142,91 @@ class MeshRD : public AbstractRD
         /// work out which cells are neighbors of each other
         void ComputeCellNeighbors(TNeighborhood neighborhood_type);
 
-        void CreateCellLocatorIfNeeded();
-
-        void FlipPaintAction(PaintAction& cca) override;
+        /// copy the lists of neighbors into the arrays used by the update loops, in the current neighbor layout
+        void StoreCellNeighbors(const std::vector<std::vector<TNeighbor> >& cell_neighbors);
+
+        /// add field data arrays to grid (which has the cells in their original order) with the neighbors of each cell
+        void AddCellNeighborArrays(vtkUnstructuredGrid* grid) const;
+
+        /// use the neighbors from the field data arrays saved with the mesh, if they were found from this mesh with the current
+        /// neighborhood type, and remove the arrays; returns false if they were missing or don't apply
+        bool ReadCellNeighborArrays();
+
+        /// the neighbors of each cell, read back from the arrays (without the unused padded slots)
+        std::vector<std::vector<TNeighbor> > GetCellNeighborLists() const;
+
+        /// renumber the cells of the mesh (and the neighbor arrays) according to cell_order
+        void ReorderCells();
+
+        /// the mesh with the cells in their original order (the mesh itself if they have not been reordered)
+        vtkSmartPointer<vtkUnstructuredGrid> GetMeshInOriginalOrder() const;
+
+        /// The position in cell_neighbor_indices and cell_neighbor_weights of padded slot j of a cell.
+        size_t GetPaddedSlotIndex(vtkIdType iCell,int j) const
+        {
+            if(this->neighbor_layout == NeighborLayout::Hybrid)
+                return j * (this->cell_neighbor_offsets.size() - 1) + iCell; // column by column
+            return iCell * this->padded_width + j; // row by row
+        }
+
+        /// The weighted average of the neighbors of a cell, minus the value of the cell itself.
+        float GetLaplacian(const float* values,vtkIdType iCell) const
+        {
+            float sum = 0.0f;
+            for(int j=0;j<this->padded_width;j++)
+            {
+                const size_t k = this->GetPaddedSlotIndex(iCell,j);
+                sum += values[this->cell_neighbor_indices[k]] * this->cell_neighbor_weights[k];
+            }
+            for(int k=this->cell_neighbor_offsets[iCell];k<this->cell_neighbor_offsets[iCell+1];k++)
+                sum += values[this->overflow_neighbor_indices[k]] * this->overflow_neighbor_weights[k];
+            return sum - values[iCell];
+        }
+
+        /// replace values (one per cell) with x, where (I - c L) x = values and L is the Laplacian of GetLaplacian
+        /** The solver for each c is kept until the neighbors change. Returns the number of conjugate gradient iterations. */
+        int SolveImplicitDiffusion(float* values,float c);
+
+        /// builds cell_grid and cell_radii from the current mesh, if they are empty
+        void CreateCellGridIfNeeded();
+
+        /// returns the chemical drawn at x (when several are shown side by side), and sets offset_x to where it is drawn
+        int GetChemicalAt(float x,const Properties& render_settings,float& offset_x) const;
+
+        /// returns the cell that contains p, or the one closest to it if none does (call CreateCellGridIfNeeded first)
+        int FindCellAt(const double p[3]) const;
+
+        void ReadCellValues(int iChemical,int first_cell,int n_cells,float* values) const override;
+        void WriteCellValues(int iChemical,int first_cell,int n_cells,const float* values) override;
+        std::vector<Timeline::Block> GetStateBlocks() override;
+        void AllCellsChanged() override;
 
     protected: // variables
 
         vtkSmartPointer<vtkUnstructuredGrid> mesh;             ///< the cell data contains a named array for each chemical ('a', 'b', etc.)
         vtkSmartPointer<vtkUnstructuredGrid> starting_pattern; ///< we save the starting pattern, to allow the user to reset
 
-        int max_neighbors;
-        std::vector<int> cell_neighbor_indices;   ///< index of each neighbor of a cell
-        std::vector<float> cell_neighbor_weights; ///< diffusion coefficient between each cell and a neighbor
-
-        vtkSmartPointer<vtkCellLocator> cell_locator; ///< Returns a cell ID when given a 3D location
+        NeighborLayout neighbor_layout;
+        int max_neighbors;                        ///< the largest number of neighbors of any cell
+        int padded_width;                         ///< the number of padded slots per cell: max_neighbors for Padded, 0 for CSR
+        std::vector<int> cell_neighbor_indices;   ///< index of each neighbor of a cell, in the padded slots (see GetPaddedSlotIndex)
+        std::vector<float> cell_neighbor_weights; ///< diffusion coefficient between each cell and a neighbor, in the padded slots
+        std::vector<int> cell_neighbor_offsets;   ///< the other neighbors of cell i are at [offsets[i],offsets[i+1]) in the overflow arrays
+        std::vector<int> overflow_neighbor_indices;
+        std::vector<float> overflow_neighbor_weights;
+
+        CellOrder cell_order;
+        std::vector<vtkIdType> original_cell_ids; ///< the original index of each cell, or empty if the cells have not been reordered
+        int bandwidth_before, bandwidth_after;
+
+        Integrator integrator;
+        SparseSolver::Preconditioner preconditioner;
+        std::vector<std::pair<float,SparseSolver> > implicit_solvers; ///< a solver for each coefficient in use, cleared when the neighbors change
+        std::vector<float> implicit_row_scales; ///< each row of (I - c L) is multiplied by this to make it symmetric
+
+        PointGrid cell_grid;           ///< the centroid of each cell, for finding the cells near a 3D location; empty until needed
+        std::vector<float> cell_radii; ///< the distance from each cell's centroid to its furthest point
+        float max_cell_radius;
 
     private: // deliberately not implemented, to prevent use
 
@@ -0,0 +1,286 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "OpenCLBinaryCAImageRD.hpp"
+#include "utils.hpp"
+
+// STL:
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+// VTK:
+#include <vtkImageData.h>
+
+using namespace std;
+
+// -------------------------------------------------------------------------
+
+OpenCLBinaryCAImageRD::OpenCLBinaryCAImageRD(int opencl_platform,int opencl_device)
+    : BinaryCAImageRD()
+    , OpenCL_MixIn(opencl_platform,opencl_device)
+    , need_read_from_opencl_buffers(false)
+{
+}
+
+// -------------------------------------------------------------------------
+
+void OpenCLBinaryCAImageRD::TestFormula(std::string program_string)
+{
+    this->TestKernel(this->AssembleKernelSourceFromFormula(program_string));
+}
+
+// -------------------------------------------------------------------------
+
+string OpenCLBinaryCAImageRD::AssembleKernelSourceFromFormula(const string& formula) const
+{
+    uint32_t birth, survival;
+    BinaryCAImageRD::ParseRule(formula, birth, survival);
+
+    const int X = this->images.empty() ? 1 : this->images.front()->GetDimensions()[0];
+    const int Y = this->images.empty() ? 1 : this->images.front()->GetDimensions()[1];
+    const int Z = this->images.empty() ? 1 : this->images.front()->GetDimensions()[2];
+    const int W = (X + 63) / 64;
+
+    // an expression that is set in the bits where the count is one of those in mask
+    auto matches = [](uint32_t mask) {
+        ostringstream oss;
+        bool first = true;
+        for(int n = 0; n <= 26; n++)
+        {
+            if(!((mask >> n) & 1)) continue;
+            if(!first) oss << " | ";
+            oss << "count_is(count, " << n << ")";
+            first = false;
+        }
+        if(first) oss << "0UL";
+        return oss.str();
+    };
+
+    ostringstream kernel_source;
+    kernel_source << "// rule: " << formula << "\n"
+        << "#define X " << X << "\n"
+        << "#define Y " << Y << "\n"
+        << "#define Z " << Z << "\n"
+        << "#define W " << W << "\n"
+        << "#define WRAP " << (this->wrap ? 1 : 0) << "\n"
+        << "#define RX " << (X > 1 ? 1 : 0) << "\n"
+        << "#define RY " << (Y > 1 ? 1 : 0) << "\n"
+        << "#define RZ " << (Z > 1 ? 1 : 0) << "\n"
+        << "#define LAST_WORD_MASK " << ((X % 64) ? (uint64_t(1) << (X % 64)) - 1 : ~uint64_t(0)) << "UL\n"
+        << "\n"
+        << "// adds one bit to each of the 64 five-bit counters held as bit-planes\n"
+        << "void add_bits(ulong* count, ulong c)\n"
+        << "{\n"
+        << "    for(int k = 0; k < 5; k++)\n"
+        << "    {\n"
+        << "        const ulong carry = count[k] & c;\n"
+        << "        count[k] ^= c;\n"
+        << "        c = carry;\n"
+        << "    }\n"
+        << "}\n"
+        << "\n"
+        << "ulong count_is(const ulong* count, int n)\n"
+        << "{\n"
+        << "    ulong equal = ~0UL;\n"
+        << "    for(int k = 0; k < 5; k++)\n"
+        << "        equal &= ((n >> k) & 1) ? count[k] : ~count[k];\n"
+        << "    return equal;\n"
+        << "}\n"
+        << "\n"
+        << "__kernel void rd_compute(__global const ulong* a_in, __global ulong* a_out)\n"
+        << "{\n"
+        << "    const int w = get_global_id(0);\n"
+        << "    const int y = get_global_id(1);\n"
+        << "    const int z = get_global_id(2);\n"
+        << "    ulong count[5] = { 0, 0, 0, 0, 0 };\n"
+        << "    ulong self = 0;\n"
+        << "    for(int dz = -RZ; dz <= RZ; dz++)\n"
+        << "    {\n"
+        << "        for(int dy = -RY; dy <= RY; dy++)\n"
+        << "        {\n"
+        << "            int sy = y + dy;\n"
+        << "            int sz = z + dz;\n"
+        << "            if(WRAP)\n"
+        << "            {\n"
+        << "                sy = (sy + Y) % Y;\n"
+        << "                sz = (sz + Z) % Z;\n"
+        << "            }\n"
+        << "            else if(sy < 0 || sy >= Y || sz < 0 || sz >= Z)\n"
+        << "                continue; // outside cells count as dead\n"
+        << "            __global const ulong* row = a_in + W * (Y * sz + sy);\n"
+        << "            const ulong c = row[w];\n"
+        << "            if(dy == 0 && dz == 0)\n"
+        << "                self = c;\n"
+        << "            else\n"
+        << "                add_bits(count, c);\n"
+        << "            if(RX)\n"
+        << "            {\n"
+        << "                ulong west_carry = 0, east_carry = 0;\n"
+        << "                if(w > 0) west_carry = row[w - 1] >> 63;\n"
+        << "                else if(WRAP) west_carry = (row[(X - 1) / 64] >> ((X - 1) % 64)) & 1;\n"
+        << "                if(w < W - 1) east_carry = row[w + 1] << 63;\n"
+        << "                else if(WRAP) east_carry = (row[0] & 1) << ((X - 1) % 64);\n"
+        << "                add_bits(count, (c << 1) | west_carry);\n"
+        << "                add_bits(count, (c >> 1) | east_carry);\n"
+        << "            }\n"
+        << "        }\n"
+        << "    }\n"
+        << "    ulong result = (~self & (" << matches(birth) << ")) | (self & (" << matches(survival) << "));\n"
+        << "    if(w == W - 1)\n"
+        << "        result &= LAST_WORD_MASK;\n"
+        << "    a_out[W * (Y * z + y) + w] = result;\n"
+        << "}\n";
+    return kernel_source.str();
+}
+
+// -------------------------------------------------------------------------
+
+void OpenCLBinaryCAImageRD::AllocateImages(int x,int y,int z,int nc,int data_type)
+{
+    BinaryCAImageRD::AllocateImages(x,y,z,nc,data_type);
+    this->ReloadContextIfNeeded();
+    this->CreateOpenCLBuffers();
+    this->need_write_to_opencl_buffers = true;
+    this->need_read_from_opencl_buffers = false;
+    this->need_reload_formula = true; // the sizes are compiled into the kernel
+}
+
+// -------------------------------------------------------------------------
+
+void OpenCLBinaryCAImageRD::PackImage()
+{
+    BinaryCAImageRD::PackImage();
+    this->need_write_to_opencl_buffers = true;
+}
+
+// -------------------------------------------------------------------------
+
+void OpenCLBinaryCAImageRD::AllCellsChanged()
+{
+    // (the host cells have been written to, so they are now the newest copy)
+    BinaryCAImageRD::AllCellsChanged();
+    this->need_write_to_opencl_buffers = true;
+    this->need_read_from_opencl_buffers = false;
+}
+
+// -------------------------------------------------------------------------
+
+void OpenCLBinaryCAImageRD::ReloadKernelIfNeeded()
+{
+    if(!this->need_reload_formula) return;
+
+    this->kernel_source = this->AssembleKernelSourceFromFormula(this->formula);
+    const char* source = this->kernel_source.c_str();
+    size_t source_size = this->kernel_source.length();
+    clReleaseProgram(this->program);
+    cl_int ret;
+    this->program = clCreateProgramWithSource(this->context, 1, &source, &source_size, &ret);
+    throwOnError(ret, "OpenCLBinaryCAImageRD::ReloadKernelIfNeeded : Failed to create program with source: ");
+
+    BuildProgramOrThrow(this->program, this->device_id, NULL, kernel_source, "OpenCLBinaryCAImageRD::ReloadKernelIfNeeded");
+
+    clReleaseKernel(this->kernel);
+    this->kernel = clCreateKernel(this->program, this->kernel_function_name.c_str(), &ret);
+    throwOnError(ret, "OpenCLBinaryCAImageRD::ReloadKernelIfNeeded : kernel creation failed: ");
+
+    // one work item per word
+    this->global_range[0] = this->words_per_row;
+    this->global_range[1] = this->images.front()->GetDimensions()[1];
+    this->global_range[2] = this->images.front()->GetDimensions()[2];
+
+    this->need_reload_formula = false;
+}
+
+// -------------------------------------------------------------------------
+
+void OpenCLBinaryCAImageRD::CreateOpenCLBuffers()
+{
+    this->ReleaseOpenCLBuffers();
+    const size_t MEM_SIZE = this->cells.size() * sizeof(uint64_t);
+    cl_int ret;
+    for(int io = 0; io < 2; io++)
+    {
+        this->buffers[io].resize(1);
+        this->buffers[io][0] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, MEM_SIZE, NULL, &ret);
+        throwOnError(ret, "OpenCLBinaryCAImageRD::CreateOpenCLBuffers : buffer creation failed: ");
+    }
+    this->iCurrentBuffer = 0;
+}
+
+// -------------------------------------------------------------------------
+
+void OpenCLBinaryCAImageRD::WriteToOpenCLBuffersIfNeeded()
+{
+    // the cells are only written after they have been changed on the host (by packing the image, or restoring a state)
+    if(!this->need_write_to_opencl_buffers)
+        return;
+    const size_t MEM_SIZE = this->cells.size() * sizeof(uint64_t);
+    cl_int ret = clEnqueueWriteBuffer(this->command_queue, this->buffers[this->iCurrentBuffer][0], CL_TRUE, 0, MEM_SIZE,
+        this->cells.data(), 0, NULL, NULL);
+    throwOnError(ret, "OpenCLBinaryCAImageRD::WriteToOpenCLBuffersIfNeeded : buffer writing failed: ");
+    this->need_write_to_opencl_buffers = false;
+}
+
+// -------------------------------------------------------------------------
+
+void OpenCLBinaryCAImageRD::ReadFromOpenCLBuffers()
+{
+    this->need_read_from_opencl_buffers = true;
+    this->ReadCellsIfNeeded();
+}
+
+// -------------------------------------------------------------------------
+
+void OpenCLBinaryCAImageRD::ReadCellsIfNeeded() const
+{
+    if(!this->need_read_from_opencl_buffers)
+        return;
+    const size_t MEM_SIZE = this->cells.size() * sizeof(uint64_t);
+    cl_int ret = clEnqueueReadBuffer(this->command_queue, this->buffers[this->iCurrentBuffer][0], CL_TRUE, 0, MEM_SIZE,
+        this->cells.data(), 0, NULL, NULL);
+    throwOnError(ret, "OpenCLBinaryCAImageRD::ReadCellsIfNeeded : buffer reading failed: ");
+    this->need_read_from_opencl_buffers = false;
+}
+
+// -------------------------------------------------------------------------
+
+void OpenCLBinaryCAImageRD::StepPacked(int n_steps)
+{
+    this->ReloadContextIfNeeded();
+    this->ReloadKernelIfNeeded();
+    this->WriteToOpenCLBuffersIfNeeded();
+
+    cl_int ret;
+    for(int iStep = 0; iStep < n_steps; iStep++)
+    {
+        ret = clSetKernelArg(this->kernel, 0, sizeof(cl_mem), &this->buffers[this->iCurrentBuffer][0]);
+        throwOnError(ret, "OpenCLBinaryCAImageRD::StepPacked : clSetKernelArg failed: ");
+        ret = clSetKernelArg(this->kernel, 1, sizeof(cl_mem), &this->buffers[1 - this->iCurrentBuffer][0]);
+        throwOnError(ret, "OpenCLBinaryCAImageRD::StepPacked : clSetKernelArg failed: ");
+        ret = clEnqueueNDRangeKernel(this->command_queue, this->kernel, 3, NULL, this->global_range, NULL, 0, NULL, NULL);
+        throwOnError(ret, "OpenCLBinaryCAImageRD::StepPacked : kernel enqueue failed: ");
+        this->iCurrentBuffer = 1 - this->iCurrentBuffer;
+    }
+
+    ret = clFinish(this->command_queue);
+    throwOnError(ret, "OpenCLBinaryCAImageRD::StepPacked : clFinish failed: ");
+
+    // (the cells are read back only when the image or the timeline needs them)
+    this->need_read_from_opencl_buffers = true;
+}
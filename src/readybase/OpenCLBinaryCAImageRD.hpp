@@ -0,0 +1,60 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __OPENCLBINARYCAIMAGERD__
+#define __OPENCLBINARYCAIMAGERD__
+
+// local:
+#include "BinaryCAImageRD.hpp"
+#include "OpenCL_MixIn.hpp"
+
+/// The bit-packed binary cellular automaton, stepped on an OpenCL device with one work item per 64-cell word.
+class OpenCLBinaryCAImageRD : public BinaryCAImageRD, public OpenCL_MixIn
+{
+    public:
+
+        OpenCLBinaryCAImageRD(int opencl_platform,int opencl_device);
+
+        void TestFormula(std::string program_string) override;
+
+        std::string GetKernel() const override { return this->AssembleKernelSourceFromFormula(this->formula); }
+
+        void SetWrap(bool w) override { BinaryCAImageRD::SetWrap(w); this->need_reload_formula = true; }
+
+    protected:
+
+        std::string AssembleKernelSourceFromFormula(const std::string& formula) const override;
+
+        void AllocateImages(int x,int y,int z,int nc,int data_type) override;
+
+        void StepPacked(int n_steps) override;
+        void ReadCellsIfNeeded() const override;
+        void PackImage() override;
+        void AllCellsChanged() override;
+
+        void ReloadKernelIfNeeded() override;
+
+        void CreateOpenCLBuffers() override;
+        void WriteToOpenCLBuffersIfNeeded() override;
+        void ReadFromOpenCLBuffers() override;
+
+    protected:
+
+        mutable bool need_read_from_opencl_buffers; ///< the cells have been stepped on the device since they were last read
+};
+
+#endif
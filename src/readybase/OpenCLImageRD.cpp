@@ -18,6 +18,8 @@
 #include "OpenCLImageRD.hpp"
 
 // local:
+#include "OpenCL_FFT.hpp"
+#include "OpenCL_SummedAreaTable.hpp"
 #include "OpenCL_utils.hpp"
 #include "utils.hpp"
 using namespace OpenCL_utils;
@@ -25,6 +27,8 @@ using namespace OpenCL_utils;
 // STL:
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
 #include <stdexcept>
 #include <sstream>
 #include <utility>
@@ -33,6 +37,7 @@ using namespace OpenCL_utils;
 // VTK:
 #include <vtkImageData.h>
 #include <vtkMath.h>
+#include <vtkXMLDataElement.h>
 
 using namespace std;
 
@@ -41,11 +46,87 @@ using namespace std;
 OpenCLImageRD::OpenCLImageRD(int opencl_platform,int opencl_device,int data_type)
     : ImageRD(data_type)
     , OpenCL_MixIn(opencl_platform,opencl_device)
+    , need_read_from_opencl_buffers(false)
+    , overlays_context(NULL)
+    , overlays_program(NULL)
+    , overlays_kernel(NULL)
 {
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
+OpenCLImageRD::~OpenCLImageRD()
+{
+    this->ReleaseStages();
+    this->ReleaseOverlaysKernel();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update)
+{
+    ImageRD::InitializeFromXML(rd,warn_to_update);
+    this->ReadRandomSeedFromXML(rd->FindNestedElementWithName("rule"));
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vtkSmartPointer<vtkXMLDataElement> OpenCLImageRD::GetAsXML(bool generate_initial_pattern_when_loading) const
+{
+    vtkSmartPointer<vtkXMLDataElement> rd = ImageRD::GetAsXML(generate_initial_pattern_when_loading);
+    this->WriteRandomSeedToXML(rd->FindNestedElementWithName("rule"));
+    return rd;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ReleaseOverlaysKernel()
+{
+    if (this->overlays_kernel)
+    {
+        clReleaseKernel(this->overlays_kernel);
+    }
+    if (this->overlays_program)
+    {
+        clReleaseProgram(this->overlays_program);
+    }
+    this->overlays_kernel = NULL;
+    this->overlays_program = NULL;
+    this->overlays_context = NULL;
+    this->overlays_kernel_source.clear();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ReleaseStages()
+{
+    for (cl_kernel stage_kernel : this->stage_kernels)
+    {
+        clReleaseKernel(stage_kernel);
+    }
+    this->stage_kernels.clear();
+    for (cl_mem stage_buffer : this->stage_buffers)
+    {
+        clReleaseMemObject(stage_buffer);
+    }
+    this->stage_buffers.clear();
+    this->fft.reset();
+    for (cl_mem convolution_buffer : this->convolution_buffers)
+    {
+        clReleaseMemObject(convolution_buffer);
+    }
+    this->convolution_buffers.clear();
+    this->summed_area_table.reset();
+    for (cl_mem summed_area_table_buffer : this->summed_area_table_buffers)
+    {
+        clReleaseMemObject(summed_area_table_buffer);
+    }
+    this->summed_area_table_buffers.clear();
+    this->summed_area_table_chemicals.clear();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
 void OpenCLImageRD::BuildProgram()
 {
     // create the program
@@ -58,20 +139,7 @@ void OpenCLImageRD::BuildProgram()
     throwOnError(ret, "OpenCLImageRD::ReloadKernelIfNeeded : Failed to create program with source: ");
 
     // build the program
-    ret = clBuildProgram(this->program, 1, &this->device_id, "-cl-denorms-are-zero", NULL, NULL);
-    if (ret != CL_SUCCESS)
-    {
-        size_t build_log_length = 0;
-        cl_int ret2 = clGetProgramBuildInfo(this->program, this->device_id, CL_PROGRAM_BUILD_LOG, 0, 0, &build_log_length);
-        throwOnError(ret2, "OpenCLImageRD::ReloadKernelIfNeeded : retrieving length of program build log failed: ");
-        vector<char> build_log(build_log_length);
-        cl_int ret3 = clGetProgramBuildInfo(this->program, this->device_id, CL_PROGRAM_BUILD_LOG, build_log_length, build_log.data(), 0);
-        throwOnError(ret3, "OpenCLImageRD::ReloadKernelIfNeeded : retrieving program build log failed: ");
-        { ofstream out("kernel.txt"); out << kernel_source; }
-        ostringstream oss;
-        oss << "OpenCLImageRD::ReloadKernelIfNeeded : build failed (kernel saved as kernel.txt):\n\n" << string(build_log.begin(), build_log.end());
-        throwOnError(ret, oss.str().c_str());
-    }
+    BuildProgramOrThrow(this->program, this->device_id, "-cl-denorms-are-zero", kernel_source, "OpenCLImageRD::ReloadKernelIfNeeded");
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -135,6 +203,84 @@ void OpenCLImageRD::ReloadKernelIfNeeded()
     this->kernel = clCreateKernel(this->program, this->kernel_function_name.c_str(), &ret);
     throwOnError(ret,"OpenCLImageRD::ReloadKernelIfNeeded : kernel creation failed: ");
 
+    // create any stage kernels and the intermediate buffers they write
+    this->ReleaseStages();
+    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    const int NC = this->GetNumberOfChemicals();
+    const vector<string> stage_kernel_names = this->GetStageKernelNames();
+    for (size_t i = 0; i < stage_kernel_names.size(); i++)
+    {
+        cl_kernel stage_kernel = clCreateKernel(this->program, stage_kernel_names[i].c_str(), &ret);
+        throwOnError(ret, "OpenCLImageRD::ReloadKernelIfNeeded : stage kernel creation failed: ");
+        this->stage_kernels.push_back(stage_kernel);
+        cl_mem stage_buffer = clCreateBuffer(this->context, CL_MEM_READ_WRITE, MEM_SIZE, NULL, &ret);
+        throwOnError(ret, "OpenCLImageRD::ReloadKernelIfNeeded : stage buffer creation failed: ");
+        this->stage_buffers.push_back(stage_buffer);
+        // these arguments don't change between steps: the stage's output, and rd_compute's extra inputs
+        ret = clSetKernelArg(stage_kernel, NC, sizeof(cl_mem), (void *)&stage_buffer);
+        throwOnError(ret, "OpenCLImageRD::ReloadKernelIfNeeded : clSetKernelArg failed: ");
+        ret = clSetKernelArg(this->kernel, 2 * NC + (cl_uint)i, sizeof(cl_mem), (void *)&stage_buffer);
+        throwOnError(ret, "OpenCLImageRD::ReloadKernelIfNeeded : clSetKernelArg failed: ");
+    }
+
+    // prepare the FFT convolutions, if any, and the buffers they write
+    if (!this->convolutions.empty())
+    {
+        if (!this->wrap)
+        {
+            throw runtime_error("OpenCLImageRD::ReloadKernelIfNeeded : convolutions need wrap-around to be on");
+        }
+        if (this->storage != Storage::Default)
+        {
+            throw runtime_error("OpenCLImageRD::ReloadKernelIfNeeded : convolutions need the default storage type");
+        }
+        const int X = vtkMath::Round(this->GetX());
+        const int Y = vtkMath::Round(this->GetY());
+        const int Z = vtkMath::Round(this->GetZ());
+        this->fft.reset(new OpenCL_FFT(this->context, this->device_id, this->command_queue, X, Y, Z, this->data_type));
+        for (size_t i = 0; i < this->convolutions.size(); i++)
+        {
+            const RadialConvolution& convolution = this->convolutions[i];
+            if (convolution.iChemical < 0 || convolution.iChemical >= NC)
+            {
+                throw runtime_error("OpenCLImageRD::ReloadKernelIfNeeded : convolution chemical out of range");
+            }
+            this->fft->AddKernel(OpenCL_FFT::GetAnnulusWeights(X, Y, Z, convolution.inner_radius, convolution.outer_radius));
+            cl_mem convolution_buffer = clCreateBuffer(this->context, CL_MEM_READ_WRITE, MEM_SIZE, NULL, &ret);
+            throwOnError(ret, "OpenCLImageRD::ReloadKernelIfNeeded : convolution buffer creation failed: ");
+            this->convolution_buffers.push_back(convolution_buffer);
+            ret = clSetKernelArg(this->kernel, 2 * NC + (cl_uint)(this->stage_kernels.size() + i), sizeof(cl_mem), (void *)&convolution_buffer);
+            throwOnError(ret, "OpenCLImageRD::ReloadKernelIfNeeded : clSetKernelArg failed: ");
+        }
+    }
+
+    // prepare the summed-area tables, if any
+    this->summed_area_table_chemicals = this->GetSummedAreaTableChemicals();
+    if (!this->summed_area_table_chemicals.empty())
+    {
+        if (this->storage != Storage::Default)
+        {
+            throw runtime_error("OpenCLImageRD::ReloadKernelIfNeeded : box sums need the default storage type");
+        }
+        this->summed_area_table.reset(new OpenCL_SummedAreaTable(this->context, this->device_id, this->command_queue,
+            vtkMath::Round(this->GetX()), vtkMath::Round(this->GetY()), vtkMath::Round(this->GetZ()), this->data_type));
+        const cl_uint first_arg = 2 * NC + (cl_uint)(this->stage_kernels.size() + this->convolutions.size());
+        for (size_t i = 0; i < this->summed_area_table_chemicals.size(); i++)
+        {
+            if (this->summed_area_table_chemicals[i] < 0 || this->summed_area_table_chemicals[i] >= NC)
+            {
+                throw runtime_error("OpenCLImageRD::ReloadKernelIfNeeded : summed-area table chemical out of range");
+            }
+            cl_mem summed_area_table_buffer = clCreateBuffer(this->context, CL_MEM_READ_WRITE, MEM_SIZE, NULL, &ret);
+            throwOnError(ret, "OpenCLImageRD::ReloadKernelIfNeeded : summed-area table buffer creation failed: ");
+            this->summed_area_table_buffers.push_back(summed_area_table_buffer);
+            ret = clSetKernelArg(this->kernel, first_arg + (cl_uint)i, sizeof(cl_mem), (void *)&summed_area_table_buffer);
+            throwOnError(ret, "OpenCLImageRD::ReloadKernelIfNeeded : clSetKernelArg failed: ");
+        }
+    }
+
+    this->kernel_uses_random_numbers = UsingKeyword(tokenize_for_keywords(this->kernel_source), "rand_key");
+
     this->need_reload_formula = false;
 }
 
@@ -144,7 +290,7 @@ void OpenCLImageRD::CreateOpenCLBuffers()
 {
     this->ReloadContextIfNeeded();
 
-    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    const size_t MEM_SIZE = this->GetStorageSize() * this->GetX() * this->GetY() * this->GetZ();
     const int NC = this->GetNumberOfChemicals();
 
     this->ReleaseOpenCLBuffers();
@@ -168,19 +314,141 @@ void OpenCLImageRD::CreateOpenCLBuffers()
 
 void OpenCLImageRD::WriteToOpenCLBuffersIfNeeded()
 {
-    if(!this->need_write_to_opencl_buffers) return;
+    if(!this->need_write_to_opencl_buffers)
+    {
+        this->WriteDirtyBoxes();
+        return;
+    }
 
-    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    const size_t N = this->GetX() * this->GetY() * this->GetZ();
+    const size_t element_size = this->GetStorageSize();
+    const size_t MEM_SIZE = element_size * N;
+
+    vector<unsigned char> stored; // the host images hold the data type, so the compact storage types are converted here
+    if(this->StorageIsConverted())
+        stored.resize(MEM_SIZE);
 
     this->iCurrentBuffer = 0;
     for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
     {
         void* data = this->images[ic]->GetScalarPointer();
+        if(this->StorageIsConverted())
+        {
+            for(size_t i=0;i<N;i++)
+                this->ConvertToStorage(data, i, &stored[i * element_size]);
+            data = stored.data();
+        }
         cl_int ret = clEnqueueWriteBuffer(this->command_queue,this->buffers[this->iCurrentBuffer][ic], CL_TRUE, 0, MEM_SIZE, data, 0, NULL, NULL);
         throwOnError(ret,"OpenCLImageRD::WriteToOpenCLBuffers : buffer writing failed: ");
     }
 
     this->need_write_to_opencl_buffers = false;
+    this->dirty_boxes.clear();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::WriteDirtyBoxes()
+{
+    // the host images and the current buffers match outside the boxes, so only the boxes need writing
+    const size_t X = this->GetX(), Y = this->GetY(), Z = this->GetZ();
+    const size_t dims[3] = { X, Y, Z };
+    const size_t element_size = this->GetStorageSize();
+    vector<unsigned char> stored;
+    for(int ic=0;ic<(int)this->dirty_boxes.size();ic++)
+    {
+        const array<int,6>& box = this->dirty_boxes[ic];
+        if(box[0] > box[1])
+            continue;
+        const size_t origin[3] = { (size_t)box[0], (size_t)box[2], (size_t)box[4] };
+        const size_t region[3] = { size_t(box[1]-box[0]+1), size_t(box[3]-box[2]+1), size_t(box[5]-box[4]+1) };
+        const char* data = static_cast<const char*>(this->images[ic]->GetScalarPointer());
+        if(this->StorageIsConverted())
+        {
+            // convert the box into a packed array of the storage type
+            stored.resize(region[0] * region[1] * region[2] * element_size);
+            size_t k = 0;
+            for(size_t z=origin[2];z<origin[2]+region[2];z++)
+                for(size_t y=origin[1];y<origin[1]+region[1];y++)
+                    for(size_t x=origin[0];x<origin[0]+region[0];x++)
+                    {
+                        this->ConvertToStorage(data, X*(Y*z+y)+x, &stored[k * element_size]);
+                        k++;
+                    }
+            this->WriteBufferBox(this->buffers[this->iCurrentBuffer][ic], element_size, dims, origin, region,
+                stored.data(), region[0] * element_size, region[0] * region[1] * element_size);
+        }
+        else
+        {
+            const char* first = data + element_size * (X*(Y*origin[2]+origin[1])+origin[0]);
+            this->WriteBufferBox(this->buffers[this->iCurrentBuffer][ic], element_size, dims, origin, region,
+                first, X * element_size, X * Y * element_size);
+        }
+    }
+    this->dirty_boxes.clear();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::CellsPainted(int iChemical,int first_cell,int n_cells)
+{
+    if(iChemical >= (int)this->dirty_boxes.size())
+        this->dirty_boxes.resize(this->GetNumberOfChemicals(), { 0, -1, 0, -1, 0, -1 });
+    const int X = this->GetX(), Y = this->GetY();
+    const int last_cell = first_cell + n_cells - 1;
+    int lo[3] = { first_cell % X, (first_cell / X) % Y, first_cell / (X * Y) };
+    int hi[3] = { last_cell % X, (last_cell / X) % Y, last_cell / (X * Y) };
+    // a run of cells that wraps onto the next row (or slice) covers the whole width (and height) between
+    if(lo[2] != hi[2])
+    {
+        lo[0] = 0; hi[0] = X - 1;
+        lo[1] = 0; hi[1] = Y - 1;
+    }
+    else if(lo[1] != hi[1])
+    {
+        lo[0] = 0; hi[0] = X - 1;
+    }
+    array<int,6>& box = this->dirty_boxes[iChemical];
+    const bool was_empty = box[0] > box[1];
+    for(int xyz=0;xyz<3;xyz++)
+    {
+        box[xyz*2+0] = was_empty ? lo[xyz] : min(box[xyz*2+0], lo[xyz]);
+        box[xyz*2+1] = was_empty ? hi[xyz] : max(box[xyz*2+1], hi[xyz]);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::AllCellsChanged()
+{
+    // (the host images were read before they were changed, so they are now the newest copy)
+    ImageRD::AllCellsChanged();
+    this->need_write_to_opencl_buffers = true;
+    this->need_read_from_opencl_buffers = false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ReadCellValues(int iChemical,int first_cell,int n_cells,float* values) const
+{
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::ReadCellValues(iChemical, first_cell, n_cells, values);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::WriteCellValues(int iChemical,int first_cell,int n_cells,const float* values)
+{
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::WriteCellValues(iChemical, first_cell, n_cells, values);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vector<Timeline::Block> OpenCLImageRD::GetStateBlocks()
+{
+    this->ReadFromOpenCLBuffersIfNeeded();
+    return ImageRD::GetStateBlocks();
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -189,30 +457,247 @@ void OpenCLImageRD::CopyFromImage(vtkImageData* im)
 {
     ImageRD::CopyFromImage(im);
     this->need_write_to_opencl_buffers = true;
+    this->need_read_from_opencl_buffers = false;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
 void OpenCLImageRD::SetFrom2DImage(int iChemical, vtkImageData *im)
 {
+    this->ReadFromOpenCLBuffersIfNeeded();
     ImageRD::SetFrom2DImage(iChemical, im);
     this->need_write_to_opencl_buffers = true;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
+void OpenCLImageRD::SaveFile(const char* filename,const Properties& render_settings,bool generate_initial_pattern_when_loading) const
+{
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::SaveFile(filename, render_settings, generate_initial_pattern_when_loading);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::UpdateRenderPipeline()
+{
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::UpdateRenderPipeline();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::InitializeRenderPipeline(vtkRenderer* pRenderer,const Properties& render_settings)
+{
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::InitializeRenderPipeline(pRenderer, render_settings);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::SaveStartingPattern()
+{
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::SaveStartingPattern();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::GetAsMesh(vtkPolyData *out,const Properties& render_settings) const
+{
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::GetAsMesh(out, render_settings);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::GetAs2DImage(vtkImageData *out,const Properties& render_settings) const
+{
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::GetAs2DImage(out, render_settings);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::SetValue(float x,float y,float z,float val,const Properties& render_settings)
+{
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::SetValue(x, y, z, val, render_settings);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings)
+{
+    // the box written to the device includes cells that weren't painted, so the host images must be current
+    this->ReadFromOpenCLBuffersIfNeeded();
+    ImageRD::SetValuesInRadius(x, y, z, r, val, render_settings);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
 void OpenCLImageRD::GenerateInitialPattern()
 {
+    if (this->GenerateInitialPatternOnDevice())
+    {
+        return;
+    }
+    this->ReadFromOpenCLBuffersIfNeeded(); // (some overlays add to the existing values)
     ImageRD::GenerateInitialPattern();
     this->need_write_to_opencl_buffers = true;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
+bool OpenCLImageRD::GenerateInitialPatternOnDevice()
+{
+    // the kernel works on the values as they are stored, so the other storage types are left to the host
+    if (this->storage != Storage::Default)
+    {
+        return false;
+    }
+
+    const int X = this->images.front()->GetDimensions()[0];
+    const int Y = this->images.front()->GetDimensions()[1];
+    const int Z = this->images.front()->GetDimensions()[2];
+    const int NC = this->GetNumberOfChemicals();
+    const bool zero_first = this->initial_pattern_generator.ShouldZeroFirst();
+
+    this->ReseedInitialPatternGenerator();
+
+    // collect the code of each overlay, giving up if any can't be computed in OpenCL
+    const ArenaSize arena = { this->GetX(), this->GetY(), this->GetZ(), this->GetArenaDimensionality() };
+    OpenCLOverlaySource source;
+    source.real_suffix = this->data_type_suffix;
+    string overlays_code;
+    vector<bool> is_target(NC, false);
+    for (size_t iOverlay = 0; iOverlay < this->initial_pattern_generator.GetNumberOfOverlays(); iOverlay++)
+    {
+        const Overlay& overlay = this->initial_pattern_generator.GetOverlay(iOverlay);
+        const int iC = overlay.GetTargetChemical();
+        if (iC < 0 || iC >= NC)
+        {
+            continue; // (ignored, as in ImageRD::GenerateInitialPattern)
+        }
+        string code;
+        if (!overlay.GetOpenCLCode(*this, arena, source, code))
+        {
+            return false;
+        }
+        overlays_code += code;
+        is_target[iC] = true;
+    }
+
+    // assemble the kernel, with one work item per cell
+    ostringstream kernel_source;
+    if (this->data_type == VTK_DOUBLE)
+    {
+        kernel_source << "\
+#ifdef cl_khr_fp64\n\
+    #pragma OPENCL EXTENSION cl_khr_fp64 : enable\n\
+#elif defined(cl_amd_fp64)\n\
+    #pragma OPENCL EXTENSION cl_amd_fp64 : enable\n\
+#else\n\
+    #error \"Double precision floating point not supported on this OpenCL device. Choose another or contact the Ready team.\"\n\
+#endif\n\n";
+    }
+    kernel_source << "typedef " << this->data_type_string << " real;\n\n";
+    kernel_source << source.helpers;
+    kernel_source << "kernel void apply_overlays(";
+    for (int ic = 0; ic < NC; ic++)
+    {
+        kernel_source << (ic ? ", " : "") << "global real* " << GetChemicalName(ic) << "_data";
+    }
+    kernel_source << ")\n{\n";
+    kernel_source << "    const int ix = get_global_id(0);\n";
+    kernel_source << "    const int iy = get_global_id(1);\n";
+    kernel_source << "    const int iz = get_global_id(2);\n";
+    kernel_source << "    const ulong index_here = " << X << "UL * (" << Y << " * iz + iy) + ix;\n";
+    kernel_source << "    const real x = ix, y = iy, z = iz;\n";
+    kernel_source << "    real vals[" << NC << "];\n";
+    for (int ic = 0; ic < NC; ic++)
+    {
+        kernel_source << "    vals[" << ic << "] = " << (zero_first ? string("0") : GetChemicalName(ic) + "_data[index_here]") << ";\n";
+    }
+    kernel_source << overlays_code;
+    for (int ic = 0; ic < NC; ic++)
+    {
+        if (zero_first || is_target[ic])
+        {
+            kernel_source << "    " << GetChemicalName(ic) << "_data[index_here] = vals[" << ic << "];\n";
+        }
+    }
+    kernel_source << "}\n";
+
+    this->ReloadContextIfNeeded();
+    if (!zero_first)
+    {
+        this->WriteToOpenCLBuffersIfNeeded(); // (the overlays apply on top of the current values)
+    }
+
+    // build the kernel, unless it is the same as last time (e.g. when regenerating the same starting pattern)
+    cl_int ret;
+    const string overlays_kernel_source = kernel_source.str();
+    if (this->overlays_context != this->context || this->overlays_kernel_source != overlays_kernel_source)
+    {
+        // (the cached program holds on to the context it was built for, so a new context can't have the same handle)
+        this->ReleaseOverlaysKernel();
+        const char* source_text = overlays_kernel_source.c_str();
+        size_t source_size = overlays_kernel_source.length();
+        this->overlays_program = clCreateProgramWithSource(this->context, 1, &source_text, &source_size, &ret);
+        throwOnError(ret, "OpenCLImageRD::GenerateInitialPatternOnDevice : Failed to create program with source: ");
+        try
+        {
+            BuildProgramOrThrow(this->overlays_program, this->device_id, "", overlays_kernel_source,
+                "OpenCLImageRD::GenerateInitialPatternOnDevice");
+        }
+        catch (...)
+        {
+            this->ReleaseOverlaysKernel();
+            throw;
+        }
+        this->overlays_kernel = clCreateKernel(this->overlays_program, "apply_overlays", &ret);
+        if (ret != CL_SUCCESS)
+        {
+            this->ReleaseOverlaysKernel();
+            throwOnError(ret, "OpenCLImageRD::GenerateInitialPatternOnDevice : kernel creation failed: ");
+        }
+        this->overlays_context = this->context;
+        this->overlays_kernel_source = overlays_kernel_source;
+    }
+
+    // run it on the current buffers
+    ret = CL_SUCCESS;
+    for (int ic = 0; ic < NC && ret == CL_SUCCESS; ic++)
+    {
+        ret = clSetKernelArg(this->overlays_kernel, ic, sizeof(cl_mem), (void *)&this->buffers[this->iCurrentBuffer][ic]);
+    }
+    const size_t global_size[3] = { (size_t)X, (size_t)Y, (size_t)Z };
+    if (ret == CL_SUCCESS)
+    {
+        ret = clEnqueueNDRangeKernel(this->command_queue, this->overlays_kernel, 3, NULL, global_size, NULL, 0, NULL, NULL);
+    }
+    if (ret == CL_SUCCESS)
+    {
+        ret = clFinish(this->command_queue);
+    }
+    throwOnError(ret, "OpenCLImageRD::GenerateInitialPatternOnDevice : running the kernel failed: ");
+    this->need_write_to_opencl_buffers = false;
+    this->dirty_boxes.clear();
+
+    // the host images are read back when rendering or saving needs them
+    this->need_read_from_opencl_buffers = true;
+    this->timesteps_taken = 0;
+    return true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
 void OpenCLImageRD::BlankImage(float value)
 {
     ImageRD::BlankImage(value);
     this->need_write_to_opencl_buffers = true;
+    this->need_read_from_opencl_buffers = false;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -220,6 +705,7 @@ void OpenCLImageRD::BlankImage(float value)
 void OpenCLImageRD::AllocateImages(int x,int y,int z,int nc,int data_type)
 {
     ImageRD::AllocateImages(x,y,z,nc,data_type);
+    this->need_read_from_opencl_buffers = false; // (the old buffers are about to be replaced)
     this->need_reload_formula = true;
     this->ReloadContextIfNeeded();
     this->ReloadKernelIfNeeded();
@@ -230,6 +716,9 @@ void OpenCLImageRD::AllocateImages(int x,int y,int z,int nc,int data_type)
 
 void OpenCLImageRD::SetNumberOfChemicals(int n, bool reallocate_storage)
 {
+    if(!reallocate_storage)
+        this->ReadFromOpenCLBuffersIfNeeded(); // (the chemicals we keep are written to the new buffers)
+    this->need_read_from_opencl_buffers = false;
     ImageRD::SetNumberOfChemicals(n, reallocate_storage);
     this->need_reload_formula = true;
     this->ReloadContextIfNeeded();
@@ -251,6 +740,28 @@ void OpenCLImageRD::InternalUpdate(int n_steps)
 
     for(int it=0;it<n_steps;it++)
     {
+        for(cl_kernel stage_kernel : this->stage_kernels)
+        {
+            for(int ic=0;ic<NC;ic++)
+            {
+                ret = clSetKernelArg(stage_kernel, ic, sizeof(cl_mem), (void *)&this->buffers[this->iCurrentBuffer][ic]);
+                throwOnError(ret,"OpenCLImageRD::InternalUpdate : clSetKernelArg failed: ");
+            }
+            ret = clEnqueueNDRangeKernel(this->command_queue, stage_kernel, 3, NULL, this->global_range, NULL, 0, NULL, NULL);
+            throwOnError(ret,"OpenCLImageRD::InternalUpdate : clEnqueueNDRangeKernel failed for stage kernel: ");
+        }
+        for(size_t i=0;i<this->convolutions.size();i++)
+        {
+            // consecutive convolutions of the same chemical can share its forward transform
+            const int ic = this->convolutions[i].iChemical;
+            const bool same_input = i > 0 && this->convolutions[i-1].iChemical == ic;
+            this->fft->Convolve(this->buffers[this->iCurrentBuffer][ic], same_input, (int)i, this->convolution_buffers[i]);
+        }
+        for(size_t i=0;i<this->summed_area_table_chemicals.size();i++)
+        {
+            const int ic = this->summed_area_table_chemicals[i];
+            this->summed_area_table->Compute(this->buffers[this->iCurrentBuffer][ic], this->summed_area_table_buffers[i]);
+        }
         for(int io=0;io<2;io++) // first input buffers (io=0) then output buffers (io=1)
         {
             iBuffer = (this->iCurrentBuffer+io)%2;
@@ -261,6 +772,16 @@ void OpenCLImageRD::InternalUpdate(int n_steps)
                 throwOnError(ret,"OpenCLImageRD::InternalUpdate : clSetKernelArg failed: ");
             }
         }
+        if(this->kernel_uses_random_numbers)
+        {
+            // the random numbers are different on each step, but the same whenever the step is repeated
+            cl_uint2 rand_key;
+            rand_key.s[0] = this->random_seed;
+            rand_key.s[1] = (cl_uint)(this->timesteps_taken + it);
+            const cl_uint iArg = 2*NC + (cl_uint)(this->stage_kernels.size() + this->convolutions.size() + this->summed_area_table_chemicals.size());
+            ret = clSetKernelArg(this->kernel, iArg, sizeof(cl_uint2), &rand_key);
+            throwOnError(ret,"OpenCLImageRD::InternalUpdate : clSetKernelArg failed on rand_key: ");
+        }
         ret = clEnqueueNDRangeKernel(this->command_queue, this->kernel, 3, // dimensions
             NULL, this->global_range, this->use_local_memory ? this->local_work_size : NULL,
             0, NULL, NULL);
@@ -274,21 +795,52 @@ void OpenCLImageRD::InternalUpdate(int n_steps)
         this->iCurrentBuffer = 1 - this->iCurrentBuffer;
     }
 
-    this->ReadFromOpenCLBuffers();
+    // the host images are read back only when something needs them, but we still wait for the steps to finish
+    ret = clFinish(this->command_queue);
+    throwOnError(ret,"OpenCLImageRD::InternalUpdate : clFinish failed: ");
+    this->need_read_from_opencl_buffers = true;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
 void OpenCLImageRD::ReadFromOpenCLBuffers()
 {
+    this->need_read_from_opencl_buffers = true;
+    this->ReadFromOpenCLBuffersIfNeeded();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ReadFromOpenCLBuffersIfNeeded() const
+{
+    if(!this->need_read_from_opencl_buffers)
+        return;
+
     // read from opencl buffers into our image
-    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    const size_t N = this->GetX() * this->GetY() * this->GetZ();
+    const size_t element_size = this->GetStorageSize();
+    const size_t MEM_SIZE = element_size * N;
+    vector<unsigned char> stored;
+    if(this->StorageIsConverted())
+        stored.resize(MEM_SIZE);
     for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
     {
         void* data = this->images[ic]->GetScalarPointer();
-        cl_int ret = clEnqueueReadBuffer(this->command_queue,this->buffers[this->iCurrentBuffer][ic], CL_TRUE, 0, MEM_SIZE, data, 0, NULL, NULL);
+        cl_int ret = clEnqueueReadBuffer(this->command_queue,this->buffers[this->iCurrentBuffer][ic], CL_TRUE, 0, MEM_SIZE,
+            this->StorageIsConverted() ? stored.data() : data, 0, NULL, NULL);
         throwOnError(ret,"OpenCLImageRD::ReadFromOpenCLBuffers : buffer reading failed: ");
+        if(this->StorageIsConverted())
+        {
+            for(size_t i=0;i<N;i++)
+            {
+                if(this->data_type == VTK_DOUBLE)
+                    static_cast<double*>(data)[i] = this->ConvertFromStorage(&stored[i * element_size]);
+                else
+                    static_cast<float*>(data)[i] = static_cast<float>(this->ConvertFromStorage(&stored[i * element_size]));
+            }
+        }
     }
+    this->need_read_from_opencl_buffers = false;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -300,34 +852,92 @@ void OpenCLImageRD::TestFormula(std::string program_string)
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLImageRD::SetValue(float x,float y,float z,float val,const Properties& render_settings)
+vector<float> OpenCLImageRD::GetRegion(int i_chemical,int x0,int y0,int z0,int nx,int ny,int nz) const
 {
-    ImageRD::SetValue(x,y,z,val,render_settings);
-    this->need_write_to_opencl_buffers = true;
+    const int X = this->GetX();
+    const int Y = this->GetY();
+    const int Z = this->GetZ();
+    if(i_chemical < 0 || i_chemical >= this->GetNumberOfChemicals() || nx < 0 || ny < 0 || nz < 0 ||
+       x0 < 0 || y0 < 0 || z0 < 0 || x0 + nx > X || y0 + ny > Y || z0 + nz > Z)
+        throw runtime_error("OpenCLImageRD::GetRegion : region out of range");
+
+    // the host images are current unless steps have been taken since they were last read, in which case the device
+    // is newer everywhere (the host images are always read before they are painted on)
+    if(!this->need_read_from_opencl_buffers)
+        return ImageRD::GetRegion(i_chemical, x0, y0, z0, nx, ny, nz);
+
+    const size_t N = size_t(nx) * ny * nz;
+    const size_t element_size = this->GetStorageSize();
+    const size_t dims[3] = { (size_t)X, (size_t)Y, (size_t)Z };
+    const size_t origin[3] = { (size_t)x0, (size_t)y0, (size_t)z0 };
+    const size_t region[3] = { (size_t)nx, (size_t)ny, (size_t)nz };
+    vector<float> values(N);
+    if(N == 0)
+        return values;
+    vector<unsigned char> bytes(N * element_size);
+    this->ReadBufferBox(this->buffers[this->iCurrentBuffer][i_chemical], element_size, dims, origin, region,
+        bytes.data(), nx * element_size, size_t(nx) * ny * element_size);
+    for(size_t i = 0; i < N; i++)
+    {
+        values[i] = static_cast<float>(this->ConvertFromStorage(&bytes[i * element_size]));
+    }
+    return values;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLImageRD::SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings)
+bool OpenCLImageRD::StorageIsConverted() const
 {
-    ImageRD::SetValuesInRadius(x,y,z,r,val,render_settings);
-    this->need_write_to_opencl_buffers = true;
+    return this->storage == Storage::UInt8 || this->storage == Storage::Int16 || this->storage == Storage::Half;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLImageRD::Undo()
+void OpenCLImageRD::ConvertToStorage(const void* host_data,size_t i,unsigned char* stored) const
 {
-    ImageRD::Undo();
-    this->need_write_to_opencl_buffers = true;
+    const double v = this->data_type == VTK_DOUBLE ? static_cast<const double*>(host_data)[i]
+                                                   : static_cast<const float*>(host_data)[i];
+    switch(this->storage)
+    {
+        case Storage::UInt8:
+        case Storage::Int16:
+        {
+            // as convert_<type>_sat_rte in the kernel: round to nearest even, saturate, and NaN becomes zero
+            const double lo = this->storage == Storage::UInt8 ? 0.0 : -32768.0;
+            const double hi = this->storage == Storage::UInt8 ? 255.0 : 32767.0;
+            double r = nearbyint(v * this->GetEffectiveStorageScale());
+            r = (r >= lo) ? min(r, hi) : (r < lo ? lo : 0.0);
+            if(this->storage == Storage::UInt8)
+                *stored = static_cast<uint8_t>(r);
+            else
+                *reinterpret_cast<int16_t*>(stored) = static_cast<int16_t>(r);
+            break;
+        }
+        case Storage::Half: *reinterpret_cast<unsigned short*>(stored) = float_to_half(static_cast<float>(v)); break;
+        case Storage::Float: *reinterpret_cast<float*>(stored) = static_cast<float>(v); break;
+        default:
+            if(this->data_type == VTK_DOUBLE)
+                *reinterpret_cast<double*>(stored) = v;
+            else
+                *reinterpret_cast<float*>(stored) = static_cast<float>(v);
+            break;
+    }
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLImageRD::Redo()
+double OpenCLImageRD::ConvertFromStorage(const unsigned char* stored) const
 {
-    ImageRD::Redo();
-    this->need_write_to_opencl_buffers = true;
+    switch(this->storage)
+    {
+        case Storage::UInt8: return *stored / double(this->GetEffectiveStorageScale());
+        case Storage::Int16: return *reinterpret_cast<const int16_t*>(stored) / double(this->GetEffectiveStorageScale());
+        case Storage::Half: return half_to_float(*reinterpret_cast<const unsigned short*>(stored));
+        case Storage::Float: return *reinterpret_cast<const float*>(stored);
+        default:
+            return this->data_type == VTK_DOUBLE ? *reinterpret_cast<const double*>(stored)
+                                                 : *reinterpret_cast<const float*>(stored);
+    }
 }
 
 // ----------------------------------------------------------------------------------------------------------------
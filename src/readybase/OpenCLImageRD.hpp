@@ -21,6 +21,12 @@
 // local:
 #include "ImageRD.hpp"
 #include "OpenCL_MixIn.hpp"
+class OpenCL_FFT;
+class OpenCL_SummedAreaTable;
+
+// STL:
+#include <array>
+#include <memory>
 
 /// Base class for implementations that use OpenCL.
 class OpenCLImageRD : public ImageRD, public OpenCL_MixIn
@@ -28,23 +34,60 @@ class OpenCLImageRD : public ImageRD, public OpenCL_MixIn
     public:
 
         OpenCLImageRD(int opencl_platform,int opencl_device,int data_type);
+        ~OpenCLImageRD() override;
 
         bool HasEditableFormula() const override { return true; }
 
+        void InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update) override;
+        vtkSmartPointer<vtkXMLDataElement> GetAsXML(bool generate_initial_pattern_when_loading) const override;
+
+        void SaveFile(const char* filename,
+            const Properties& render_settings,
+            bool generate_initial_pattern_when_loading) const override;
+
+        void UpdateRenderPipeline() override;
+
         void GenerateInitialPattern() override;
         void BlankImage(float value = 0.0f) override;
+        void SaveStartingPattern() override;
+
+        void InitializeRenderPipeline(vtkRenderer* pRenderer,const Properties& render_settings) override;
 
         void TestFormula(std::string program_string) override;
 
         std::string GetKernel() const override { return this->AssembleKernelSourceFromFormula(this->formula); }
 
+        /// Names of any extra kernels to run before rd_compute on each step.
+        /** Each one takes the input buffers of every chemical and writes a single intermediate buffer. These
+         *  intermediate buffers are passed to rd_compute in order, after the output buffers. */
+        virtual std::vector<std::string> GetStageKernelNames() const { return {}; }
+
+        /// A convolution of one chemical with an anti-aliased annulus (or disk if inner_radius is zero), normalized to sum to 1.
+        struct RadialConvolution
+        {
+            int iChemical;
+            float inner_radius;
+            float outer_radius;
+        };
+        /// Convolutions to compute by FFT before rd_compute on each step, passed to rd_compute after any stage buffers.
+        const std::vector<RadialConvolution>& GetConvolutions() const { return this->convolutions; }
+
+        /// Chemicals whose summed-area tables are computed before rd_compute on each step, passed to rd_compute after any convolution buffers.
+        /** Each table holds one real value per cell (not blocks of four) and is read with sat_box_sum(). */
+        virtual std::vector<int> GetSummedAreaTableChemicals() const { return {}; }
+
+        void GetAsMesh(vtkPolyData *out,const Properties& render_settings) const override;
+        void GetAs2DImage(vtkImageData *out,const Properties& render_settings) const override;
         void SetFrom2DImage(int iChemical, vtkImageData *im) override;
 
         void SetValue(float x,float y,float z,float val,const Properties& render_settings) override;
         void SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings) override;
 
-        void Undo() override;
-        void Redo() override;
+        /// Reads the box straight from the device if the host images are behind it, else from the host images.
+        std::vector<float> GetRegion(int i_chemical,int x0,int y0,int z0,int nx,int ny,int nz) const override;
+
+        /// Brings the host images up to date with the device, if any steps have been taken since they were last read.
+        void ReadFromOpenCLBuffersIfNeeded() const;
 
     protected:
 
@@ -61,9 +104,61 @@ class OpenCLImageRD : public ImageRD, public OpenCL_MixIn
         void WriteToOpenCLBuffersIfNeeded() override;
         void ReadFromOpenCLBuffers() override;
 
+        void ReadCellValues(int iChemical,int first_cell,int n_cells,float* values) const override;
+        void WriteCellValues(int iChemical,int first_cell,int n_cells,const float* values) override;
+        std::vector<Timeline::Block> GetStateBlocks() override;
+        void CellsPainted(int iChemical,int first_cell,int n_cells) override;
+        void AllCellsChanged() override;
+
+    protected:
+
+        std::vector<RadialConvolution> convolutions;
+
+        /// Set when the steps taken on the device haven't been read back into the host images yet.
+        /** The host images are only needed for rendering, saving, painting and the timeline, so they are read
+         *  when one of those needs them rather than after every step. */
+        mutable bool need_read_from_opencl_buffers;
+
+        /// For each chemical, the box around the cells painted since the buffers were last written: xmin,xmax,ymin,ymax,zmin,zmax (inclusive).
+        /** Only these boxes are written when need_write_to_opencl_buffers is false. A box is empty if xmin > xmax. */
+        std::vector<std::array<int,6> > dirty_boxes;
+
     private:
 
         void BuildProgram();
+        void ReleaseStages();
+        void ReleaseOverlaysKernel();
+
+        /// Apply the overlays to the OpenCL buffers in place, returning false (having done nothing) if they can't all be computed in OpenCL.
+        bool GenerateInitialPatternOnDevice();
+
+        /// Write the dirty box of each chemical from the host images into the current buffers.
+        void WriteDirtyBoxes();
+
+        /// True if the host images hold a different type to the buffers (uint8, int16 and half storage).
+        bool StorageIsConverted() const;
+
+        /// Converts value i of a host image into the storage type, rounding and clamping as the kernel's STORE does.
+        void ConvertToStorage(const void* host_data,size_t i,unsigned char* stored) const;
+
+        /// Converts a stored value back into the value it represents.
+        double ConvertFromStorage(const unsigned char* stored) const;
+
+    private:
+
+        std::vector<cl_kernel> stage_kernels;
+        std::vector<cl_mem> stage_buffers;
+        std::unique_ptr<OpenCL_FFT> fft;
+        std::vector<cl_mem> convolution_buffers;
+        std::unique_ptr<OpenCL_SummedAreaTable> summed_area_table;
+        std::vector<cl_mem> summed_area_table_buffers;
+        std::vector<int> summed_area_table_chemicals; // cached from GetSummedAreaTableChemicals() when the kernel is reloaded
+
+        // the kernel that GenerateInitialPatternOnDevice last built, kept for as long as its source and context stay the same
+        std::string overlays_kernel_source;
+        cl_context overlays_context;
+        cl_program overlays_program;
+        cl_kernel overlays_kernel;
 };
 
 #endif
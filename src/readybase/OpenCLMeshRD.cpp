@@ -22,13 +22,16 @@ using namespace OpenCL_utils;
 #include "utils.hpp"
 
 // STL:
+#include <algorithm>
 #include <string>
 #include <sstream>
+#include <unordered_map>
 
 // VTK:
 #include <vtkMath.h>
 #include <vtkUnstructuredGrid.h>
 #include <vtkCellData.h>
+#include <vtkXMLDataElement.h>
 
 using namespace std;
 
@@ -37,17 +40,49 @@ using namespace std;
 OpenCLMeshRD::OpenCLMeshRD(int opencl_platform,int opencl_device,int data_type)
     : MeshRD(data_type)
     , OpenCL_MixIn(opencl_platform,opencl_device)
+    , max_halo(0)
 {
+    this->clBuffer_local_neighbor_indices = NULL;
+    this->clBuffer_local_overflow_indices = NULL;
+    this->clBuffer_halo_offsets = NULL;
+    this->clBuffer_halo_cells = NULL;
     this->clBuffer_cell_neighbor_indices = NULL;
     this->clBuffer_cell_neighbor_weights = NULL;
+    this->clBuffer_cell_neighbor_offsets = NULL;
+    this->clBuffer_overflow_neighbor_indices = NULL;
+    this->clBuffer_overflow_neighbor_weights = NULL;
 }
 
 // -------------------------------------------------------------------------
 
 OpenCLMeshRD::~OpenCLMeshRD()
 {
+    clReleaseMemObject(this->clBuffer_local_neighbor_indices);
+    clReleaseMemObject(this->clBuffer_local_overflow_indices);
+    clReleaseMemObject(this->clBuffer_halo_offsets);
+    clReleaseMemObject(this->clBuffer_halo_cells);
     clReleaseMemObject(this->clBuffer_cell_neighbor_indices);
     clReleaseMemObject(this->clBuffer_cell_neighbor_weights);
+    clReleaseMemObject(this->clBuffer_cell_neighbor_offsets);
+    clReleaseMemObject(this->clBuffer_overflow_neighbor_indices);
+    clReleaseMemObject(this->clBuffer_overflow_neighbor_weights);
+}
+
+// -------------------------------------------------------------------------
+
+void OpenCLMeshRD::InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update)
+{
+    MeshRD::InitializeFromXML(rd,warn_to_update);
+    this->ReadRandomSeedFromXML(rd->FindNestedElementWithName("rule"));
+}
+
+// -------------------------------------------------------------------------
+
+vtkSmartPointer<vtkXMLDataElement> OpenCLMeshRD::GetAsXML(bool generate_initial_pattern_when_loading) const
+{
+    vtkSmartPointer<vtkXMLDataElement> rd = MeshRD::GetAsXML(generate_initial_pattern_when_loading);
+    this->WriteRandomSeedToXML(rd->FindNestedElementWithName("rule"));
+    return rd;
 }
 
 // -------------------------------------------------------------------------
@@ -114,12 +149,34 @@ void OpenCLMeshRD::InternalUpdate(int n_steps)
     const int NC = this->GetNumberOfChemicals();
 
     // pass the neighbor indices and weights as parameters for the kernel
-    ret = clSetKernelArg(this->kernel, 2*NC + 0, sizeof(cl_mem), (void *)&this->clBuffer_cell_neighbor_indices);
+    // (when using clusters, the indices are of the cells' positions in local memory)
+    cl_mem* neighbor_indices = this->UsesClusters() ? &this->clBuffer_local_neighbor_indices : &this->clBuffer_cell_neighbor_indices;
+    cl_mem* overflow_indices = this->UsesClusters() ? &this->clBuffer_local_overflow_indices : &this->clBuffer_overflow_neighbor_indices;
+    ret = clSetKernelArg(this->kernel, 2*NC + 0, sizeof(cl_mem), (void *)neighbor_indices);
     throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on indices array: ");
     ret = clSetKernelArg(this->kernel, 2*NC + 1, sizeof(cl_mem), (void *)&this->clBuffer_cell_neighbor_weights);
     throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on weights array: ");
-    ret = clSetKernelArg(this->kernel, 2*NC + 2, sizeof(int), &this->max_neighbors);
+    ret = clSetKernelArg(this->kernel, 2*NC + 2, sizeof(int), &this->padded_width);
     throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on max_neighbors parameter: ");
+    if(this->neighbor_layout != NeighborLayout::Padded)
+    {
+        // the kernels for the other layouts also take the overflow lists
+        ret = clSetKernelArg(this->kernel, 2*NC + 3, sizeof(cl_mem), (void *)&this->clBuffer_cell_neighbor_offsets);
+        throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on offsets array: ");
+        ret = clSetKernelArg(this->kernel, 2*NC + 4, sizeof(cl_mem), (void *)overflow_indices);
+        throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on overflow indices array: ");
+        ret = clSetKernelArg(this->kernel, 2*NC + 5, sizeof(cl_mem), (void *)&this->clBuffer_overflow_neighbor_weights);
+        throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on overflow weights array: ");
+    }
+    if(this->UsesClusters())
+    {
+        // the kernel also needs to know which cells to stage in local memory
+        const int iArg = 2*NC + (this->neighbor_layout != NeighborLayout::Padded ? 6 : 3);
+        ret = clSetKernelArg(this->kernel, iArg, sizeof(cl_mem), (void *)&this->clBuffer_halo_offsets);
+        throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on halo offsets array: ");
+        ret = clSetKernelArg(this->kernel, iArg + 1, sizeof(cl_mem), (void *)&this->clBuffer_halo_cells);
+        throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on halo cells array: ");
+    }
 
     for(int it=0;it<n_steps;it++)
     {
@@ -133,7 +190,18 @@ void OpenCLMeshRD::InternalUpdate(int n_steps)
                 throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on buffer: ");
             }
         }
-        ret = clEnqueueNDRangeKernel(this->command_queue,this->kernel, 3, NULL, this->global_range, NULL, 0, NULL, NULL);
+        if(this->kernel_uses_random_numbers)
+        {
+            // the random numbers are different on each step, but the same whenever the step is repeated
+            cl_uint2 rand_key;
+            rand_key.s[0] = this->random_seed;
+            rand_key.s[1] = (cl_uint)(this->timesteps_taken + it);
+            const cl_uint iArg = 2*NC + (this->neighbor_layout != NeighborLayout::Padded ? 6 : 3) + (this->UsesClusters() ? 2 : 0);
+            ret = clSetKernelArg(this->kernel, iArg, sizeof(cl_uint2), &rand_key);
+            throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on rand_key: ");
+        }
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->kernel, 3, NULL, this->global_range,
+            this->UsesClusters() ? this->local_work_size : NULL, 0, NULL, NULL);
         throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clEnqueueNDRangeKernel failed: ");
         this->iCurrentBuffer = 1 - this->iCurrentBuffer;
     }
@@ -152,6 +220,22 @@ void OpenCLMeshRD::ReloadKernelIfNeeded()
 
     cl_int ret;
 
+    if(this->UsesClusters())
+    {
+        if(this->halo_offsets.empty())
+        {
+            this->ComputeClusterHalos();
+            this->WriteClusterBuffers();
+        }
+        // check that each cluster's cells and halo fit in local memory, for every chemical
+        cl_ulong local_memory_size;
+        clGetDeviceInfo(this->device_id, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_memory_size), &local_memory_size, NULL);
+        const size_t needed = (MeshRD::CLUSTER_SIZE + this->max_halo) * this->n_chemicals * this->data_type_size;
+        if(needed > local_memory_size)
+            throw runtime_error("OpenCLMeshRD::ReloadKernelIfNeeded : the cells around each cluster don't fit in local memory. "
+                "Try cell_order=\"bisection\", or turn off local memory.");
+    }
+
     // create the program
     this->kernel_source = this->AssembleKernelSourceFromFormula(this->formula);
     const char *source = this->kernel_source.c_str();
@@ -161,20 +245,7 @@ void OpenCLMeshRD::ReloadKernelIfNeeded()
     throwOnError(ret,"OpenCLMeshRD::ReloadKernelIfNeeded : Failed to create program with source: ");
 
     // build the program
-    ret = clBuildProgram(this->program,1,&this->device_id,"-cl-denorms-are-zero",NULL,NULL);
-    if(ret != CL_SUCCESS)
-    {
-        size_t build_log_length = 0;
-        cl_int ret2 = clGetProgramBuildInfo(this->program,this->device_id,CL_PROGRAM_BUILD_LOG,0,0,&build_log_length);
-        throwOnError(ret2,"OpenCLMeshRD::ReloadKernelIfNeeded : retrieving length of program build log failed: ");
-        vector<char> build_log(build_log_length);
-        cl_int ret3 = clGetProgramBuildInfo(this->program,this->device_id,CL_PROGRAM_BUILD_LOG,build_log_length,build_log.data(),0);
-        throwOnError(ret3,"OpenCLMeshRD::ReloadKernelIfNeeded : retrieving program build log failed: ");
-        { ofstream out("kernel.txt"); out << kernel_source; }
-        ostringstream oss;
-        oss << "OpenCLMeshRD::ReloadKernelIfNeeded : build failed (kernel saved as kernel.txt):\n\n" << string( build_log.begin(), build_log.end() );
-        throwOnError(ret,oss.str().c_str());
-    }
+    BuildProgramOrThrow(this->program,this->device_id,"-cl-denorms-are-zero",kernel_source,"OpenCLMeshRD::ReloadKernelIfNeeded");
 
     // create the kernel
     clReleaseKernel(this->kernel);
@@ -186,6 +257,16 @@ void OpenCLMeshRD::ReloadKernelIfNeeded()
     this->global_range[1] = 1;
     this->global_range[2] = 1;
     // (we let the local work group size be automatically decided, seems to be faster and more flexible that way)
+    if(this->UsesClusters())
+    {
+        // except when using clusters: one per work group, so the range is rounded up to a whole number of them
+        this->global_range[0] = (this->halo_offsets.size() - 1) * MeshRD::CLUSTER_SIZE;
+        this->local_work_size[0] = MeshRD::CLUSTER_SIZE;
+        this->local_work_size[1] = 1;
+        this->local_work_size[2] = 1;
+    }
+
+    this->kernel_uses_random_numbers = UsingKeyword(tokenize_for_keywords(this->kernel_source), "rand_key");
 
     this->need_reload_formula = false;
 }
@@ -214,23 +295,112 @@ void OpenCLMeshRD::CreateOpenCLBuffers()
     }
 
     // create a buffer for the indices of the neighbors of each cell
-    const size_t NBORS_INDICES_SIZE = sizeof(int) * this->mesh->GetNumberOfCells() * this->max_neighbors;
+    const size_t NBORS_INDICES_SIZE = sizeof(int) * this->cell_neighbor_indices.size();
     this->clBuffer_cell_neighbor_indices = clCreateBuffer(this->context, CL_MEM_READ_ONLY, NBORS_INDICES_SIZE, NULL, &ret);
     throwOnError(ret,"OpenCLMeshRD::CreateOpenCLBuffers : neighbor_indices buffer creation failed: ");
 
     // create a buffer for the diffusion coefficients of the neighbors of each cell
-    const size_t NBORS_WEIGHTS_SIZE = sizeof(float) * this->mesh->GetNumberOfCells() * this->max_neighbors;
+    const size_t NBORS_WEIGHTS_SIZE = sizeof(float) * this->cell_neighbor_weights.size();
     this->clBuffer_cell_neighbor_weights = clCreateBuffer(this->context, CL_MEM_READ_ONLY, NBORS_WEIGHTS_SIZE, NULL, &ret);
     throwOnError(ret,"OpenCLMeshRD::CreateOpenCLBuffers : neighbor_weights buffer creation failed: ");
 
+    // create buffers for the neighbors that are not in the padded slots
+    const size_t OFFSETS_SIZE = sizeof(int) * this->cell_neighbor_offsets.size();
+    this->clBuffer_cell_neighbor_offsets = clCreateBuffer(this->context, CL_MEM_READ_ONLY, OFFSETS_SIZE, NULL, &ret);
+    throwOnError(ret,"OpenCLMeshRD::CreateOpenCLBuffers : neighbor_offsets buffer creation failed: ");
+    const size_t OVERFLOW_INDICES_SIZE = sizeof(int) * this->overflow_neighbor_indices.size();
+    this->clBuffer_overflow_neighbor_indices = clCreateBuffer(this->context, CL_MEM_READ_ONLY, OVERFLOW_INDICES_SIZE, NULL, &ret);
+    throwOnError(ret,"OpenCLMeshRD::CreateOpenCLBuffers : overflow_indices buffer creation failed: ");
+    const size_t OVERFLOW_WEIGHTS_SIZE = sizeof(float) * this->overflow_neighbor_weights.size();
+    this->clBuffer_overflow_neighbor_weights = clCreateBuffer(this->context, CL_MEM_READ_ONLY, OVERFLOW_WEIGHTS_SIZE, NULL, &ret);
+    throwOnError(ret,"OpenCLMeshRD::CreateOpenCLBuffers : overflow_weights buffer creation failed: ");
+
+    // the clusters depend on the neighbors, so are found again when the kernel is next built
+    this->halo_offsets.clear();
+    if(this->UsesClusters())
+        this->need_reload_formula = true;
+
     this->need_write_to_opencl_buffers = true;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
+void OpenCLMeshRD::ComputeClusterHalos()
+{
+    const int n_cells = this->mesh->GetNumberOfCells();
+    const int CLUSTER_SIZE = MeshRD::CLUSTER_SIZE;
+    const int n_clusters = (n_cells + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    this->local_neighbor_indices.assign(this->cell_neighbor_indices.size(), 0);
+    this->local_overflow_indices.assign(this->overflow_neighbor_indices.size(), 0);
+    this->halo_offsets.assign(1, 0);
+    this->halo_cells.clear();
+    this->max_halo = 0;
+    unordered_map<int,int> halo_position; // the position in local memory of each halo cell of the current cluster
+    for(int iCluster = 0; iCluster < n_clusters; iCluster++)
+    {
+        const int first = iCluster * CLUSTER_SIZE;
+        const int last = min(n_cells, first + CLUSTER_SIZE);
+        halo_position.clear();
+        auto local_index = [&](int iNeighbor) {
+            if(iNeighbor >= first && iNeighbor < last)
+                return iNeighbor - first;
+            unordered_map<int,int>::const_iterator found = halo_position.find(iNeighbor);
+            if(found != halo_position.end())
+                return found->second;
+            const int iLocal = CLUSTER_SIZE + (int)halo_position.size();
+            halo_position[iNeighbor] = iLocal;
+            this->halo_cells.push_back(iNeighbor);
+            return iLocal;
+        };
+        for(int iCell = first; iCell < last; iCell++)
+        {
+            for(int j = 0; j < this->padded_width; j++)
+            {
+                const size_t k = this->GetPaddedSlotIndex(iCell, j);
+                if(this->cell_neighbor_weights[k] == 0.0f)
+                    this->local_neighbor_indices[k] = iCell - first; // (an unused slot, so no need to stage the cell it points at)
+                else
+                    this->local_neighbor_indices[k] = local_index(this->cell_neighbor_indices[k]);
+            }
+            for(int k = this->cell_neighbor_offsets[iCell]; k < this->cell_neighbor_offsets[iCell+1]; k++)
+                this->local_overflow_indices[k] = local_index(this->overflow_neighbor_indices[k]);
+        }
+        this->halo_offsets.push_back((int)this->halo_cells.size());
+        this->max_halo = max(this->max_halo, (int)halo_position.size());
+    }
+    if(this->halo_cells.empty())
+        this->halo_cells.push_back(0); // (OpenCL doesn't allow empty buffers)
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLMeshRD::WriteClusterBuffers()
+{
+    cl_mem* buffers[4] = { &this->clBuffer_local_neighbor_indices, &this->clBuffer_local_overflow_indices,
+                           &this->clBuffer_halo_offsets, &this->clBuffer_halo_cells };
+    const vector<int>* arrays[4] = { &this->local_neighbor_indices, &this->local_overflow_indices,
+                                     &this->halo_offsets, &this->halo_cells };
+    for(int i = 0; i < 4; i++)
+    {
+        clReleaseMemObject(*buffers[i]);
+        cl_int ret;
+        const size_t SIZE = sizeof(int) * arrays[i]->size();
+        *buffers[i] = clCreateBuffer(this->context, CL_MEM_READ_ONLY, SIZE, NULL, &ret);
+        throwOnError(ret,"OpenCLMeshRD::WriteClusterBuffers : buffer creation failed: ");
+        ret = clEnqueueWriteBuffer(this->command_queue, *buffers[i], CL_TRUE, 0, SIZE, arrays[i]->data(), 0, NULL, NULL);
+        throwOnError(ret,"OpenCLMeshRD::WriteClusterBuffers : buffer writing failed: ");
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
 void OpenCLMeshRD::WriteToOpenCLBuffersIfNeeded()
 {
-    if(!this->need_write_to_opencl_buffers) return;
+    if(!this->need_write_to_opencl_buffers)
+    {
+        this->WriteDirtyCells();
+        return;
+    }
 
     if(this->buffers[0].empty())
         this->CreateOpenCLBuffers();
@@ -246,7 +416,7 @@ void OpenCLMeshRD::WriteToOpenCLBuffersIfNeeded()
     }
 
     // fill indices buffer
-    const size_t NBORS_INDICES_SIZE = sizeof(int) * this->mesh->GetNumberOfCells() * this->max_neighbors;
+    const size_t NBORS_INDICES_SIZE = sizeof(int) * this->cell_neighbor_indices.size();
     ret = clEnqueueWriteBuffer(
         this->command_queue,
         this->clBuffer_cell_neighbor_indices,
@@ -260,7 +430,7 @@ void OpenCLMeshRD::WriteToOpenCLBuffersIfNeeded()
     throwOnError(ret,"OpenCLMeshRD::WriteToOpenCLBuffers : indices buffer writing failed: ");
 
     // fill weights buffer
-    const size_t NBORS_WEIGHTS_SIZE = sizeof(float) * this->mesh->GetNumberOfCells() * this->max_neighbors;
+    const size_t NBORS_WEIGHTS_SIZE = sizeof(float) * this->cell_neighbor_weights.size();
     ret = clEnqueueWriteBuffer(
         this->command_queue,
         this->clBuffer_cell_neighbor_weights,
@@ -271,7 +441,63 @@ void OpenCLMeshRD::WriteToOpenCLBuffersIfNeeded()
         NULL);
     throwOnError(ret,"OpenCLMeshRD::WriteToOpenCLBuffers : weights buffer writing failed: ");
 
+    // fill the overflow buffers
+    ret = clEnqueueWriteBuffer(this->command_queue, this->clBuffer_cell_neighbor_offsets, CL_TRUE, 0,
+        sizeof(int) * this->cell_neighbor_offsets.size(), &this->cell_neighbor_offsets[0], 0, NULL, NULL);
+    throwOnError(ret,"OpenCLMeshRD::WriteToOpenCLBuffers : offsets buffer writing failed: ");
+    ret = clEnqueueWriteBuffer(this->command_queue, this->clBuffer_overflow_neighbor_indices, CL_TRUE, 0,
+        sizeof(int) * this->overflow_neighbor_indices.size(), &this->overflow_neighbor_indices[0], 0, NULL, NULL);
+    throwOnError(ret,"OpenCLMeshRD::WriteToOpenCLBuffers : overflow indices buffer writing failed: ");
+    ret = clEnqueueWriteBuffer(this->command_queue, this->clBuffer_overflow_neighbor_weights, CL_TRUE, 0,
+        sizeof(float) * this->overflow_neighbor_weights.size(), &this->overflow_neighbor_weights[0], 0, NULL, NULL);
+    throwOnError(ret,"OpenCLMeshRD::WriteToOpenCLBuffers : overflow weights buffer writing failed: ");
+
     this->need_write_to_opencl_buffers = false;
+    this->dirty_cells.clear();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLMeshRD::WriteDirtyCells()
+{
+    // the mesh and the current buffers match outside the dirty cells, so write just the runs of cells that hold them
+    const int MAX_GAP = 16; // (clean cells between two dirty ones are written too, if there are no more than this)
+    bool any_written = false;
+    for(int ic=0;ic<(int)this->dirty_cells.size();ic++)
+    {
+        vector<pair<int,int> >& runs = this->dirty_cells[ic];
+        if(runs.empty())
+            continue;
+        sort(runs.begin(),runs.end());
+        const char* data = static_cast<const char*>(this->mesh->GetCellData()->GetArray(GetChemicalName(ic).c_str())->GetVoidPointer(0));
+        size_t i = 0;
+        while(i < runs.size())
+        {
+            const int first = runs[i].first;
+            int last = runs[i].second;
+            while(i < runs.size() && runs[i].first <= last + MAX_GAP + 1)
+                last = max(last,runs[i++].second);
+            cl_int ret = clEnqueueWriteBuffer(this->command_queue,this->buffers[this->iCurrentBuffer][ic], CL_FALSE,
+                first * this->data_type_size, (last - first + 1) * this->data_type_size, data + first * this->data_type_size, 0, NULL, NULL);
+            throwOnError(ret,"OpenCLMeshRD::WriteDirtyCells : data buffer writing failed: ");
+            any_written = true;
+        }
+    }
+    if(any_written)
+    {
+        cl_int ret = clFinish(this->command_queue);
+        throwOnError(ret,"OpenCLMeshRD::WriteDirtyCells : clFinish failed: ");
+    }
+    this->dirty_cells.clear();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLMeshRD::CellsPainted(int iChemical,int first_cell,int n_cells)
+{
+    if(iChemical >= (int)this->dirty_cells.size())
+        this->dirty_cells.resize(this->GetNumberOfChemicals());
+    this->dirty_cells[iChemical].push_back(make_pair(first_cell,first_cell+n_cells-1));
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -295,71 +521,67 @@ void OpenCLMeshRD::ReadFromOpenCLBuffers()
 void OpenCLMeshRD::CopyFromMesh(vtkUnstructuredGrid* mesh2)
 {
     MeshRD::CopyFromMesh(mesh2);
-    this->need_write_to_opencl_buffers = true;
-}
-
-// ----------------------------------------------------------------------------------------------------------------
-
-void OpenCLMeshRD::TestFormula(std::string program_string)
-{
-    this->TestKernel(this->AssembleKernelSourceFromFormula(program_string));
+    this->CreateOpenCLBuffers(); // (the neighbor arrays may have changed size)
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLMeshRD::GenerateInitialPattern()
+void OpenCLMeshRD::SetNeighborLayout(NeighborLayout layout)
 {
-    MeshRD::GenerateInitialPattern();
-    this->need_write_to_opencl_buffers = true;
-}
-
-// ----------------------------------------------------------------------------------------------------------------
-
-void OpenCLMeshRD::BlankImage(float value)
-{
-    MeshRD::BlankImage(value);
-    this->need_write_to_opencl_buffers = true;
+    MeshRD::SetNeighborLayout(layout);
+    this->need_reload_formula = true; // the kernel arguments depend on the layout
+    this->CreateOpenCLBuffers();
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLMeshRD::ReleaseOpenCLBuffers()
+void OpenCLMeshRD::TestFormula(std::string program_string)
 {
-    OpenCL_MixIn::ReleaseOpenCLBuffers();
-    clReleaseMemObject(this->clBuffer_cell_neighbor_indices);
-    clReleaseMemObject(this->clBuffer_cell_neighbor_weights);
+    this->TestKernel(this->AssembleKernelSourceFromFormula(program_string));
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLMeshRD::SetValue(float x,float y,float z,float val,const Properties& render_settings)
+void OpenCLMeshRD::GenerateInitialPattern()
 {
-    MeshRD::SetValue(x,y,z,val,render_settings);
+    MeshRD::GenerateInitialPattern();
     this->need_write_to_opencl_buffers = true;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLMeshRD::SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings)
+void OpenCLMeshRD::AllCellsChanged()
 {
-    MeshRD::SetValuesInRadius(x,y,z,r,val,render_settings);
+    MeshRD::AllCellsChanged();
     this->need_write_to_opencl_buffers = true;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLMeshRD::Undo()
+void OpenCLMeshRD::BlankImage(float value)
 {
-    MeshRD::Undo();
+    MeshRD::BlankImage(value);
     this->need_write_to_opencl_buffers = true;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
-void OpenCLMeshRD::Redo()
+void OpenCLMeshRD::ReleaseOpenCLBuffers()
 {
-    MeshRD::Redo();
-    this->need_write_to_opencl_buffers = true;
+    OpenCL_MixIn::ReleaseOpenCLBuffers();
+    clReleaseMemObject(this->clBuffer_cell_neighbor_indices);
+    clReleaseMemObject(this->clBuffer_cell_neighbor_weights);
+    clReleaseMemObject(this->clBuffer_cell_neighbor_offsets);
+    clReleaseMemObject(this->clBuffer_overflow_neighbor_indices);
+    clReleaseMemObject(this->clBuffer_overflow_neighbor_weights);
+    clReleaseMemObject(this->clBuffer_local_neighbor_indices);
+    clReleaseMemObject(this->clBuffer_local_overflow_indices);
+    clReleaseMemObject(this->clBuffer_halo_offsets);
+    clReleaseMemObject(this->clBuffer_halo_cells);
+    this->clBuffer_local_neighbor_indices = NULL;
+    this->clBuffer_local_overflow_indices = NULL;
+    this->clBuffer_halo_offsets = NULL;
+    this->clBuffer_halo_cells = NULL;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
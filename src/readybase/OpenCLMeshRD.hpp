@@ -22,6 +22,9 @@
 #include "MeshRD.hpp"
 #include "OpenCL_MixIn.hpp"
 
+// STL:
+#include <utility>
+
 /// Base class for mesh implementations that use OpenCL.
 class OpenCLMeshRD : public MeshRD, public OpenCL_MixIn
 {
@@ -34,8 +37,13 @@ class OpenCLMeshRD : public MeshRD, public OpenCL_MixIn
 
         bool HasEditableFormula() const override { return true; }
 
+        void InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update) override;
+        vtkSmartPointer<vtkXMLDataElement> GetAsXML(bool generate_initial_pattern_when_loading) const override;
+
         void CopyFromMesh(vtkUnstructuredGrid* mesh2) override;
 
+        void SetNeighborLayout(NeighborLayout layout) override;
+
         // we override the parameter access functions because changing the parameters requires rewriting the kernel
         void AddParameter(const std::string& name,float val) override;
         void DeleteParameter(int iParam) override;
@@ -49,12 +57,6 @@ class OpenCLMeshRD : public MeshRD, public OpenCL_MixIn
         void TestFormula(std::string program_string) override;
         std::string GetKernel() const override { return this->AssembleKernelSourceFromFormula(this->formula); }
 
-        void SetValue(float x,float y,float z,float val,const Properties& render_settings) override;
-        void SetValuesInRadius(float x,float y,float z,float r,float val,const Properties& render_settings) override;
-
-        void Undo() override;
-        void Redo() override;
-
     protected:
 
         void InternalUpdate(int n_steps) override;
@@ -66,10 +68,42 @@ class OpenCLMeshRD : public MeshRD, public OpenCL_MixIn
         void ReadFromOpenCLBuffers() override;
         void ReleaseOpenCLBuffers() override;
 
+        void CellsPainted(int iChemical,int first_cell,int n_cells) override;
+        void AllCellsChanged() override;
+
+        /// write the runs of dirty_cells of each chemical from the mesh into the current buffers
+        void WriteDirtyCells();
+
+        /// Whether the kernel runs one cluster of CLUSTER_SIZE cells per work group, with the cells it reads in local memory.
+        virtual bool UsesClusters() const { return false; }
+
+        /// find the cells outside each cluster that its cells read from, and where each neighbor will be in local memory
+        void ComputeClusterHalos();
+        void WriteClusterBuffers();
+
+    protected:
+
+        std::vector<int> local_neighbor_indices; ///< as cell_neighbor_indices, but the position in local memory: the cluster's own cells, then its halo
+        std::vector<int> local_overflow_indices; ///< as overflow_neighbor_indices, but the position in local memory
+        std::vector<int> halo_offsets;           ///< the halo of cluster i is at [halo_offsets[i],halo_offsets[i+1]) in halo_cells, or empty if not computed
+        std::vector<int> halo_cells;             ///< the cells outside each cluster that its cells read from
+        int max_halo;                            ///< the largest number of cells in any halo
+
+        /// For each chemical, the runs of cells (first,last inclusive) painted since the buffers were last written (unsorted, possibly overlapping).
+        /** Only these are written when need_write_to_opencl_buffers is false. */
+        std::vector<std::vector<std::pair<int,int> > > dirty_cells;
+
     private:
 
         cl_mem clBuffer_cell_neighbor_indices;
         cl_mem clBuffer_cell_neighbor_weights;
+        cl_mem clBuffer_cell_neighbor_offsets;
+        cl_mem clBuffer_overflow_neighbor_indices;
+        cl_mem clBuffer_overflow_neighbor_weights;
+        cl_mem clBuffer_local_neighbor_indices;
+        cl_mem clBuffer_local_overflow_indices;
+        cl_mem clBuffer_halo_offsets;
+        cl_mem clBuffer_halo_cells;
 };
 
 #endif
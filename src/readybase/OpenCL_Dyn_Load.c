@@ -95,10 +95,11 @@ __clSetMemObjectDestructorCallback   *clSetMemObjectDestructorCallback;
 __clCreateUserEvent                  *clCreateUserEvent;
 __clSetUserEventStatus               *clSetUserEventStatus;
 __clSetEventCallback                 *clSetEventCallback;
-__clEnqueueReadBufferRect            *clEnqueueReadBufferRect;
-__clEnqueueWriteBufferRect           *clEnqueueWriteBufferRect;
 __clEnqueueCopyBufferRect            *clEnqueueCopyBufferRect;
 */
+/* these are loaded if present, and only used if the device reports OpenCL 1.1 or later */
+__clEnqueueReadBufferRect            *clEnqueueReadBufferRect;
+__clEnqueueWriteBufferRect           *clEnqueueWriteBufferRect;
 
 #if defined(_WIN32) || defined(_WIN64)
 
@@ -126,6 +127,9 @@ cl_int CL_LOAD_LIBRARY(CL_LIBRARY *pInstance)
         name = (__##name *)GetProcAddress(ClLib, #name);        \
         if (name == NULL) return CL_DEVICE_NOT_AVAILABLE
 
+#define GET_OPTIONAL_PROC(name)                                 \
+        name = (__##name *)GetProcAddress(ClLib, #name)
+
 #elif defined(__unix__) || defined(__APPLE__) || defined(__MACOSX)
 
 #include <dlfcn.h>
@@ -152,6 +156,9 @@ cl_int CL_LOAD_LIBRARY(CL_LIBRARY *pInstance)
         name = (__##name *)(size_t)dlsym(ClLib, #name);                 \
         if (name == NULL) return CL_DEVICE_NOT_AVAILABLE
 
+#define GET_OPTIONAL_PROC(name)                                 \
+        name = (__##name *)(size_t)dlsym(ClLib, #name)
+
 #endif
 
 
@@ -237,9 +244,9 @@ cl_int CL_API_CALL clLibLoad()
     //GET_PROC(clCreateUserEvent                  );
     //GET_PROC(clSetUserEventStatus               );
     //GET_PROC(clSetEventCallback                 );
-    //GET_PROC(clEnqueueReadBufferRect            );
-    //GET_PROC(clEnqueueWriteBufferRect           );
     //GET_PROC(clEnqueueCopyBufferRect            );
+    GET_OPTIONAL_PROC(clEnqueueReadBufferRect   );
+    GET_OPTIONAL_PROC(clEnqueueWriteBufferRect  );
 
     return CL_SUCCESS;
 }
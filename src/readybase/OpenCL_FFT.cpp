@@ -0,0 +1,344 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "OpenCL_FFT.hpp"
+#include "OpenCL_MixIn.hpp"
+#include "OpenCL_utils.hpp"
+using namespace OpenCL_utils;
+
+// STL:
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// VTK:
+#include <vtkType.h>
+
+using namespace std;
+
+// ----------------------------------------------------------------------------------------------------------------
+
+namespace
+{
+    bool IsPowerOfTwo(int n) { return n > 0 && (n & (n - 1)) == 0; }
+
+    string GetFFTKernelSource(const int dimensions[3], int data_type)
+    {
+        ostringstream kernel_source;
+        if (data_type == VTK_DOUBLE)
+        {
+            kernel_source << "\
+#ifdef cl_khr_fp64\n\
+    #pragma OPENCL EXTENSION cl_khr_fp64 : enable\n\
+#elif defined(cl_amd_fp64)\n\
+    #pragma OPENCL EXTENSION cl_amd_fp64 : enable\n\
+#else\n\
+    #error \"Double precision floating point not supported on this OpenCL device. Choose another or contact the Ready team.\"\n\
+#endif\n\n\
+typedef double real;\n\
+typedef double2 complex_t;\n\
+#define PI M_PI\n";
+        }
+        else
+        {
+            kernel_source << "\
+typedef float real;\n\
+typedef float2 complex_t;\n\
+#define PI M_PI_F\n";
+        }
+        kernel_source << "#define NX " << dimensions[0] << "\n";
+        kernel_source << "#define NY " << dimensions[1] << "\n";
+        kernel_source << "#define NZ " << dimensions[2] << "\n\n";
+        kernel_source << "\
+kernel void fft_load(global const real* in, global complex_t* out)\n\
+{\n\
+    const int i = get_global_id(0);\n\
+    out[i] = (complex_t)(in[i], 0);\n\
+}\n\
+\n\
+// one radix-2 pass of a Stockham FFT along the given axis, for half-sub-transform size Ns\n\
+kernel void fft_pass(global const complex_t* src, global complex_t* dst, const int axis, const int Ns, const real sign)\n\
+{\n\
+    int id[3] = { get_global_id(0), get_global_id(1), get_global_id(2) };\n\
+    const int N = (axis == 0) ? NX : ((axis == 1) ? NY : NZ);\n\
+    const int stride = (axis == 0) ? 1 : ((axis == 1) ? NX : NX * NY);\n\
+    const int j = id[axis];\n\
+    id[axis] = 0;\n\
+    const int base = NX * (NY * id[2] + id[1]) + id[0];\n\
+    const complex_t v0 = src[base + j * stride];\n\
+    const complex_t u = src[base + (j + N / 2) * stride];\n\
+    const int k = j & (Ns - 1);\n\
+    const real angle = sign * PI * k / Ns;\n\
+    const real c = cos(angle);\n\
+    const real s = sin(angle);\n\
+    const complex_t v1 = (complex_t)(u.x * c - u.y * s, u.x * s + u.y * c);\n\
+    const int out = ((j - k) << 1) + k;\n\
+    dst[base + out * stride] = v0 + v1;\n\
+    dst[base + (out + Ns) * stride] = v0 - v1;\n\
+}\n\
+\n\
+kernel void fft_multiply(global const complex_t* a, global const complex_t* b, global complex_t* out)\n\
+{\n\
+    const int i = get_global_id(0);\n\
+    const complex_t p = a[i];\n\
+    const complex_t q = b[i];\n\
+    out[i] = (complex_t)(p.x * q.x - p.y * q.y, p.x * q.y + p.y * q.x);\n\
+}\n\
+\n\
+kernel void fft_store(global const complex_t* in, global real* out)\n\
+{\n\
+    const int i = get_global_id(0);\n\
+    out[i] = in[i].x / (real)(NX * NY * NZ);\n\
+}\n";
+        return kernel_source.str();
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+OpenCL_FFT::OpenCL_FFT(cl_context context,cl_device_id device_id,cl_command_queue command_queue,int x,int y,int z,int data_type)
+    : context(context)
+    , command_queue(command_queue)
+    , program(NULL)
+    , load_kernel(NULL)
+    , pass_kernel(NULL)
+    , multiply_kernel(NULL)
+    , store_kernel(NULL)
+    , dimensions{ x, y, z }
+    , n_cells((size_t)x * y * z)
+    , complex_size(data_type == VTK_DOUBLE ? 2 * sizeof(double) : 2 * sizeof(float))
+    , work{ NULL, NULL, NULL }
+    , iForwardResult(-1)
+{
+    if (!IsPowerOfTwo(x) || !IsPowerOfTwo(y) || !IsPowerOfTwo(z))
+    {
+        throw runtime_error("OpenCL_FFT : image dimensions must be powers of two");
+    }
+
+    // build the program
+    const string kernel_source = GetFFTKernelSource(this->dimensions, data_type);
+    const char* source = kernel_source.c_str();
+    size_t source_size = kernel_source.length();
+    cl_int ret;
+    this->program = clCreateProgramWithSource(context, 1, &source, &source_size, &ret);
+    throwOnError(ret, "OpenCL_FFT : Failed to create program with source: ");
+    OpenCL_MixIn::BuildProgramOrThrow(this->program, device_id, "", kernel_source, "OpenCL_FFT");
+    this->load_kernel = clCreateKernel(this->program, "fft_load", &ret);
+    throwOnError(ret, "OpenCL_FFT : kernel creation failed: ");
+    this->pass_kernel = clCreateKernel(this->program, "fft_pass", &ret);
+    throwOnError(ret, "OpenCL_FFT : kernel creation failed: ");
+    this->multiply_kernel = clCreateKernel(this->program, "fft_multiply", &ret);
+    throwOnError(ret, "OpenCL_FFT : kernel creation failed: ");
+    this->store_kernel = clCreateKernel(this->program, "fft_store", &ret);
+    throwOnError(ret, "OpenCL_FFT : kernel creation failed: ");
+
+    for (int i = 0; i < 3; i++)
+    {
+        this->work[i] = clCreateBuffer(context, CL_MEM_READ_WRITE, this->n_cells * this->complex_size, NULL, &ret);
+        throwOnError(ret, "OpenCL_FFT : buffer creation failed: ");
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+OpenCL_FFT::~OpenCL_FFT()
+{
+    for (cl_mem spectrum : this->spectra)
+    {
+        clReleaseMemObject(spectrum);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        if (this->work[i])
+        {
+            clReleaseMemObject(this->work[i]);
+        }
+    }
+    cl_kernel kernels[4] = { this->load_kernel, this->pass_kernel, this->multiply_kernel, this->store_kernel };
+    for (cl_kernel kernel : kernels)
+    {
+        if (kernel)
+        {
+            clReleaseKernel(kernel);
+        }
+    }
+    if (this->program)
+    {
+        clReleaseProgram(this->program);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+int OpenCL_FFT::Transform(int iSource,int iOther,float sign)
+{
+    // transforms work[iSource] along each axis in turn, ping-ponging with work[iOther], returns the index of the result
+    cl_int ret;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        size_t global_range[3] = { (size_t)this->dimensions[0], (size_t)this->dimensions[1], (size_t)this->dimensions[2] };
+        global_range[axis] /= 2; // each work item computes a pair of outputs
+        for (int Ns = 1; Ns < this->dimensions[axis]; Ns *= 2)
+        {
+            ret = clSetKernelArg(this->pass_kernel, 0, sizeof(cl_mem), (void *)&this->work[iSource]);
+            throwOnError(ret, "OpenCL_FFT::Transform : clSetKernelArg failed: ");
+            ret = clSetKernelArg(this->pass_kernel, 1, sizeof(cl_mem), (void *)&this->work[iOther]);
+            throwOnError(ret, "OpenCL_FFT::Transform : clSetKernelArg failed: ");
+            ret = clSetKernelArg(this->pass_kernel, 2, sizeof(int), (void *)&axis);
+            throwOnError(ret, "OpenCL_FFT::Transform : clSetKernelArg failed: ");
+            ret = clSetKernelArg(this->pass_kernel, 3, sizeof(int), (void *)&Ns);
+            throwOnError(ret, "OpenCL_FFT::Transform : clSetKernelArg failed: ");
+            if (this->complex_size == 2 * sizeof(double))
+            {
+                const double sign_d = sign;
+                ret = clSetKernelArg(this->pass_kernel, 4, sizeof(double), (void *)&sign_d);
+            }
+            else
+            {
+                ret = clSetKernelArg(this->pass_kernel, 4, sizeof(float), (void *)&sign);
+            }
+            throwOnError(ret, "OpenCL_FFT::Transform : clSetKernelArg failed: ");
+            ret = clEnqueueNDRangeKernel(this->command_queue, this->pass_kernel, 3, NULL, global_range, NULL, 0, NULL, NULL);
+            throwOnError(ret, "OpenCL_FFT::Transform : clEnqueueNDRangeKernel failed: ");
+            swap(iSource, iOther);
+        }
+    }
+    return iSource;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+int OpenCL_FFT::AddKernel(const vector<double>& weights)
+{
+    if (weights.size() != this->n_cells)
+    {
+        throw runtime_error("OpenCL_FFT::AddKernel : wrong number of weights");
+    }
+    // upload the weights as complex values with zero imaginary part
+    cl_int ret;
+    if (this->complex_size == 2 * sizeof(double))
+    {
+        vector<double> complex_weights(2 * this->n_cells, 0.0);
+        for (size_t i = 0; i < this->n_cells; i++)
+        {
+            complex_weights[2 * i] = weights[i];
+        }
+        ret = clEnqueueWriteBuffer(this->command_queue, this->work[0], CL_TRUE, 0, this->n_cells * this->complex_size, complex_weights.data(), 0, NULL, NULL);
+    }
+    else
+    {
+        vector<float> complex_weights(2 * this->n_cells, 0.0f);
+        for (size_t i = 0; i < this->n_cells; i++)
+        {
+            complex_weights[2 * i] = static_cast<float>(weights[i]);
+        }
+        ret = clEnqueueWriteBuffer(this->command_queue, this->work[0], CL_TRUE, 0, this->n_cells * this->complex_size, complex_weights.data(), 0, NULL, NULL);
+    }
+    throwOnError(ret, "OpenCL_FFT::AddKernel : buffer writing failed: ");
+
+    // transform them and keep the spectrum
+    const int iResult = this->Transform(0, 1, -1.0f);
+    cl_mem spectrum = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->n_cells * this->complex_size, NULL, &ret);
+    throwOnError(ret, "OpenCL_FFT::AddKernel : buffer creation failed: ");
+    ret = clEnqueueCopyBuffer(this->command_queue, this->work[iResult], spectrum, 0, 0, this->n_cells * this->complex_size, 0, NULL, NULL);
+    throwOnError(ret, "OpenCL_FFT::AddKernel : buffer copying failed: ");
+    this->spectra.push_back(spectrum);
+    this->iForwardResult = -1; // we have overwritten the working buffers
+    return (int)this->spectra.size() - 1;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCL_FFT::Convolve(cl_mem input,bool input_unchanged,int iKernel,cl_mem output)
+{
+    if (iKernel < 0 || iKernel >= (int)this->spectra.size())
+    {
+        throw runtime_error("OpenCL_FFT::Convolve : kernel index out of range");
+    }
+    cl_int ret;
+    if (!input_unchanged || this->iForwardResult < 0)
+    {
+        ret = clSetKernelArg(this->load_kernel, 0, sizeof(cl_mem), (void *)&input);
+        throwOnError(ret, "OpenCL_FFT::Convolve : clSetKernelArg failed: ");
+        ret = clSetKernelArg(this->load_kernel, 1, sizeof(cl_mem), (void *)&this->work[0]);
+        throwOnError(ret, "OpenCL_FFT::Convolve : clSetKernelArg failed: ");
+        ret = clEnqueueNDRangeKernel(this->command_queue, this->load_kernel, 1, NULL, &this->n_cells, NULL, 0, NULL, NULL);
+        throwOnError(ret, "OpenCL_FFT::Convolve : clEnqueueNDRangeKernel failed: ");
+        this->iForwardResult = this->Transform(0, 1, -1.0f);
+    }
+    // multiply by the spectrum of the kernel, into the third buffer, leaving the forward transform intact for reuse
+    ret = clSetKernelArg(this->multiply_kernel, 0, sizeof(cl_mem), (void *)&this->work[this->iForwardResult]);
+    throwOnError(ret, "OpenCL_FFT::Convolve : clSetKernelArg failed: ");
+    ret = clSetKernelArg(this->multiply_kernel, 1, sizeof(cl_mem), (void *)&this->spectra[iKernel]);
+    throwOnError(ret, "OpenCL_FFT::Convolve : clSetKernelArg failed: ");
+    ret = clSetKernelArg(this->multiply_kernel, 2, sizeof(cl_mem), (void *)&this->work[2]);
+    throwOnError(ret, "OpenCL_FFT::Convolve : clSetKernelArg failed: ");
+    ret = clEnqueueNDRangeKernel(this->command_queue, this->multiply_kernel, 1, NULL, &this->n_cells, NULL, 0, NULL, NULL);
+    throwOnError(ret, "OpenCL_FFT::Convolve : clEnqueueNDRangeKernel failed: ");
+    // inverse transform and write the real part
+    const int iResult = this->Transform(2, 1 - this->iForwardResult, 1.0f);
+    ret = clSetKernelArg(this->store_kernel, 0, sizeof(cl_mem), (void *)&this->work[iResult]);
+    throwOnError(ret, "OpenCL_FFT::Convolve : clSetKernelArg failed: ");
+    ret = clSetKernelArg(this->store_kernel, 1, sizeof(cl_mem), (void *)&output);
+    throwOnError(ret, "OpenCL_FFT::Convolve : clSetKernelArg failed: ");
+    ret = clEnqueueNDRangeKernel(this->command_queue, this->store_kernel, 1, NULL, &this->n_cells, NULL, 0, NULL, NULL);
+    throwOnError(ret, "OpenCL_FFT::Convolve : clEnqueueNDRangeKernel failed: ");
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vector<double> OpenCL_FFT::GetAnnulusWeights(int x,int y,int z,float inner_radius,float outer_radius)
+{
+    // same anti-aliasing as the SmoothLife kernels: a linear ramp of width 1 at each edge
+    auto ramp = [](double v) { return min(1.0, max(0.0, v + 0.5)); };
+    vector<double> weights((size_t)x * y * z);
+    double total = 0.0;
+    for (int k = 0; k < z; k++)
+    {
+        const int dz = (k <= z / 2) ? k : k - z; // nearest image, since we wrap around
+        for (int j = 0; j < y; j++)
+        {
+            const int dy = (j <= y / 2) ? j : j - y;
+            for (int i = 0; i < x; i++)
+            {
+                const int dx = (i <= x / 2) ? i : i - x;
+                const double r = sqrt((double)(dx * dx + dy * dy + dz * dz));
+                double w = ramp(outer_radius - r);
+                if (inner_radius > 0.0f)
+                {
+                    w *= ramp(r - inner_radius);
+                }
+                weights[(size_t)x * (y * k + j) + i] = w;
+                total += w;
+            }
+        }
+    }
+    if (total <= 0.0)
+    {
+        throw runtime_error("OpenCL_FFT::GetAnnulusWeights : kernel is empty");
+    }
+    for (double& w : weights)
+    {
+        w /= total;
+    }
+    return weights;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
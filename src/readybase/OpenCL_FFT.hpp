@@ -0,0 +1,73 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __OPENCL_FFT__
+#define __OPENCL_FFT__
+
+// OpenCL:
+#ifdef __APPLE__
+    // OpenCL is linked at start up time on Mac OS 10.6+
+    #include <OpenCL/opencl.h>
+#else
+    // OpenCL is loaded dynamically on Windows and Linux
+    #include "OpenCL_Dyn_Load.h"
+#endif
+
+// STL:
+#include <vector>
+
+/// Convolution of a wrap-around image with fixed kernels, using FFTs on the OpenCL device.
+/** The image dimensions must be powers of two. Each convolution costs the same whatever the size of
+ *  the kernel: a forward transform of the input, a multiplication by the precomputed spectrum of the
+ *  kernel and an inverse transform. */
+class OpenCL_FFT
+{
+    public:
+
+        OpenCL_FFT(cl_context context,cl_device_id device_id,cl_command_queue command_queue,int x,int y,int z,int data_type);
+        ~OpenCL_FFT();
+
+        /// Adds a convolution kernel, given as weights for every cell with the origin at (0,0,0) and wrap-around. Returns its index.
+        int AddKernel(const std::vector<double>& weights);
+
+        /// Enqueues the convolution of input with kernel iKernel, writing the result to output.
+        /** Both buffers hold one real value per cell, of the data type given on construction. If input_unchanged is true
+         *  then the forward transform from the previous call is reused. */
+        void Convolve(cl_mem input,bool input_unchanged,int iKernel,cl_mem output);
+
+        /// A radially symmetric kernel that is 1 in the annulus inner_radius <= r <= outer_radius, anti-aliased at the edges and normalized to sum to 1.
+        static std::vector<double> GetAnnulusWeights(int x,int y,int z,float inner_radius,float outer_radius);
+
+    private:
+
+        int Transform(int iSource,int iOther,float sign);
+
+    private:
+
+        cl_context context;
+        cl_command_queue command_queue;
+        cl_program program;
+        cl_kernel load_kernel,pass_kernel,multiply_kernel,store_kernel;
+        int dimensions[3];
+        size_t n_cells;
+        size_t complex_size;
+        cl_mem work[3]; // complex-valued working buffers
+        int iForwardResult; // which of work[] holds the most recent forward transform
+        std::vector<cl_mem> spectra; // the transformed kernels
+};
+
+#endif
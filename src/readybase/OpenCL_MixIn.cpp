@@ -18,13 +18,19 @@
 // local:
 #include "OpenCL_MixIn.hpp"
 #include "OpenCL_utils.hpp"
+#include "utils.hpp"
 using namespace OpenCL_utils;
 
 // STL:
+#include <cstdio>
 #include <stdexcept>
 #include <fstream>
+#include <random>
 #include <sstream>
 
+// VTK:
+#include <vtkXMLDataElement.h>
+
 using namespace std;
 
 // ---------------------------------------------------------------------------
@@ -40,7 +46,11 @@ OpenCL_MixIn::OpenCL_MixIn(int opencl_platform, int opencl_device)
     , command_queue(NULL)
     , need_reload_context(true)
     , need_write_to_opencl_buffers(true)
+    , have_buffer_rect(false)
     , iCurrentBuffer(0)
+    , random_seed(random_device()())
+    , random_seed_is_fixed(false)
+    , kernel_uses_random_numbers(false)
     , iPlatform(opencl_platform)
     , iDevice(opencl_device)
 {
@@ -139,6 +149,19 @@ void OpenCL_MixIn::ReloadContextIfNeeded()
         this->device_id = devices_available[this->iDevice];
     }
 
+    // the rectangular buffer copies need OpenCL 1.1 (the device version is "OpenCL <major>.<minor> ...")
+    {
+        char version[256] = "";
+        ret = clGetDeviceInfo(this->device_id,CL_DEVICE_VERSION,sizeof(version)-1,version,NULL);
+        throwOnError(ret,"OpenCL_MixIn::ReloadContextIfNeeded : Failed to retrieve device version: ");
+        int major = 1, minor = 0;
+        sscanf(version,"OpenCL %d.%d",&major,&minor);
+        this->have_buffer_rect = major > 1 || (major == 1 && minor >= 1);
+#ifndef __APPLE__
+        this->have_buffer_rect = this->have_buffer_rect && clEnqueueReadBufferRect && clEnqueueWriteBufferRect;
+#endif
+    }
+
     // create the context
     clReleaseContext(this->context);
     this->context = clCreateContext(NULL,1,&this->device_id,NULL,NULL,&ret);
@@ -168,25 +191,59 @@ void OpenCL_MixIn::TestKernel(std::string kernel_source)
     throwOnError(ret,"OpenCL_MixIn::TestKernel : Failed to create program with source: ");
 
     // build the program
-    ret = clBuildProgram(temp_program,1,&this->device_id,"-cl-denorms-are-zero",NULL,NULL);
-    if(ret != CL_SUCCESS)
+    try
+    {
+        BuildProgramOrThrow(temp_program,this->device_id,"-cl-denorms-are-zero",kernel_source,"OpenCL_MixIn::TestKernel");
+    }
+    catch(...)
     {
-        size_t build_log_length = 0;
-        cl_int ret2 = clGetProgramBuildInfo(temp_program,this->device_id,CL_PROGRAM_BUILD_LOG,0,0,&build_log_length);
-        throwOnError(ret2,"OpenCL_MixIn::TestKernel : retrieving length of program build log failed: ");
-        vector<char> build_log(build_log_length);
-        cl_int ret3 = clGetProgramBuildInfo(temp_program,this->device_id,CL_PROGRAM_BUILD_LOG,build_log_length,build_log.data(),0);
-        throwOnError(ret3,"OpenCL_MixIn::TestKernel : retrieving program build log failed: ");
-        { ofstream out("kernel.txt"); out << kernel_source; }
-        ostringstream oss;
-        oss << "OpenCL_MixIn::TestKernel : build failed (kernel saved as kernel.txt):\n\n" << string( build_log.begin(), build_log.end() );
-        throwOnError(ret,oss.str().c_str());
+        clReleaseProgram(temp_program);
+        throw;
     }
     clReleaseProgram(temp_program);
 }
 
 // -----------------------------------------------------------------------
 
+void OpenCL_MixIn::ReadRandomSeedFromXML(vtkXMLDataElement* rule)
+{
+    if(!rule->GetAttribute("random_seed"))
+        return;
+    cl_uint seed;
+    read_required_attribute(rule,"random_seed",seed);
+    this->SetRandomSeed(seed);
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::WriteRandomSeedToXML(vtkXMLDataElement* rule) const
+{
+    if(this->random_seed_is_fixed)
+        rule->SetAttribute("random_seed",to_string(this->random_seed).c_str());
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::BuildProgramOrThrow(cl_program program,cl_device_id device,const char* options,const string& source,
+                                       const string& caller)
+{
+    cl_int ret = clBuildProgram(program,1,&device,options,NULL,NULL);
+    if(ret == CL_SUCCESS)
+        return;
+    size_t build_log_length = 0;
+    cl_int ret2 = clGetProgramBuildInfo(program,device,CL_PROGRAM_BUILD_LOG,0,0,&build_log_length);
+    throwOnError(ret2,(caller + " : retrieving length of program build log failed: ").c_str());
+    vector<char> build_log(build_log_length);
+    cl_int ret3 = clGetProgramBuildInfo(program,device,CL_PROGRAM_BUILD_LOG,build_log_length,build_log.data(),0);
+    throwOnError(ret3,(caller + " : retrieving program build log failed: ").c_str());
+    { ofstream out("kernel.txt"); out << source; }
+    ostringstream oss;
+    oss << caller << " : build failed (kernel saved as kernel.txt):\n\n" << string( build_log.begin(), build_log.end() );
+    throwOnError(ret,oss.str().c_str());
+}
+
+// -----------------------------------------------------------------------
+
 void OpenCL_MixIn::ReleaseOpenCLBuffers()
 {
     for(int i=0;i<2;i++)
@@ -195,3 +252,66 @@ void OpenCL_MixIn::ReleaseOpenCLBuffers()
 }
 
 // -----------------------------------------------------------------------
+
+void OpenCL_MixIn::WriteBufferBox(cl_mem buffer,size_t element_size,const size_t dims[3],const size_t origin[3],const size_t region[3],
+                                  const void* host,size_t host_row_pitch,size_t host_slice_pitch)
+{
+    cl_int ret;
+    if(this->have_buffer_rect)
+    {
+        const size_t buffer_origin[3] = { origin[0] * element_size, origin[1], origin[2] };
+        const size_t host_origin[3] = { 0, 0, 0 };
+        const size_t byte_region[3] = { region[0] * element_size, region[1], region[2] };
+        ret = clEnqueueWriteBufferRect(this->command_queue,buffer,CL_TRUE,buffer_origin,host_origin,byte_region,
+            dims[0] * element_size,dims[0] * dims[1] * element_size,host_row_pitch,host_slice_pitch,host,0,NULL,NULL);
+        throwOnError(ret,"OpenCL_MixIn::WriteBufferBox : buffer writing failed: ");
+        return;
+    }
+
+    // each row of the box is contiguous in the buffer, so can be written on its own
+    for(size_t z = 0; z < region[2]; z++)
+    {
+        for(size_t y = 0; y < region[1]; y++)
+        {
+            const size_t offset = ((origin[2] + z) * dims[1] + origin[1] + y) * dims[0] + origin[0];
+            ret = clEnqueueWriteBuffer(this->command_queue,buffer,CL_FALSE,offset * element_size,region[0] * element_size,
+                static_cast<const char*>(host) + z * host_slice_pitch + y * host_row_pitch,0,NULL,NULL);
+            throwOnError(ret,"OpenCL_MixIn::WriteBufferBox : buffer writing failed: ");
+        }
+    }
+    ret = clFinish(this->command_queue);
+    throwOnError(ret,"OpenCL_MixIn::WriteBufferBox : clFinish failed: ");
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::ReadBufferBox(cl_mem buffer,size_t element_size,const size_t dims[3],const size_t origin[3],const size_t region[3],
+                                 void* host,size_t host_row_pitch,size_t host_slice_pitch) const
+{
+    cl_int ret;
+    if(this->have_buffer_rect)
+    {
+        const size_t buffer_origin[3] = { origin[0] * element_size, origin[1], origin[2] };
+        const size_t host_origin[3] = { 0, 0, 0 };
+        const size_t byte_region[3] = { region[0] * element_size, region[1], region[2] };
+        ret = clEnqueueReadBufferRect(this->command_queue,buffer,CL_TRUE,buffer_origin,host_origin,byte_region,
+            dims[0] * element_size,dims[0] * dims[1] * element_size,host_row_pitch,host_slice_pitch,host,0,NULL,NULL);
+        throwOnError(ret,"OpenCL_MixIn::ReadBufferBox : buffer reading failed: ");
+        return;
+    }
+
+    for(size_t z = 0; z < region[2]; z++)
+    {
+        for(size_t y = 0; y < region[1]; y++)
+        {
+            const size_t offset = ((origin[2] + z) * dims[1] + origin[1] + y) * dims[0] + origin[0];
+            ret = clEnqueueReadBuffer(this->command_queue,buffer,CL_FALSE,offset * element_size,region[0] * element_size,
+                static_cast<char*>(host) + z * host_slice_pitch + y * host_row_pitch,0,NULL,NULL);
+            throwOnError(ret,"OpenCL_MixIn::ReadBufferBox : buffer reading failed: ");
+        }
+    }
+    ret = clFinish(this->command_queue);
+    throwOnError(ret,"OpenCL_MixIn::ReadBufferBox : clFinish failed: ");
+}
+
+// -----------------------------------------------------------------------
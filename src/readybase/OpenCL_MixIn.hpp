@@ -31,6 +31,9 @@
 #include <vector>
 #include <string>
 
+// VTK:
+class vtkXMLDataElement;
+
 /// OpenCL functionality, for adding to those implementations that use it.
 class OpenCL_MixIn
 {
@@ -44,6 +47,16 @@ class OpenCL_MixIn
         int GetPlatform() const;
         int GetDevice() const;
 
+        /// The seed for the rand_uniform() and rand_normal() keywords: random, unless set here or by the file.
+        cl_uint GetRandomSeed() const { return this->random_seed; }
+        /// Fixes the seed, so that runs can be repeated. A fixed seed is saved as the random_seed attribute of the rule.
+        void SetRandomSeed(cl_uint seed) { this->random_seed = seed; this->random_seed_is_fixed = true; }
+
+        /// Builds a program for the device, or saves its source as kernel.txt and throws with the build log if that fails.
+        /** caller is put at the start of the error message, e.g. "OpenCLImageRD::ReloadKernelIfNeeded". */
+        static void BuildProgramOrThrow(cl_program program,cl_device_id device,const char* options,const std::string& source,
+                                        const std::string& caller);
+
     protected:
 
         virtual std::string AssembleKernelSourceFromFormula(const std::string& formula) const =0;
@@ -59,6 +72,22 @@ class OpenCL_MixIn
         /// Test a kernel string for errors on the current device.
         void TestKernel(std::string s);
 
+        /// Reads the optional random_seed attribute of a rule element, keeping the random seed if there isn't one.
+        void ReadRandomSeedFromXML(vtkXMLDataElement* rule);
+        /// Writes the random_seed attribute to a rule element, if the seed is fixed.
+        void WriteRandomSeedToXML(vtkXMLDataElement* rule) const;
+
+        /// Writes a box of elements into a buffer that holds a dims[0] x dims[1] x dims[2] array, x fastest.
+        /** The box starts at origin and has size region (both in elements). Its host data is at host, with rows
+         *  host_row_pitch bytes apart and slices host_slice_pitch bytes apart. Uses clEnqueueWriteBufferRect if the
+         *  device has OpenCL 1.1, otherwise writes each row of the box separately. */
+        void WriteBufferBox(cl_mem buffer,size_t element_size,const size_t dims[3],const size_t origin[3],const size_t region[3],
+                            const void* host,size_t host_row_pitch,size_t host_slice_pitch);
+
+        /// Reads a box of elements from a buffer into host memory, the reverse of WriteBufferBox.
+        void ReadBufferBox(cl_mem buffer,size_t element_size,const size_t dims[3],const size_t origin[3],const size_t region[3],
+                           void* host,size_t host_row_pitch,size_t host_slice_pitch) const;
+
     protected:
 
         cl_context context;
@@ -72,12 +101,19 @@ class OpenCL_MixIn
         cl_command_queue command_queue;
 
         bool need_reload_context,need_write_to_opencl_buffers;
+        bool have_buffer_rect; ///< whether clEnqueueReadBufferRect and clEnqueueWriteBufferRect can be used on this device
 
         std::vector<cl_mem> buffers[2];
         int iCurrentBuffer;
 
         std::string kernel_source;
 
+        /// The seed for kernels that take a uint2 rand_key as their last argument, which holds the seed and the step number.
+        /** Formulas get this argument when they use the rand_uniform() or rand_normal() keywords. */
+        cl_uint random_seed;
+        bool random_seed_is_fixed;
+        bool kernel_uses_random_numbers;
+
     private:
 
         int iPlatform,iDevice;
@@ -0,0 +1,201 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "OpenCL_SummedAreaTable.hpp"
+#include "OpenCL_MixIn.hpp"
+#include "OpenCL_utils.hpp"
+using namespace OpenCL_utils;
+
+// STL:
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+// VTK:
+#include <vtkType.h>
+
+using namespace std;
+
+// ----------------------------------------------------------------------------------------------------------------
+
+namespace
+{
+    string GetScanKernelSource(const int dimensions[3], int data_type)
+    {
+        ostringstream kernel_source;
+        if (data_type == VTK_DOUBLE)
+        {
+            kernel_source << "\
+#ifdef cl_khr_fp64\n\
+    #pragma OPENCL EXTENSION cl_khr_fp64 : enable\n\
+#elif defined(cl_amd_fp64)\n\
+    #pragma OPENCL EXTENSION cl_amd_fp64 : enable\n\
+#else\n\
+    #error \"Double precision floating point not supported on this OpenCL device. Choose another or contact the Ready team.\"\n\
+#endif\n\n\
+typedef double real;\n";
+        }
+        else
+        {
+            kernel_source << "typedef float real;\n";
+        }
+        kernel_source << "#define NX " << dimensions[0] << "\n";
+        kernel_source << "#define NY " << dimensions[1] << "\n";
+        kernel_source << "#define NZ " << dimensions[2] << "\n\n";
+        kernel_source << "\
+// in-place running sum along one line of the given axis, one work item per line\n\
+kernel void sat_scan(global real* data, const int axis)\n\
+{\n\
+    const int N = (axis == 0) ? NX : ((axis == 1) ? NY : NZ);\n\
+    const int stride = (axis == 0) ? 1 : ((axis == 1) ? NX : NX * NY);\n\
+    const int base = NX * (NY * get_global_id(2) + get_global_id(1)) + get_global_id(0);\n\
+    real sum = 0;\n\
+    for (int i = 0; i < N; i++)\n\
+    {\n\
+        sum += data[base + i * stride];\n\
+        data[base + i * stride] = sum;\n\
+    }\n\
+}\n";
+        return kernel_source.str();
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+OpenCL_SummedAreaTable::OpenCL_SummedAreaTable(cl_context context,cl_device_id device_id,cl_command_queue command_queue,int x,int y,int z,int data_type)
+    : command_queue(command_queue)
+    , program(NULL)
+    , scan_kernel(NULL)
+    , dimensions{ x, y, z }
+    , buffer_size((size_t)x * y * z * (data_type == VTK_DOUBLE ? sizeof(double) : sizeof(float)))
+{
+    const string kernel_source = GetScanKernelSource(this->dimensions, data_type);
+    const char* source = kernel_source.c_str();
+    size_t source_size = kernel_source.length();
+    cl_int ret;
+    this->program = clCreateProgramWithSource(context, 1, &source, &source_size, &ret);
+    throwOnError(ret, "OpenCL_SummedAreaTable : Failed to create program with source: ");
+    OpenCL_MixIn::BuildProgramOrThrow(this->program, device_id, "", kernel_source, "OpenCL_SummedAreaTable");
+    this->scan_kernel = clCreateKernel(this->program, "sat_scan", &ret);
+    throwOnError(ret, "OpenCL_SummedAreaTable : kernel creation failed: ");
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+OpenCL_SummedAreaTable::~OpenCL_SummedAreaTable()
+{
+    if (this->scan_kernel)
+    {
+        clReleaseKernel(this->scan_kernel);
+    }
+    if (this->program)
+    {
+        clReleaseProgram(this->program);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCL_SummedAreaTable::Compute(cl_mem input,cl_mem output)
+{
+    cl_int ret = clEnqueueCopyBuffer(this->command_queue, input, output, 0, 0, this->buffer_size, 0, NULL, NULL);
+    throwOnError(ret, "OpenCL_SummedAreaTable::Compute : buffer copying failed: ");
+    // a running sum along each axis in turn gives the inclusive sum over the box from the origin
+    ret = clSetKernelArg(this->scan_kernel, 0, sizeof(cl_mem), (void *)&output);
+    throwOnError(ret, "OpenCL_SummedAreaTable::Compute : clSetKernelArg failed: ");
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (this->dimensions[axis] < 2)
+        {
+            continue;
+        }
+        ret = clSetKernelArg(this->scan_kernel, 1, sizeof(int), (void *)&axis);
+        throwOnError(ret, "OpenCL_SummedAreaTable::Compute : clSetKernelArg failed: ");
+        size_t global_range[3] = { (size_t)this->dimensions[0], (size_t)this->dimensions[1], (size_t)this->dimensions[2] };
+        global_range[axis] = 1;
+        ret = clEnqueueNDRangeKernel(this->command_queue, this->scan_kernel, 3, NULL, global_range, NULL, 0, NULL, NULL);
+        throwOnError(ret, "OpenCL_SummedAreaTable::Compute : clEnqueueNDRangeKernel failed: ");
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+string OpenCL_SummedAreaTable::GetBoxSumSource(const string& real_type,bool wrap)
+{
+    const string& T = real_type;
+    ostringstream oss;
+    oss << "\
+#ifndef SAT_BOX_SUM_DEFINED\n\
+#define SAT_BOX_SUM_DEFINED\n\
+\n\
+// the sum over [0,x)*[0,y)*[0,z), for 0 <= x <= X, 0 <= y <= Y, 0 <= z <= Z\n\
+" << T << " sat_lookup(global const " << T << "* sat, int x, int y, int z, int X, int Y)\n\
+{\n\
+    if (x == 0 || y == 0 || z == 0) return 0;\n\
+    return sat[X * (Y * (z - 1) + (y - 1)) + (x - 1)];\n\
+}\n\
+\n";
+    if (wrap)
+    {
+        oss << "\
+int sat_floor_div(int a, int b) { return (a >= 0) ? a / b : -((b - 1 - a) / b); }\n\
+\n\
+// the signed sum over [0,x)*[0,y)*[0,z) of the image repeated in every direction, for any x, y, z\n\
+" << T << " sat_prefix(global const " << T << "* sat, int x, int y, int z, int X, int Y, int Z)\n\
+{\n\
+    const int qx = sat_floor_div(x, X), qy = sat_floor_div(y, Y), qz = sat_floor_div(z, Z);\n\
+    const int rx = x - qx * X, ry = y - qy * Y, rz = z - qz * Z;\n\
+    " << T << " sum = sat_lookup(sat, rx, ry, rz, X, Y);\n\
+    if (qx != 0) sum += qx * sat_lookup(sat, X, ry, rz, X, Y);\n\
+    if (qy != 0) sum += qy * sat_lookup(sat, rx, Y, rz, X, Y);\n\
+    if (qz != 0) sum += qz * sat_lookup(sat, rx, ry, Z, X, Y);\n\
+    if (qx != 0 && qy != 0) sum += qx * qy * sat_lookup(sat, X, Y, rz, X, Y);\n\
+    if (qx != 0 && qz != 0) sum += qx * qz * sat_lookup(sat, X, ry, Z, X, Y);\n\
+    if (qy != 0 && qz != 0) sum += qy * qz * sat_lookup(sat, rx, Y, Z, X, Y);\n\
+    if (qx != 0 && qy != 0 && qz != 0) sum += qx * qy * qz * sat_lookup(sat, X, Y, Z, X, Y);\n\
+    return sum;\n\
+}\n";
+    }
+    else
+    {
+        oss << "\
+// the sum over [0,x)*[0,y)*[0,z), treating cells outside the image as zero\n\
+" << T << " sat_prefix(global const " << T << "* sat, int x, int y, int z, int X, int Y, int Z)\n\
+{\n\
+    return sat_lookup(sat, clamp(x, 0, X), clamp(y, 0, Y), clamp(z, 0, Z), X, Y);\n\
+}\n";
+    }
+    oss << "\
+\n\
+// the sum over [x-rx,x+rx]*[y-ry,y+ry]*[z-rz,z+rz]\n\
+" << T << " sat_box_sum(global const " << T << "* sat, int x, int y, int z, int rx, int ry, int rz, int X, int Y, int Z)\n\
+{\n\
+    const int x0 = x - rx, x1 = x + rx + 1;\n\
+    const int y0 = y - ry, y1 = y + ry + 1;\n\
+    const int z0 = z - rz, z1 = z + rz + 1;\n\
+    return sat_prefix(sat, x1, y1, z1, X, Y, Z) - sat_prefix(sat, x0, y1, z1, X, Y, Z)\n\
+         - sat_prefix(sat, x1, y0, z1, X, Y, Z) - sat_prefix(sat, x1, y1, z0, X, Y, Z)\n\
+         + sat_prefix(sat, x0, y0, z1, X, Y, Z) + sat_prefix(sat, x0, y1, z0, X, Y, Z)\n\
+         + sat_prefix(sat, x1, y0, z0, X, Y, Z) - sat_prefix(sat, x0, y0, z0, X, Y, Z);\n\
+}\n\
+\n\
+#endif\n\n";
+    return oss.str();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
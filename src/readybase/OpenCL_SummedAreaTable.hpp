@@ -0,0 +1,62 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __OPENCL_SUMMEDAREATABLE__
+#define __OPENCL_SUMMEDAREATABLE__
+
+// OpenCL:
+#ifdef __APPLE__
+    // OpenCL is linked at start up time on Mac OS 10.6+
+    #include <OpenCL/opencl.h>
+#else
+    // OpenCL is loaded dynamically on Windows and Linux
+    #include "OpenCL_Dyn_Load.h"
+#endif
+
+// STL:
+#include <string>
+
+/// Summed-area tables (integral images) computed on the OpenCL device.
+/** Once the table is built, the sum over any box costs at most eight lookups whatever its size, using the
+ *  sat_box_sum() function from GetBoxSumSource(). */
+class OpenCL_SummedAreaTable
+{
+    public:
+
+        OpenCL_SummedAreaTable(cl_context context,cl_device_id device_id,cl_command_queue command_queue,int x,int y,int z,int data_type);
+        ~OpenCL_SummedAreaTable();
+
+        /// Enqueues the computation of the summed-area table of input, writing it to output.
+        /** Both buffers hold one real value per cell, of the data type given on construction. Each entry of the
+         *  table is the sum of the input over all the cells with coordinates less than or equal to its own. */
+        void Compute(cl_mem input,cl_mem output);
+
+        /// OpenCL source for sat_box_sum(sat,x,y,z,rx,ry,rz,X,Y,Z): the sum over the box [x-rx,x+rx]*[y-ry,y+ry]*[z-rz,z+rz].
+        /** If wrap is true then the box wraps around the image, else cells outside the image count as zero.
+         *  real_type is the scalar type of the table, e.g. "float". The source is guarded so that it can be included more than once. */
+        static std::string GetBoxSumSource(const std::string& real_type,bool wrap);
+
+    private:
+
+        cl_command_queue command_queue;
+        cl_program program;
+        cl_kernel scan_kernel;
+        int dimensions[3];
+        size_t buffer_size;
+};
+
+#endif
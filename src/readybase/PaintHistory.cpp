@@ -0,0 +1,269 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "PaintHistory.hpp"
+
+// STL:
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+namespace
+{
+    const size_t DEFAULT_MEMORY_LIMIT = 256 * 1024 * 1024;
+
+    // Each packet is a header word holding a count, with the top bit set for a run (the count is followed by one
+    // value, repeated that many times) or clear for literals (the count is followed by that many values).
+    const uint32_t RUN_FLAG = 0x80000000u;
+    const size_t MAX_PACKET = 0x7FFFFFFFu;
+    const size_t MIN_RUN = 3; // (shorter runs are cheaper as literals)
+
+    uint32_t FloatBits(float f)
+    {
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    }
+
+    vector<uint32_t> Encode(const vector<float>& values)
+    {
+        vector<uint32_t> encoded;
+        const size_t n = values.size();
+        auto run_length = [&](size_t i) {
+            size_t length = 1;
+            while(i + length < n && length < MAX_PACKET && FloatBits(values[i + length]) == FloatBits(values[i]))
+                length++;
+            return length;
+        };
+        size_t i = 0;
+        while(i < n)
+        {
+            const size_t length = run_length(i);
+            if(length >= MIN_RUN)
+            {
+                encoded.push_back(RUN_FLAG | uint32_t(length));
+                encoded.push_back(FloatBits(values[i]));
+                i += length;
+                continue;
+            }
+            // gather literals until the next run that is worth encoding
+            const size_t first = i;
+            while(i < n && i - first < MAX_PACKET && run_length(i) < MIN_RUN)
+                i++;
+            encoded.push_back(uint32_t(i - first));
+            for(size_t j = first; j < i; j++)
+                encoded.push_back(FloatBits(values[j]));
+        }
+        return encoded;
+    }
+
+    vector<float> Decode(const vector<uint32_t>& encoded,size_t n)
+    {
+        vector<float> values(n);
+        size_t i = 0, k = 0;
+        while(k < encoded.size())
+        {
+            const uint32_t header = encoded[k++];
+            const size_t count = header & ~RUN_FLAG;
+            if(i + count > n)
+                throw runtime_error("PaintHistory : corrupt stroke record");
+            if(header & RUN_FLAG)
+            {
+                float value;
+                memcpy(&value, &encoded[k++], sizeof(value));
+                fill(values.begin() + i, values.begin() + i + count, value);
+            }
+            else
+            {
+                memcpy(&values[i], &encoded[k], count * sizeof(float));
+                k += count;
+            }
+            i += count;
+        }
+        return values;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+PaintHistory::PaintHistory()
+    : n_done(0)
+    , strokes_size(0)
+    , memory_limit(DEFAULT_MEMORY_LIMIT)
+{
+}
+
+// ---------------------------------------------------------------------
+
+void PaintHistory::Clear()
+{
+    this->strokes.clear();
+    this->n_done = 0;
+    this->strokes_size = 0;
+    this->open_stroke.clear();
+}
+
+// ---------------------------------------------------------------------
+
+void PaintHistory::SetMemoryLimit(size_t bytes)
+{
+    this->memory_limit = bytes;
+    this->ApplyMemoryLimit();
+}
+
+// ---------------------------------------------------------------------
+
+size_t PaintHistory::GetMemorySize() const
+{
+    return this->strokes_size + this->open_stroke.size() * (sizeof(uint64_t) + sizeof(float));
+}
+
+// ---------------------------------------------------------------------
+
+size_t PaintHistory::Stroke::GetMemorySize() const
+{
+    return sizeof(Stroke) + sizeof(int) * this->runs.size()
+        + sizeof(uint32_t) * (this->old_values.size() + this->new_values.size());
+}
+
+// ---------------------------------------------------------------------
+
+void PaintHistory::StoreOldValue(int iChemical,int iCell,float old_val)
+{
+    this->ForgetUndoneStrokes();
+    const uint64_t key = (uint64_t(uint32_t(iChemical)) << 32) | uint32_t(iCell);
+    this->open_stroke.emplace(key, old_val); // (does nothing if the cell was already painted in this stroke)
+}
+
+// ---------------------------------------------------------------------
+
+void PaintHistory::EndStroke(const ReadCells& read)
+{
+    if(this->open_stroke.empty())
+        return;
+
+    vector<pair<uint64_t,float> > cells(this->open_stroke.begin(), this->open_stroke.end());
+    this->open_stroke.clear();
+    sort(cells.begin(), cells.end());
+
+    Stroke stroke;
+    stroke.n_cells = cells.size();
+    vector<float> old_values(cells.size()), new_values(cells.size());
+    size_t i = 0;
+    while(i < cells.size())
+    {
+        // find the run of consecutive cells of one chemical that starts here
+        size_t length = 1;
+        while(i + length < cells.size() && cells[i + length].first == cells[i].first + length)
+            length++;
+        const int iChemical = int(cells[i].first >> 32);
+        const int first_cell = int(uint32_t(cells[i].first));
+        stroke.runs.push_back(iChemical);
+        stroke.runs.push_back(first_cell);
+        stroke.runs.push_back(int(length));
+        for(size_t j = 0; j < length; j++)
+            old_values[i + j] = cells[i + j].second;
+        read(iChemical, first_cell, int(length), &new_values[i]);
+        i += length;
+    }
+    stroke.old_values = Encode(old_values);
+    stroke.new_values = Encode(new_values);
+
+    this->ForgetUndoneStrokes();
+    this->strokes_size += stroke.GetMemorySize();
+    this->strokes.push_back(move(stroke));
+    this->n_done = this->strokes.size();
+    this->ApplyMemoryLimit();
+}
+
+// ---------------------------------------------------------------------
+
+bool PaintHistory::CanUndo() const
+{
+    return this->n_done > 0 || !this->open_stroke.empty();
+}
+
+// ---------------------------------------------------------------------
+
+bool PaintHistory::CanRedo() const
+{
+    return this->n_done < this->strokes.size() && this->open_stroke.empty();
+}
+
+// ---------------------------------------------------------------------
+
+void PaintHistory::Undo(const WriteCells& write)
+{
+    if(this->n_done == 0 || !this->open_stroke.empty())
+        throw runtime_error("PaintHistory::Undo : nothing to undo, or the stroke has not ended");
+    this->n_done--;
+    this->Restore(this->strokes[this->n_done], this->strokes[this->n_done].old_values, write);
+}
+
+// ---------------------------------------------------------------------
+
+void PaintHistory::Redo(const WriteCells& write)
+{
+    if(!this->CanRedo())
+        throw runtime_error("PaintHistory::Redo : nothing to redo");
+    this->Restore(this->strokes[this->n_done], this->strokes[this->n_done].new_values, write);
+    this->n_done++;
+}
+
+// ---------------------------------------------------------------------
+
+void PaintHistory::Restore(const Stroke& stroke,const vector<uint32_t>& encoded_values,const WriteCells& write) const
+{
+    const vector<float> values = Decode(encoded_values, stroke.n_cells);
+    size_t i = 0;
+    for(size_t iRun = 0; iRun < stroke.runs.size(); iRun += 3)
+    {
+        write(stroke.runs[iRun], stroke.runs[iRun + 1], stroke.runs[iRun + 2], &values[i]);
+        i += stroke.runs[iRun + 2];
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void PaintHistory::ForgetUndoneStrokes()
+{
+    while(this->strokes.size() > this->n_done)
+    {
+        this->strokes_size -= this->strokes.back().GetMemorySize();
+        this->strokes.pop_back();
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void PaintHistory::ApplyMemoryLimit()
+{
+    // forget the oldest strokes first
+    while(!this->strokes.empty() && this->strokes_size > this->memory_limit)
+    {
+        this->strokes_size -= this->strokes.front().GetMemorySize();
+        this->strokes.pop_front();
+        if(this->n_done > 0)
+            this->n_done--;
+    }
+}
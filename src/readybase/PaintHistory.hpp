@@ -0,0 +1,93 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __PAINTHISTORY__
+#define __PAINTHISTORY__
+
+// STL:
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+/// The undo history for painting, kept as one record per stroke.
+/** While a stroke is being painted, the value that each cell had before the stroke is kept. When the stroke ends,
+ *  its cells are sorted into runs of consecutive cells, and the values before and after the stroke are stored
+ *  run-length encoded, which for a brush painting one value over a uniform region takes only a few words. Undo and
+ *  redo then restore a whole stroke at once, one run at a time. The oldest strokes are forgotten when the records
+ *  take more than the memory limit. */
+class PaintHistory
+{
+    public:
+
+        /// Reads or writes the values of n_cells consecutive cells of a chemical, starting at first_cell.
+        typedef std::function<void(int iChemical,int first_cell,int n_cells,float* values)> ReadCells;
+        typedef std::function<void(int iChemical,int first_cell,int n_cells,const float* values)> WriteCells;
+
+        PaintHistory();
+
+        void Clear();
+
+        void SetMemoryLimit(size_t bytes);
+        size_t GetMemoryLimit() const { return this->memory_limit; }
+        size_t GetMemorySize() const;
+
+        /// Stores the value a cell had before it was painted, unless it was already painted in this stroke.
+        /** Forgets any strokes that have been undone, since they can no longer be redone. */
+        void StoreOldValue(int iChemical,int iCell,float old_val);
+
+        bool IsStrokeOpen() const { return !this->open_stroke.empty(); }
+
+        /// Makes the cells painted since the last call into one stroke, using read to get the values they were painted with.
+        void EndStroke(const ReadCells& read);
+
+        bool CanUndo() const;
+        bool CanRedo() const;
+
+        /// Passes the values from before the last done stroke to write, and marks it as undone. The stroke must be ended.
+        void Undo(const WriteCells& write);
+        /// Passes the values from after the first undone stroke to write, and marks it as done.
+        void Redo(const WriteCells& write);
+
+    private:
+
+        struct Stroke
+        {
+            std::vector<int> runs;                      ///< iChemical, first_cell, n_cells for each run of consecutive cells
+            std::vector<uint32_t> old_values, new_values; ///< the values of the cells in the runs, run-length encoded
+            size_t n_cells;
+
+            size_t GetMemorySize() const;
+        };
+
+        void Restore(const Stroke& stroke,const std::vector<uint32_t>& encoded_values,const WriteCells& write) const;
+        void ForgetUndoneStrokes();
+        void ApplyMemoryLimit();
+
+    private:
+
+        std::deque<Stroke> strokes;
+        size_t n_done;       ///< the strokes before this have been done, the rest have been undone
+        size_t strokes_size; ///< the memory used by strokes
+        size_t memory_limit;
+
+        std::unordered_map<uint64_t,float> open_stroke; ///< the old value of each cell painted since the last stroke ended, keyed on chemical and cell
+};
+
+#endif
@@ -0,0 +1,235 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "PointGrid.hpp"
+#include "utils.hpp"
+
+// STL:
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+namespace
+{
+    const double POINTS_PER_BUCKET = 2.0;
+    const int MAX_BUCKETS_PER_AXIS = 1024;
+    const size_t MIN_ROWS_PER_THREAD = 64; // rows of buckets, below which starting the threads costs more than it saves
+}
+
+// ---------------------------------------------------------------------
+
+PointGrid::PointGrid()
+    : bucket_size(1.0)
+{
+    this->Clear();
+}
+
+// ---------------------------------------------------------------------
+
+void PointGrid::Clear()
+{
+    this->x.clear();
+    this->y.clear();
+    this->z.clear();
+    this->bucket_offsets.assign(2, 0);
+    this->bucket_points.clear();
+    for(int xyz = 0; xyz < 3; xyz++)
+    {
+        this->origin[xyz] = 0.0;
+        this->dims[xyz] = 1;
+    }
+    this->bucket_size = 1.0;
+}
+
+// ---------------------------------------------------------------------
+
+void PointGrid::SetPoints(const vector<array<double,3> >& points)
+{
+    this->Clear();
+    const int n = (int)points.size();
+    if(n == 0)
+        return;
+
+    this->x.resize(n);
+    this->y.resize(n);
+    this->z.resize(n);
+    double lower[3], upper[3];
+    for(int xyz = 0; xyz < 3; xyz++)
+        lower[xyz] = upper[xyz] = points[0][xyz];
+    for(int i = 0; i < n; i++)
+    {
+        this->x[i] = float(points[i][0]);
+        this->y[i] = float(points[i][1]);
+        this->z[i] = float(points[i][2]);
+        for(int xyz = 0; xyz < 3; xyz++)
+        {
+            lower[xyz] = min(lower[xyz], points[i][xyz]);
+            upper[xyz] = max(upper[xyz], points[i][xyz]);
+        }
+    }
+
+    // choose a bucket size that gives about POINTS_PER_BUCKET points in each, over the axes that have any extent
+    double extent[3], max_extent = 0.0, product = 1.0;
+    int n_axes = 0;
+    for(int xyz = 0; xyz < 3; xyz++)
+    {
+        extent[xyz] = upper[xyz] - lower[xyz];
+        max_extent = max(max_extent, extent[xyz]);
+    }
+    for(int xyz = 0; xyz < 3; xyz++)
+    {
+        if(extent[xyz] > 1e-6 * max_extent)
+        {
+            product *= extent[xyz];
+            n_axes++;
+        }
+    }
+    if(n_axes == 0)
+        this->bucket_size = 1.0; // all the points are in the same place
+    else
+    {
+        this->bucket_size = pow(product * POINTS_PER_BUCKET / n, 1.0 / n_axes);
+        this->bucket_size = max(this->bucket_size, max_extent / MAX_BUCKETS_PER_AXIS);
+    }
+    for(int xyz = 0; xyz < 3; xyz++)
+    {
+        this->origin[xyz] = lower[xyz];
+        this->dims[xyz] = max(1, min(MAX_BUCKETS_PER_AXIS, int(extent[xyz] / this->bucket_size) + 1));
+    }
+
+    // sort the points into the buckets, by counting
+    const size_t n_buckets = size_t(this->dims[0]) * this->dims[1] * this->dims[2];
+    vector<int> point_buckets(n);
+    this->bucket_offsets.assign(n_buckets + 1, 0);
+    for(int i = 0; i < n; i++)
+    {
+        const size_t bucket = (size_t(this->GetBucket(2, points[i][2])) * this->dims[1] + this->GetBucket(1, points[i][1]))
+                              * this->dims[0] + this->GetBucket(0, points[i][0]);
+        point_buckets[i] = (int)bucket;
+        this->bucket_offsets[bucket + 1]++;
+    }
+    for(size_t b = 0; b < n_buckets; b++)
+        this->bucket_offsets[b + 1] += this->bucket_offsets[b];
+    vector<int> next(this->bucket_offsets.begin(), this->bucket_offsets.end() - 1);
+    this->bucket_points.resize(n);
+    for(int i = 0; i < n; i++)
+        this->bucket_points[next[point_buckets[i]]++] = i;
+}
+
+// ---------------------------------------------------------------------
+
+int PointGrid::GetBucket(int xyz,double coord) const
+{
+    const double b = floor((coord - this->origin[xyz]) / this->bucket_size);
+    return int(max(0.0, min(double(this->dims[xyz] - 1), b)));
+}
+
+// ---------------------------------------------------------------------
+
+int PointGrid::FindNearest(const double p[3]) const
+{
+    if(this->IsEmpty())
+        return -1;
+
+    // search shells of buckets of increasing radius around p, until no unsearched bucket can hold anything nearer
+    const int center[3] = { this->GetBucket(0, p[0]), this->GetBucket(1, p[1]), this->GetBucket(2, p[2]) };
+    const int max_shell = max(this->dims[0], max(this->dims[1], this->dims[2]));
+    int nearest = -1;
+    double nearest_dist2 = numeric_limits<double>::infinity();
+    for(int shell = 0; shell <= max_shell; shell++)
+    {
+        for(int bz = max(0, center[2] - shell); bz <= min(this->dims[2] - 1, center[2] + shell); bz++)
+        {
+            for(int by = max(0, center[1] - shell); by <= min(this->dims[1] - 1, center[1] + shell); by++)
+            {
+                const bool on_shell = abs(bz - center[2]) == shell || abs(by - center[1]) == shell;
+                for(int bx = max(0, center[0] - shell); bx <= min(this->dims[0] - 1, center[0] + shell); bx++)
+                {
+                    if(!on_shell && abs(bx - center[0]) != shell)
+                        continue; // (already searched)
+                    const size_t bucket = (size_t(bz) * this->dims[1] + by) * this->dims[0] + bx;
+                    for(int k = this->bucket_offsets[bucket]; k < this->bucket_offsets[bucket + 1]; k++)
+                    {
+                        const int i = this->bucket_points[k];
+                        const double dx = this->x[i] - p[0], dy = this->y[i] - p[1], dz = this->z[i] - p[2];
+                        const double dist2 = dx * dx + dy * dy + dz * dz;
+                        if(dist2 < nearest_dist2 || (dist2 == nearest_dist2 && i < nearest))
+                        {
+                            nearest = i;
+                            nearest_dist2 = dist2;
+                        }
+                    }
+                }
+            }
+        }
+        // every point outside the shells searched so far is at least this far from p
+        // (p may lie outside the grid, so only count the distance from the center bucket's walls)
+        const double searched_radius = shell * this->bucket_size;
+        if(nearest >= 0 && nearest_dist2 <= searched_radius * searched_radius)
+            break;
+    }
+    return nearest;
+}
+
+// ---------------------------------------------------------------------
+
+void PointGrid::FindWithinRadius(const double p[3],double r,vector<int>& found) const
+{
+    found.clear();
+    if(this->IsEmpty() || r < 0.0)
+        return;
+
+    int lower[3], upper[3];
+    for(int xyz = 0; xyz < 3; xyz++)
+    {
+        lower[xyz] = this->GetBucket(xyz, p[xyz] - r);
+        upper[xyz] = this->GetBucket(xyz, p[xyz] + r);
+        if(p[xyz] + r < this->origin[xyz] || p[xyz] - r > this->origin[xyz] + this->dims[xyz] * this->bucket_size)
+            return; // the sphere misses the grid
+    }
+
+    // share out the rows of buckets between threads, and put the results from each row back together in order
+    const int n_rows_y = upper[1] - lower[1] + 1;
+    const size_t n_rows = size_t(upper[2] - lower[2] + 1) * n_rows_y;
+    const double r2 = r * r;
+    mutex found_mutex;
+    parallel_for(n_rows, [&](size_t first, size_t last) {
+        vector<int> local;
+        for(size_t row = first; row < last; row++)
+        {
+            const int bz = lower[2] + int(row / n_rows_y);
+            const int by = lower[1] + int(row % n_rows_y);
+            const size_t row_start = (size_t(bz) * this->dims[1] + by) * this->dims[0];
+            for(int k = this->bucket_offsets[row_start + lower[0]]; k < this->bucket_offsets[row_start + upper[0] + 1]; k++)
+            {
+                const int i = this->bucket_points[k];
+                const double dx = this->x[i] - p[0], dy = this->y[i] - p[1], dz = this->z[i] - p[2];
+                if(dx * dx + dy * dy + dz * dz <= r2)
+                    local.push_back(i);
+            }
+        }
+        lock_guard<mutex> lock(found_mutex);
+        found.insert(found.end(), local.begin(), local.end());
+    }, MIN_ROWS_PER_THREAD);
+    sort(found.begin(), found.end());
+}
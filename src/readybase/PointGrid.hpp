@@ -0,0 +1,67 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __POINTGRID__
+#define __POINTGRID__
+
+// STL:
+#include <array>
+#include <vector>
+
+/// A set of 3D points, stored as separate x, y and z arrays and sorted into the buckets of a uniform grid.
+/** Finding the points near a location then only needs to visit the few buckets around it. The grid is sized to hold
+ *  about two points per bucket, with buckets of the same size in every direction, so flat sets of points (such as
+ *  the cells of a surface mesh) get a grid that is flat too. */
+class PointGrid
+{
+    public:
+
+        PointGrid();
+
+        void SetPoints(const std::vector<std::array<double,3> >& points);
+        void Clear();
+
+        bool IsEmpty() const { return this->x.empty(); }
+        int GetNumberOfPoints() const { return (int)this->x.size(); }
+
+        /// The coordinates of the points, in the order they were given.
+        const float* GetX() const { return this->x.data(); }
+        const float* GetY() const { return this->y.data(); }
+        const float* GetZ() const { return this->z.data(); }
+
+        /// Returns the index of the point nearest to p, or -1 if there are no points.
+        int FindNearest(const double p[3]) const;
+
+        /// Fills found with the index of each point within r of p, in increasing order.
+        /** The buckets to visit are shared out between threads when there are many of them. */
+        void FindWithinRadius(const double p[3],double r,std::vector<int>& found) const;
+
+    private:
+
+        int GetBucket(int xyz,double coord) const;
+
+    private:
+
+        std::vector<float> x, y, z;
+        double origin[3];
+        double bucket_size;
+        int dims[3];
+        std::vector<int> bucket_offsets; ///< the points in bucket i are at [offsets[i],offsets[i+1]) in bucket_points
+        std::vector<int> bucket_points;
+};
+
+#endif
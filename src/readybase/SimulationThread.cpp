@@ -0,0 +1,273 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "SimulationThread.hpp"
+#include "AbstractRD.hpp"
+#include "utils.hpp"
+
+// STL:
+#include <algorithm>
+#include <exception>
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+SimulationThread::SimulationThread()
+    : system(NULL)
+    , steps_to_do(0)
+    , steps_per_batch(1)
+    , target_batch_time(0.05)
+    , n_pauses(0)
+    , n_waiting(0)
+    , in_batch(false)
+    , quit(false)
+    , progress{ 0, 0, 0.0, true, string() }
+{
+    this->worker = thread(&SimulationThread::WorkerLoop, this);
+}
+
+// ---------------------------------------------------------------------
+
+SimulationThread::~SimulationThread()
+{
+    {
+        lock_guard<mutex> lock(this->state_mutex);
+        this->quit = true;
+    }
+    this->changed.notify_all();
+    this->worker.join();
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::SetSystem(AbstractRD* system)
+{
+    this->Stop();
+    lock_guard<mutex> lock(this->state_mutex);
+    this->system = system;
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::Run(int n_steps)
+{
+    {
+        unique_lock<mutex> lock(this->state_mutex);
+        this->WaitForBatch(lock);
+        if(!this->system)
+            return;
+        this->steps_to_do = max(0, n_steps);
+        this->progress.timesteps_taken = this->system->GetTimestepsTaken();
+        this->progress.steps_done = 0;
+        this->progress.computation_time = 0.0;
+        this->progress.finished = this->steps_to_do == 0;
+        this->progress.error.clear();
+        this->published_progress.Acquire(); // (drops any progress of an earlier run that wasn't read)
+    }
+    this->changed.notify_all();
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::Stop()
+{
+    unique_lock<mutex> lock(this->state_mutex);
+    this->WaitForBatch(lock);
+    this->steps_to_do = 0;
+    this->RunWaitingCommands(lock);
+}
+
+// ---------------------------------------------------------------------
+
+bool SimulationThread::IsRunning() const
+{
+    lock_guard<mutex> lock(this->state_mutex);
+    return this->steps_to_do > 0;
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::Pause()
+{
+    unique_lock<mutex> lock(this->state_mutex);
+    this->n_pauses++;
+    this->WaitForBatch(lock);
+    // (so that they are run before any that are posted while paused)
+    this->RunWaitingCommands(lock);
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::Resume()
+{
+    {
+        lock_guard<mutex> lock(this->state_mutex);
+        if(this->n_pauses > 0)
+            this->n_pauses--;
+    }
+    this->changed.notify_all();
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::Post(const Command& command)
+{
+    {
+        unique_lock<mutex> lock(this->state_mutex);
+        if(this->in_batch || (this->steps_to_do > 0 && this->n_pauses == 0))
+        {
+            // the worker has the system, so it will run the command before its next batch
+            this->commands.push_back(command);
+            return;
+        }
+        if(!this->system)
+            return;
+    }
+    command(*this->system);
+}
+
+// ---------------------------------------------------------------------
+
+bool SimulationThread::GetLatestProgress(Progress& progress)
+{
+    if(!this->published_progress.Acquire())
+        return false;
+    progress = this->published_progress.GetReadBuffer();
+    return true;
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::SetFinishedCallback(const function<void()>& callback)
+{
+    lock_guard<mutex> lock(this->state_mutex);
+    this->on_finished = callback;
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::SetStepsPerBatch(int n)
+{
+    lock_guard<mutex> lock(this->state_mutex);
+    this->steps_per_batch = max(1, n);
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::WaitForBatch(unique_lock<mutex>& lock)
+{
+    // (counted, so that the worker doesn't start another batch before this thread gets the mutex back)
+    this->n_waiting++;
+    this->changed.wait(lock, [this] { return !this->in_batch; });
+    this->n_waiting--;
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::RunWaitingCommands(unique_lock<mutex>& lock)
+{
+    // (the worker can't start a batch meanwhile, so the mutex is left free while each command runs, in case it posts another)
+    while(!this->commands.empty() && this->system)
+    {
+        const Command command = this->commands.front();
+        this->commands.pop_front();
+        lock.unlock();
+        command(*this->system);
+        lock.lock();
+    }
+    this->commands.clear();
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::WorkerLoop()
+{
+    unique_lock<mutex> lock(this->state_mutex);
+    for(;;)
+    {
+        this->changed.wait(lock, [this] { return this->quit || (this->steps_to_do > 0 && this->n_pauses == 0 && this->n_waiting == 0); });
+        if(this->quit)
+            return;
+
+        // take the system for one batch, leaving the mutex free so that other threads can post commands or ask to pause
+        this->in_batch = true;
+        deque<Command> batch_commands;
+        batch_commands.swap(this->commands);
+        const int n_steps = min(this->steps_per_batch, this->steps_to_do);
+        AbstractRD* system = this->system;
+        lock.unlock();
+
+        string error;
+        double time_taken = 0.0;
+        try
+        {
+            for(const Command& command : batch_commands)
+                command(*system);
+            const double time_before = get_time_in_seconds();
+            system->Step(n_steps);
+            time_taken = get_time_in_seconds() - time_before;
+        }
+        catch(const exception& e)
+        {
+            error = e.what();
+        }
+        catch(...)
+        {
+            error = "SimulationThread::WorkerLoop : unknown error";
+        }
+
+        lock.lock();
+        this->in_batch = false;
+
+        // if the batch was quick then use more steps in the next one, otherwise use fewer so that pausing stays quick
+        // (a batch cut short by the end of the run tells us nothing)
+        if(n_steps == this->steps_per_batch)
+        {
+            if(time_taken < this->target_batch_time)
+                this->steps_per_batch = min(this->steps_per_batch, (1 << 30) / 2) * 2;
+            else
+                this->steps_per_batch = max(1, this->steps_per_batch / 2);
+        }
+
+        this->progress.timesteps_taken = system->GetTimestepsTaken();
+        this->progress.computation_time += time_taken;
+        if(error.empty())
+        {
+            this->progress.steps_done += n_steps;
+            this->steps_to_do -= n_steps;
+        }
+        else
+        {
+            this->progress.error = error;
+            this->steps_to_do = 0;
+        }
+        this->progress.finished = this->steps_to_do <= 0;
+        this->published_progress.GetWriteBuffer() = this->progress;
+        this->published_progress.Publish();
+        const bool call_back = this->progress.finished && this->on_finished;
+        this->changed.notify_all();
+
+        if(call_back)
+        {
+            const function<void()> callback = this->on_finished;
+            lock.unlock();
+            callback();
+            lock.lock();
+        }
+    }
+}
@@ -0,0 +1,135 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __SIMULATIONTHREAD__
+#define __SIMULATIONTHREAD__
+
+// local:
+#include "TripleBuffer.hpp"
+class AbstractRD;
+
+// STL:
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// Steps a system on a worker thread, so that the thread that handles the user interface isn't held up while it runs.
+/** Only one thread may use the system at a time. The worker has it while it is running a batch of steps. Any other
+ *  thread must have it paused (see Pause) or stopped before touching it. The steps are run in batches, sized to take
+ *  about GetTargetBatchTime() each, so that pausing is never held up for long. After each batch the worker publishes
+ *  its Progress, which can be read at any time without waiting. Changes to the system (e.g. painting or setting a
+ *  parameter) can be posted as commands: they are run straight away if the system is paused or stopped, otherwise by
+ *  the worker before its next batch. Rendering is left to the caller, e.g. once each run has finished. */
+class SimulationThread
+{
+    public:
+
+        typedef std::function<void(AbstractRD&)> Command;
+
+        /// What the worker has done since Run was last called.
+        struct Progress
+        {
+            int timesteps_taken;    ///< by the system in total
+            int steps_done;         ///< since Run was called
+            double computation_time; ///< in seconds, since Run was called
+            bool finished;          ///< whether all the steps asked for have been done, or an error stopped them
+            std::string error;      ///< what went wrong, if an error stopped the steps
+        };
+
+        SimulationThread();
+        ~SimulationThread();
+
+        /// Changes the system to step. Stops the worker if it is running.
+        void SetSystem(AbstractRD* system);
+
+        /// Starts the worker on n_steps more steps, once it isn't paused.
+        void Run(int n_steps);
+        /// Stops the worker at the end of its current batch, if it is running, and runs any commands still waiting.
+        void Stop();
+        /// Whether the worker has steps left to do.
+        bool IsRunning() const;
+
+        /// Waits for the worker to finish its current batch, and keeps it from starting another until Resume is called.
+        /** Calls can be nested, and made while the worker is stopped. */
+        void Pause();
+        void Resume();
+
+        /// Pauses the worker for as long as it is in scope.
+        class ScopedPause
+        {
+            public:
+                ScopedPause(SimulationThread& thread) : thread(thread) { this->thread.Pause(); }
+                ~ScopedPause() { this->thread.Resume(); }
+            private:
+                SimulationThread& thread;
+        };
+
+        /// Runs command on the system, straight away if the worker is paused or stopped, otherwise before its next batch.
+        void Post(const Command& command);
+
+        /// Sets progress to the latest Progress published by the worker, returning false if none is new since the last call.
+        /** Should only be called from the thread that calls Run. */
+        bool GetLatestProgress(Progress& progress);
+
+        /// Called on the worker thread whenever a run finishes, e.g. to wake up the thread that renders.
+        void SetFinishedCallback(const std::function<void()>& callback);
+
+        /// The number of steps in each batch is adjusted so that a batch takes about this long, in seconds.
+        void SetTargetBatchTime(double seconds) { this->target_batch_time = seconds; }
+        double GetTargetBatchTime() const { return this->target_batch_time; }
+        /// Sets the number of steps in the next batch, e.g. when starting a new system. It is adjusted after each batch.
+        void SetStepsPerBatch(int n);
+
+    private:
+
+        void WorkerLoop();
+        /// Waits for the worker to finish its current batch. Call with the mutex held.
+        void WaitForBatch(std::unique_lock<std::mutex>& lock);
+        /// Runs the commands that are waiting, in order, on the calling thread. Call with the mutex held.
+        void RunWaitingCommands(std::unique_lock<std::mutex>& lock);
+
+    private:
+
+        AbstractRD* system;
+
+        mutable std::mutex state_mutex;      ///< guards everything below, apart from the progress buffer
+        std::condition_variable changed;
+        int steps_to_do;
+        int steps_per_batch;
+        double target_batch_time;
+        int n_pauses;
+        int n_waiting;                       ///< the number of threads waiting in WaitForBatch
+        bool in_batch;
+        bool quit;
+        std::deque<Command> commands;
+        Progress progress;                   ///< the worker's copy, published after each batch
+        std::function<void()> on_finished;
+
+        TripleBuffer<Progress> published_progress;
+
+        std::thread worker;
+
+    private: // deliberately not implemented, to prevent use
+
+        SimulationThread(SimulationThread&);
+        SimulationThread& operator=(SimulationThread&);
+};
+
+#endif
@@ -0,0 +1,261 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "SparseSolver.hpp"
+#include "utils.hpp"
+
+// STL:
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+namespace
+{
+    // below this, starting the threads costs more than it saves (each pass starts its own threads, so the passes
+    // of each iteration are fused to keep their number down)
+    const size_t MIN_ROWS_PER_THREAD = 16384;
+
+    typedef array<double,2> Sums;
+
+    /// Runs f on ranges of [0,n) on several threads and adds up the sums that it returns for each range.
+    Sums ParallelSums(size_t n,const function<Sums(size_t,size_t)>& f)
+    {
+        // sum the partial sums in the same order every time, so that the results don't depend on which thread finishes first
+        vector<pair<size_t,Sums> > partial_sums;
+        mutex partial_sums_mutex;
+        parallel_for(n, [&](size_t first, size_t last) {
+            const Sums sums = f(first, last);
+            lock_guard<mutex> lock(partial_sums_mutex);
+            partial_sums.emplace_back(first, sums);
+        }, MIN_ROWS_PER_THREAD);
+        sort(partial_sums.begin(), partial_sums.end());
+        Sums sums = { 0.0, 0.0 };
+        for(const pair<size_t,Sums>& partial_sum : partial_sums)
+        {
+            sums[0] += partial_sum.second[0];
+            sums[1] += partial_sum.second[1];
+        }
+        return sums;
+    }
+
+    double Dot(const float* a,const float* b,size_t n)
+    {
+        return ParallelSums(n, [&](size_t first, size_t last) {
+            double sum = 0.0;
+            for(size_t i = first; i < last; i++)
+                sum += double(a[i]) * b[i];
+            return Sums{ sum, 0.0 };
+        })[0];
+    }
+}
+
+// ---------------------------------------------------------------------
+
+SparseSolver::SparseSolver()
+    : n(0)
+    , preconditioner(Preconditioner::Jacobi)
+{
+}
+
+// ---------------------------------------------------------------------
+
+void SparseSolver::SetMatrix(const vector<int>& offsets,const vector<int>& columns,const vector<float>& values,
+                             const vector<float>& diagonal,Preconditioner preconditioner)
+{
+    this->n = (int)diagonal.size();
+    this->offsets = offsets;
+    this->columns = columns;
+    this->values = values;
+    this->diagonal = diagonal;
+    this->preconditioner = preconditioner;
+    if(preconditioner == Preconditioner::IncompleteCholesky)
+        this->FactorizeIncompleteCholesky();
+}
+
+// ---------------------------------------------------------------------
+
+double SparseSolver::Multiply(const float* x,float* y) const
+{
+    return ParallelSums(this->n, [&](size_t first, size_t last) {
+        double xy = 0.0;
+        for(size_t i = first; i < last; i++)
+        {
+            float sum = this->diagonal[i] * x[i];
+            for(int k = this->offsets[i]; k < this->offsets[i+1]; k++)
+                sum += this->values[k] * x[this->columns[k]];
+            y[i] = sum;
+            xy += double(x[i]) * sum;
+        }
+        return Sums{ xy, 0.0 };
+    })[0];
+}
+
+// ---------------------------------------------------------------------
+
+void SparseSolver::FactorizeIncompleteCholesky()
+{
+    // copy the entries below the diagonal, sorted by column
+    this->lower_offsets.assign(1, 0);
+    this->lower_columns.clear();
+    this->lower_values.clear();
+    vector<pair<int,float> > row;
+    for(int i = 0; i < this->n; i++)
+    {
+        row.clear();
+        for(int k = this->offsets[i]; k < this->offsets[i+1]; k++)
+            if(this->columns[k] < i)
+                row.emplace_back(this->columns[k], this->values[k]);
+        sort(row.begin(), row.end());
+        for(const pair<int,float>& entry : row)
+        {
+            this->lower_columns.push_back(entry.first);
+            this->lower_values.push_back(entry.second);
+        }
+        this->lower_offsets.push_back((int)this->lower_columns.size());
+    }
+
+    // factorize row by row, only keeping entries where A has them
+    this->lower_diagonal.resize(this->n);
+    vector<int> position(this->n, -1); // where each column of the current row is in lower_values, or -1 if not there
+    for(int i = 0; i < this->n; i++)
+    {
+        for(int k = this->lower_offsets[i]; k < this->lower_offsets[i+1]; k++)
+            position[this->lower_columns[k]] = k;
+        double d = this->diagonal[i];
+        for(int k = this->lower_offsets[i]; k < this->lower_offsets[i+1]; k++)
+        {
+            const int j = this->lower_columns[k];
+            double v = this->lower_values[k];
+            for(int m = this->lower_offsets[j]; m < this->lower_offsets[j+1]; m++)
+                if(position[this->lower_columns[m]] >= 0)
+                    v -= double(this->lower_values[position[this->lower_columns[m]]]) * this->lower_values[m];
+            this->lower_values[k] = float(v / this->lower_diagonal[j]);
+            d -= double(this->lower_values[k]) * this->lower_values[k];
+        }
+        if(d <= 0.0)
+            d = this->diagonal[i]; // (the factorization broke down, which can't happen for an M-matrix; carry on as Jacobi would)
+        this->lower_diagonal[i] = float(sqrt(d));
+        for(int k = this->lower_offsets[i]; k < this->lower_offsets[i+1]; k++)
+            position[this->lower_columns[k]] = -1;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void SparseSolver::ApplyPreconditioner(const float* r,float* z) const
+{
+    switch(this->preconditioner)
+    {
+        case Preconditioner::Jacobi:
+            parallel_for(this->n, [&](size_t first, size_t last) {
+                for(size_t i = first; i < last; i++)
+                    z[i] = r[i] / this->diagonal[i];
+            }, MIN_ROWS_PER_THREAD);
+            break;
+        case Preconditioner::IncompleteCholesky:
+            // solve L y = r
+            for(int i = 0; i < this->n; i++)
+            {
+                float sum = r[i];
+                for(int k = this->lower_offsets[i]; k < this->lower_offsets[i+1]; k++)
+                    sum -= this->lower_values[k] * z[this->lower_columns[k]];
+                z[i] = sum / this->lower_diagonal[i];
+            }
+            // solve L^T z = y, in place
+            for(int i = this->n - 1; i >= 0; i--)
+            {
+                z[i] /= this->lower_diagonal[i];
+                for(int k = this->lower_offsets[i]; k < this->lower_offsets[i+1]; k++)
+                    z[this->lower_columns[k]] -= this->lower_values[k] * z[i];
+            }
+            break;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+int SparseSolver::Solve(const float* b,float* x,float tolerance,int max_iterations) const
+{
+    const size_t N = this->n;
+    vector<float> r(N), z(N), p(N), q(N);
+
+    // r = b - A x
+    this->Multiply(x, q.data());
+    const Sums bb_rr = ParallelSums(N, [&](size_t first, size_t last) {
+        double bb = 0.0, rr = 0.0;
+        for(size_t i = first; i < last; i++)
+        {
+            r[i] = b[i] - q[i];
+            bb += double(b[i]) * b[i];
+            rr += double(r[i]) * r[i];
+        }
+        return Sums{ bb, rr };
+    });
+    const double target = tolerance * tolerance * bb_rr[0];
+    double rr = bb_rr[1];
+
+    this->ApplyPreconditioner(r.data(), z.data());
+    p = z;
+    double rz = Dot(r.data(), z.data(), N);
+    const bool jacobi = this->preconditioner == Preconditioner::Jacobi;
+    int iIteration = 0;
+    for(; iIteration < max_iterations && rr > target; iIteration++)
+    {
+        const double pq = this->Multiply(p.data(), q.data());
+        if(pq <= 0.0)
+            break; // (only if A isn't positive definite, or we have already converged)
+        const float alpha = float(rz / pq);
+        // update x and r, and with Jacobi apply the preconditioner too, all in one pass
+        const Sums rz_rr = ParallelSums(N, [&](size_t first, size_t last) {
+            double rz_sum = 0.0, rr_sum = 0.0;
+            for(size_t i = first; i < last; i++)
+            {
+                x[i] += alpha * p[i];
+                r[i] -= alpha * q[i];
+                if(jacobi)
+                {
+                    z[i] = r[i] / this->diagonal[i];
+                    rz_sum += double(r[i]) * z[i];
+                }
+                rr_sum += double(r[i]) * r[i];
+            }
+            return Sums{ rz_sum, rr_sum };
+        });
+        rr = rz_rr[1];
+        double rz_new = rz_rr[0];
+        if(!jacobi)
+        {
+            this->ApplyPreconditioner(r.data(), z.data());
+            rz_new = Dot(r.data(), z.data(), N);
+        }
+        const float beta = float(rz_new / rz);
+        rz = rz_new;
+        parallel_for(N, [&](size_t first, size_t last) {
+            for(size_t i = first; i < last; i++)
+                p[i] = z[i] + beta * p[i];
+        }, MIN_ROWS_PER_THREAD);
+    }
+    return iIteration;
+}
@@ -0,0 +1,63 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __SPARSESOLVER__
+#define __SPARSESOLVER__
+
+// STL:
+#include <vector>
+
+/// Solves A x = b for a sparse symmetric positive definite matrix A, by preconditioned conjugate gradients.
+/** The matrix is given by rows, with the diagonal kept apart and each off-diagonal entry listed in both of its rows.
+ *  The products and vector updates are shared out between threads, fused into as few passes over the rows as the
+ *  dependencies allow, since each pass starts its own threads. The incomplete Cholesky preconditioner is
+ *  applied on one thread, since its triangular solves are sequential, but usually needs far fewer iterations. */
+class SparseSolver
+{
+    public:
+
+        /// Jacobi: divide by the diagonal. IncompleteCholesky: IC(0), a Cholesky factor with the same sparsity as A.
+        enum class Preconditioner { Jacobi, IncompleteCholesky };
+
+        SparseSolver();
+
+        /// Row i has diagonal[i], and the entry values[k] in column columns[k] for k in [offsets[i],offsets[i+1]).
+        void SetMatrix(const std::vector<int>& offsets,const std::vector<int>& columns,const std::vector<float>& values,
+                       const std::vector<float>& diagonal,Preconditioner preconditioner);
+
+        /// Solves A x = b, starting from the values already in x. Returns the number of iterations taken.
+        /** Stops when the residual is no more than tolerance times the length of b, or after max_iterations. */
+        int Solve(const float* b,float* x,float tolerance,int max_iterations) const;
+
+    private:
+
+        /// Sets y = A x, returning the dot product of x and y.
+        double Multiply(const float* x,float* y) const;
+        void ApplyPreconditioner(const float* r,float* z) const;
+        void FactorizeIncompleteCholesky();
+
+    private:
+
+        int n;
+        std::vector<int> offsets, columns;
+        std::vector<float> values, diagonal;
+        Preconditioner preconditioner;
+        std::vector<int> lower_offsets, lower_columns; // the incomplete Cholesky factor L, below the diagonal, by rows
+        std::vector<float> lower_values, lower_diagonal;
+};
+
+#endif
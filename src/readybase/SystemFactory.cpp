@@ -22,6 +22,9 @@
 #include <GrayScottImageRD.hpp>
 #include <FormulaOpenCLImageRD.hpp>
 #include <FullKernelOpenCLImageRD.hpp>
+#include <BinaryCAImageRD.hpp>
+#include <OpenCLBinaryCAImageRD.hpp>
+#include <HashlifeImageRD.hpp>
 #include <GrayScottMeshRD.hpp>
 #include <FormulaOpenCLMeshRD.hpp>
 #include <FullKernelOpenCLMeshRD.hpp>
@@ -143,6 +146,15 @@ unique_ptr<AbstractRD> CreateFromImageDataFile(
             throw runtime_error(OpenCL_utils::GetOpenCLInstallationHints());
         image_system = make_unique<FullKernelOpenCLImageRD>(opencl_platform,opencl_device,data_type);
     }
+    else if(type=="binary")
+    {
+        if(is_opencl_available)
+            image_system = make_unique<OpenCLBinaryCAImageRD>(opencl_platform,opencl_device);
+        else
+            image_system = make_unique<BinaryCAImageRD>();
+    }
+    else if(type=="hashlife")
+        image_system = make_unique<HashlifeImageRD>();
     else throw runtime_error("Unsupported rule type: "+type);
     image_system->InitializeFromXML(reader->GetRDElement(),warn_to_update);
 
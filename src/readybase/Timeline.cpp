@@ -0,0 +1,396 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "Timeline.hpp"
+
+// STL:
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+namespace
+{
+    const size_t DEFAULT_MEMORY_LIMIT = 512 * 1024 * 1024;
+    const int DEFAULT_KEYFRAME_INTERVAL = 16;
+    const size_t MIN_ZERO_RUN = 4; // (shorter runs of zeros are cheaper left among the literals)
+
+    void PutCount(vector<uint8_t>& out,size_t n)
+    {
+        // 7 bits at a time, with the top bit set on all but the last byte
+        while(n >= 0x80)
+        {
+            out.push_back(uint8_t(n & 0x7F) | 0x80);
+            n >>= 7;
+        }
+        out.push_back(uint8_t(n));
+    }
+
+    size_t GetCount(const vector<uint8_t>& in,size_t& k)
+    {
+        size_t n = 0;
+        int shift = 0;
+        while(true)
+        {
+            if(k >= in.size())
+                throw runtime_error("Timeline : corrupt frame");
+            const uint8_t byte = in[k++];
+            n |= size_t(byte & 0x7F) << shift;
+            if(!(byte & 0x80))
+                return n;
+            shift += 7;
+        }
+    }
+
+    /// Stores bytes as a list of packets: the number of zeros, then the number of literal bytes, then the literal bytes.
+    vector<uint8_t> Encode(const uint8_t* bytes,size_t n)
+    {
+        vector<uint8_t> encoded;
+        size_t i = 0;
+        while(i < n)
+        {
+            const size_t zeros_start = i;
+            while(i < n && bytes[i] == 0)
+                i++;
+            const size_t literals_start = i;
+            size_t zero_run = 0;
+            while(i < n)
+            {
+                zero_run = (bytes[i] == 0) ? zero_run + 1 : 0;
+                i++;
+                if(zero_run == MIN_ZERO_RUN)
+                {
+                    i -= zero_run; // leave the zeros for the next packet
+                    break;
+                }
+            }
+            PutCount(encoded, literals_start - zeros_start);
+            PutCount(encoded, i - literals_start);
+            encoded.insert(encoded.end(), bytes + literals_start, bytes + i);
+        }
+        return encoded;
+    }
+
+    /// Decodes into out, either replacing its contents or XOR-ing with them.
+    void Decode(const vector<uint8_t>& encoded,vector<uint8_t>& out,bool apply_xor)
+    {
+        size_t i = 0, k = 0;
+        while(k < encoded.size())
+        {
+            const size_t n_zeros = GetCount(encoded, k);
+            const size_t n_literals = GetCount(encoded, k);
+            if(i + n_zeros + n_literals > out.size() || k + n_literals > encoded.size())
+                throw runtime_error("Timeline : corrupt frame");
+            if(!apply_xor)
+                fill(out.begin() + i, out.begin() + i + n_zeros, 0);
+            i += n_zeros;
+            for(size_t j = 0; j < n_literals; j++)
+            {
+                if(apply_xor)
+                    out[i + j] ^= encoded[k + j];
+                else
+                    out[i + j] = encoded[k + j];
+            }
+            i += n_literals;
+            k += n_literals;
+        }
+        if(i != out.size())
+            throw runtime_error("Timeline : corrupt frame");
+    }
+}
+
+// ---------------------------------------------------------------------
+
+Timeline::Timeline()
+    : frames_size(0)
+    , memory_limit(DEFAULT_MEMORY_LIMIT)
+    , keyframe_interval(DEFAULT_KEYFRAME_INTERVAL)
+    , frames_since_keyframe(0)
+{
+}
+
+// ---------------------------------------------------------------------
+
+void Timeline::Clear()
+{
+    this->frames.clear();
+    this->frames_size = 0;
+    this->frames_since_keyframe = 0;
+    this->layout.clear();
+    this->last_planes.clear();
+    this->last_planes.shrink_to_fit();
+}
+
+// ---------------------------------------------------------------------
+
+void Timeline::SetMemoryLimit(size_t bytes)
+{
+    this->memory_limit = bytes;
+    this->ApplyMemoryLimit();
+}
+
+// ---------------------------------------------------------------------
+
+size_t Timeline::GetMemorySize() const
+{
+    return this->frames_size + this->last_planes.capacity();
+}
+
+// ---------------------------------------------------------------------
+
+void Timeline::SetKeyframeInterval(int n)
+{
+    if(n < 1)
+        throw runtime_error("Timeline::SetKeyframeInterval : interval must be at least 1");
+    this->keyframe_interval = n;
+}
+
+// ---------------------------------------------------------------------
+
+bool Timeline::MatchesLayout(const vector<Block>& blocks) const
+{
+    if(blocks.size() != this->layout.size())
+        return false;
+    for(size_t i = 0; i < blocks.size(); i++)
+        if(blocks[i].n_bytes != this->layout[i].first || blocks[i].element_size != this->layout[i].second)
+            return false;
+    return true;
+}
+
+// ---------------------------------------------------------------------
+
+void Timeline::Shuffle(const vector<Block>& blocks,vector<uint8_t>& planes) const
+{
+    // byte b of each element of a block goes to plane b of that block
+    size_t offset = 0;
+    for(const Block& block : blocks)
+    {
+        const uint8_t* data = static_cast<const uint8_t*>(block.data);
+        const size_t n_elements = block.n_bytes / block.element_size;
+        for(size_t b = 0; b < block.element_size; b++)
+        {
+            uint8_t* plane = planes.data() + offset + b * n_elements;
+            for(size_t e = 0; e < n_elements; e++)
+                plane[e] = data[e * block.element_size + b];
+        }
+        offset += block.n_bytes;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void Timeline::Unshuffle(const vector<uint8_t>& planes,const vector<Block>& blocks) const
+{
+    size_t offset = 0;
+    for(const Block& block : blocks)
+    {
+        uint8_t* data = static_cast<uint8_t*>(block.data);
+        const size_t n_elements = block.n_bytes / block.element_size;
+        for(size_t b = 0; b < block.element_size; b++)
+        {
+            const uint8_t* plane = planes.data() + offset + b * n_elements;
+            for(size_t e = 0; e < n_elements; e++)
+                data[e * block.element_size + b] = plane[e];
+        }
+        offset += block.n_bytes;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void Timeline::XorWithPreviousByte(vector<uint8_t>& planes,bool undo) const
+{
+    // within each plane, so that the first byte of a plane is kept as it is
+    size_t offset = 0;
+    for(const pair<size_t,size_t>& block : this->layout)
+    {
+        const size_t n_elements = block.first / block.second;
+        for(size_t b = 0; b < block.second; b++)
+        {
+            uint8_t* plane = planes.data() + offset + b * n_elements;
+            if(undo)
+                for(size_t e = 1; e < n_elements; e++)
+                    plane[e] ^= plane[e - 1];
+            else
+                for(size_t e = n_elements - 1; e > 0; e--)
+                    plane[e] ^= plane[e - 1];
+        }
+        offset += block.first;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void Timeline::DecodeFrame(int iFrame,vector<uint8_t>& planes) const
+{
+    // start from the keyframe at or before iFrame and apply the changes since
+    size_t total_bytes = 0;
+    for(const pair<size_t,size_t>& block : this->layout)
+        total_bytes += block.first;
+    planes.resize(total_bytes);
+    int iKeyframe = iFrame;
+    while(!this->frames[iKeyframe].is_keyframe)
+        iKeyframe--;
+    Decode(this->frames[iKeyframe].encoded, planes, false);
+    this->XorWithPreviousByte(planes, true);
+    for(int i = iKeyframe + 1; i <= iFrame; i++)
+        Decode(this->frames[i].encoded, planes, true);
+}
+
+// ---------------------------------------------------------------------
+
+void Timeline::Record(int timestep,const vector<Block>& blocks)
+{
+    if(this->frames.empty() || timestep <= this->frames.back().timestep || !this->MatchesLayout(blocks))
+    {
+        this->Clear();
+        for(const Block& block : blocks)
+        {
+            if(block.element_size == 0 || block.n_bytes % block.element_size != 0)
+                throw runtime_error("Timeline::Record : block size is not a whole number of elements");
+            this->layout.push_back(make_pair(block.n_bytes, block.element_size));
+        }
+    }
+
+    size_t total_bytes = 0;
+    for(const Block& block : blocks)
+        total_bytes += block.n_bytes;
+    vector<uint8_t> planes(total_bytes);
+    this->Shuffle(blocks, planes);
+
+    Frame frame;
+    frame.timestep = timestep;
+    frame.is_keyframe = this->frames.empty() || this->last_planes.empty()
+        || this->frames_since_keyframe + 1 >= this->keyframe_interval;
+    if(frame.is_keyframe)
+    {
+        this->last_planes = planes;
+        this->XorWithPreviousByte(this->last_planes, false);
+        frame.encoded = Encode(this->last_planes.data(), this->last_planes.size());
+        this->frames_since_keyframe = 0;
+    }
+    else
+    {
+        // store the change from the last frame, reusing its planes for the XOR
+        for(size_t i = 0; i < planes.size(); i++)
+            this->last_planes[i] ^= planes[i];
+        frame.encoded = Encode(this->last_planes.data(), this->last_planes.size());
+        this->frames_since_keyframe++;
+    }
+    frame.encoded.shrink_to_fit();
+    this->last_planes.swap(planes);
+
+    this->frames_size += sizeof(Frame) + frame.encoded.capacity();
+    this->frames.push_back(move(frame));
+    this->ApplyMemoryLimit();
+}
+
+// ---------------------------------------------------------------------
+
+int Timeline::GetTimestep(int iFrame) const
+{
+    if(iFrame < 0 || iFrame >= (int)this->frames.size())
+        throw runtime_error("Timeline::GetTimestep : frame out of range");
+    return this->frames[iFrame].timestep;
+}
+
+// ---------------------------------------------------------------------
+
+int Timeline::FindFrame(int timestep) const
+{
+    // the frames are in order of timestep
+    auto it = upper_bound(this->frames.begin(), this->frames.end(), timestep,
+        [](int t,const Frame& frame) { return t < frame.timestep; });
+    return int(it - this->frames.begin()) - 1;
+}
+
+// ---------------------------------------------------------------------
+
+void Timeline::Restore(int iFrame,const vector<Block>& blocks) const
+{
+    if(iFrame < 0 || iFrame >= (int)this->frames.size())
+        throw runtime_error("Timeline::Restore : frame out of range");
+    if(!this->MatchesLayout(blocks))
+        throw runtime_error("Timeline::Restore : the state is laid out differently from when it was recorded");
+
+    if(iFrame == (int)this->frames.size() - 1 && !this->last_planes.empty())
+    {
+        this->Unshuffle(this->last_planes, blocks);
+        return;
+    }
+
+    vector<uint8_t> planes;
+    this->DecodeFrame(iFrame, planes);
+    this->Unshuffle(planes, blocks);
+}
+
+// ---------------------------------------------------------------------
+
+void Timeline::DiscardAfter(int iFrame)
+{
+    if(iFrame < 0)
+    {
+        this->Clear();
+        return;
+    }
+    if(iFrame >= (int)this->frames.size() - 1)
+        return;
+
+    // rebuild the planes of iFrame, so that the next frame can be stored as a change from it
+    this->DecodeFrame(iFrame, this->last_planes);
+    int iKeyframe = iFrame;
+    while(!this->frames[iKeyframe].is_keyframe)
+        iKeyframe--;
+    this->frames_since_keyframe = iFrame - iKeyframe;
+
+    while((int)this->frames.size() > iFrame + 1)
+    {
+        this->frames_size -= sizeof(Frame) + this->frames.back().encoded.capacity();
+        this->frames.pop_back();
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void Timeline::Compact()
+{
+    this->last_planes.clear();
+    this->last_planes.shrink_to_fit();
+}
+
+// ---------------------------------------------------------------------
+
+void Timeline::ApplyMemoryLimit()
+{
+    // forget the oldest keyframe and the frames that depend on it, but always keep the latest keyframe
+    while(this->GetMemorySize() > this->memory_limit)
+    {
+        size_t iNextKeyframe = 1;
+        while(iNextKeyframe < this->frames.size() && !this->frames[iNextKeyframe].is_keyframe)
+            iNextKeyframe++;
+        if(iNextKeyframe >= this->frames.size())
+            break;
+        for(size_t i = 0; i < iNextKeyframe; i++)
+        {
+            this->frames_size -= sizeof(Frame) + this->frames.front().encoded.capacity();
+            this->frames.pop_front();
+        }
+    }
+}
@@ -0,0 +1,108 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __TIMELINE__
+#define __TIMELINE__
+
+// STL:
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+/// A history of recorded states of a system, for going back to an earlier timestep without running again from the start.
+/** The state is a list of blocks of raw values, e.g. one per chemical. Every few frames a whole keyframe is stored,
+ *  and the frames between store only what changed since the frame before: the XOR of the bit patterns, with the bytes
+ *  of each value gathered into planes so that the bytes that rarely change (the sign, the exponent and the high bits
+ *  of the mantissa) form long runs of zeros, which are stored as their length. Keyframes store each byte of a plane as
+ *  the XOR with the byte before, so that smooth or uniform regions compress too. This is lossless. The oldest frames
+ *  are forgotten, a keyframe and the frames that depend on it at a time, when the frames take more than the memory limit. */
+class Timeline
+{
+    public:
+
+        /// A block of the state: n_bytes of values of element_size bytes each.
+        struct Block
+        {
+            void* data;
+            size_t n_bytes;
+            size_t element_size;
+        };
+
+        Timeline();
+
+        void Clear();
+
+        void SetMemoryLimit(size_t bytes);
+        size_t GetMemoryLimit() const { return this->memory_limit; }
+        size_t GetMemorySize() const;
+
+        /// Every n-th frame is a keyframe. Frames are faster to restore when n is smaller, but take more memory.
+        void SetKeyframeInterval(int n);
+        int GetKeyframeInterval() const { return this->keyframe_interval; }
+
+        /// Adds a frame with the state at timestep, after the last frame.
+        /** If timestep is not after the last frame, or the blocks are laid out differently from before, the timeline
+         *  is cleared first since it no longer leads up to this state. */
+        void Record(int timestep,const std::vector<Block>& blocks);
+
+        bool IsEmpty() const { return this->frames.empty(); }
+        int GetNumberOfFrames() const { return (int)this->frames.size(); }
+        int GetTimestep(int iFrame) const;
+        /// Returns the last frame at or before timestep, or -1 if there is none.
+        int FindFrame(int timestep) const;
+
+        /// Copies the state recorded in a frame into blocks, which must be laid out as when it was recorded.
+        void Restore(int iFrame,const std::vector<Block>& blocks) const;
+
+        /// Forgets the frames after iFrame, e.g. because the state has moved on from there along a different path.
+        void DiscardAfter(int iFrame);
+
+        /// Frees the copy of the last frame that is kept for storing the next one as a change, e.g. when only one frame is needed.
+        /** The next frame recorded will be a keyframe. */
+        void Compact();
+
+    private:
+
+        struct Frame
+        {
+            int timestep;
+            bool is_keyframe;
+            std::vector<uint8_t> encoded; ///< the keyframe or the change since the last frame, as byte planes with runs of zeros compressed
+        };
+
+        bool MatchesLayout(const std::vector<Block>& blocks) const;
+        void Shuffle(const std::vector<Block>& blocks,std::vector<uint8_t>& planes) const;
+        void Unshuffle(const std::vector<uint8_t>& planes,const std::vector<Block>& blocks) const;
+        void XorWithPreviousByte(std::vector<uint8_t>& planes,bool undo) const;
+        void DecodeFrame(int iFrame,std::vector<uint8_t>& planes) const;
+        void ApplyMemoryLimit();
+
+    private:
+
+        std::deque<Frame> frames;
+        size_t frames_size;   ///< the memory used by frames
+        size_t memory_limit;
+        int keyframe_interval;
+        int frames_since_keyframe;
+
+        std::vector<std::pair<size_t,size_t> > layout; ///< n_bytes and element_size of each block
+        std::vector<uint8_t> last_planes;             ///< the byte planes of the last frame, to find the next change from
+};
+
+#endif
@@ -0,0 +1,63 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __TRIPLEBUFFER__
+#define __TRIPLEBUFFER__
+
+// STL:
+#include <atomic>
+
+/// Passes the latest of a stream of values from one writer thread to one reader thread, without either waiting.
+/** The writer fills in GetWriteBuffer() then calls Publish(). The reader calls Acquire(), which returns false if nothing
+ *  new has been published since the last call, then reads GetReadBuffer(), which stays untouched until the next Acquire().
+ *  The third buffer sits between them, holding the value most recently published. */
+template<typename T>
+class TripleBuffer
+{
+    public:
+
+        TripleBuffer() : iWrite(0), iRead(1), middle(2) {}
+
+        T& GetWriteBuffer() { return this->buffers[this->iWrite]; }
+
+        void Publish()
+        {
+            // swap the buffer just written with the middle one, marking it as new
+            this->iWrite = this->middle.exchange(this->iWrite | NEW) & INDEX;
+        }
+
+        bool Acquire()
+        {
+            if(!(this->middle.load() & NEW))
+                return false;
+            this->iRead = this->middle.exchange(this->iRead) & INDEX;
+            return true;
+        }
+
+        const T& GetReadBuffer() const { return this->buffers[this->iRead]; }
+
+    private:
+
+        static const int INDEX = 3;
+        static const int NEW = 4; ///< set in middle when it holds a value that hasn't been read yet
+
+        T buffers[3];
+        int iWrite, iRead;     ///< only used by the writer and the reader respectively
+        std::atomic<int> middle;
+};
+
+#endif
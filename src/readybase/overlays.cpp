@@ -17,6 +17,7 @@
 
 // local:
 #include "overlays.hpp"
+#include "CounterRNG.hpp"
 #include "ImageRD.hpp"
 #include "PerlinNoise.hpp"
 #include "utils.hpp"
@@ -29,6 +30,11 @@
 // STL:
 #include <stdexcept>
 #include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <random>
+#include <sstream>
 
 using namespace std;
 
@@ -80,21 +86,86 @@ vtkSmartPointer<vtkXMLDataElement> Overlay::GetAsXML() const
     return xml;
 }
 
-double Overlay::Apply(const vector<double>& vals, const AbstractRD& system, float x, float y, float z) const
+void Overlay::ApplyToSpan(const vector<double*>& vals, const AbstractRD& system, const ArenaSize& arena,
+                          const float* x, const float* y, const float* z, int n, size_t first_cell, SpanScratch& scratch) const
 {
-    // copy the values into a scratchpad to allow the overlays to affect each other
-    // e.g. one might write a constant value, the next double it
-    vector<double> vals_scratchpad(vals);
+    // (the target values are changed in place, so later shapes see the earlier ones)
+    scratch.fill_values.resize(n);
+    scratch.inside.resize(n);
+    double* targets = vals[this->iTargetChemical];
+    for(int iShape=0;iShape<(int)this->shapes.size();iShape++)
+    {
+        this->shapes[iShape]->AreInside( x, y, z, n, arena.X, arena.Y, arena.Z, arena.dimensionality, scratch.inside.data() );
+        if( find(scratch.inside.begin(), scratch.inside.end(), 1) == scratch.inside.end() )
+            continue; // (no need to compute the fill)
+        this->fill->GetValues( system, arena, vals, x, y, z, n, first_cell, this->iTargetChemical, scratch.fill_values.data() );
+        this->op->ApplyToSpan( targets, scratch.fill_values.data(), scratch.inside.data(), n );
+    }
+}
 
-    double& val = vals_scratchpad[this->iTargetChemical];
+bool Overlay::GetBounds(const ArenaSize& arena, double bounds[6]) const
+{
+    // the union of the boxes of the shapes, which is empty (xmin > xmax) if there are none, since nothing is changed
+    const double INF = numeric_limits<double>::infinity();
+    for(int xyz=0;xyz<3;xyz++)
+    {
+        bounds[xyz*2+0] = INF;
+        bounds[xyz*2+1] = -INF;
+    }
     for(int iShape=0;iShape<(int)this->shapes.size();iShape++)
     {
-        if( this->shapes[iShape]->IsInside( x, y, z, system.GetX(), system.GetY(), system.GetZ(), system.GetArenaDimensionality() ) )
+        double shape_bounds[6];
+        if( !this->shapes[iShape]->GetBounds( arena.X, arena.Y, arena.Z, arena.dimensionality, shape_bounds ) )
+            return false;
+        for(int xyz=0;xyz<3;xyz++)
         {
-            this->op->Apply( val, this->fill->GetValue(system, vals_scratchpad, x, y, z) );
+            bounds[xyz*2+0] = min(bounds[xyz*2+0], shape_bounds[xyz*2+0]);
+            bounds[xyz*2+1] = max(bounds[xyz*2+1], shape_bounds[xyz*2+1]);
         }
     }
-    return val;
+    return true;
+}
+
+bool Overlay::GetOpenCLCode(const AbstractRD& system, const ArenaSize& arena, OpenCLOverlaySource& source, string& code) const
+{
+    string expression;
+    if( !this->fill->GetOpenCLExpression( system, arena, this->iTargetChemical, source, expression ) )
+        return false;
+    // (as in ApplyToSpan, the fill is evaluated again for each shape, so that later shapes see the earlier ones)
+    ostringstream oss;
+    for(int iShape=0;iShape<(int)this->shapes.size();iShape++)
+    {
+        string condition;
+        if( !this->shapes[iShape]->GetOpenCLCondition( arena, source, condition ) )
+            return false;
+        oss << "    if(" << condition << ")\n";
+        oss << "        vals[" << this->iTargetChemical << "] " << this->op->GetOpenCLAssignment() << " " << expression << ";\n";
+    }
+    code = oss.str();
+    return true;
+}
+
+// --------------------------------------------------------------------------------------------------
+
+string OpenCLOverlaySource::Literal(double value) const
+{
+    if(std::isnan(value))
+        return "NAN";
+    if(std::isinf(value))
+        return value > 0 ? "INFINITY" : "(-INFINITY)";
+    // (showpoint ensures that there is a decimal point, which the suffix needs)
+    ostringstream oss;
+    oss << "(" << setprecision(this->real_suffix.empty() ? 17 : 9) << showpoint << value << this->real_suffix << ")";
+    return oss.str();
+}
+
+// --------------------------------------------------------------------------------------------------
+
+void BaseShape::AreInside(const float* x, const float* y, const float* z, int n, float X, float Y, float Z, int dimensionality,
+                          uint8_t* inside) const
+{
+    for(int i=0;i<n;i++)
+        inside[i] = this->IsInside(x[i], y[i], z[i], X, Y, Z, dimensionality) ? 1 : 0;
 }
 
 // --------------------------------------------------------------------------------------------------
@@ -149,7 +220,13 @@ class Add : public BaseOperation
             return xml;
         }
 
-        void Apply(double& target,double value) const override { target += value; }
+        void ApplyToSpan(double* targets,const double* values,const uint8_t* inside,int n) const override
+        {
+            for(int i=0;i<n;i++)
+                if(inside[i]) targets[i] += values[i];
+        }
+
+        string GetOpenCLAssignment() const override { return "+="; }
 };
 
 class Subtract : public BaseOperation
@@ -167,7 +244,13 @@ class Subtract : public BaseOperation
             return xml;
         }
 
-        void Apply(double& target,double value) const override { target -= value; }
+        void ApplyToSpan(double* targets,const double* values,const uint8_t* inside,int n) const override
+        {
+            for(int i=0;i<n;i++)
+                if(inside[i]) targets[i] -= values[i];
+        }
+
+        string GetOpenCLAssignment() const override { return "-="; }
 };
 
 class Overwrite : public BaseOperation
@@ -185,7 +268,13 @@ class Overwrite : public BaseOperation
             return xml;
         }
 
-        void Apply(double& target,double value) const override { target = value; }
+        void ApplyToSpan(double* targets,const double* values,const uint8_t* inside,int n) const override
+        {
+            for(int i=0;i<n;i++)
+                if(inside[i]) targets[i] = values[i];
+        }
+
+        string GetOpenCLAssignment() const override { return "="; }
 };
 
 class Multiply : public BaseOperation
@@ -203,7 +292,13 @@ class Multiply : public BaseOperation
             return xml;
         }
 
-        void Apply(double& target,double value) const override { target *= value; }
+        void ApplyToSpan(double* targets,const double* values,const uint8_t* inside,int n) const override
+        {
+            for(int i=0;i<n;i++)
+                if(inside[i]) targets[i] *= values[i];
+        }
+
+        string GetOpenCLAssignment() const override { return "*="; }
 };
 
 class Divide : public BaseOperation
@@ -221,7 +316,13 @@ class Divide : public BaseOperation
             return xml;
         }
 
-        void Apply(double& target,double value) const override { target /= value; }
+        void ApplyToSpan(double* targets,const double* values,const uint8_t* inside,int n) const override
+        {
+            for(int i=0;i<n;i++)
+                if(inside[i]) targets[i] /= values[i];
+        }
+
+        string GetOpenCLAssignment() const override { return "/="; }
 };
 
 // -------- fill methods: -----------
@@ -245,9 +346,18 @@ class Constant : public BaseFill
             return xml;
         }
 
-        double GetValue(const AbstractRD& system, const vector<double>& vals, float x, float y, float z) const override
+        void GetValues(const AbstractRD& system, const ArenaSize& arena, const vector<double*>& vals,
+                       const float* x, const float* y, const float* z, int n, size_t first_cell, int iTargetChemical,
+                       double* values) const override
         {
-            return this->value;
+            fill(values, values + n, this->value);
+        }
+
+        bool GetOpenCLExpression(const AbstractRD& system, const ArenaSize& arena, int iTargetChemical,
+                                 OpenCLOverlaySource& source, string& expression) const override
+        {
+            expression = source.Literal(this->value);
+            return true;
         }
 
     protected:
@@ -276,11 +386,22 @@ class OtherChemical : public BaseFill
             return xml;
         }
 
-        double GetValue(const AbstractRD& system,const vector<double>& vals, float x, float y, float z) const override
+        void GetValues(const AbstractRD& system, const ArenaSize& arena, const vector<double*>& vals,
+                       const float* x, const float* y, const float* z, int n, size_t first_cell, int iTargetChemical,
+                       double* values) const override
         {
             if(this->iOtherChemical < 0 || this->iOtherChemical >= (int)vals.size())
-                throw runtime_error("OtherChemical:GetValue : chemical out of range");
-            return vals[this->iOtherChemical];
+                throw runtime_error("OtherChemical:GetValues : chemical out of range");
+            copy(vals[this->iOtherChemical], vals[this->iOtherChemical] + n, values);
+        }
+
+        bool GetOpenCLExpression(const AbstractRD& system, const ArenaSize& arena, int iTargetChemical,
+                                 OpenCLOverlaySource& source, string& expression) const override
+        {
+            if(this->iOtherChemical < 0 || this->iOtherChemical >= system.GetNumberOfChemicals())
+                return false; // (leave it to GetValues to report the problem)
+            expression = "vals[" + to_string(this->iOtherChemical) + "]";
+            return true;
         }
 
     protected:
@@ -307,9 +428,18 @@ class Parameter : public BaseFill
             return xml;
         }
 
-        double GetValue(const AbstractRD& system, const vector<double>& vals, float x, float y, float z) const override
+        void GetValues(const AbstractRD& system, const ArenaSize& arena, const vector<double*>& vals,
+                       const float* x, const float* y, const float* z, int n, size_t first_cell, int iTargetChemical,
+                       double* values) const override
+        {
+            fill(values, values + n, system.GetParameterValueByName(this->parameter_name.c_str()));
+        }
+
+        bool GetOpenCLExpression(const AbstractRD& system, const ArenaSize& arena, int iTargetChemical,
+                                 OpenCLOverlaySource& source, string& expression) const override
         {
-            return system.GetParameterValueByName(this->parameter_name.c_str());
+            expression = source.Literal(system.GetParameterValueByName(this->parameter_name.c_str()));
+            return true;
         }
 
     protected:
@@ -321,10 +451,20 @@ class WhiteNoise : public BaseFill
 {
     public:
 
-        WhiteNoise(vtkXMLDataElement* node) : BaseFill(node)
+        WhiteNoise(vtkXMLDataElement* node) : BaseFill(node), has_fixed_seed(false)
         {
             read_required_attribute(node,"low",this->low);
             read_required_attribute(node,"high",this->high);
+            // (with a seed the noise is the same every time, otherwise it changes whenever the overlay is reseeded)
+            this->has_fixed_seed = node->GetAttribute("seed") != NULL;
+            read_optional_attribute(node,"seed",this->seed);
+            this->Reseed();
+        }
+
+        void Reseed() override
+        {
+            if(!this->has_fixed_seed)
+                this->seed = random_device()();
         }
 
         static const char* GetTypeName() { return "white_noise"; }
@@ -335,32 +475,58 @@ class WhiteNoise : public BaseFill
             xml->SetName(WhiteNoise::GetTypeName());
             xml->SetFloatAttribute("low",this->low);
             xml->SetFloatAttribute("high",this->high);
+            if(this->has_fixed_seed)
+                xml->SetAttribute("seed",to_string(this->seed).c_str());
             return xml;
         }
 
-        double GetValue(const AbstractRD& system, const vector<double>& vals, float x, float y, float z) const override
+        void GetValues(const AbstractRD& system, const ArenaSize& arena, const vector<double*>& vals,
+                       const float* x, const float* y, const float* z, int n, size_t first_cell, int iTargetChemical,
+                       double* values) const override
+        {
+            for(int i=0;i<n;i++)
+                values[i] = this->low + (this->high - this->low) * CounterRNG::Uniform(this->seed, first_cell + i, iTargetChemical);
+        }
+
+        bool GetOpenCLExpression(const AbstractRD& system, const ArenaSize& arena, int iTargetChemical,
+                                 OpenCLOverlaySource& source, string& expression) const override
         {
-            return frand(this->low,this->high);
+            if(!source.has_counter_rng)
+            {
+                source.helpers += CounterRNG::GetOpenCLSource("real");
+                source.has_counter_rng = true;
+            }
+            // (the same random numbers as GetValues)
+            expression = "(" + source.Literal(this->low) + " + " + source.Literal(this->high - this->low)
+                + " * counter_uniform(philox4x32((uint4)((uint)index_here, (uint)(index_here >> 32), 0, 0), (uint2)("
+                + to_string(this->seed) + "u, " + to_string(iTargetChemical) + "u)).x))";
+            return true;
         }
 
     protected:
 
         double low,high;
+        unsigned int seed;     ///< the random numbers are keyed on this, the cell index and the chemical
+        bool has_fixed_seed;   ///< whether the seed was given in the file, rather than chosen at random
 };
 
 class PerlinNoise: public BaseFill
 {
     public:
 
-        PerlinNoise(vtkXMLDataElement* node) : BaseFill(node), scale(64.0), num_octaves(8)
+        PerlinNoise(vtkXMLDataElement* node) : BaseFill(node), scale(64.0), num_octaves(8), has_fixed_seed(false)
         {
             read_optional_attribute(node, "scale", this->scale);
             read_optional_attribute(node, "num_octaves", this->num_octaves);
+            this->has_fixed_seed = node->GetAttribute("seed") != NULL;
+            read_optional_attribute(node, "seed", this->seed);
+            if(this->has_fixed_seed)
+                this->perlin.reseed(this->seed);
         }
 
         void Reseed() override
         {
-            this->perlin.reseed(static_cast<unsigned int>(time(NULL)));
+            this->perlin.reseed(this->has_fixed_seed ? this->seed : static_cast<unsigned int>(time(NULL)));
         }
 
         static const char* GetTypeName() { return "perlin_noise"; }
@@ -371,18 +537,98 @@ class PerlinNoise: public BaseFill
             xml->SetName(PerlinNoise::GetTypeName());
             xml->SetFloatAttribute("scale",this->scale);
             xml->SetIntAttribute("num_octaves",this->num_octaves);
+            if(this->has_fixed_seed)
+                xml->SetAttribute("seed",to_string(this->seed).c_str());
             return xml;
         }
 
-        double GetValue(const AbstractRD& system, const vector<double>& vals, float x, float y, float z) const override
+        void GetValues(const AbstractRD& system, const ArenaSize& arena, const vector<double*>& vals,
+                       const float* x, const float* y, const float* z, int n, size_t first_cell, int iTargetChemical,
+                       double* values) const override
+        {
+            for(int i=0;i<n;i++)
+                values[i] = this->perlin.octave3D_01((x[i] / this->scale), (y[i] / this->scale), (z[i] / this->scale), this->num_octaves);
+        }
+
+        bool GetOpenCLExpression(const AbstractRD& system, const ArenaSize& arena, int iTargetChemical,
+                                 OpenCLOverlaySource& source, string& expression) const override
         {
-            return this->perlin.octave3D_01((x / this->scale), (y / this->scale), (z / this->scale), this->num_octaves);
+            if(!source.has_perlin)
+            {
+                // a port of octave3D_01 in PerlinNoise.hpp, with the permutation table passed in
+                source.helpers += "\
+real perlin_fade(real t)\n\
+{\n\
+    return t * t * t * (t * (t * 6 - 15) + 10);\n\
+}\n\n\
+real perlin_grad(uchar hash, real x, real y, real z)\n\
+{\n\
+    const int h = hash & 15;\n\
+    const real u = h < 8 ? x : y;\n\
+    const real v = h < 4 ? y : (h == 12 || h == 14 ? x : z);\n\
+    return ((h & 1) == 0 ? u : -u) + ((h & 2) == 0 ? v : -v);\n\
+}\n\n\
+real perlin_noise(constant uchar* p, real x, real y, real z)\n\
+{\n\
+    const real _x = floor(x), _y = floor(y), _z = floor(z);\n\
+    const int ix = (int)_x & 255, iy = (int)_y & 255, iz = (int)_z & 255;\n\
+    const real fx = x - _x, fy = y - _y, fz = z - _z;\n\
+    const real u = perlin_fade(fx), v = perlin_fade(fy), w = perlin_fade(fz);\n\
+    const int A = (p[ix] + iy) & 255;\n\
+    const int B = (p[(ix + 1) & 255] + iy) & 255;\n\
+    const int AA = (p[A] + iz) & 255;\n\
+    const int AB = (p[(A + 1) & 255] + iz) & 255;\n\
+    const int BA = (p[B] + iz) & 255;\n\
+    const int BB = (p[(B + 1) & 255] + iz) & 255;\n\
+    const real p0 = perlin_grad(p[AA], fx, fy, fz);\n\
+    const real p1 = perlin_grad(p[BA], fx - 1, fy, fz);\n\
+    const real p2 = perlin_grad(p[AB], fx, fy - 1, fz);\n\
+    const real p3 = perlin_grad(p[BB], fx - 1, fy - 1, fz);\n\
+    const real p4 = perlin_grad(p[(AA + 1) & 255], fx, fy, fz - 1);\n\
+    const real p5 = perlin_grad(p[(BA + 1) & 255], fx - 1, fy, fz - 1);\n\
+    const real p6 = perlin_grad(p[(AB + 1) & 255], fx, fy - 1, fz - 1);\n\
+    const real p7 = perlin_grad(p[(BB + 1) & 255], fx - 1, fy - 1, fz - 1);\n\
+    const real q0 = mix(p0, p1, u);\n\
+    const real q1 = mix(p2, p3, u);\n\
+    const real q2 = mix(p4, p5, u);\n\
+    const real q3 = mix(p6, p7, u);\n\
+    return mix(mix(q0, q1, v), mix(q2, q3, v), w);\n\
+}\n\n\
+real perlin_octaves_01(constant uchar* p, real x, real y, real z, int octaves)\n\
+{\n\
+    real result = 0, amplitude = 1;\n\
+    for(int i = 0; i < octaves; i++)\n\
+    {\n\
+        result += perlin_noise(p, x, y, z) * amplitude;\n\
+        x *= 2;\n\
+        y *= 2;\n\
+        z *= 2;\n\
+        amplitude /= 2;\n\
+    }\n\
+    return clamp(result / 2 + " + source.Literal(0.5) + ", (real)0, (real)1);\n\
+}\n\n";
+                source.has_perlin = true;
+            }
+            // each fill has its own permutation table
+            const string table = "perlin_table_" + to_string(source.n_tables++);
+            ostringstream oss;
+            oss << "constant uchar " << table << "[256] = {";
+            const siv::PerlinNoise::state_type& permutation = this->perlin.serialize();
+            for(size_t i=0;i<permutation.size();i++)
+                oss << (i ? "," : " ") << (int)permutation[i];
+            oss << " };\n\n";
+            source.helpers += oss.str();
+            expression = "perlin_octaves_01(" + table + ", x / " + source.Literal(this->scale) + ", y / " + source.Literal(this->scale)
+                + ", z / " + source.Literal(this->scale) + ", " + to_string(this->num_octaves) + ")";
+            return true;
         }
 
     protected:
 
         double scale;
         int num_octaves;
+        unsigned int seed;
+        bool has_fixed_seed;
 
         siv::PerlinNoise perlin;
 };
@@ -414,19 +660,37 @@ class LinearGradient : public BaseFill
             return xml;
         }
 
-        double GetValue(const AbstractRD& system, const vector<double>& vals, float x, float y, float z) const override
+        void GetValues(const AbstractRD& system, const ArenaSize& arena, const vector<double*>& vals,
+                       const float* x, const float* y, const float* z, int n, size_t first_cell, int iTargetChemical,
+                       double* values) const override
+        {
+            const float X = arena.X, Y = arena.Y, Z = arena.Z;
+            const double blen = hypot3(this->p2->x-this->p1->x,this->p2->y-this->p1->y,this->p2->z-this->p1->z);
+            const double bx = (this->p2->x-this->p1->x) / blen;
+            const double by = (this->p2->y-this->p1->y) / blen;
+            const double bz = (this->p2->z-this->p1->z) / blen;
+            for(int i=0;i<n;i++)
+            {
+                const double rel_x = x[i]/X;
+                const double rel_y = y[i]/Y;
+                const double rel_z = z[i]/Z;
+                const double dp = (rel_x-this->p1->x) * bx + (rel_y-this->p1->y) * by + (rel_z-this->p1->z) * bz;
+                values[i] = this->val1 + (this->val2-this->val1) * dp / blen;
+            }
+        }
+
+        bool GetOpenCLExpression(const AbstractRD& system, const ArenaSize& arena, int iTargetChemical,
+                                 OpenCLOverlaySource& source, string& expression) const override
         {
-            double rel_x = x/system.GetX();
-            double rel_y = y/system.GetY();
-            double rel_z = z/system.GetZ();
-            // project this point onto the linear gradient axis
-            double blen = hypot3(this->p2->x-this->p1->x,this->p2->y-this->p1->y,this->p2->z-this->p1->z);
-            double bx = (this->p2->x-this->p1->x) / blen;
-            double by = (this->p2->y-this->p1->y) / blen;
-            double bz = (this->p2->z-this->p1->z) / blen;
-            double dp = (rel_x-this->p1->x) * bx + (rel_y-this->p1->y) * by + (rel_z-this->p1->z) * bz; // dp = a.norm(b)
-            double u = dp / blen; // [0,1]
-            return this->val1 + (this->val2-this->val1) * u;
+            const double blen = hypot3(this->p2->x-this->p1->x,this->p2->y-this->p1->y,this->p2->z-this->p1->z);
+            const double bx = (this->p2->x-this->p1->x) / blen;
+            const double by = (this->p2->y-this->p1->y) / blen;
+            const double bz = (this->p2->z-this->p1->z) / blen;
+            expression = "(" + source.Literal(this->val1) + " + " + source.Literal((this->val2-this->val1) / blen) + " * ("
+                + "(x / " + source.Literal(arena.X) + " - " + source.Literal(this->p1->x) + ") * " + source.Literal(bx) + " + "
+                + "(y / " + source.Literal(arena.Y) + " - " + source.Literal(this->p1->y) + ") * " + source.Literal(by) + " + "
+                + "(z / " + source.Literal(arena.Z) + " - " + source.Literal(this->p1->z) + ") * " + source.Literal(bz) + "))";
+            return true;
         }
 
     protected:
@@ -463,16 +727,33 @@ class RadialGradient : public BaseFill
             return xml;
         }
 
-        double GetValue(const AbstractRD& system, const vector<double>& vals, float x, float y, float z) const override
+        void GetValues(const AbstractRD& system, const ArenaSize& arena, const vector<double*>& vals,
+                       const float* x, const float* y, const float* z, int n, size_t first_cell, int iTargetChemical,
+                       double* values) const override
         {
-            // convert p1 and p2 to absolute coordinates
-            double rp1x = p1->x * system.GetX();
-            double rp1y = p1->y * system.GetY();
-            double rp1z = p1->z * system.GetZ();
-            double rp2x = p2->x * system.GetX();
-            double rp2y = p2->y * system.GetY();
-            double rp2z = p2->z * system.GetZ();
-            return val1 + (val2-val1) * hypot3(x-rp1x,y-rp1y,z-rp1z) / hypot3(rp2x-rp1x,rp2y-rp1y,rp2z-rp1z);
+            const double rp1x = p1->x * arena.X;
+            const double rp1y = p1->y * arena.Y;
+            const double rp1z = p1->z * arena.Z;
+            const double rp2x = p2->x * arena.X;
+            const double rp2y = p2->y * arena.Y;
+            const double rp2z = p2->z * arena.Z;
+            const double radius = hypot3(rp2x-rp1x,rp2y-rp1y,rp2z-rp1z);
+            for(int i=0;i<n;i++)
+                values[i] = val1 + (val2-val1) * hypot3(x[i]-rp1x,y[i]-rp1y,z[i]-rp1z) / radius;
+        }
+
+        bool GetOpenCLExpression(const AbstractRD& system, const ArenaSize& arena, int iTargetChemical,
+                                 OpenCLOverlaySource& source, string& expression) const override
+        {
+            const double rp1x = p1->x * arena.X;
+            const double rp1y = p1->y * arena.Y;
+            const double rp1z = p1->z * arena.Z;
+            const double radius = hypot3(p2->x * arena.X - rp1x, p2->y * arena.Y - rp1y, p2->z * arena.Z - rp1z);
+            expression = "(" + source.Literal(val1) + " + " + source.Literal((val2-val1) / radius) + " * sqrt("
+                + "(x - " + source.Literal(rp1x) + ") * (x - " + source.Literal(rp1x) + ") + "
+                + "(y - " + source.Literal(rp1y) + ") * (y - " + source.Literal(rp1y) + ") + "
+                + "(z - " + source.Literal(rp1z) + ") * (z - " + source.Literal(rp1z) + ")))";
+            return true;
         }
 
     protected:
@@ -507,15 +788,34 @@ class Gaussian : public BaseFill
             return xml;
         }
 
-        double GetValue(const AbstractRD& system, const vector<double>& vals, float x, float y, float z) const override
+        void GetValues(const AbstractRD& system, const ArenaSize& arena, const vector<double*>& vals,
+                       const float* x, const float* y, const float* z, int n, size_t first_cell, int iTargetChemical,
+                       double* values) const override
         {
-            // convert center to absolute coordinates
-            double ax = center->x * system.GetX();
-            double ay = center->y * system.GetY();
-            double az = center->z * system.GetZ();
-            double asigma = this->sigma * max(system.GetX(),max(system.GetY(),system.GetZ())); // (proportional to the largest dimension)
-            double dist = hypot3(ax-x,ay-y,az-z);
-            return this->height * exp( -dist*dist/(2.0f*asigma*asigma) );
+            const double ax = center->x * arena.X;
+            const double ay = center->y * arena.Y;
+            const double az = center->z * arena.Z;
+            const double asigma = this->sigma * max(arena.X,max(arena.Y,arena.Z));
+            for(int i=0;i<n;i++)
+            {
+                const double dist = hypot3(ax-x[i],ay-y[i],az-z[i]);
+                values[i] = this->height * exp( -dist*dist/(2.0f*asigma*asigma) );
+            }
+        }
+
+        bool GetOpenCLExpression(const AbstractRD& system, const ArenaSize& arena, int iTargetChemical,
+                                 OpenCLOverlaySource& source, string& expression) const override
+        {
+            const double ax = center->x * arena.X;
+            const double ay = center->y * arena.Y;
+            const double az = center->z * arena.Z;
+            const double asigma = this->sigma * max(arena.X,max(arena.Y,arena.Z));
+            expression = "(" + source.Literal(this->height) + " * exp(-("
+                + "(x - " + source.Literal(ax) + ") * (x - " + source.Literal(ax) + ") + "
+                + "(y - " + source.Literal(ay) + ") * (y - " + source.Literal(ay) + ") + "
+                + "(z - " + source.Literal(az) + ") * (z - " + source.Literal(az) + ")) / "
+                + source.Literal(2.0*asigma*asigma) + "))";
+            return true;
         }
 
     protected:
@@ -551,19 +851,38 @@ class Sine : public BaseFill
             return xml;
         }
 
-        double GetValue(const AbstractRD& system, const vector<double>& vals, float x, float y, float z) const override
+        void GetValues(const AbstractRD& system, const ArenaSize& arena, const vector<double*>& vals,
+                       const float* x, const float* y, const float* z, int n, size_t first_cell, int iTargetChemical,
+                       double* values) const override
+        {
+            const float X = arena.X, Y = arena.Y, Z = arena.Z;
+            const double blen = hypot3(this->p2->x-this->p1->x,this->p2->y-this->p1->y,this->p2->z-this->p1->z);
+            const double bx = (this->p2->x-this->p1->x) / blen;
+            const double by = (this->p2->y-this->p1->y) / blen;
+            const double bz = (this->p2->z-this->p1->z) / blen;
+            for(int i=0;i<n;i++)
+            {
+                const double rel_x = x[i]/X;
+                const double rel_y = y[i]/Y;
+                const double rel_z = z[i]/Z;
+                const double dp = (rel_x-this->p1->x) * bx + (rel_y-this->p1->y) * by + (rel_z-this->p1->z) * bz;
+                values[i] = this->amplitude * sin( dp / blen * 2.0 * vtkMath::Pi() - this->phase );
+            }
+        }
+
+        bool GetOpenCLExpression(const AbstractRD& system, const ArenaSize& arena, int iTargetChemical,
+                                 OpenCLOverlaySource& source, string& expression) const override
         {
-            double rel_x = x/system.GetX();
-            double rel_y = y/system.GetY();
-            double rel_z = z/system.GetZ();
-            // project this point onto the axis
-            double blen = hypot3(this->p2->x-this->p1->x,this->p2->y-this->p1->y,this->p2->z-this->p1->z);
-            double bx = (this->p2->x-this->p1->x) / blen;
-            double by = (this->p2->y-this->p1->y) / blen;
-            double bz = (this->p2->z-this->p1->z) / blen;
-            double dp = (rel_x-this->p1->x) * bx + (rel_y-this->p1->y) * by + (rel_z-this->p1->z) * bz; // dp = a.norm(b)
-            double u = dp / blen; // [0,1]
-            return this->amplitude * sin( u * 2.0 * vtkMath::Pi() - this->phase );
+            const double blen = hypot3(this->p2->x-this->p1->x,this->p2->y-this->p1->y,this->p2->z-this->p1->z);
+            const double bx = (this->p2->x-this->p1->x) / blen;
+            const double by = (this->p2->y-this->p1->y) / blen;
+            const double bz = (this->p2->z-this->p1->z) / blen;
+            expression = "(" + source.Literal(this->amplitude) + " * sin(" + source.Literal(2.0 * vtkMath::Pi() / blen) + " * ("
+                + "(x / " + source.Literal(arena.X) + " - " + source.Literal(this->p1->x) + ") * " + source.Literal(bx) + " + "
+                + "(y / " + source.Literal(arena.Y) + " - " + source.Literal(this->p1->y) + ") * " + source.Literal(by) + " + "
+                + "(z / " + source.Literal(arena.Z) + " - " + source.Literal(this->p1->z) + ") * " + source.Literal(bz) + ") - "
+                + source.Literal(this->phase) + "))";
+            return true;
         }
 
     protected:
@@ -594,6 +913,18 @@ class Everywhere : public BaseShape
         {
             return true;
         }
+
+        void AreInside(const float* x,const float* y,const float* z,int n,float X,float Y,float Z,int dimensionality,
+                       uint8_t* inside) const override
+        {
+            fill(inside, inside + n, 1);
+        }
+
+        bool GetOpenCLCondition(const ArenaSize& arena, OpenCLOverlaySource& source, string& condition) const override
+        {
+            condition = "true";
+            return true;
+        }
 };
 
 class Rectangle : public BaseShape
@@ -636,6 +967,52 @@ class Rectangle : public BaseShape
             }
         }
 
+        void AreInside(const float* x,const float* y,const float* z,int n,float X,float Y,float Z,int dimensionality,
+                       uint8_t* inside) const override
+        {
+            // (the axes beyond the dimensionality are not tested)
+            const bool test_y = dimensionality == 2 || dimensionality == 3;
+            const bool test_z = dimensionality == 3;
+            for(int i=0;i<n;i++)
+            {
+                const double rel_x = x[i]/X;
+                const double rel_y = y[i]/Y;
+                const double rel_z = z[i]/Z;
+                inside[i] = rel_x>=this->a->x && rel_x<=this->b->x &&
+                            (!test_y || (rel_y>=this->a->y && rel_y<=this->b->y)) &&
+                            (!test_z || (rel_z>=this->a->z && rel_z<=this->b->z));
+            }
+        }
+
+        bool GetBounds(float X,float Y,float Z,int dimensionality,double bounds[6]) const override
+        {
+            const double INF = numeric_limits<double>::infinity();
+            const bool test_y = dimensionality == 2 || dimensionality == 3;
+            const bool test_z = dimensionality == 3;
+            bounds[0] = this->a->x * X;
+            bounds[1] = this->b->x * X;
+            bounds[2] = test_y ? this->a->y * Y : -INF;
+            bounds[3] = test_y ? this->b->y * Y : INF;
+            bounds[4] = test_z ? this->a->z * Z : -INF;
+            bounds[5] = test_z ? this->b->z * Z : INF;
+            return true;
+        }
+
+        bool GetOpenCLCondition(const ArenaSize& arena, OpenCLOverlaySource& source, string& condition) const override
+        {
+            const bool test_y = arena.dimensionality == 2 || arena.dimensionality == 3;
+            const bool test_z = arena.dimensionality == 3;
+            const string rel_x = "x / " + source.Literal(arena.X);
+            const string rel_y = "y / " + source.Literal(arena.Y);
+            const string rel_z = "z / " + source.Literal(arena.Z);
+            condition = rel_x + " >= " + source.Literal(this->a->x) + " && " + rel_x + " <= " + source.Literal(this->b->x);
+            if(test_y)
+                condition += " && " + rel_y + " >= " + source.Literal(this->a->y) + " && " + rel_y + " <= " + source.Literal(this->b->y);
+            if(test_z)
+                condition += " && " + rel_z + " >= " + source.Literal(this->a->z) + " && " + rel_z + " <= " + source.Literal(this->b->z);
+            return true;
+        }
+
     protected:
 
         unique_ptr<Point3D> a;
@@ -681,6 +1058,51 @@ class Circle : public BaseShape
             }
         }
 
+        void AreInside(const float* x,const float* y,const float* z,int n,float X,float Y,float Z,int dimensionality,
+                       uint8_t* inside) const override
+        {
+            const double cx = this->c->x * X;
+            const double cy = this->c->y * Y;
+            const double cz = this->c->z * Z;
+            const double abs_radius = this->radius * max(X,max(Y,Z));
+            const double ky = (dimensionality == 2 || dimensionality == 3) ? 1.0 : 0.0; // (the axes beyond the dimensionality are ignored)
+            const double kz = dimensionality == 3 ? 1.0 : 0.0;
+            for(int i=0;i<n;i++)
+            {
+                const double dx = x[i]-cx, dy = ky*(y[i]-cy), dz = kz*(z[i]-cz);
+                inside[i] = sqrt(dx*dx + dy*dy + dz*dz) < abs_radius;
+            }
+        }
+
+        bool GetBounds(float X,float Y,float Z,int dimensionality,double bounds[6]) const override
+        {
+            const double INF = numeric_limits<double>::infinity();
+            const double center[3] = { this->c->x * X, this->c->y * Y, this->c->z * Z };
+            const double abs_radius = this->radius * max(X,max(Y,Z));
+            for(int xyz=0;xyz<3;xyz++)
+            {
+                const bool tested = xyz==0 || (xyz==1 && (dimensionality == 2 || dimensionality == 3)) || (xyz==2 && dimensionality == 3);
+                bounds[xyz*2+0] = tested ? center[xyz] - abs_radius : -INF;
+                bounds[xyz*2+1] = tested ? center[xyz] + abs_radius : INF;
+            }
+            return true;
+        }
+
+        bool GetOpenCLCondition(const ArenaSize& arena, OpenCLOverlaySource& source, string& condition) const override
+        {
+            const string cx = source.Literal(this->c->x * arena.X);
+            const string cy = source.Literal(this->c->y * arena.Y);
+            const string cz = source.Literal(this->c->z * arena.Z);
+            const double abs_radius = this->radius * max(arena.X,max(arena.Y,arena.Z));
+            string squared_distance = "(x - " + cx + ") * (x - " + cx + ")";
+            if(arena.dimensionality == 2 || arena.dimensionality == 3)
+                squared_distance += " + (y - " + cy + ") * (y - " + cy + ")";
+            if(arena.dimensionality == 3)
+                squared_distance += " + (z - " + cz + ") * (z - " + cz + ")";
+            condition = "sqrt(" + squared_distance + ") < " + source.Literal(abs_radius);
+            return true;
+        }
+
     protected:
 
         unique_ptr<Point3D> c;
@@ -721,6 +1143,43 @@ class Pixel : public BaseShape
             }
         }
 
+        void AreInside(const float* x,const float* y,const float* z,int n,float X,float Y,float Z,int dimensionality,
+                       uint8_t* inside) const override
+        {
+            const bool test_y = dimensionality == 2 || dimensionality == 3;
+            const bool test_z = dimensionality == 3;
+            for(int i=0;i<n;i++)
+                inside[i] = vtkMath::Round(x[i])==this->px &&
+                            (!test_y || vtkMath::Round(y[i])==this->py) &&
+                            (!test_z || vtkMath::Round(z[i])==this->pz);
+        }
+
+        bool GetBounds(float X,float Y,float Z,int dimensionality,double bounds[6]) const override
+        {
+            const double INF = numeric_limits<double>::infinity();
+            const bool test_y = dimensionality == 2 || dimensionality == 3;
+            const bool test_z = dimensionality == 3;
+            // (the locations that round to the pixel)
+            bounds[0] = this->px - 0.5;
+            bounds[1] = this->px + 0.5;
+            bounds[2] = test_y ? this->py - 0.5 : -INF;
+            bounds[3] = test_y ? this->py + 0.5 : INF;
+            bounds[4] = test_z ? this->pz - 0.5 : -INF;
+            bounds[5] = test_z ? this->pz + 0.5 : INF;
+            return true;
+        }
+
+        bool GetOpenCLCondition(const ArenaSize& arena, OpenCLOverlaySource& source, string& condition) const override
+        {
+            // (round() rounds halves away from zero, as vtkMath::Round does)
+            condition = "(int)round(x) == " + to_string(this->px);
+            if(arena.dimensionality == 2 || arena.dimensionality == 3)
+                condition += " && (int)round(y) == " + to_string(this->py);
+            if(arena.dimensionality == 3)
+                condition += " && (int)round(z) == " + to_string(this->pz);
+            return true;
+        }
+
     protected:
 
         int px,py,pz;
@@ -19,6 +19,7 @@
 #define __OVERLAYS__
 
 // STL:
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
@@ -33,6 +34,23 @@ class AbstractRD;
 
 // ------------------------------------------------------------------------------------------------
 
+/// The parts of an OpenCL kernel that applies the overlays, as built up by the overlays and their elements.
+/** In the kernel, each cell has real x, y, z for its location, real vals[] for the value of each chemical there and
+ *  ulong index_here for its index. Helper functions and tables that the expressions need are collected separately. */
+struct OpenCLOverlaySource
+{
+    std::string real_suffix;        ///< for floating-point literals: "f" if real is float, "" if double
+    std::string helpers;            ///< functions and tables to be placed before the kernel
+    int n_tables = 0;               ///< for giving each table a unique name
+    bool has_perlin = false;        ///< whether the Perlin noise functions have been added to helpers
+    bool has_counter_rng = false;   ///< whether the CounterRNG functions have been added to helpers
+
+    /// a floating-point literal of type real
+    std::string Literal(double value) const;
+};
+
+// ------------------------------------------------------------------------------------------------
+
 /// Base class for a mathematical operation to be carried out at a particular location in the RD system.
 class BaseOperation : public XML_Object
 {
@@ -43,8 +61,11 @@ public:
     /// construct when we don't know the derived type (returns empty pointer if name is unknown)
     static std::unique_ptr<BaseOperation> New(vtkXMLDataElement* node);
 
-    /// apply the operation to target, with parameter value
-    virtual void Apply(double& target, double value) const = 0;
+    /// apply the operation to each of n targets where inside[i] is set, with the parameter values
+    virtual void ApplyToSpan(double* targets, const double* values, const uint8_t* inside, int n) const = 0;
+
+    /// the OpenCL assignment operator that applies the operation, e.g. "+="
+    virtual std::string GetOpenCLAssignment() const = 0;
 
 protected:
 
@@ -54,6 +75,15 @@ protected:
 
 // ------------------------------------------------------------------------------------------------
 
+/// The size and dimensionality of a system, looked up once for a whole span of locations.
+struct ArenaSize
+{
+    float X, Y, Z;
+    int dimensionality;
+};
+
+// ------------------------------------------------------------------------------------------------
+
 /// Base class for different ways of specifying values at a particular location in the RD system.
 class BaseFill : public XML_Object
 {
@@ -64,12 +94,21 @@ public:
     /// construct when we don't know the derived type (returns empty pointer if name is unknown)
     static std::unique_ptr<BaseFill> New(vtkXMLDataElement* node);
 
-    /// what value would this fill type be at the given location, given the existing data
-    virtual double GetValue(const AbstractRD& system, const std::vector<double>& vals, float x, float y, float z) const = 0;
+    /// what values would this fill type be at n locations, where vals[iChemical][i] is the existing data at location i
+    /** The locations are the cells first_cell, first_cell+1, etc. of the system, and iTargetChemical is the chemical being
+     *  changed: fills that use randomness key their random numbers on these, so that the values don't depend on how the
+     *  cells are shared out between threads. */
+    virtual void GetValues(const AbstractRD& system, const ArenaSize& arena, const std::vector<double*>& vals,
+                           const float* x, const float* y, const float* z, int n, size_t first_cell, int iTargetChemical,
+                           double* values) const = 0;
 
     /// cause the fill to give different results next time, for those fills that use randomness
     virtual void Reseed() {}
 
+    /// get an OpenCL expression for the value at each cell, or return false if the fill can't be computed in OpenCL
+    virtual bool GetOpenCLExpression(const AbstractRD& system, const ArenaSize& arena, int iTargetChemical,
+                                     OpenCLOverlaySource& source, std::string& expression) const { return false; }
+
 protected:
 
     /// can construct from an XML node
@@ -91,6 +130,17 @@ public:
     /// returns whether the x, y, z location is inside this shape
     virtual bool IsInside(float x, float y, float z, float X, float Y, float Z, int dimensionality) const = 0;
 
+    /// as IsInside, but for n locations at once, setting inside[i] to 1 or 0
+    virtual void AreInside(const float* x, const float* y, const float* z, int n, float X, float Y, float Z, int dimensionality,
+                           uint8_t* inside) const;
+
+    /// get an axis-aligned box (xmin,xmax,ymin,ymax,zmin,zmax) containing every location where IsInside is true,
+    /// or return false if there isn't one; the box can be larger than the shape but never smaller
+    virtual bool GetBounds(float X, float Y, float Z, int dimensionality, double bounds[6]) const { return false; }
+
+    /// get an OpenCL condition that is true at the cells inside this shape, or return false if the shape can't be tested in OpenCL
+    virtual bool GetOpenCLCondition(const ArenaSize& arena, OpenCLOverlaySource& source, std::string& condition) const { return false; }
+
 protected:
 
     /// can construct from an XML node
@@ -114,9 +164,21 @@ class Overlay : public XML_Object
 
         int GetTargetChemical() const { return this->iTargetChemical; }
 
-        /// given a vector of values (one for each chemical) at a location in a system,
-        /// apply all the operations and return the new value
-        double Apply(const std::vector<double>& vals, const AbstractRD& system,float x,float y,float z) const;
+        /// get an axis-aligned box containing every location that this overlay can change,
+        /// or return false if there isn't one (e.g. for the "everywhere" shape); with no shapes the box is empty (min > max)
+        bool GetBounds(const ArenaSize& arena, double bounds[6]) const;
+
+        /// working space for ApplyToSpan, kept between calls to avoid allocating
+        struct SpanScratch { std::vector<double> fill_values; std::vector<uint8_t> inside; };
+
+        /// apply all the operations to a span of n locations (the cells first_cell, first_cell+1, etc.): vals[iChemical]
+        /// points at the n values of each chemical, and the values of the target chemical are updated in place
+        void ApplyToSpan(const std::vector<double*>& vals, const AbstractRD& system, const ArenaSize& arena,
+                         const float* x, const float* y, const float* z, int n, size_t first_cell, SpanScratch& scratch) const;
+
+        /// get OpenCL statements that apply this overlay to vals[] at each cell,
+        /// or return false if any of its elements can't be computed in OpenCL
+        bool GetOpenCLCode(const AbstractRD& system, const ArenaSize& arena, OpenCLOverlaySource& source, std::string& code) const;
 
         /// cause the overlay to give different results next time, for those overlays that use randomness
         void Reseed() { this->fill->Reseed(); }
@@ -188,7 +188,7 @@ string GetCoordString(int val, const string& coord, const string& coord_capital,
 
 // ---------------------------------------------------------------------
 
-string InputPoint::GetDirectAccessCode(bool wrap, const int block_size[3], bool use_local_memory) const
+string InputPoint::GetDirectAccessCode(bool wrap, const int block_size[3], bool use_local_memory, bool use_load_macro) const
 {
     if (block_size[0] == 4 && point.x % 4 != 0)
     {
@@ -204,7 +204,15 @@ string InputPoint::GetDirectAccessCode(bool wrap, const int block_size[3], bool
     }
     else
     {
-        oss << chem << "_in[" << GetIndexString(point.x / block_size[0], point.y / block_size[1], point.z / block_size[2], wrap) << "]";
+        const string index = GetIndexString(point.x / block_size[0], point.y / block_size[1], point.z / block_size[2], wrap);
+        if (use_load_macro)
+        {
+            oss << "LOAD(" << chem << "_in, " << index << ")";
+        }
+        else
+        {
+            oss << chem << "_in[" << index << "]";
+        }
     }
     return oss.str();
 }
@@ -241,7 +249,7 @@ set<InputPoint> AppliedStencil::GetInputPoints() const
     set<InputPoint> input_points;
     for (const StencilPoint& stencil_point : stencil.points)
     {
-        input_points.insert({ stencil_point.point, chem });
+        input_points.insert({ stencil_point.point, GetInputName() });
     }
     return input_points;
 }
@@ -288,7 +296,7 @@ string AppliedStencil::GetCode() const
                 oss << " + ";
             }
             is_first_point = false;
-            oss << InputPoint{ point, chem }.GetName();
+            oss << InputPoint{ point, GetInputName() }.GetName();
         }
         if (weight != 1 && points.size() > 1)
         {
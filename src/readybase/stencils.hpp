@@ -72,7 +72,8 @@ struct InputPoint
     std::string chem;
 
     std::string GetName() const;
-    std::string GetDirectAccessCode(bool wrap, const int block_size[3], bool use_local_memory) const;
+    /// Code to declare this input and read it from global or local memory. With use_load_macro the global read is LOAD(chem_in,index), for compact storage types.
+    std::string GetDirectAccessCode(bool wrap, const int block_size[3], bool use_local_memory, bool use_load_macro = false) const;
     std::string GetSwizzled_Block411() const;
     std::pair<InputPoint, InputPoint> GetAlignedBlocks_Block411() const;
 
@@ -90,8 +91,10 @@ struct AppliedStencil
 {
     Stencil stencil;
     std::string chem; // e.g. "a"
+    std::string input_chem = ""; // the array the stencil reads, if not chem itself, e.g. "bilaplacian_a"
 
     std::string GetName() const { return stencil.label + "_" + chem; }
+    std::string GetInputName() const { return input_chem.empty() ? chem : input_chem; }
     std::string GetCode() const;
     std::set<InputPoint> GetInputPoints() const;
 };
@@ -99,6 +102,8 @@ struct AppliedStencil
 // ---------------------------------------------------------------------
 
 std::vector<Stencil> GetKnownStencils(int dimensionality, const AbstractRD::Accuracy& accuracy);
+Stencil GetLaplacianStencil(int dimensionality, const AbstractRD::Accuracy& accuracy);
+Stencil GetBiLaplacianStencil(int dimensionality);
 std::string GetIndexString(int x, int y, int z, bool wrap);
 std::string GetIndexString(const std::string& x, const std::string& y, const std::string& z, bool wrap);
 std::string GetCoordString(int val, const std::string& coord, const std::string& coord_capital, bool wrap);
@@ -19,12 +19,17 @@
 #include "utils.hpp"
 
 // VTK:
+#include <vtkDataArray.h>
 #include <vtkMath.h>
 
 // STL:
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <limits>
 #include <random>
+#include <thread>
 #include <vector>
 
 // ---------------------------------------------------------------------------------------------------------
@@ -89,6 +94,141 @@ double hypot3(double x,double y,double z)
 
 // ---------------------------------------------------------------------------------------------------------
 
+unsigned short float_to_half(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t abs_bits = bits & 0x7FFFFFFF;
+    if(abs_bits >= 0x7F800000) // inf or NaN
+        return (unsigned short)(sign | 0x7C00 | (abs_bits > 0x7F800000 ? 0x200 : 0));
+    if(abs_bits >= 0x477FF000) // rounds to more than the largest half
+        return (unsigned short)(sign | 0x7C00);
+    if(abs_bits < 0x38800000) // subnormal half, or zero
+    {
+        if(abs_bits < 0x33000000) return (unsigned short)sign;
+        const uint32_t mantissa = (abs_bits & 0x007FFFFF) | 0x00800000;
+        const int shift = 126 - (int)(abs_bits >> 23); // from 14 to 24
+        uint32_t h = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if(remainder > halfway || (remainder == halfway && (h & 1))) h++;
+        return (unsigned short)(sign | h);
+    }
+    uint32_t h = ((abs_bits - 0x38000000) >> 13);
+    const uint32_t remainder = abs_bits & 0x1FFF;
+    if(remainder > 0x1000 || (remainder == 0x1000 && (h & 1))) h++; // (may carry into the exponent, which is correct)
+    return (unsigned short)(sign | h);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
+float half_to_float(unsigned short h)
+{
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1F;
+    uint32_t mantissa = h & 0x3FF;
+    uint32_t bits;
+    if(exponent == 0x1F)
+        bits = sign | 0x7F800000 | (mantissa << 13); // inf or NaN
+    else if(exponent != 0)
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    else if(mantissa == 0)
+        bits = sign;
+    else
+    {
+        // subnormal half: normalize
+        exponent = 113;
+        while(!(mantissa & 0x400))
+        {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
+void parallel_for(size_t n,const function<void(size_t,size_t)>& f,size_t min_per_thread)
+{
+    const size_t n_threads = min<size_t>(max(1u,thread::hardware_concurrency()),n / max<size_t>(1,min_per_thread));
+    if(n_threads <= 1)
+    {
+        if(n > 0)
+            f(0,n);
+        return;
+    }
+    vector<thread> threads;
+    vector<exception_ptr> errors(n_threads);
+    for(size_t iThread = 0; iThread < n_threads; iThread++)
+    {
+        threads.emplace_back([&,iThread]() {
+            try { f(n * iThread / n_threads, n * (iThread + 1) / n_threads); }
+            catch(...) { errors[iThread] = current_exception(); }
+        });
+    }
+    for(thread& t : threads)
+        t.join();
+    for(const exception_ptr& e : errors)
+        if(e)
+            rethrow_exception(e);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
+namespace
+{
+    template <typename T>
+    void read_typed_values(vtkDataArray* array,size_t first,size_t n,double* out)
+    {
+        const T* p = static_cast<const T*>(array->GetVoidPointer(0)) + first;
+        for(size_t i = 0; i < n; i++)
+            out[i] = static_cast<double>(p[i]);
+    }
+
+    template <typename T>
+    void write_typed_values(vtkDataArray* array,size_t first,size_t n,const double* values)
+    {
+        T* p = static_cast<T*>(array->GetVoidPointer(0)) + first;
+        for(size_t i = 0; i < n; i++)
+            p[i] = static_cast<T>(values[i]);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
+void read_values(vtkDataArray* array,size_t first,size_t n,double* out)
+{
+    switch(array->GetDataType())
+    {
+        case VTK_FLOAT:         read_typed_values<float>(array,first,n,out); break;
+        case VTK_DOUBLE:        read_typed_values<double>(array,first,n,out); break;
+        case VTK_UNSIGNED_CHAR: read_typed_values<unsigned char>(array,first,n,out); break;
+        case VTK_SHORT:         read_typed_values<short>(array,first,n,out); break;
+        default: throw runtime_error("read_values : unsupported data type");
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
+void write_values(vtkDataArray* array,size_t first,size_t n,const double* values)
+{
+    switch(array->GetDataType())
+    {
+        case VTK_FLOAT:         write_typed_values<float>(array,first,n,values); break;
+        case VTK_DOUBLE:        write_typed_values<double>(array,first,n,values); break;
+        case VTK_UNSIGNED_CHAR: write_typed_values<unsigned char>(array,first,n,values); break;
+        case VTK_SHORT:         write_typed_values<short>(array,first,n,values); break;
+        default: throw runtime_error("write_values : unsupported data type");
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
 float* vtk_at(float* origin,int x,int y,int z,int X,int Y)
 {
     // single-component vtkImageData scalars are stored as: float,float,... for consecutive x, then y, then z
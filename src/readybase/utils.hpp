@@ -19,6 +19,7 @@
 #define __UTILS__
 
 // STL:
+#include <functional>
 #include <string>
 #include <sstream>
 #include <stdexcept>
@@ -29,6 +30,7 @@
 #include <vtkCommand.h>
 #include <vtkSmartPointer.h>
 #include <vtkXMLDataElement.h>
+class vtkDataArray;
 
 double get_time_in_seconds();
 
@@ -38,6 +40,23 @@ double hypot2(double x,double y);
 
 double hypot3(double x,double y,double z);
 
+/// Converts to the 16-bit half format used by OpenCL's vload_half and vstore_half, rounding to nearest even.
+unsigned short float_to_half(float f);
+
+float half_to_float(unsigned short h);
+
+/// Calls f(begin,end) on contiguous ranges that together cover [0,n), on as many threads as the hardware supports.
+/** Each thread gets at least min_per_thread items, so small jobs are run on the calling thread. If any call throws, the
+ *  first exception is rethrown once all the threads have finished. */
+void parallel_for(size_t n,const std::function<void(size_t,size_t)>& f,size_t min_per_thread = 1);
+
+/// Copies n values of a single-component array, starting at index first, into out.
+/** Reads the memory directly, so different threads can read and write different ranges of the same array at once. */
+void read_values(vtkDataArray* array,size_t first,size_t n,double* out);
+
+/// Copies n values into a single-component array, starting at index first, converting them as a static_cast would.
+void write_values(vtkDataArray* array,size_t first,size_t n,const double* values);
+
 // http://www.doc.ic.ac.uk/~akf/handel-c/cgi-bin/forum.cgi?msg=551
 #define STRING_FROM_LITERAL(a) #a
 #define STR(a) STRING_FROM_LITERAL(a)